@@ -0,0 +1,78 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ *   Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ *   The contents of this file are subject to the Mozilla Public License Version
+ *   1.1 (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.mozilla.org/MPL/
+ *
+ *   Software distributed under the License is distributed on an "AS IS" basis,
+ *   WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ *   for the specific language governing rights and limitations under the
+ *   License.
+ *
+ *   Copyright 2013, Red Hat Inc.
+ *
+ *   Alternatively, the contents of this file may be used under the terms of
+ *   either the GNU General Public License Version 2 or later (the "GPL"), or
+ *   the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ *   in which case the provisions of the GPL or the LGPL are applicable instead
+ *   of those above. If you wish to allow use of your version of this file only
+ *   under the terms of either the GPL or the LGPL, and not to allow others to
+ *   use your version of this file under the terms of the MPL, indicate your
+ *   decision by deleting the provisions above and replace them with the notice
+ *   and other provisions required by the GPL or the LGPL. If you do not delete
+ *   the provisions above, a recipient may use your version of this file under
+ *   the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include "config.h"
+
+#include "asynccaller.h"
+
+AsyncCaller::AsyncCaller(NPP aInstance):
+    m_instance(aInstance),
+    m_token(new Token)
+{
+    m_token->refcount = 1;
+    m_token->alive = true;
+}
+
+AsyncCaller::~AsyncCaller()
+{
+    m_token->alive = false;
+    UnrefToken(m_token);
+}
+
+void AsyncCaller::Call(void (*aFunc)(void *), void *aData)
+{
+    PendingCall *call = new PendingCall;
+
+    g_atomic_int_inc(&m_token->refcount);
+    call->token = m_token;
+    call->func = aFunc;
+    call->data = aData;
+    NPN_PluginThreadAsyncCall(m_instance, Run, call);
+}
+
+// a call the browser drops along with its instance leaks the few bytes
+// of the PendingCall, nothing else
+void AsyncCaller::Run(void *data)
+{
+    PendingCall *call = static_cast<PendingCall *>(data);
+
+    if (call->token->alive)
+        call->func(call->data);
+    else
+        g_debug("dropping a call for an object which is gone");
+
+    UnrefToken(call->token);
+    delete call;
+}
+
+void AsyncCaller::UnrefToken(Token *token)
+{
+    if (g_atomic_int_dec_and_test(&token->refcount))
+        delete token;
+}
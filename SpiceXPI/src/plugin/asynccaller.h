@@ -0,0 +1,78 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ *   Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ *   The contents of this file are subject to the Mozilla Public License Version
+ *   1.1 (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.mozilla.org/MPL/
+ *
+ *   Software distributed under the License is distributed on an "AS IS" basis,
+ *   WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ *   for the specific language governing rights and limitations under the
+ *   License.
+ *
+ *   Copyright 2013, Red Hat Inc.
+ *
+ *   Alternatively, the contents of this file may be used under the terms of
+ *   either the GNU General Public License Version 2 or later (the "GPL"), or
+ *   the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ *   in which case the provisions of the GPL or the LGPL are applicable instead
+ *   of those above. If you wish to allow use of your version of this file only
+ *   under the terms of either the GPL or the LGPL, and not to allow others to
+ *   use your version of this file under the terms of the MPL, indicate your
+ *   decision by deleting the provisions above and replace them with the notice
+ *   and other provisions required by the GPL or the LGPL. If you do not delete
+ *   the provisions above, a recipient may use your version of this file under
+ *   the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef ASYNC_CALLER_H
+#define ASYNC_CALLER_H
+
+/*
+    Main thread calls for objects which may go first
+    ------------------------------------------------
+    NPN_PluginThreadAsyncCall() gives no way to cancel a call. The browser
+    drops the calls of a destroyed instance, but sessions share the NPP of
+    their embed (see nsPluginInstance::CreateSession()), so a call queued
+    for a session which is gone by then would still run on freed memory.
+    AsyncCaller hands the browser a token instead of the object; a call
+    whose AsyncCaller has been destroyed is dropped.
+*/
+
+#include <glib.h>
+
+#include <npapi.h>
+
+class AsyncCaller
+{
+public:
+    AsyncCaller(NPP aInstance);
+    // must run on the main thread, pending calls are dropped
+    ~AsyncCaller();
+
+    // may be called from any thread, aFunc runs on the main thread
+    void Call(void (*aFunc)(void *), void *aData);
+
+private:
+    struct Token {
+        volatile gint refcount;
+        // only touched on the main thread
+        bool alive;
+    };
+
+    struct PendingCall {
+        Token *token;
+        void (*func)(void *);
+        void *data;
+    };
+
+    static void Run(void *data);
+    static void UnrefToken(Token *token);
+
+    NPP m_instance;
+    Token *m_token;
+};
+
+#endif // ASYNC_CALLER_H
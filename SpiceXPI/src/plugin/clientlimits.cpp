@@ -0,0 +1,216 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ *   Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ *   The contents of this file are subject to the Mozilla Public License Version
+ *   1.1 (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.mozilla.org/MPL/
+ *
+ *   Software distributed under the License is distributed on an "AS IS" basis,
+ *   WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ *   for the specific language governing rights and limitations under the
+ *   License.
+ *
+ *   Copyright 2013, Red Hat Inc.
+ *
+ *   Alternatively, the contents of this file may be used under the terms of
+ *   either the GNU General Public License Version 2 or later (the "GPL"), or
+ *   the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ *   in which case the provisions of the GPL or the LGPL are applicable instead
+ *   of those above. If you wish to allow use of your version of this file only
+ *   under the terms of either the GPL or the LGPL, and not to allow others to
+ *   use your version of this file under the terms of the MPL, indicate your
+ *   decision by deleting the provisions above and replace them with the notice
+ *   and other provisions required by the GPL or the LGPL. If you do not delete
+ *   the provisions above, a recipient may use your version of this file under
+ *   the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+#include "config.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+extern "C" {
+#  include <unistd.h>
+#  include <sys/syscall.h>
+}
+
+#include "clientlimits.h"
+
+// glibc has no wrapper for ioprio_set(), see linux/ioprio.h
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_BE    2
+#define IOPRIO_CLASS_IDLE  3
+#define IOPRIO_WHO_PROCESS 1
+
+namespace {
+    // "0-3,6"
+    bool parseCpuList(const char *list, cpu_set_t *cpus)
+    {
+        gchar **ranges = g_strsplit(list, ",", -1);
+        bool valid = true;
+
+        CPU_ZERO(cpus);
+        for (gchar **range = ranges; *range != NULL && valid; ++range) {
+            char *end;
+            long first = strtol(*range, &end, 10);
+            long last = first;
+            if (*end == '-')
+                last = strtol(end + 1, &end, 10);
+            valid = (end != *range && *end == '\0' &&
+                     first >= 0 && first <= last && last < CPU_SETSIZE);
+            for (long cpu = first; valid && cpu <= last; ++cpu)
+                CPU_SET(cpu, cpus);
+        }
+        g_strfreev(ranges);
+
+        return valid && CPU_COUNT(cpus) > 0;
+    }
+}
+
+ClientLimits::ClientLimits():
+    m_set_nice(false),
+    m_nice(0),
+    m_ioprio(-1),
+    m_set_affinity(false),
+    m_memory(0)
+{
+    CPU_ZERO(&m_cpus);
+}
+
+void ClientLimits::Load()
+{
+    const char *value;
+
+    *this = ClientLimits();
+
+    value = g_getenv("SPICE_XPI_CLIENT_NICE");
+    if (value != NULL && *value != '\0') {
+        m_nice = CLAMP(atoi(value), -20, 19);
+        m_set_nice = true;
+    }
+
+    value = g_getenv("SPICE_XPI_CLIENT_IOPRIO");
+    if (value != NULL && g_ascii_strcasecmp(value, "idle") == 0)
+        m_ioprio = IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT;
+    else if (value != NULL && value[0] >= '0' && value[0] <= '7' && value[1] == '\0')
+        m_ioprio = (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | (value[0] - '0');
+    else if (value != NULL)
+        g_warning("invalid SPICE_XPI_CLIENT_IOPRIO '%s'", value);
+
+    value = g_getenv("SPICE_XPI_CLIENT_CPUS");
+    if (value != NULL) {
+        m_set_affinity = parseCpuList(value, &m_cpus);
+        if (!m_set_affinity)
+            g_warning("invalid SPICE_XPI_CLIENT_CPUS '%s'", value);
+    }
+
+    value = g_getenv("SPICE_XPI_CLIENT_MEMORY");
+    if (value != NULL)
+        m_memory = (rlim_t)g_ascii_strtoull(value, NULL, 10) * 1024 * 1024;
+
+    value = g_getenv("SPICE_XPI_CLIENT_SCOPE");
+    if (value != NULL && *value != '\0' && strcmp(value, "0") != 0) {
+        // without systemd, run the client as is
+        gchar *systemd_run = g_find_program_in_path("systemd-run");
+        if (systemd_run != NULL && g_file_test("/run/systemd/system", G_FILE_TEST_IS_DIR))
+            m_systemd_run = systemd_run;
+        else
+            g_warning("systemd is not available, clients run without a scope");
+        g_free(systemd_run);
+
+        gchar **properties = g_strsplit(value, ";", -1);
+        for (gchar **property = properties; *property != NULL; ++property) {
+            g_strstrip(*property);
+            if (strchr(*property, '=') != NULL)
+                m_scope_properties.push_back(*property);
+        }
+        g_strfreev(properties);
+    }
+}
+
+// systemd-run --scope exec()s the client in place, so the pid we spawned
+// stays the client's
+void ClientLimits::WrapArgv(GStrv &argv) const
+{
+    static volatile gint scopes = 0;
+
+    if (m_systemd_run.empty() || argv == NULL)
+        return;
+
+    std::vector<gchar *> wrapped;
+    wrapped.push_back(g_strdup(m_systemd_run.c_str()));
+    wrapped.push_back(g_strdup("--user"));
+    wrapped.push_back(g_strdup("--scope"));
+    wrapped.push_back(g_strdup("--quiet"));
+    wrapped.push_back(g_strdup_printf("--unit=spice-xpi-%d-%d", (int)getpid(),
+                                      g_atomic_int_add(&scopes, 1)));
+    for (size_t i = 0; i < m_scope_properties.size(); ++i)
+        wrapped.push_back(g_strdup_printf("--property=%s", m_scope_properties[i].c_str()));
+    wrapped.push_back(g_strdup("--"));
+    for (gchar **arg = argv; *arg != NULL; ++arg)
+        wrapped.push_back(*arg);
+    wrapped.push_back(NULL);
+
+    // the strings moved over, only the old array goes
+    g_free(argv);
+    argv = g_new(gchar *, wrapped.size());
+    memcpy(argv, &wrapped[0], wrapped.size() * sizeof(gchar *));
+}
+
+// Only async-signal-safe calls here. Failures are ignored: e.g. a lower
+// nice value needs privileges, and the client is better off running
+// without the limit than not at all.
+void ClientLimits::ChildSetup(gpointer data)
+{
+    const ClientLimits *limits = static_cast<const ClientLimits *>(data);
+
+    if (limits->m_set_nice)
+        setpriority(PRIO_PROCESS, 0, limits->m_nice);
+    if (limits->m_ioprio != -1)
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, limits->m_ioprio);
+    if (limits->m_set_affinity)
+        sched_setaffinity(0, sizeof(limits->m_cpus), &limits->m_cpus);
+    if (limits->m_memory != 0) {
+        struct rlimit rlim = { limits->m_memory, limits->m_memory };
+        setrlimit(RLIMIT_AS, &rlim);
+    }
+}
+
+bool ClientLimits::ReadUsage(GPid pid, double *cpu_time, double *rss)
+{
+    gchar *path, *stat = NULL, *statm = NULL;
+    unsigned long utime, stime;
+    unsigned long size, resident;
+    bool valid = false;
+
+    if (pid <= 0)
+        return false;
+
+    path = g_strdup_printf("/proc/%d/stat", (int)pid);
+    g_file_get_contents(path, &stat, NULL, NULL);
+    g_free(path);
+    path = g_strdup_printf("/proc/%d/statm", (int)pid);
+    g_file_get_contents(path, &statm, NULL, NULL);
+    g_free(path);
+
+    // the command name may contain anything, fields start after its ')'
+    const char *fields = stat != NULL ? strrchr(stat, ')') : NULL;
+    if (fields != NULL && statm != NULL &&
+        sscanf(fields + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+               &utime, &stime) == 2 &&
+        sscanf(statm, "%lu %lu", &size, &resident) == 2) {
+        *cpu_time = (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+        *rss = (double)resident * sysconf(_SC_PAGESIZE);
+        valid = true;
+    }
+
+    g_free(stat);
+    g_free(statm);
+
+    return valid;
+}
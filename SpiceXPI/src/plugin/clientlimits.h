@@ -0,0 +1,86 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ *   Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ *   The contents of this file are subject to the Mozilla Public License Version
+ *   1.1 (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.mozilla.org/MPL/
+ *
+ *   Software distributed under the License is distributed on an "AS IS" basis,
+ *   WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ *   for the specific language governing rights and limitations under the
+ *   License.
+ *
+ *   Copyright 2013, Red Hat Inc.
+ *
+ *   Alternatively, the contents of this file may be used under the terms of
+ *   either the GNU General Public License Version 2 or later (the "GPL"), or
+ *   the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ *   in which case the provisions of the GPL or the LGPL are applicable instead
+ *   of those above. If you wish to allow use of your version of this file only
+ *   under the terms of either the GPL or the LGPL, and not to allow others to
+ *   use your version of this file under the terms of the MPL, indicate your
+ *   decision by deleting the provisions above and replace them with the notice
+ *   and other provisions required by the GPL or the LGPL. If you do not delete
+ *   the provisions above, a recipient may use your version of this file under
+ *   the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef CLIENT_LIMITS_H
+#define CLIENT_LIMITS_H
+
+/*
+    Resource policy for spawned clients, so that a runaway client cannot
+    starve the browser or the other seats of a thin client host. It is set
+    by the administrator through the environment, never by pages:
+
+        SPICE_XPI_CLIENT_NICE    nice value, e.g. 5
+        SPICE_XPI_CLIENT_IOPRIO  best-effort level 0-7, or "idle"
+        SPICE_XPI_CLIENT_CPUS    CPU affinity list, e.g. "0-3,6"
+        SPICE_XPI_CLIENT_MEMORY  address space limit in MiB (RLIMIT_AS)
+        SPICE_XPI_CLIENT_SCOPE   "1" to start every client in its own
+                                 transient systemd scope (cgroup), or a
+                                 ';' separated list of unit properties
+                                 for it, e.g. "MemoryMax=1G;CPUQuota=50%"
+*/
+
+#include <string>
+#include <vector>
+#include <glib.h>
+#include <glib-object.h> /* for GStrv */
+
+extern "C" {
+#  include <sched.h>
+#  include <sys/resource.h>
+}
+
+class ClientLimits
+{
+public:
+    ClientLimits();
+
+    // reads the environment again
+    void Load();
+    // prefixes the command line with systemd-run, if a scope is wanted
+    // and systemd is running
+    void WrapArgv(GStrv &argv) const;
+    // between fork() and exec(), data is the ClientLimits
+    static void ChildSetup(gpointer data);
+
+    // CPU time in seconds and resident set size in bytes of a process
+    static bool ReadUsage(GPid pid, double *cpu_time, double *rss);
+
+private:
+    bool m_set_nice;
+    int m_nice;
+    // already encoded for ioprio_set(), -1 to leave it alone
+    int m_ioprio;
+    bool m_set_affinity;
+    cpu_set_t m_cpus;
+    rlim_t m_memory;
+    std::string m_systemd_run;
+    std::vector<std::string> m_scope_properties;
+};
+
+#endif // CLIENT_LIMITS_H
@@ -0,0 +1,165 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ *   Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ *   The contents of this file are subject to the Mozilla Public License Version
+ *   1.1 (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.mozilla.org/MPL/
+ *
+ *   Software distributed under the License is distributed on an "AS IS" basis,
+ *   WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ *   for the specific language governing rights and limitations under the
+ *   License.
+ *
+ *   Copyright 2013, Red Hat Inc.
+ *
+ *   Alternatively, the contents of this file may be used under the terms of
+ *   either the GNU General Public License Version 2 or later (the "GPL"), or
+ *   the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ *   in which case the provisions of the GPL or the LGPL are applicable instead
+ *   of those above. If you wish to allow use of your version of this file only
+ *   under the terms of either the GPL or the LGPL, and not to allow others to
+ *   use your version of this file under the terms of the MPL, indicate your
+ *   decision by deleting the provisions above and replace them with the notice
+ *   and other provisions required by the GPL or the LGPL. If you do not delete
+ *   the provisions above, a recipient may use your version of this file under
+ *   the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+#include "config.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include <glib.h>
+
+extern "C" {
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/stat.h>
+}
+
+#include "clientprefetch.h"
+
+namespace {
+    GMutex prefetch_lock;
+    GThread *thread = NULL;
+    bool started = false;
+    volatile gint cancelled = 0;
+
+    const char *setting()
+    {
+        const char *value = g_getenv("SPICE_XPI_PREFETCH");
+
+        if (value == NULL || *value == '\0' || strcmp(value, "0") == 0)
+            return NULL;
+        return value;
+    }
+
+    void prefetch(const std::string &path)
+    {
+        struct stat st;
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+        if (fd < 0)
+            return;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+            if (::readahead(fd, 0, st.st_size) != 0)
+                posix_fadvise(fd, 0, st.st_size, POSIX_FADV_WILLNEED);
+            g_debug("prefetched %s (%lld bytes)", path.c_str(), (long long)st.st_size);
+        }
+        close(fd);
+    }
+
+    gpointer run(gpointer data)
+    {
+        std::vector<std::string> *programs = static_cast<std::vector<std::string> *>(data);
+
+        for (size_t i = 0; i < programs->size() && !g_atomic_int_get(&cancelled); ++i)
+            prefetch((*programs)[i]);
+        delete programs;
+
+        return NULL;
+    }
+
+    void addProgram(const char *program, std::vector<std::string> &programs)
+    {
+        gchar *path = g_path_is_absolute(program) ?
+            g_strdup(program) : g_find_program_in_path(program);
+
+        if (path != NULL)
+            programs.push_back(path);
+        g_free(path);
+    }
+}
+
+bool ClientPrefetch::Wanted()
+{
+    bool wanted;
+
+    if (setting() == NULL)
+        return false;
+
+    g_mutex_lock(&prefetch_lock);
+    wanted = !started;
+    g_mutex_unlock(&prefetch_lock);
+
+    return wanted;
+}
+
+void ClientPrefetch::Start(char **argv)
+{
+    const char *value = setting();
+
+    if (value == NULL)
+        return;
+
+    g_mutex_lock(&prefetch_lock);
+    if (started) {
+        g_mutex_unlock(&prefetch_lock);
+        return;
+    }
+    started = true;
+
+    std::vector<std::string> *programs = new std::vector<std::string>();
+    if (argv != NULL && argv[0] != NULL)
+        addProgram(argv[0], *programs);
+    if (strcmp(value, "1") != 0) {
+        gchar **extra = g_strsplit(value, ":", -1);
+        for (gchar **program = extra; *program != NULL; ++program) {
+            if (**program != '\0')
+                addProgram(*program, *programs);
+        }
+        g_strfreev(extra);
+    }
+
+    GError *error = NULL;
+    thread = g_thread_try_new("spice-prefetch", run, programs, &error);
+    if (thread == NULL) {
+        g_warning("Failed to start the client prefetch: %s", error->message);
+        g_clear_error(&error);
+        delete programs;
+    }
+    g_mutex_unlock(&prefetch_lock);
+}
+
+void ClientPrefetch::Shutdown()
+{
+    GThread *old_thread;
+
+    g_mutex_lock(&prefetch_lock);
+    old_thread = thread;
+    thread = NULL;
+    g_mutex_unlock(&prefetch_lock);
+
+    if (old_thread != NULL) {
+        g_atomic_int_set(&cancelled, 1);
+        g_thread_join(old_thread);
+    }
+
+    // a reloaded library prefetches again
+    g_mutex_lock(&prefetch_lock);
+    started = false;
+    g_atomic_int_set(&cancelled, 0);
+    g_mutex_unlock(&prefetch_lock);
+}
@@ -0,0 +1,62 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ *   Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ *   The contents of this file are subject to the Mozilla Public License Version
+ *   1.1 (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.mozilla.org/MPL/
+ *
+ *   Software distributed under the License is distributed on an "AS IS" basis,
+ *   WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ *   for the specific language governing rights and limitations under the
+ *   License.
+ *
+ *   Copyright 2013, Red Hat Inc.
+ *
+ *   Alternatively, the contents of this file may be used under the terms of
+ *   either the GNU General Public License Version 2 or later (the "GPL"), or
+ *   the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ *   in which case the provisions of the GPL or the LGPL are applicable instead
+ *   of those above. If you wish to allow use of your version of this file only
+ *   under the terms of either the GPL or the LGPL, and not to allow others to
+ *   use your version of this file under the terms of the MPL, indicate your
+ *   decision by deleting the provisions above and replace them with the notice
+ *   and other provisions required by the GPL or the LGPL. If you do not delete
+ *   the provisions above, a recipient may use your version of this file under
+ *   the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+
+#ifndef CLIENT_PREFETCH_H
+#define CLIENT_PREFETCH_H
+
+/*
+    Warms the page cache with the client executable, so that the first
+    spawn after boot does not page-fault it in from disk. It is opt-in
+    through the environment:
+
+        SPICE_XPI_PREFETCH  "1" to prefetch the client, or a ':' separated
+                            list of further files to prefetch with it,
+                            e.g. "/usr/bin/remote-viewer" when the client
+                            is a wrapper script, or its largest libraries
+
+    The work is done once per process on a thread of its own and only
+    issues readahead() hints, nothing is kept mapped or locked. See
+    tests/bench-prefetch.cpp for what it saves.
+*/
+
+class ClientPrefetch
+{
+public:
+    // SPICE_XPI_PREFETCH is set and the prefetch did not run yet; cheap,
+    // checked before the client command line is worked out
+    static bool Wanted();
+    // starts the prefetch thread unless it already ran, argv is the
+    // client command line
+    static void Start(char **argv);
+    // stops the thread if it is still running
+    static void Shutdown();
+};
+
+#endif // CLIENT_PREFETCH_H
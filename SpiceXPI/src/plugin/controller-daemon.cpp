@@ -0,0 +1,576 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ *   Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ *   The contents of this file are subject to the Mozilla Public License Version
+ *   1.1 (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.mozilla.org/MPL/
+ *
+ *   Software distributed under the License is distributed on an "AS IS" basis,
+ *   WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ *   for the specific language governing rights and limitations under the
+ *   License.
+ *
+ *   Copyright 2013, Red Hat Inc.
+ *
+ *   Alternatively, the contents of this file may be used under the terms of
+ *   either the GNU General Public License Version 2 or later (the "GPL"), or
+ *   the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ *   in which case the provisions of the GPL or the LGPL are applicable instead
+ *   of those above. If you wish to allow use of your version of this file only
+ *   under the terms of either the GPL or the LGPL, and not to allow others to
+ *   use your version of this file under the terms of the MPL, indicate your
+ *   decision by deleting the provisions above and replace them with the notice
+ *   and other provisions required by the GPL or the LGPL. If you do not delete
+ *   the provisions above, a recipient may use your version of this file under
+ *   the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+#include "config.h"
+
+#include <cstring>
+#include <cerrno>
+#include <map>
+#include <vector>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+extern "C" {
+#  include <stdint.h>
+#  include <unistd.h>
+#  include <fcntl.h>
+#  include <sys/socket.h>
+#  include <sys/un.h>
+}
+
+#include "controller-session.h"
+#include "controller-daemon.h"
+
+// how long a freshly started daemon gets to create its socket
+#define DAEMON_START_RETRIES 50
+#define DAEMON_START_RETRY_INTERVAL 100 // ms
+
+// what may be queued for a daemon which does not read, it is taken for
+// stuck beyond that
+#define DAEMON_OUTPUT_MAX (8 * 1024 * 1024)
+
+// The connection to the daemon, shared by all controllers of the
+// process. It is opened by the first session and closed with the last
+// one, so an idle daemon sees no clients and can go away.
+//
+// Nothing here blocks: the socket is non-blocking, records are queued
+// in m_output and what the daemon does not take at once is flushed from
+// the reaper thread, as is the connection to a daemon still starting up.
+class SpiceDaemonChannel
+{
+public:
+    static SpiceDaemonChannel *Get();
+
+    uint32_t OpenSession(SpiceControllerDaemon *controller);
+    bool Send(uint32_t session, const void *data, uint32_t size);
+    bool IsOpen(uint32_t session);
+
+private:
+    typedef std::map<uint32_t, SpiceControllerDaemon *> SessionMap;
+    typedef std::vector<std::pair<SpiceControllerDaemon *, int> > ClosedList;
+
+    SpiceDaemonChannel();
+
+    bool StartConnecting();
+    bool TryConnect();
+    void Connected(int fd);
+    int ConnectSocket();
+    bool StartDaemon();
+    void QueueLocked(uint32_t session, const void *data, uint32_t size);
+    bool FlushLocked();
+    void CloseLocked(ClosedList &closed);
+    static void ReportClosed(const ClosedList &closed);
+    static gboolean RetryConnect(gpointer data);
+    static gboolean OnInput(GIOChannel *source, GIOCondition condition, gpointer data);
+    static gboolean OnOutput(GIOChannel *source, GIOCondition condition, gpointer data);
+
+    GMutex m_lock;
+    int m_fd;
+    GSource *m_watch;
+    GSource *m_output_watch;
+    GSource *m_retry_source;
+    guint m_retries;
+    std::string m_socket_path;
+    std::vector<char> m_input;
+    // records not written yet, all of them while connecting
+    std::string m_output;
+    SessionMap m_sessions;
+    uint32_t m_next_session;
+};
+
+SpiceDaemonChannel::SpiceDaemonChannel():
+    m_fd(-1),
+    m_watch(NULL),
+    m_output_watch(NULL),
+    m_retry_source(NULL),
+    m_retries(0),
+    m_next_session(1)
+{
+    g_mutex_init(&m_lock);
+
+    const char *path = g_getenv("SPICE_XPI_DAEMON_SOCKET");
+    if (path != NULL) {
+        m_socket_path = path;
+    } else {
+        gchar *dir = g_build_filename(g_get_user_runtime_dir(), "spice-xpi", NULL);
+        gchar *file = g_build_filename(dir, "daemon", NULL);
+        if (g_mkdir_with_parents(dir, 0700) != 0)
+            g_warning("failed to create %s: %s", dir, g_strerror(errno));
+        m_socket_path = file;
+        g_free(file);
+        g_free(dir);
+    }
+}
+
+// never freed, the channel lives as long as the process
+SpiceDaemonChannel *SpiceDaemonChannel::Get()
+{
+    static GMutex lock;
+    static SpiceDaemonChannel *channel = NULL;
+
+    g_mutex_lock(&lock);
+    if (channel == NULL)
+        channel = new SpiceDaemonChannel();
+    g_mutex_unlock(&lock);
+
+    return channel;
+}
+
+// Runs on the reaper thread. The session is usable once IsOpen() says
+// so; if the daemon cannot be reached, it ends with ClientGone().
+uint32_t SpiceDaemonChannel::OpenSession(SpiceControllerDaemon *controller)
+{
+    ControllerMsg msg = {CONTROLLER_SESSION_OPEN, sizeof(msg)};
+    uint32_t session = 0;
+
+    g_mutex_lock(&m_lock);
+    if (m_fd != -1 || m_retry_source != NULL || StartConnecting()) {
+        session = m_next_session++;
+        if (m_next_session == 0)
+            m_next_session = 1;
+        m_sessions[session] = controller;
+        QueueLocked(session, &msg, sizeof(msg));
+    }
+    g_mutex_unlock(&m_lock);
+
+    return session;
+}
+
+bool SpiceDaemonChannel::Send(uint32_t session, const void *data, uint32_t size)
+{
+    bool sent = false;
+
+    g_mutex_lock(&m_lock);
+    if (m_sessions.count(session)) {
+        QueueLocked(session, data, size);
+        sent = true;
+    }
+    g_mutex_unlock(&m_lock);
+
+    return sent;
+}
+
+bool SpiceDaemonChannel::IsOpen(uint32_t session)
+{
+    bool open;
+
+    g_mutex_lock(&m_lock);
+    open = m_fd != -1 && m_sessions.count(session);
+    g_mutex_unlock(&m_lock);
+
+    return open;
+}
+
+// m_lock must be held; connects right away if the daemon runs, starts
+// it and polls for its socket otherwise
+bool SpiceDaemonChannel::StartConnecting()
+{
+    ControllerSessionInit init = {CONTROLLER_SESSION_MAGIC, CONTROLLER_SESSION_VERSION};
+
+    m_input.clear();
+    m_output.assign(reinterpret_cast<const char *>(&init), sizeof(init));
+
+    if (TryConnect())
+        return true;
+    if (!StartDaemon()) {
+        g_critical("could not connect to client daemon at %s", m_socket_path.c_str());
+        m_output.clear();
+        return false;
+    }
+
+    m_retries = 0;
+    m_retry_source = g_timeout_source_new(DAEMON_START_RETRY_INTERVAL);
+    g_source_set_callback(m_retry_source, RetryConnect, this, NULL);
+    g_source_attach(m_retry_source, SpiceController::ReaperContext());
+
+    return true;
+}
+
+// m_lock must be held
+bool SpiceDaemonChannel::TryConnect()
+{
+    int fd = ConnectSocket();
+
+    if (fd == -1)
+        return false;
+
+    Connected(fd);
+    return true;
+}
+
+// m_lock must be held
+void SpiceDaemonChannel::Connected(int fd)
+{
+    m_fd = fd;
+
+    GIOChannel *channel = g_io_channel_unix_new(m_fd);
+    m_watch = g_io_create_watch(channel, GIOCondition(G_IO_IN | G_IO_HUP | G_IO_ERR));
+    g_source_set_callback(m_watch, (GSourceFunc)OnInput, this, NULL);
+    g_source_attach(m_watch, SpiceController::ReaperContext());
+    g_io_channel_unref(channel);
+
+    g_debug("connected to client daemon at %s", m_socket_path.c_str());
+
+    // the init and whatever the sessions sent in the meantime
+    FlushLocked();
+}
+
+// runs on the reaper thread while the daemon starts up
+gboolean SpiceDaemonChannel::RetryConnect(gpointer data)
+{
+    SpiceDaemonChannel *fake_this = static_cast<SpiceDaemonChannel *>(data);
+    ClosedList closed;
+    gboolean keep = TRUE;
+
+    g_mutex_lock(&fake_this->m_lock);
+    if (fake_this->TryConnect()) {
+        keep = FALSE;
+    } else if (++fake_this->m_retries >= DAEMON_START_RETRIES) {
+        g_critical("could not connect to client daemon at %s",
+                   fake_this->m_socket_path.c_str());
+        keep = FALSE;
+    }
+    if (!keep) {
+        g_source_unref(fake_this->m_retry_source);
+        fake_this->m_retry_source = NULL;
+        if (fake_this->m_fd == -1)
+            fake_this->CloseLocked(closed);
+    }
+    g_mutex_unlock(&fake_this->m_lock);
+
+    ReportClosed(closed);
+
+    return keep;
+}
+
+int SpiceDaemonChannel::ConnectSocket()
+{
+    struct sockaddr_un remote;
+    int fd;
+
+    if (m_socket_path.length() + 1 > sizeof(remote.sun_path))
+        return -1;
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+        g_critical("daemon socket: %s", g_strerror(errno));
+        return -1;
+    }
+
+    // a full backlog fails like a daemon not there yet, and is retried
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    memset(&remote, 0, sizeof(remote));
+    remote.sun_family = AF_UNIX;
+    strcpy(remote.sun_path, m_socket_path.c_str());
+    if (connect(fd, (struct sockaddr *) &remote, sizeof(remote)) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// the daemon is detached, GLib double forks it when we do not reap it
+bool SpiceDaemonChannel::StartDaemon()
+{
+    const char *cmdline = g_getenv("SPICE_XPI_DAEMON");
+    GError *error = NULL;
+    gchar **argv = NULL;
+    gchar **env;
+    bool spawned;
+
+    if (cmdline == NULL || !g_shell_parse_argv(cmdline, NULL, &argv, &error)) {
+        g_warning("no usable client daemon command line: %s",
+                  error ? error->message : "SPICE_XPI_DAEMON not set");
+        g_clear_error(&error);
+        return false;
+    }
+
+    env = g_get_environ();
+    env = g_environ_setenv(env, "SPICE_XPI_DAEMON_SOCKET", m_socket_path.c_str(), TRUE);
+    // see SpiceController::LaunchClient()
+    env = g_environ_unsetenv(env, "LD_PRELOAD");
+
+    g_message("starting client daemon: %s", cmdline);
+    spawned = g_spawn_async(NULL, argv, env, G_SPAWN_SEARCH_PATH,
+                            NULL, NULL, NULL, &error);
+    if (!spawned) {
+        g_warning("failed to start %s: %s", argv[0], error->message);
+        g_clear_error(&error);
+    }
+
+    g_strfreev(env);
+    g_strfreev(argv);
+
+    return spawned;
+}
+
+// m_lock must be held
+void SpiceDaemonChannel::QueueLocked(uint32_t session, const void *data, uint32_t size)
+{
+    ControllerSessionHeader header = {session, size};
+
+    m_output.append(reinterpret_cast<const char *>(&header), sizeof(header));
+    m_output.append(static_cast<const char *>(data), size);
+    if (m_fd != -1)
+        FlushLocked();
+}
+
+// m_lock must be held; writes what the socket takes without waiting and
+// leaves the rest to OnOutput(). A broken or stuck daemon is shut down,
+// OnInput() then closes the channel on the reaper thread.
+bool SpiceDaemonChannel::FlushLocked()
+{
+    while (!m_output.empty()) {
+        ssize_t len = send(m_fd, m_output.data(), m_output.length(), MSG_NOSIGNAL);
+        if (len == -1 && errno == EINTR)
+            continue;
+        if (len == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (len == -1) {
+            g_warning("failed to write to client daemon: %s", g_strerror(errno));
+            m_output.clear();
+            shutdown(m_fd, SHUT_RDWR);
+            return false;
+        }
+        m_output.erase(0, len);
+    }
+
+    if (m_output.length() > DAEMON_OUTPUT_MAX) {
+        g_warning("client daemon does not read, giving up on it");
+        m_output.clear();
+        shutdown(m_fd, SHUT_RDWR);
+        return false;
+    }
+
+    if (!m_output.empty() && m_output_watch == NULL) {
+        GIOChannel *channel = g_io_channel_unix_new(m_fd);
+        m_output_watch = g_io_create_watch(channel, G_IO_OUT);
+        g_source_set_callback(m_output_watch, (GSourceFunc)OnOutput, this, NULL);
+        g_source_attach(m_output_watch, SpiceController::ReaperContext());
+        g_io_channel_unref(channel);
+    }
+
+    return true;
+}
+
+// m_lock must be held; sessions still open are reported as failed
+void SpiceDaemonChannel::CloseLocked(ClosedList &closed)
+{
+    for (SessionMap::iterator it = m_sessions.begin(); it != m_sessions.end(); ++it)
+        closed.push_back(std::make_pair(it->second, -1));
+    m_sessions.clear();
+
+    if (m_watch != NULL) {
+        g_source_destroy(m_watch);
+        g_source_unref(m_watch);
+        m_watch = NULL;
+    }
+    if (m_output_watch != NULL) {
+        g_source_destroy(m_output_watch);
+        g_source_unref(m_output_watch);
+        m_output_watch = NULL;
+    }
+    if (m_retry_source != NULL) {
+        g_source_destroy(m_retry_source);
+        g_source_unref(m_retry_source);
+        m_retry_source = NULL;
+    }
+    if (m_fd != -1) {
+        close(m_fd);
+        m_fd = -1;
+    }
+    m_input.clear();
+    m_output.clear();
+}
+
+// without m_lock, this may take controller locks and free them
+void SpiceDaemonChannel::ReportClosed(const ClosedList &closed)
+{
+    for (ClosedList::const_iterator it = closed.begin(); it != closed.end(); ++it) {
+        g_atomic_int_set(&it->first->m_session, 0);
+        it->first->ClientGone(it->second);
+    }
+}
+
+gboolean SpiceDaemonChannel::OnOutput(GIOChannel *source, GIOCondition condition, gpointer data)
+{
+    SpiceDaemonChannel *fake_this = static_cast<SpiceDaemonChannel *>(data);
+    gboolean keep;
+
+    g_mutex_lock(&fake_this->m_lock);
+    keep = fake_this->FlushLocked() && !fake_this->m_output.empty();
+    if (!keep) {
+        g_source_unref(fake_this->m_output_watch);
+        fake_this->m_output_watch = NULL;
+    }
+    g_mutex_unlock(&fake_this->m_lock);
+
+    return keep;
+}
+
+gboolean SpiceDaemonChannel::OnInput(GIOChannel *source, GIOCondition condition, gpointer data)
+{
+    SpiceDaemonChannel *fake_this = static_cast<SpiceDaemonChannel *>(data);
+    ClosedList closed;
+    gboolean keep = TRUE;
+    char buf[4096];
+
+    g_mutex_lock(&fake_this->m_lock);
+    ssize_t len = recv(fake_this->m_fd, buf, sizeof(buf), 0);
+    if (len > 0)
+        fake_this->m_input.insert(fake_this->m_input.end(), buf, buf + len);
+
+    size_t offset = 0;
+    while (fake_this->m_input.size() - offset >= sizeof(ControllerSessionHeader)) {
+        ControllerSessionHeader header;
+        memcpy(&header, &fake_this->m_input[offset], sizeof(header));
+        if (fake_this->m_input.size() - offset - sizeof(header) < header.size)
+            break;
+
+        ControllerValue msg;
+        if (header.size >= sizeof(msg)) {
+            memcpy(&msg, &fake_this->m_input[offset + sizeof(header)], sizeof(msg));
+            SessionMap::iterator it = fake_this->m_sessions.find(header.session);
+            if (msg.base.id == CONTROLLER_SESSION_CLOSED && it != fake_this->m_sessions.end()) {
+                closed.push_back(std::make_pair(it->second, (int)msg.value));
+                fake_this->m_sessions.erase(it);
+            }
+        }
+        offset += sizeof(header) + header.size;
+    }
+    fake_this->m_input.erase(fake_this->m_input.begin(), fake_this->m_input.begin() + offset);
+
+    if (len == 0 || (len == -1 && errno != EINTR && errno != EAGAIN)) {
+        g_warning("client daemon went away");
+        keep = FALSE;
+    } else if (fake_this->m_sessions.empty()) {
+        keep = FALSE;
+    }
+    if (!keep) {
+        // CloseLocked() must not destroy the source we return FALSE from
+        g_source_unref(fake_this->m_watch);
+        fake_this->m_watch = NULL;
+        fake_this->CloseLocked(closed);
+    }
+    g_mutex_unlock(&fake_this->m_lock);
+
+    ReportClosed(closed);
+
+    return keep;
+}
+
+SpiceControllerDaemon::SpiceControllerDaemon(nsPluginInstance *aPlugin):
+    SpiceController(aPlugin),
+    m_session(0)
+{
+}
+
+SpiceControllerDaemon::~SpiceControllerDaemon()
+{
+    g_debug("%s", G_STRFUNC);
+}
+
+bool SpiceControllerDaemon::LaunchClient()
+{
+    uint32_t session = SpiceDaemonChannel::Get()->OpenSession(this);
+
+    if (session == 0)
+        return false;
+
+    if (!m_proxy.empty()) {
+        const uint32_t size = sizeof(ControllerMsg) + m_proxy.length() + 1;
+        ControllerMsg msg = {CONTROLLER_PROXY, size};
+        std::vector<char> buf(size);
+        memcpy(&buf[0], &msg, sizeof(msg));
+        memcpy(&buf[sizeof(msg)], m_proxy.c_str(), m_proxy.length() + 1);
+        SpiceDaemonChannel::Get()->Send(session, &buf[0], msg.size);
+    }
+
+    g_atomic_int_set(&m_session, session);
+
+    return true;
+}
+
+int SpiceControllerDaemon::Connect()
+{
+    uint32_t session = g_atomic_int_get(&m_session);
+
+    return session != 0 && SpiceDaemonChannel::Get()->IsOpen(session) ? 0 : -1;
+}
+
+bool SpiceControllerDaemon::CheckPipe()
+{
+    return g_atomic_int_get(&m_session) != 0;
+}
+
+uint32_t SpiceControllerDaemon::WritePipe(const void *lpBuffer, uint32_t nBytesToWrite)
+{
+    uint32_t session = g_atomic_int_get(&m_session);
+
+    if (session == 0 || !SpiceDaemonChannel::Get()->Send(session, lpBuffer, nBytesToWrite))
+        return 0;
+
+    return nBytesToWrite;
+}
+
+void SpiceControllerDaemon::CloseSession(uint32_t flags)
+{
+    uint32_t session = g_atomic_int_get(&m_session);
+    ControllerValue msg = {{CONTROLLER_SESSION_CLOSE, sizeof(msg)}, flags};
+
+    if (session != 0)
+        SpiceDaemonChannel::Get()->Send(session, &msg, sizeof(msg));
+}
+
+void SpiceControllerDaemon::StopClient()
+{
+    CloseSession(0);
+}
+
+void SpiceControllerDaemon::KillClient()
+{
+    CloseSession(CONTROLLER_SESSION_FORCE);
+}
+
+// the daemon owns the clients, nothing is spawned per session
+bool SpiceControllerDaemon::SetupControllerPipe(GStrv &env)
+{
+    return true;
+}
+
+GStrv SpiceControllerDaemon::GetClientPath()
+{
+    return NULL;
+}
+
+GStrv SpiceControllerDaemon::GetFallbackClientPath()
+{
+    return NULL;
+}
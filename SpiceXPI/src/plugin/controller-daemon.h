@@ -0,0 +1,79 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ *   Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ *   The contents of this file are subject to the Mozilla Public License Version
+ *   1.1 (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.mozilla.org/MPL/
+ *
+ *   Software distributed under the License is distributed on an "AS IS" basis,
+ *   WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ *   for the specific language governing rights and limitations under the
+ *   License.
+ *
+ *   Copyright 2013, Red Hat Inc.
+ *
+ *   Alternatively, the contents of this file may be used under the terms of
+ *   either the GNU General Public License Version 2 or later (the "GPL"), or
+ *   the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ *   in which case the provisions of the GPL or the LGPL are applicable instead
+ *   of those above. If you wish to allow use of your version of this file only
+ *   under the terms of either the GPL or the LGPL, and not to allow others to
+ *   use your version of this file under the terms of the MPL, indicate your
+ *   decision by deleting the provisions above and replace them with the notice
+ *   and other provisions required by the GPL or the LGPL. If you do not delete
+ *   the provisions above, a recipient may use your version of this file under
+ *   the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef SPICE_CONTROLLER_DAEMON_H
+#define SPICE_CONTROLLER_DAEMON_H
+
+/*
+    Client sessions hosted by a shared per-user daemon instead of a client
+    process per plugin instance, see controller-session.h for the protocol.
+    All controllers of the process share one connection to the daemon.
+*/
+
+#include <glib.h>
+#include <glib-object.h> /* for GStrv */
+#include <string>
+extern "C" {
+#  include <stdint.h>
+}
+
+#include "controller.h"
+
+class nsPluginInstance;
+class SpiceDaemonChannel;
+
+class SpiceControllerDaemon: public SpiceController
+{
+public:
+    SpiceControllerDaemon(nsPluginInstance *aPlugin);
+
+    virtual void StopClient();
+    virtual void KillClient();
+    int Connect(int nRetries) { return SpiceController::Connect(nRetries); };
+
+protected:
+    virtual ~SpiceControllerDaemon();
+
+private:
+    friend class SpiceDaemonChannel;
+
+    virtual int Connect();
+    virtual uint32_t WritePipe(const void *lpBuffer, uint32_t nBytesToWrite);
+    virtual bool SetupControllerPipe(GStrv &env);
+    virtual bool CheckPipe();
+    virtual GStrv GetClientPath(void);
+    virtual GStrv GetFallbackClientPath(void);
+    virtual bool LaunchClient();
+    void CloseSession(uint32_t flags);
+
+    // 0 while no session is open; set on the reaper thread
+    volatile gint m_session;
+};
+
+#endif // SPICE_CONTROLLER_DAEMON_H
@@ -46,6 +46,7 @@
 #include <cstdlib>
 #include <cstring>
 #include <cerrno>
+#include <vector>
 #include <glib.h>
 
 extern "C" {
@@ -55,19 +56,27 @@ extern "C" {
 #  include <sys/socket.h>
 #  include <sys/un.h>
 #  include <sys/wait.h>
+#  include <signal.h>
 }
 
 #include "rederrorcodes.h"
+#include "controller-tls-session.h"
 #include "controller-unix.h"
 #include "plugin.h"
 
+namespace {
+    struct ControllerReader {
+        // holds a reference
+        SpiceControllerUnix *controller;
+        int fd;
+        std::vector<char> input;
+    };
+}
+
 SpiceControllerUnix::SpiceControllerUnix(nsPluginInstance *aPlugin):
     SpiceController(aPlugin),
     m_client_socket(-1)
 {
-    // create temporary directory in /tmp
-    char tmp_dir[] = "/tmp/spicec-XXXXXX";
-    m_tmp_dir = mkdtemp(tmp_dir);
 }
 
 SpiceControllerUnix::~SpiceControllerUnix()
@@ -76,7 +85,8 @@ SpiceControllerUnix::~SpiceControllerUnix()
     Disconnect();
 
     // delete the temporary directory used for a client socket
-    rmdir(m_tmp_dir.c_str());
+    if (!m_tmp_dir.empty())
+        rmdir(m_tmp_dir.c_str());
 }
 
 int SpiceControllerUnix::Connect()
@@ -110,18 +120,108 @@ int SpiceControllerUnix::Connect()
     else
     {
         g_debug("controller connected");
+        StartReader();
     }
 
     return rc;
 }
 
+// The client talks back on the same socket. The reaper thread reads it
+// through a duplicate descriptor, so that DisconnectPipe() never closes it
+// under the reader; the shutdown() there ends both.
+void SpiceControllerUnix::StartReader()
+{
+    int fd = fcntl(m_client_socket, F_DUPFD_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        g_warning("cannot read from the client: %s", g_strerror(errno));
+        return;
+    }
+
+    ControllerReader *reader = new ControllerReader;
+    reader->controller = this;
+    reader->fd = fd;
+    Ref();
+
+    GIOChannel *channel = g_io_channel_unix_new(fd);
+    GSource *source = g_io_create_watch(channel, GIOCondition(G_IO_IN | G_IO_HUP | G_IO_ERR));
+    g_source_set_callback(source, (GSourceFunc)OnInput, reader, ReaderDone);
+    g_source_attach(source, ReaperContext());
+    g_source_unref(source);
+    g_io_channel_unref(channel);
+}
+
+gboolean SpiceControllerUnix::OnInput(GIOChannel *source, GIOCondition condition, gpointer data)
+{
+    ControllerReader *reader = static_cast<ControllerReader *>(data);
+    char buf[4096];
+
+    ssize_t len = recv(reader->fd, buf, sizeof(buf), 0);
+    if (len == -1 && (errno == EINTR || errno == EAGAIN))
+        return TRUE;
+    if (len <= 0)
+        return FALSE;
+    reader->input.insert(reader->input.end(), buf, buf + len);
+
+    size_t offset = 0;
+    while (reader->input.size() - offset >= sizeof(ControllerMsg))
+    {
+        ControllerMsg msg;
+        memcpy(&msg, &reader->input[offset], sizeof(msg));
+        if (msg.size < sizeof(msg) || msg.size > sizeof(msg) + CONTROLLER_TLS_SESSION_MAX)
+        {
+            g_warning("invalid message from the client, size %u", msg.size);
+            return FALSE;
+        }
+        if (reader->input.size() - offset < msg.size)
+            break;
+
+        reader->controller->ClientMessage(msg.id, &reader->input[0] + offset + sizeof(msg),
+                                          msg.size - sizeof(msg));
+        offset += msg.size;
+    }
+    reader->input.erase(reader->input.begin(), reader->input.begin() + offset);
+
+    return TRUE;
+}
+
+void SpiceControllerUnix::ReaderDone(gpointer data)
+{
+    ControllerReader *reader = static_cast<ControllerReader *>(data);
+
+    close(reader->fd);
+    reader->controller->Unref();
+    delete reader;
+}
+
+// the socket is only kept once connect() succeeded
 bool SpiceControllerUnix::CheckPipe()
 {
+    return m_client_socket != -1;
 }
 
 GStrv SpiceControllerUnix::GetClientPath()
+{
+    return ClientArgv();
+}
+
+GStrv SpiceControllerUnix::ClientArgv()
 {
     const char *client_argv[] = { "/usr/libexec/spice-xpi-client", NULL };
+    const char *client_cmdline = g_getenv("SPICE_XPI_CLIENT");
+
+    // allows running a locally built or a stand-in client
+    if (client_cmdline != NULL) {
+        GError *err = NULL;
+        gchar **args = NULL;
+
+        if (g_shell_parse_argv(client_cmdline, NULL, &args, &err))
+            return args;
+
+        g_warning("Failed to parse SPICE_XPI_CLIENT '%s': %s",
+                  client_cmdline, err->message);
+        g_clear_error(&err);
+    }
 
     return g_strdupv((GStrv)client_argv);
 }
@@ -133,14 +233,69 @@ GStrv SpiceControllerUnix::GetFallbackClientPath()
     return g_strdupv((GStrv)fallback_argv);
 }
 
-void SpiceControllerUnix::SetupControllerPipe(GStrv &env)
+// the directory is created on the first connect only and reused by
+// later clients of this controller
+bool SpiceControllerUnix::PrepareControllerPipe()
+{
+    if (!m_tmp_dir.empty())
+        return true;
+
+    char tmp_dir[] = "/tmp/spicec-XXXXXX";
+    if (mkdtemp(tmp_dir) == NULL) {
+        g_critical("failed to create controller directory: %s", g_strerror(errno));
+        return false;
+    }
+    m_tmp_dir = tmp_dir;
+
+    return true;
+}
+
+bool SpiceControllerUnix::SetupControllerPipe(GStrv &env)
 {
+    if (!PrepareControllerPipe())
+        return false;
+
     std::string socket_file(this->m_tmp_dir);
     socket_file += "/spice-xpi";
 
     this->SetFilename(socket_file);
 
     env = g_environ_setenv(env, "SPICE_XPI_SOCKET", socket_file.c_str(), TRUE);
+
+    return true;
+}
+
+// killed by a signal that was not a request to quit
+bool SpiceControllerUnix::ClientCrashed(int status)
+{
+    if (!WIFSIGNALED(status))
+        return false;
+
+    const int sig = WTERMSIG(status);
+    return sig != SIGTERM && sig != SIGINT && sig != SIGHUP;
+}
+
+// runs on the reaper thread, LaunchClient() spawns right after
+void SpiceControllerUnix::ApplyClientLimits(GStrv &argv, GSpawnChildSetupFunc *setup,
+                                            gpointer *setup_data)
+{
+    m_limits.Load();
+    m_limits.WrapArgv(argv);
+    *setup = ChildSetup;
+    *setup_data = &m_limits;
+}
+
+// runs in the child; StopClient() signals the process group, so the
+// client has to lead one, and a wrapper takes its children along
+void SpiceControllerUnix::ChildSetup(gpointer data)
+{
+    setpgid(0, 0);
+    ClientLimits::ChildSetup(data);
+}
+
+bool SpiceControllerUnix::ReadClientUsage(GPid pid, double *cpu_time, double *rss)
+{
+    return ClientLimits::ReadUsage(pid, cpu_time, rss);
 }
 
 void SpiceControllerUnix::StopClient()
@@ -149,7 +304,13 @@ void SpiceControllerUnix::StopClient()
         kill(-m_pid_controller, SIGTERM);
 }
 
-uint32_t SpiceControllerUnix::Write(const void *lpBuffer, uint32_t nBytesToWrite)
+void SpiceControllerUnix::KillClient()
+{
+    if (m_pid_controller > 0)
+        kill(-m_pid_controller, SIGKILL);
+}
+
+uint32_t SpiceControllerUnix::WritePipe(const void *lpBuffer, uint32_t nBytesToWrite)
 {
     ssize_t len = send(m_client_socket, lpBuffer, nBytesToWrite, 0);
 
@@ -162,9 +323,46 @@ uint32_t SpiceControllerUnix::Write(const void *lpBuffer, uint32_t nBytesToWrite
     return len;
 }
 
-void SpiceControllerUnix::Disconnect()
+bool SpiceControllerUnix::WritePipeFd(const void *lpBuffer, uint32_t nBytesToWrite, int fd)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    iov.iov_base = const_cast<void *>(lpBuffer);
+    iov.iov_len = nBytesToWrite;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    ssize_t len = sendmsg(m_client_socket, &msg, 0);
+    if (len != (ssize_t)nBytesToWrite)
+    {
+        g_warning("failed to pass descriptor, bytes written = %zd: %s",
+                  len, g_strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+void SpiceControllerUnix::DisconnectPipe()
 {
-    // close the socket
+    // close the socket, this also ends the reader
+    if (m_client_socket != -1)
+        shutdown(m_client_socket, SHUT_RDWR);
     close(m_client_socket);
     m_client_socket = -1;
 
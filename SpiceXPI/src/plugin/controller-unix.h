@@ -69,6 +69,7 @@ extern "C" {
 
 #include <spice/controller_prot.h>
 #include "controller.h"
+#include "clientlimits.h"
 
 class nsPluginInstance;
 
@@ -76,22 +77,38 @@ class SpiceControllerUnix: public SpiceController
 {
 public:
     SpiceControllerUnix(nsPluginInstance *aPlugin);
-    virtual ~SpiceControllerUnix();
 
     virtual void StopClient();
-    virtual uint32_t Write(const void *lpBuffer, uint32_t nBytesToWrite);
+    virtual void KillClient();
     int Connect(int nRetries) { return SpiceController::Connect(nRetries); };
+    // command line of the preferred client
+    static GStrv ClientArgv();
+
+protected:
+    virtual ~SpiceControllerUnix();
 
 private:
     virtual int Connect();
-    virtual void Disconnect();
-    virtual void SetupControllerPipe(GStrv &env);
+    virtual uint32_t WritePipe(const void *lpBuffer, uint32_t nBytesToWrite);
+    virtual bool WritePipeFd(const void *lpBuffer, uint32_t nBytesToWrite, int fd);
+    virtual void DisconnectPipe();
+    virtual bool PrepareControllerPipe();
+    virtual bool SetupControllerPipe(GStrv &env);
     virtual bool CheckPipe();
+    virtual bool ClientCrashed(int status);
+    virtual void ApplyClientLimits(GStrv &argv, GSpawnChildSetupFunc *setup, gpointer *setup_data);
+    virtual bool ReadClientUsage(GPid pid, double *cpu_time, double *rss);
     virtual GStrv GetClientPath(void);
     virtual GStrv GetFallbackClientPath(void);
+    void StartReader();
+    static gboolean OnInput(GIOChannel *source, GIOCondition condition, gpointer data);
+    static void ReaderDone(gpointer data);
+    static void ChildSetup(gpointer data);
 
     int m_client_socket;
     std::string m_tmp_dir;
+    // read before every spawn, used by the child between fork and exec
+    ClientLimits m_limits;
 };
 
 #endif // SPICE_CONTROLLER_UNIX_H
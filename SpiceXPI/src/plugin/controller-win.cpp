@@ -132,6 +132,13 @@ bool SpiceControllerWin::CheckPipe()
     return true;
 }
 
+// exit codes of unhandled exceptions are NTSTATUS errors, e.g.
+// 0xC0000005 for an access violation
+bool SpiceControllerWin::ClientCrashed(int status)
+{
+    return ((guint32)status & 0xC0000000) == 0xC0000000;
+}
+
 #define SPICE_CLIENT_REGISTRY_KEY TEXT("Software\\spice-space.org\\spicex")
 #define SPICE_XPI_DLL TEXT("npSpiceConsole.dll")
 #define RED_CLIENT_FILE_NAME TEXT("spicec.exe")
@@ -187,26 +194,28 @@ GStrv SpiceControllerWin::GetFallbackClientPath()
 }
 
 #define RED_CLIENT_PIPE_NAME TEXT("\\\\.\\pipe\\SpiceController-%lu")
-void SpiceControllerWin::SetupControllerPipe(GStrv &env)
+bool SpiceControllerWin::SetupControllerPipe(GStrv &env)
 {
     char *pipe_name;
     pipe_name = g_strdup_printf(RED_CLIENT_PIPE_NAME, (unsigned long)g_random_int());
     this->SetFilename(pipe_name);
     env = g_environ_setenv(env, "SPICE_XPI_NAMEDPIPE", pipe_name, TRUE);
     g_free(pipe_name);
+
+    return true;
 }
 
 void SpiceControllerWin::StopClient()
 {
     if (m_pid_controller != NULL) {
-        //WaitForPid will take care of closing the handle
+        //ChildExited will take care of closing the handle
         TerminateProcess(m_pid_controller, 0);
         m_pid_controller = NULL;
     }
 }
 
 
-uint32_t SpiceControllerWin::Write(const void *lpBuffer, uint32_t nBytesToWrite)
+uint32_t SpiceControllerWin::WritePipe(const void *lpBuffer, uint32_t nBytesToWrite)
 {
     GError *error = NULL;
     gsize bytes_written;
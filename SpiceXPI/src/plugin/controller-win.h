@@ -76,16 +76,19 @@ class SpiceControllerWin: public SpiceController
 {
 public:
     SpiceControllerWin(nsPluginInstance *aPlugin);
-    virtual ~SpiceControllerWin();
 
     virtual void StopClient();
-    virtual uint32_t Write(const void *lpBuffer, uint32_t nBytesToWrite);
     int Connect(int nRetries) { return SpiceController::Connect(nRetries); };
 
+protected:
+    virtual ~SpiceControllerWin();
+
 private:
     virtual int Connect();
-    virtual void SetupControllerPipe(GStrv &env);
+    virtual uint32_t WritePipe(const void *lpBuffer, uint32_t nBytesToWrite);
+    virtual bool SetupControllerPipe(GStrv &env);
     virtual bool CheckPipe();
+    virtual bool ClientCrashed(int status);
     virtual GStrv GetClientPath(void);
     virtual GStrv GetFallbackClientPath(void);
 };
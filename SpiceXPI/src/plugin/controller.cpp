@@ -44,28 +44,400 @@
 
 #include "config.h"
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <cerrno>
 #include <glib.h>
+#include <glib/gstdio.h>
+
+extern "C" {
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/stat.h>
+}
 
 #include "rederrorcodes.h"
+#include "controller-caps.h"
+#include "controller-capture.h"
+#include "controller-heartbeat.h"
+#include "controller-tls-session.h"
 #include "controller.h"
+#include "handoffregistry.h"
 #include "plugin.h"
+#include "tlssessioncache.h"
+
+// how long a client gets to exit after SIGTERM before it is killed
+#define CLIENT_STOP_GRACE_PERIOD 5
+
+// crashed clients are restarted after 1, 2, 4, 8 and 16 seconds; more
+// crashes than this within the window are a crash loop
+#define RESTART_DELAY_MIN     1000
+#define RESTART_MAX_CRASHES   5
+#define RESTART_CRASH_WINDOW  120
+// how often and how long to try the controller socket of a new client
+#define RESTART_CONNECT_INTERVAL 500
+#define RESTART_CONNECT_TRIES    20
+
+// a client is hung after this many intervals without a pong by default
+#define HEARTBEAT_TIMEOUT_FACTOR 3
+
+// what is kept of the stdout and stderr of the clients of a session,
+// older lines are dropped first; longer lines are cut
+#define CLIENT_LOG_MAX      (64 * 1024)
+#define CLIENT_LOG_LINE_MAX 1024
+#define CLIENT_LOG_READ     4096
+
+// All controllers of the process share a single thread which spawns the
+// clients, watches them and runs the kill timers, see ReaperContext().
+namespace {
+    GMutex reaper_lock;
+    GThread *reaper_thread = NULL;
+    GMainContext *reaper_context = NULL;
+    GMainLoop *reaper_loop = NULL;
+
+    gpointer reaper_run(gpointer data)
+    {
+        g_main_loop_run(static_cast<GMainLoop *>(data));
+        return NULL;
+    }
+}
+
+struct SpiceController::ClientOutput {
+    // holds a reference
+    SpiceController *controller;
+    GIOChannel *channel;
+    // the line being written
+    std::string partial;
+    // the rest of a line over CLIENT_LOG_LINE_MAX is dropped
+    bool truncated;
+};
 
 SpiceController::SpiceController(nsPluginInstance *aPlugin):
     m_pid_controller(0),
     m_pipe(NULL),
+    m_refcount(1),
     m_plugin(aPlugin),
-    m_child_watch_mainloop(NULL)
+    m_state(STATE_IDLE),
+    m_kill_source(NULL),
+    m_orphan_source(NULL),
+    m_client_caps(0),
+    m_client_caps_known(false),
+    m_auto_restart(false),
+    m_restarting(false),
+    m_restart_status(0),
+    m_restart_source(NULL),
+    m_replay_source(NULL),
+    m_replay_tries(0),
+    m_crash_count(0),
+    m_crash_window_start(0),
+    m_heartbeat_interval(0),
+    m_heartbeat_timeout(0),
+    m_heartbeat_restart(false),
+    m_heartbeat_source(NULL),
+    m_ping_seq(0),
+    m_ping_sent(0),
+    m_heartbeat_rtt(-1),
+    m_degraded(false),
+    m_capture_fd(-1),
+    m_capture_session(0),
+    m_client_log_size(0),
+    m_client_log_dropped(0)
 {
+    static volatile gint capture_sessions = 0;
+
+    g_mutex_init(&m_plugin_lock);
+    g_mutex_init(&m_state_lock);
+    g_mutex_init(&m_write_lock);
+    g_cond_init(&m_client_caps_cond);
+
+    // the capture holds passwords, it is only ever readable by the user
+    const char *capture = g_getenv("SPICE_XPI_CAPTURE");
+    if (capture != NULL) {
+        m_capture_fd = g_open(capture, O_WRONLY | O_CREAT | O_APPEND, 0600);
+        if (m_capture_fd == -1)
+            g_warning("failed to open capture file %s: %s", capture, g_strerror(errno));
+#ifdef XP_UNIX
+        struct stat st;
+        if (m_capture_fd != -1 && (fstat(m_capture_fd, &st) != 0 || (st.st_mode & 077))) {
+            g_warning("capture file %s is accessible by others, not capturing", capture);
+            close(m_capture_fd);
+            m_capture_fd = -1;
+        }
+#endif
+        m_capture_session = g_atomic_int_add(&capture_sessions, 1) + 1;
+    }
 }
 
 SpiceController::~SpiceController()
 {
     g_debug("%s", G_STRFUNC);
     Disconnect();
+    RemoveTrustStoreFile();
+    if (m_capture_fd != -1)
+        close(m_capture_fd);
+    g_cond_clear(&m_client_caps_cond);
+    g_mutex_clear(&m_write_lock);
+    g_mutex_clear(&m_state_lock);
+    g_mutex_clear(&m_plugin_lock);
+}
+
+void SpiceController::Ref()
+{
+    g_atomic_int_inc(&m_refcount);
+}
+
+void SpiceController::Unref()
+{
+    if (g_atomic_int_dec_and_test(&m_refcount))
+        delete this;
+}
+
+// Called when the plugin instance goes away. This never waits for the
+// client: it gets SIGTERM now and SIGKILL after a grace period, and the
+// running client holds the last reference, so the socket, the temporary
+// directory and the trust store are cleaned up once the child is reaped,
+// even though the instance is long gone by then.
+void SpiceController::Shutdown()
+{
+    g_mutex_lock(&m_plugin_lock);
+    m_plugin = NULL;
+    g_mutex_unlock(&m_plugin_lock);
+
+    RequestStop();
+    Unref();
+}
+
+// The instance goes away but its client is kept running: the reference
+// of the instance now belongs to the HandoffRegistry, which gives it to
+// the next instance of the page or, after grace ms, to Shutdown().
+void SpiceController::Orphan(guint grace)
+{
+    g_mutex_lock(&m_plugin_lock);
+    m_plugin = NULL;
+    g_mutex_unlock(&m_plugin_lock);
+
+    g_mutex_lock(&m_state_lock);
+    if (m_orphan_source == NULL) {
+        Ref();
+        m_orphan_source = g_timeout_source_new(grace);
+        g_source_set_callback(m_orphan_source, OrphanTimeout, this, ReleaseReference);
+        g_source_attach(m_orphan_source, ReaperContext());
+    }
+    g_mutex_unlock(&m_state_lock);
+}
+
+// false if the client is no longer connected, Shutdown() it then
+bool SpiceController::Adopt(nsPluginInstance *aPlugin)
+{
+    bool connected;
+
+    g_mutex_lock(&m_state_lock);
+    if (m_orphan_source != NULL) {
+        g_source_destroy(m_orphan_source);
+        g_source_unref(m_orphan_source);
+        m_orphan_source = NULL;
+    }
+    connected = (m_state == STATE_CONNECTED);
+    g_mutex_unlock(&m_state_lock);
+
+    if (!connected)
+        return false;
+
+    g_mutex_lock(&m_plugin_lock);
+    m_plugin = aPlugin;
+    g_mutex_unlock(&m_plugin_lock);
+
+    return true;
+}
+
+// runs on the reaper thread, nobody adopted the client in time
+gboolean SpiceController::OrphanTimeout(gpointer data)
+{
+    SpiceController *fake_this = (SpiceController *)data;
+
+    g_mutex_lock(&fake_this->m_state_lock);
+    if (fake_this->m_orphan_source != NULL) {
+        g_source_unref(fake_this->m_orphan_source);
+        fake_this->m_orphan_source = NULL;
+    }
+    g_mutex_unlock(&fake_this->m_state_lock);
+
+    // lost against HandoffRegistry::Take() otherwise
+    if (HandoffRegistry::Remove(fake_this)) {
+        g_debug("handed over client was not adopted, stopping it");
+        fake_this->Shutdown();
+    }
+
+    return FALSE;
+}
+
+void SpiceController::SetTrustStoreFile(const std::string &path)
+{
+    RemoveTrustStoreFile();
+    m_trust_store_file = path;
+}
+
+void SpiceController::RemoveTrustStoreFile()
+{
+    if (m_trust_store_file.empty())
+        return;
+
+    if (g_unlink(m_trust_store_file.c_str()) != 0)
+        g_warning("failed to remove %s: %s", m_trust_store_file.c_str(), g_strerror(errno));
+    m_trust_store_file.clear();
+}
+
+void SpiceController::KillClient()
+{
+    StopClient();
+}
+
+gboolean SpiceController::KillTimeout(gpointer user_data)
+{
+    SpiceController *fake_this = (SpiceController *)user_data;
+
+    g_mutex_lock(&fake_this->m_state_lock);
+    if (fake_this->m_state == STATE_STOPPING) {
+        g_warning("client did not exit in %d seconds, killing it",
+                  CLIENT_STOP_GRACE_PERIOD);
+        fake_this->KillClient();
+    }
+    g_source_unref(fake_this->m_kill_source);
+    fake_this->m_kill_source = NULL;
+    g_mutex_unlock(&fake_this->m_state_lock);
+
+    return FALSE;
+}
+
+// m_state_lock must be held; the timer is disarmed when the child is
+// reaped, it never outlives the reference held for the client
+void SpiceController::ArmKillTimer()
+{
+    if (m_kill_source != NULL)
+        return;
+
+    m_kill_source = g_timeout_source_new_seconds(CLIENT_STOP_GRACE_PERIOD);
+    g_source_set_callback(m_kill_source, KillTimeout, this, NULL);
+    g_source_attach(m_kill_source, ReaperContext());
+}
+
+// m_state_lock must be held
+void SpiceController::DisarmKillTimer()
+{
+    if (m_kill_source == NULL)
+        return;
+
+    g_source_destroy(m_kill_source);
+    g_source_unref(m_kill_source);
+    m_kill_source = NULL;
+}
+
+GMainContext *SpiceController::ReaperContext()
+{
+    g_mutex_lock(&reaper_lock);
+    if (reaper_context == NULL) {
+        reaper_context = g_main_context_new();
+        reaper_loop = g_main_loop_new(reaper_context, FALSE);
+        reaper_thread = g_thread_new("spice-xpi reaper", reaper_run, reaper_loop);
+    }
+    g_mutex_unlock(&reaper_lock);
+
+    return reaper_context;
+}
+
+// Called when the plugin library is about to be unloaded, the thread
+// must not run code from it any more. Clients still running are left
+// alone at this point.
+void SpiceController::StopReaper()
+{
+    g_mutex_lock(&reaper_lock);
+    if (reaper_context != NULL) {
+        g_main_loop_quit(reaper_loop);
+        g_thread_join(reaper_thread);
+        g_main_loop_unref(reaper_loop);
+        g_main_context_unref(reaper_context);
+        reaper_thread = NULL;
+        reaper_loop = NULL;
+        reaper_context = NULL;
+    }
+    g_mutex_unlock(&reaper_lock);
+}
+
+SpiceController::State SpiceController::GetState()
+{
+    State state;
+
+    g_mutex_lock(&m_state_lock);
+    state = m_state;
+    g_mutex_unlock(&m_state_lock);
+
+    return state;
+}
+
+// only moves to 'to' when nobody changed the state behind our back,
+// e.g. the client exiting while it is being configured
+bool SpiceController::SetState(State from, State to)
+{
+    bool changed = false;
+
+    g_mutex_lock(&m_state_lock);
+    if (m_state == from) {
+        m_state = to;
+        changed = true;
+        // recorded anew by Write() for every client the page configures
+        if (to == STATE_CONFIGURING)
+            m_config_batch.clear();
+        if (to == STATE_CONNECTED)
+            ArmHeartbeat();
+    }
+    g_mutex_unlock(&m_state_lock);
+
+    return changed;
+}
+
+const char *SpiceController::StateToString(State state)
+{
+    switch (state)
+    {
+    case STATE_IDLE:        return "idle";
+    case STATE_SPAWNING:    return "spawning";
+    case STATE_CONFIGURING: return "configuring";
+    case STATE_CONNECTED:   return "connected";
+    case STATE_STOPPING:    return "stopping";
+    case STATE_RESTARTING:  return "restarting";
+    }
+
+    return "unknown";
+}
+
+void SpiceController::RequestStop()
+{
+    g_mutex_lock(&m_state_lock);
+    switch (m_state)
+    {
+    case STATE_IDLE:
+    case STATE_STOPPING:
+        break;
+
+    case STATE_SPAWNING:
+    case STATE_CONFIGURING:
+    case STATE_CONNECTED:
+        // if the client is not spawned yet, SpawnClient() kills it
+        // as soon as it has a pid
+        m_state = STATE_STOPPING;
+        StopClient();
+        ArmKillTimer();
+        break;
+
+    case STATE_RESTARTING:
+        // no client to stop, RestartClient() reports the crash right away
+        m_state = STATE_STOPPING;
+        ArmRestartTimer(0);
+        break;
+    }
+    g_mutex_unlock(&m_state_lock);
 }
 
 void SpiceController::SetFilename(const std::string &name)
@@ -78,6 +450,363 @@ void SpiceController::SetProxy(const std::string &proxy)
     m_proxy = proxy;
 }
 
+void SpiceController::SetAutoRestart(bool enable)
+{
+    g_mutex_lock(&m_state_lock);
+    m_auto_restart = enable;
+    if (!enable)
+        m_config_batch.clear();
+    g_mutex_unlock(&m_state_lock);
+}
+
+void SpiceController::SetTlsSessionKey(const std::string &key)
+{
+    g_mutex_lock(&m_state_lock);
+    m_tls_session_key = key;
+    g_mutex_unlock(&m_state_lock);
+}
+
+uint32_t SpiceController::WaitForClientCaps(guint timeout)
+{
+    const gint64 end_time = g_get_monotonic_time() + (gint64)timeout * 1000;
+    uint32_t caps;
+
+    g_mutex_lock(&m_state_lock);
+    while (!m_client_caps_known &&
+           g_cond_wait_until(&m_client_caps_cond, &m_state_lock, end_time))
+        ;
+    caps = m_client_caps;
+    g_mutex_unlock(&m_state_lock);
+
+    return caps;
+}
+
+// runs on the reaper thread, before a client is launched
+void SpiceController::ResetClientCaps()
+{
+    g_mutex_lock(&m_state_lock);
+    m_client_caps = 0;
+    m_client_caps_known = false;
+    g_mutex_unlock(&m_state_lock);
+}
+
+void SpiceController::ClientMessage(uint32_t id, const void *data, uint32_t size)
+{
+    std::string key;
+    uint32_t seq;
+    uint32_t caps;
+
+    switch (id)
+    {
+    case CONTROLLER_CLIENT_CAPS:
+        if (size < sizeof(caps))
+            break;
+        memcpy(&caps, data, sizeof(caps));
+        g_mutex_lock(&m_state_lock);
+        m_client_caps = caps;
+        m_client_caps_known = true;
+        g_cond_broadcast(&m_client_caps_cond);
+        // a restarted client may announce itself after the replay
+        if (m_state == STATE_CONNECTED)
+            ArmHeartbeat();
+        g_mutex_unlock(&m_state_lock);
+        return;
+
+    case CONTROLLER_TLS_SESSION_NEW:
+        if (size == 0)
+            break;
+        g_mutex_lock(&m_state_lock);
+        key = m_tls_session_key;
+        g_mutex_unlock(&m_state_lock);
+        if (!key.empty())
+            TlsSessionCache::Store(key, data, size);
+        return;
+
+    case CONTROLLER_PONG:
+        if (size < sizeof(seq))
+            break;
+        memcpy(&seq, data, sizeof(seq));
+        Pong(seq);
+        return;
+    }
+
+    g_debug("ignoring client message %#x", id);
+}
+
+void SpiceController::SetHeartbeat(guint interval, guint timeout, bool restart)
+{
+    g_mutex_lock(&m_state_lock);
+    m_heartbeat_interval = interval;
+    m_heartbeat_timeout = timeout;
+    m_heartbeat_restart = restart;
+    // applies to a connected client right away
+    if (m_state == STATE_CONNECTED)
+        ArmHeartbeat();
+    g_mutex_unlock(&m_state_lock);
+}
+
+bool SpiceController::GetClientUsage(double *cpu_time, double *rss)
+{
+    GPid pid;
+
+    g_mutex_lock(&m_state_lock);
+    pid = m_pid_controller;
+    g_mutex_unlock(&m_state_lock);
+
+    return pid > 0 && ReadClientUsage(pid, cpu_time, rss);
+}
+
+void SpiceController::ApplyClientLimits(GStrv &argv, GSpawnChildSetupFunc *setup,
+                                        gpointer *setup_data)
+{
+}
+
+bool SpiceController::ReadClientUsage(GPid pid, double *cpu_time, double *rss)
+{
+    return false;
+}
+
+std::string SpiceController::GetClientLog()
+{
+    std::string log;
+
+    g_mutex_lock(&m_state_lock);
+    if (m_client_log_dropped > 0) {
+        gchar *dropped = g_strdup_printf("[%u earlier lines dropped]\n", m_client_log_dropped);
+        log = dropped;
+        g_free(dropped);
+    }
+    for (size_t i = 0; i < m_client_log.size(); ++i) {
+        log += m_client_log[i];
+        log += '\n';
+    }
+    g_mutex_unlock(&m_state_lock);
+
+    return log;
+}
+
+// The client must never block on a full pipe, nor may its output grow
+// without bound: the reaper reads its stdout and stderr as soon as there
+// is anything, into a ring of at most CLIENT_LOG_MAX bytes.
+void SpiceController::CaptureClientOutput(int fd)
+{
+#ifdef XP_WIN
+    GIOChannel *channel = g_io_channel_win32_new_fd(fd);
+#else
+    GIOChannel *channel = g_io_channel_unix_new(fd);
+#endif
+    g_io_channel_set_close_on_unref(channel, TRUE);
+    g_io_channel_set_encoding(channel, NULL, NULL);
+    g_io_channel_set_buffered(channel, FALSE);
+    g_io_channel_set_flags(channel, G_IO_FLAG_NONBLOCK, NULL);
+
+    ClientOutput *output = new ClientOutput;
+    output->controller = this;
+    output->channel = channel;
+    output->truncated = false;
+    m_client_outputs.push_back(output);
+    Ref();
+
+    GSource *source = g_io_create_watch(channel, GIOCondition(G_IO_IN | G_IO_HUP | G_IO_ERR));
+    g_source_set_callback(source, (GSourceFunc)OnClientOutput, output, ClientOutputDone);
+    g_source_attach(source, ReaperContext());
+    g_source_unref(source);
+}
+
+// runs on the reaper thread, reads once
+GIOStatus SpiceController::ReadClientOutput(ClientOutput *output)
+{
+    char buf[CLIENT_LOG_READ];
+    gsize len = 0;
+
+    GIOStatus status = g_io_channel_read_chars(output->channel, buf, sizeof(buf), &len, NULL);
+    if (status != G_IO_STATUS_NORMAL)
+        return status;
+
+    output->partial.append(buf, len);
+    size_t start = 0;
+    size_t end;
+    while ((end = output->partial.find('\n', start)) != std::string::npos) {
+        if (!output->truncated)
+            AppendClientLog(output->partial.substr(start, end - start));
+        output->truncated = false;
+        start = end + 1;
+    }
+    output->partial.erase(0, start);
+
+    // a line may never end
+    if (!output->truncated && output->partial.size() >= CLIENT_LOG_LINE_MAX) {
+        AppendClientLog(output->partial);
+        output->truncated = true;
+    }
+    if (output->truncated)
+        output->partial.clear();
+
+    return status;
+}
+
+void SpiceController::AppendClientLog(const std::string &line)
+{
+    std::string entry(line, 0, CLIENT_LOG_LINE_MAX);
+
+    if (!entry.empty() && entry[entry.size() - 1] == '\r')
+        entry.erase(entry.size() - 1);
+    g_debug("client: %s", entry.c_str());
+
+    g_mutex_lock(&m_state_lock);
+    m_client_log.push_back(entry);
+    m_client_log_size += entry.size() + 1;
+    while (m_client_log_size > CLIENT_LOG_MAX) {
+        m_client_log_size -= m_client_log.front().size() + 1;
+        m_client_log.pop_front();
+        m_client_log_dropped++;
+    }
+    g_mutex_unlock(&m_state_lock);
+}
+
+gboolean SpiceController::OnClientOutput(GIOChannel *source, GIOCondition condition, gpointer data)
+{
+    ClientOutput *output = static_cast<ClientOutput *>(data);
+
+    GIOStatus status = output->controller->ReadClientOutput(output);
+
+    return status == G_IO_STATUS_NORMAL || status == G_IO_STATUS_AGAIN;
+}
+
+void SpiceController::ClientOutputDone(gpointer data)
+{
+    ClientOutput *output = static_cast<ClientOutput *>(data);
+    SpiceController *controller = output->controller;
+    std::vector<ClientOutput *> &outputs = controller->m_client_outputs;
+
+    if (!output->partial.empty() && !output->truncated)
+        controller->AppendClientLog(output->partial);
+    outputs.erase(std::find(outputs.begin(), outputs.end(), output));
+    g_io_channel_unref(output->channel);
+    delete output;
+    controller->Unref();
+}
+
+double SpiceController::GetHeartbeatRtt()
+{
+    gint64 rtt;
+
+    g_mutex_lock(&m_state_lock);
+    rtt = m_heartbeat_rtt;
+    g_mutex_unlock(&m_state_lock);
+
+    return rtt < 0 ? -1.0 : rtt / 1000.0;
+}
+
+bool SpiceController::IsDegraded()
+{
+    bool degraded;
+
+    g_mutex_lock(&m_state_lock);
+    degraded = m_degraded;
+    g_mutex_unlock(&m_state_lock);
+
+    return degraded;
+}
+
+// m_state_lock must be held; starts over for a newly connected client,
+// if it announced CONTROLLER_CAP_HEARTBEAT
+void SpiceController::ArmHeartbeat()
+{
+    DisarmHeartbeat();
+    m_ping_sent = 0;
+    m_heartbeat_rtt = -1;
+    m_degraded = false;
+
+    if (m_heartbeat_interval == 0 || !(m_client_caps & CONTROLLER_CAP_HEARTBEAT))
+        return;
+
+    m_heartbeat_source = g_timeout_source_new(m_heartbeat_interval);
+    g_source_set_callback(m_heartbeat_source, HeartbeatTick, this, NULL);
+    g_source_attach(m_heartbeat_source, ReaperContext());
+}
+
+// m_state_lock must be held; the timer never outlives the client
+void SpiceController::DisarmHeartbeat()
+{
+    if (m_heartbeat_source == NULL)
+        return;
+
+    g_source_destroy(m_heartbeat_source);
+    g_source_unref(m_heartbeat_source);
+    m_heartbeat_source = NULL;
+}
+
+// runs on the reaper thread
+gboolean SpiceController::HeartbeatTick(gpointer data)
+{
+    SpiceController *fake_this = (SpiceController *)data;
+    ControllerValue ping = { {CONTROLLER_PING, sizeof(ping)}, 0 };
+    bool send = false;
+    bool hung = false;
+
+    g_mutex_lock(&fake_this->m_state_lock);
+    if (fake_this->m_state == STATE_CONNECTED) {
+        gint64 now = g_get_monotonic_time();
+        guint timeout = fake_this->m_heartbeat_timeout != 0 ? fake_this->m_heartbeat_timeout :
+            fake_this->m_heartbeat_interval * HEARTBEAT_TIMEOUT_FACTOR;
+
+        if (fake_this->m_ping_sent == 0) {
+            ping.value = ++fake_this->m_ping_seq;
+            fake_this->m_ping_sent = now;
+            send = true;
+        } else if (!fake_this->m_degraded &&
+                   now - fake_this->m_ping_sent > (gint64)timeout * 1000) {
+            fake_this->m_degraded = true;
+            hung = true;
+            // a crash for ShouldRestart(), so AutoRestart replaces it
+            if (fake_this->m_heartbeat_restart)
+                fake_this->KillClient();
+        }
+    }
+    g_mutex_unlock(&fake_this->m_state_lock);
+
+    // pings are not captured, they are no part of the configuration
+    if (send) {
+        g_mutex_lock(&fake_this->m_write_lock);
+        fake_this->WritePipe(&ping, sizeof(ping));
+        g_mutex_unlock(&fake_this->m_write_lock);
+    }
+
+    if (hung) {
+        g_warning("client did not answer the heartbeat, it seems hung");
+        g_mutex_lock(&fake_this->m_plugin_lock);
+        if (fake_this->m_plugin != NULL)
+            fake_this->m_plugin->OnSpiceClientHealth(true);
+        g_mutex_unlock(&fake_this->m_plugin_lock);
+    }
+
+    return TRUE;
+}
+
+// runs on the reaper thread
+void SpiceController::Pong(uint32_t seq)
+{
+    bool recovered = false;
+
+    g_mutex_lock(&m_state_lock);
+    if (m_ping_sent != 0 && seq == m_ping_seq) {
+        m_heartbeat_rtt = g_get_monotonic_time() - m_ping_sent;
+        m_ping_sent = 0;
+        recovered = m_degraded;
+        m_degraded = false;
+    }
+    g_mutex_unlock(&m_state_lock);
+
+    if (recovered) {
+        g_message("client answers the heartbeat again");
+        g_mutex_lock(&m_plugin_lock);
+        if (m_plugin != NULL)
+            m_plugin->OnSpiceClientHealth(false);
+        g_mutex_unlock(&m_plugin_lock);
+    }
+}
+
 #define FACILITY_SPICEX             50
 #define FACILITY_CREATE_RED_PROCESS 51
 #define FACILITY_STRING_OPERATION   52
@@ -90,83 +819,430 @@ int SpiceController::Connect(const int nRetries)
     int rc = -1;
     int sleep_time = 1;
 
-    // try to connect for specified count
+    // try to connect for specified count, unless the client is
+    // being stopped or is already gone
     for (int i = 0; rc != 0 && i < nRetries; ++i)
     {
+        if (GetState() != STATE_SPAWNING)
+            break;
+        g_mutex_lock(&m_write_lock);
         rc = Connect();
-        if (rc == 1)
+        g_mutex_unlock(&m_write_lock);
+        if (rc == 0 || rc == 1)
             break;
         g_usleep(sleep_time * G_USEC_PER_SEC);
     }
-    if (rc != 0) {
+    bool valid = (rc == 0);
+    if (!valid) {
         g_warning("error connecting");
         g_assert(m_pipe == NULL);
-    }
-    if (!CheckPipe()) {
+    } else if (!CheckPipe()) {
         g_warning("Pipe validation failure");
         g_warn_if_fail(m_pipe == NULL);
+        valid = false;
     }
-    if (m_pipe == NULL) {
+    if (!valid) {
         g_warning("failed to create pipe");
 #ifdef XP_WIN
         rc = MAKE_HRESULT(1, FACILITY_CREATE_RED_PIPE, GetLastError());
 #endif
-        this->StopClient();
+        this->RequestStop();
     }
 
     return rc;
 }
 
+// the client may exit, and the reaper thread disconnect from it, while
+// the main thread is writing
 void SpiceController::Disconnect()
+{
+    g_mutex_lock(&m_write_lock);
+    DisconnectPipe();
+    g_mutex_unlock(&m_write_lock);
+}
+
+void SpiceController::DisconnectPipe()
 {
 }
 
+bool SpiceController::PrepareControllerPipe()
+{
+    return true;
+}
+
+uint32_t SpiceController::Write(const void *lpBuffer, uint32_t nBytesToWrite)
+{
+    uint32_t written;
+    bool restarting;
+
+    g_mutex_lock(&m_state_lock);
+    // kept for a restart, see ReplayConfig()
+    if (m_state == STATE_CONFIGURING && m_auto_restart)
+        m_config_batch.append(static_cast<const char *>(lpBuffer), nBytesToWrite);
+    restarting = m_restarting;
+    g_mutex_unlock(&m_state_lock);
+
+    // nobody is listening until the new client has its configuration
+    if (restarting)
+        return 0;
+
+    g_mutex_lock(&m_write_lock);
+    if (m_capture_fd != -1)
+        CaptureFrame(lpBuffer, nBytesToWrite);
+    written = WritePipe(lpBuffer, nBytesToWrite);
+    g_mutex_unlock(&m_write_lock);
+
+    return written;
+}
+
+// Passes a file descriptor along with the message, where the controller
+// transport can carry one; the descriptor stays owned by the caller.
+bool SpiceController::WriteWithFd(const void *lpBuffer, uint32_t nBytesToWrite, int fd)
+{
+    bool written;
+
+    g_mutex_lock(&m_write_lock);
+    if (m_capture_fd != -1)
+        CaptureFrame(lpBuffer, nBytesToWrite);
+    written = WritePipeFd(lpBuffer, nBytesToWrite, fd);
+    g_mutex_unlock(&m_write_lock);
+
+    return written;
+}
+
+bool SpiceController::WritePipeFd(const void *lpBuffer, uint32_t nBytesToWrite, int fd)
+{
+    return false;
+}
+
+// see controller-capture.h for the record format; each record goes out
+// in a single write(), so that records of processes sharing the file
+// never interleave
+void SpiceController::CaptureFrame(const void *lpBuffer, uint32_t nBytesToWrite)
+{
+    CaptureFrameHeader header;
+    std::string record;
+
+    header.magic = CONTROLLER_CAPTURE_MAGIC;
+    header.pid = getpid();
+    header.session = m_capture_session;
+    header.size = nBytesToWrite;
+    header.timestamp = g_get_real_time();
+
+    record.reserve(sizeof(header) + nBytesToWrite);
+    record.append(reinterpret_cast<const char *>(&header), sizeof(header));
+    record.append(static_cast<const char *>(lpBuffer), nBytesToWrite);
+
+    ssize_t written = write(m_capture_fd, record.data(), record.size());
+    if (written != (ssize_t) record.size()) {
+        g_warning("failed to write capture file, capture disabled: %s",
+                  written == -1 ? g_strerror(errno) : "short write");
+        close(m_capture_fd);
+        m_capture_fd = -1;
+    }
+}
+
 void SpiceController::ChildExited(GPid pid, gint status, gpointer user_data)
 {
     SpiceController *fake_this = (SpiceController *)user_data;
 
     g_message("Client with pid %p exited", pid);
+    g_spawn_close_pid(pid);
 
-    g_main_loop_quit(fake_this->m_child_watch_mainloop);
-    /* FIXME: we are not in the main thread!! */
-    fake_this->m_plugin->OnSpiceClientExit(status);
+#ifdef XP_UNIX
+    // the last words of the client belong to the log of its exit; the
+    // pipes do not block, and a child it left behind may keep writing
+    for (size_t i = 0; i < fake_this->m_client_outputs.size(); ++i) {
+        ClientOutput *output = fake_this->m_client_outputs[i];
+        for (int reads = 0; reads < CLIENT_LOG_MAX / CLIENT_LOG_READ; ++reads) {
+            if (fake_this->ReadClientOutput(output) != G_IO_STATUS_NORMAL)
+                break;
+        }
+    }
+#endif
+
+    fake_this->ClientGone(status);
 }
 
-void SpiceController::WaitForPid(GPid pid)
+// Called once for every successful LaunchClient(), when the client is
+// gone; may release the last reference.
+void SpiceController::ClientGone(int status)
 {
-    GMainContext *context;
-    GSource *source;
+    guint delay = 0;
+    guint attempt = 0;
+    bool restart;
 
-    context = g_main_context_new();
+    g_mutex_lock(&m_state_lock);
+    restart = ShouldRestart(status, &delay, &attempt);
+    if (restart) {
+        m_state = STATE_RESTARTING;
+        m_pid_controller = 0;
+        DisarmKillTimer();
+        DisarmReplay();
+        DisarmHeartbeat();
+        ArmRestartTimer(delay);
+    }
+    g_mutex_unlock(&m_state_lock);
 
-    m_child_watch_mainloop = g_main_loop_new(context, FALSE);
-    source = g_child_watch_source_new(pid);
-    g_source_set_callback(source, (GSourceFunc)ChildExited, this, NULL);
-    g_source_attach(source, context);
+    if (!restart) {
+        ClientFinished(status);
+        return;
+    }
 
-    g_main_loop_run(m_child_watch_mainloop);
+    g_warning("client crashed, restarting it in %u ms (attempt %u)", delay, attempt);
+    g_mutex_lock(&m_plugin_lock);
+    if (m_plugin != NULL)
+        m_plugin->OnSpiceClientRestart(attempt, delay);
+    g_mutex_unlock(&m_plugin_lock);
 
-    g_main_loop_unref(m_child_watch_mainloop);
-    g_main_context_unref(context);
+    // the reference held for the client carries over to the next one
+}
 
-    g_spawn_close_pid(pid);
-    if (pid == m_pid_controller)
-        m_pid_controller = 0;
+// The client is gone for good, reports its exit status and drops the
+// reference held for it.
+void SpiceController::ClientFinished(int status)
+{
+    // before going idle, so a new client cannot have its file removed
+    // or its pipe closed; Disconnect() waits for a write in progress
+    RemoveTrustStoreFile();
+    Disconnect();
+
+    g_mutex_lock(&m_state_lock);
+    m_state = STATE_IDLE;
+    m_pid_controller = 0;
+    m_restarting = false;
+    DisarmKillTimer();
+    DisarmReplay();
+    DisarmHeartbeat();
+    g_mutex_unlock(&m_state_lock);
+
+    // the instance may have been destroyed while the client was running,
+    // Shutdown() waits on m_plugin_lock for this call to finish
+    g_mutex_lock(&m_plugin_lock);
+    if (m_plugin != NULL)
+        m_plugin->OnSpiceClientExit(status);
+    g_mutex_unlock(&m_plugin_lock);
+
+    // drop the reference StartClient() took for the client
+    Unref();
+}
+
+// an abnormal end which a new client may not run into again
+bool SpiceController::ClientCrashed(int status)
+{
+    return false;
+}
+
+// m_state_lock must be held. Only a configured client that was not asked
+// to stop is restarted; one crashing more than RESTART_MAX_CRASHES times
+// within RESTART_CRASH_WINDOW seconds is given up on.
+bool SpiceController::ShouldRestart(int status, guint *delay, guint *attempt)
+{
+    if (!m_auto_restart || m_config_batch.empty() || !ClientCrashed(status))
+        return false;
+    if (m_state != STATE_CONNECTED && !(m_restarting && m_state == STATE_SPAWNING))
+        return false;
+
+    gint64 now = g_get_monotonic_time();
+    if (m_crash_count == 0 || now - m_crash_window_start > RESTART_CRASH_WINDOW * G_USEC_PER_SEC) {
+        m_crash_window_start = now;
+        m_crash_count = 0;
+    }
+    if (++m_crash_count > RESTART_MAX_CRASHES) {
+        g_warning("client crashed %d times in %d seconds, not restarting it",
+                  RESTART_MAX_CRASHES + 1, RESTART_CRASH_WINDOW);
+        m_crash_count = 0;
+        return false;
+    }
+
+    *attempt = m_crash_count;
+    *delay = RESTART_DELAY_MIN << (m_crash_count - 1);
+    m_restart_status = status;
+    m_restarting = true;
+
+    return true;
+}
+
+// m_state_lock must be held
+void SpiceController::ArmRestartTimer(guint delay)
+{
+    if (m_restart_source != NULL) {
+        g_source_destroy(m_restart_source);
+        g_source_unref(m_restart_source);
+    }
+
+    m_restart_source = g_timeout_source_new(delay);
+    g_source_set_callback(m_restart_source, RestartClient, this, NULL);
+    g_source_attach(m_restart_source, ReaperContext());
+}
+
+// m_state_lock must be held
+void SpiceController::DisarmReplay()
+{
+    if (m_replay_source == NULL)
+        return;
+
+    g_source_destroy(m_replay_source);
+    g_source_unref(m_replay_source);
+    m_replay_source = NULL;
+}
+
+void SpiceController::ReleaseReference(gpointer data)
+{
+    static_cast<SpiceController *>(data)->Unref();
+}
+
+// runs on the reaper thread
+gboolean SpiceController::RestartClient(gpointer data)
+{
+    SpiceController *fake_this = (SpiceController *)data;
+    bool stopped;
+
+    g_mutex_lock(&fake_this->m_state_lock);
+    g_source_unref(fake_this->m_restart_source);
+    fake_this->m_restart_source = NULL;
+    stopped = (fake_this->m_state == STATE_STOPPING);
+    if (!stopped)
+        fake_this->m_state = STATE_SPAWNING;
+    g_mutex_unlock(&fake_this->m_state_lock);
+
+    // disconnect() came in while waiting, the page learns about the crash
+    if (stopped) {
+        fake_this->ClientFinished(fake_this->m_restart_status);
+        return FALSE;
+    }
+
+    // the new client listens on a new socket
+    fake_this->Disconnect();
+
+    fake_this->ResetClientCaps();
+    if (!fake_this->LaunchClient()) {
+        fake_this->ClientFinished(fake_this->m_restart_status);
+        return FALSE;
+    }
+
+    g_mutex_lock(&fake_this->m_state_lock);
+    if (fake_this->m_state == STATE_STOPPING) {
+        fake_this->StopClient();
+    } else {
+        // the trust store file of the crashed client is still in place
+        fake_this->Ref();
+        fake_this->m_replay_tries = 0;
+        fake_this->m_replay_source = g_timeout_source_new(RESTART_CONNECT_INTERVAL);
+        g_source_set_callback(fake_this->m_replay_source, ReplayConfig, fake_this,
+                              ReleaseReference);
+        g_source_attach(fake_this->m_replay_source, ReaperContext());
+    }
+    g_mutex_unlock(&fake_this->m_state_lock);
+
+    return FALSE;
 }
 
-gpointer SpiceController::ClientThread(gpointer data)
+// Connects to the restarted client and sends it what the page sent the
+// crashed one, byte for byte. Runs on the reaper thread; the connection
+// is attempted every RESTART_CONNECT_INTERVAL ms, as the client needs
+// some time to create its socket.
+gboolean SpiceController::ReplayConfig(gpointer data)
 {
     SpiceController *fake_this = (SpiceController *)data;
+    std::string batch;
+    bool connected;
+    bool spawning;
+
+    g_mutex_lock(&fake_this->m_write_lock);
+    connected = (fake_this->Connect() == 0 && fake_this->CheckPipe());
+    g_mutex_unlock(&fake_this->m_write_lock);
+
+    g_mutex_lock(&fake_this->m_state_lock);
+    spawning = (fake_this->m_state == STATE_SPAWNING);
+    if (spawning && !connected && ++fake_this->m_replay_tries < RESTART_CONNECT_TRIES) {
+        g_mutex_unlock(&fake_this->m_state_lock);
+        return TRUE;
+    }
+    g_source_unref(fake_this->m_replay_source);
+    fake_this->m_replay_source = NULL;
+    if (spawning && connected)
+        batch = fake_this->m_config_batch;
+    g_mutex_unlock(&fake_this->m_state_lock);
+
+    if (!spawning)
+        return FALSE;
+    if (!connected) {
+        g_warning("could not connect to the restarted client");
+        fake_this->RequestStop();
+        return FALSE;
+    }
+
+    g_mutex_lock(&fake_this->m_write_lock);
+    if (fake_this->m_capture_fd != -1)
+        fake_this->CaptureFrame(batch.data(), batch.size());
+    fake_this->WritePipe(batch.data(), batch.size());
+    g_mutex_unlock(&fake_this->m_write_lock);
+
+    g_mutex_lock(&fake_this->m_state_lock);
+    spawning = (fake_this->m_state == STATE_SPAWNING);
+    if (spawning) {
+        fake_this->m_state = STATE_CONNECTED;
+        fake_this->m_restarting = false;
+        fake_this->ArmHeartbeat();
+    }
+    g_mutex_unlock(&fake_this->m_state_lock);
+
+    if (spawning) {
+        g_mutex_lock(&fake_this->m_plugin_lock);
+        if (fake_this->m_plugin != NULL)
+            fake_this->m_plugin->OnSpiceClientRestarted();
+        g_mutex_unlock(&fake_this->m_plugin_lock);
+    }
+
+    return FALSE;
+}
+
+// runs on the reaper thread
+gboolean SpiceController::SpawnClient(gpointer data)
+{
+    SpiceController *fake_this = (SpiceController *)data;
+
+    fake_this->ResetClientCaps();
+    if (!fake_this->LaunchClient()) {
+        g_mutex_lock(&fake_this->m_state_lock);
+        fake_this->m_state = STATE_IDLE;
+        fake_this->DisarmKillTimer();
+        g_mutex_unlock(&fake_this->m_state_lock);
+        fake_this->Unref();
+        return FALSE;
+    }
+
+    g_mutex_lock(&fake_this->m_state_lock);
+    // disconnect() came in while we were spawning
+    if (fake_this->m_state == STATE_STOPPING)
+        fake_this->StopClient();
+    g_mutex_unlock(&fake_this->m_state_lock);
+
+    return FALSE;
+}
+
+// Starts a client process watched by the reaper, ChildExited() reports
+// its end. Runs on the reaper thread.
+bool SpiceController::LaunchClient()
+{
     gchar **env = g_get_environ();
     GPid pid;
     gboolean spawned = FALSE;
     GError *error = NULL;
     GStrv client_argv;
+    GSpawnChildSetupFunc child_setup = NULL;
+    gpointer child_data = NULL;
+    gint out_fd = -1;
+    gint err_fd = -1;
 
     // Setup client environment
-    fake_this->SetupControllerPipe(env);
-    if (!fake_this->m_proxy.empty())
-        env = g_environ_setenv(env, "SPICE_PROXY", fake_this->m_proxy.c_str(), TRUE);
+    if (!SetupControllerPipe(env)) {
+        g_strfreev(env);
+        return false;
+    }
+    if (!m_proxy.empty())
+        env = g_environ_setenv(env, "SPICE_PROXY", m_proxy.c_str(), TRUE);
 
     // Work around bug in firefox gtk3 builds, see
     // https://bugzilla.redhat.com/show_bug.cgi?id=1217076
@@ -177,17 +1253,19 @@ gpointer SpiceController::ClientThread(gpointer data)
     env = g_environ_unsetenv(env, "LD_PRELOAD");
 
     // Try to spawn main client
-    client_argv = fake_this->GetClientPath();
+    client_argv = GetClientPath();
     if (client_argv != NULL) {
+        ApplyClientLimits(client_argv, &child_setup, &child_data);
         char *argv_str = g_strjoinv(" ", client_argv);
         g_warning("main client cmdline: %s", argv_str);
         g_free(argv_str);
 
-        spawned = g_spawn_async(NULL,
-                                client_argv, env,
-                                G_SPAWN_DO_NOT_REAP_CHILD,
-                                NULL, NULL, /* child_func, child_arg */
-                                &pid, &error);
+        spawned = g_spawn_async_with_pipes(NULL,
+                                           client_argv, env,
+                                           G_SPAWN_DO_NOT_REAP_CHILD,
+                                           child_setup, child_data,
+                                           &pid, NULL, &out_fd, &err_fd,
+                                           &error);
         if (error != NULL) {
             g_warning("failed to start %s: %s", client_argv[0], error->message);
             g_warn_if_fail(spawned == FALSE);
@@ -200,20 +1278,22 @@ gpointer SpiceController::ClientThread(gpointer data)
         // Fallback client for backward compatibility
         GStrv fallback_argv;
         char *argv_str;
-        fallback_argv = fake_this->GetFallbackClientPath();
+        fallback_argv = GetFallbackClientPath();
         if (fallback_argv == NULL) {
             goto out;
         }
+        ApplyClientLimits(fallback_argv, &child_setup, &child_data);
 
         argv_str = g_strjoinv(" ", fallback_argv);
         g_warning("fallback client cmdline: %s", argv_str);
         g_free(argv_str);
 
         g_message("failed to run preferred client, running fallback client instead");
-        spawned = g_spawn_async(NULL, fallback_argv, env,
-                                G_SPAWN_DO_NOT_REAP_CHILD,
-                                NULL, NULL, /* child_func, child_arg */
-                                &pid, &error);
+        spawned = g_spawn_async_with_pipes(NULL, fallback_argv, env,
+                                           G_SPAWN_DO_NOT_REAP_CHILD,
+                                           child_setup, child_data,
+                                           &pid, NULL, &out_fd, &err_fd,
+                                           &error);
         if (error != NULL) {
             g_warning("failed to start %s: %s", fallback_argv[0], error->message);
             g_warn_if_fail(spawned == FALSE);
@@ -226,24 +1306,57 @@ gpointer SpiceController::ClientThread(gpointer data)
 
     if (!spawned) {
         g_critical("ERROR failed to run spicec fallback");
-        return NULL;
+        return false;
     }
 
+    CaptureClientOutput(out_fd);
+    CaptureClientOutput(err_fd);
+
+    GSource *source = g_child_watch_source_new(pid);
+    g_source_set_callback(source, (GSourceFunc)ChildExited, this, NULL);
+    g_source_attach(source, ReaperContext());
+    g_source_unref(source);
+
 #ifdef XP_UNIX
-    fake_this->m_pid_controller = pid;
+    g_mutex_lock(&m_state_lock);
+    m_pid_controller = pid;
+    g_mutex_unlock(&m_state_lock);
 #endif
-    fake_this->WaitForPid(pid);
 
-    return NULL;
+    return true;
 }
 
 bool SpiceController::StartClient()
 {
-    GThread *thread;
+    GSource *source;
+
+    // the spawn itself happens on the reaper thread, what can fail
+    // beforehand is reported here
+    if (!PrepareControllerPipe())
+        return false;
+
+    if (!SetState(STATE_IDLE, STATE_SPAWNING)) {
+        g_warning("client already running (%s)", StateToString(GetState()));
+        return false;
+    }
+
+    // connecting again is a fresh start for the crash loop detection,
+    // the log covers the restarted clients of a session
+    g_mutex_lock(&m_state_lock);
+    m_crash_count = 0;
+    m_client_log.clear();
+    m_client_log_size = 0;
+    m_client_log_dropped = 0;
+    g_mutex_unlock(&m_state_lock);
 
-    thread = g_thread_new("spice-xpi client thread", ClientThread, this);
+    // the reference keeps us alive until the child has been reaped
+    Ref();
+    source = g_idle_source_new();
+    g_source_set_callback(source, SpawnClient, this, NULL);
+    g_source_attach(source, ReaperContext());
+    g_source_unref(source);
 
-    return (thread != NULL);
+    return true;
 }
 
 int SpiceController::TranslateRC(int nRC)
@@ -61,6 +61,9 @@
 #include <glib-object.h> /* for GStrv */
 #include <gio/gio.h>
 #include <string>
+#include <deque>
+#include <vector>
+#include <cstdio>
 extern "C" {
 #  include <stdint.h>
 #  include <limits.h>
@@ -73,38 +76,169 @@ class nsPluginInstance;
 class SpiceController
 {
 public:
+    // lifecycle of the client process, see StartClient() and RequestStop()
+    enum State {
+        STATE_IDLE,
+        STATE_SPAWNING,
+        STATE_CONFIGURING,
+        STATE_CONNECTED,
+        STATE_STOPPING,
+        // the client crashed, a new one is started after a delay
+        STATE_RESTARTING
+    };
+
     SpiceController(nsPluginInstance *aPlugin);
-    virtual ~SpiceController();
+
+    void Ref();
+    void Unref();
+    void Shutdown();
+    // lets the client outlive the instance for grace ms, for another one
+    // to adopt it; see HandoffRegistry
+    void Orphan(guint grace);
+    bool Adopt(nsPluginInstance *aPlugin);
 
     bool StartClient();
+    void RequestStop();
+    State GetState();
+    bool SetState(State from, State to);
+    static const char *StateToString(State state);
     virtual void StopClient() = 0;
+    virtual void KillClient();
     void SetFilename(const std::string &name);
     void SetProxy(const std::string &proxy);
+    void SetTrustStoreFile(const std::string &path);
+    void SetAutoRestart(bool enable);
+    // intervals in ms, 0 disables the heartbeat; see controller-heartbeat.h
+    void SetHeartbeat(guint interval, guint timeout, bool restart);
+    // of the last ping in ms, -1 if not known
+    double GetHeartbeatRtt();
+    bool IsDegraded();
+    // of the running client: CPU time in seconds, resident memory in bytes
+    bool GetClientUsage(double *cpu_time, double *rss);
+    // the last lines the clients of this session wrote to stdout and stderr
+    std::string GetClientLog();
+    // where sessions the client sends back are cached, empty to drop them
+    void SetTlsSessionKey(const std::string &key);
+    // the CONTROLLER_CAP_* flags of the running client, waits up to
+    // timeout ms for it to announce them; 0 for a stock client
+    uint32_t WaitForClientCaps(guint timeout);
     int Connect(int nRetries);
-    virtual void Disconnect();
-    virtual uint32_t Write(const void *lpBuffer, uint32_t nBytesToWrite) = 0;
+    // closes the connection to the client, from any thread
+    void Disconnect();
+    uint32_t Write(const void *lpBuffer, uint32_t nBytesToWrite);
+    bool WriteWithFd(const void *lpBuffer, uint32_t nBytesToWrite, int fd);
 
     static int TranslateRC(int nRC);
+    static void StopReaper();
 
 protected:
+    // instances are refcounted, release them with Shutdown() or Unref()
+    virtual ~SpiceController();
+
+    void ClientGone(int status);
+    // a message from the client, runs on the reaper thread
+    void ClientMessage(uint32_t id, const void *data, uint32_t size);
+    static GMainContext *ReaperContext();
+
     std::string m_name;
     std::string m_proxy;
     GPid m_pid_controller;
     GOutputStream *m_pipe;
 
 private:
+    struct ClientOutput;
+
     virtual int Connect() = 0;
-    void WaitForPid(GPid pid);
-    virtual void SetupControllerPipe(GStrv &env) = 0;
+    // m_write_lock is held for these
+    virtual void DisconnectPipe();
+    virtual uint32_t WritePipe(const void *lpBuffer, uint32_t nBytesToWrite) = 0;
+    virtual bool WritePipeFd(const void *lpBuffer, uint32_t nBytesToWrite, int fd);
+    void CaptureFrame(const void *lpBuffer, uint32_t nBytesToWrite);
+    void ArmKillTimer();
+    void DisarmKillTimer();
+    void ClientFinished(int status);
+    virtual bool ClientCrashed(int status);
+    bool ShouldRestart(int status, guint *delay, guint *attempt);
+    void ArmRestartTimer(guint delay);
+    void DisarmReplay();
+    void ResetClientCaps();
+    void ArmHeartbeat();
+    void DisarmHeartbeat();
+    void Pong(uint32_t seq);
+    static gboolean HeartbeatTick(gpointer data);
+    static gboolean RestartClient(gpointer data);
+    static gboolean ReplayConfig(gpointer data);
+    static void ReleaseReference(gpointer data);
+    void RemoveTrustStoreFile();
+    static gboolean KillTimeout(gpointer user_data);
+    static gboolean OrphanTimeout(gpointer data);
+    // what the client needs to reach us, on the main thread before the
+    // spawn and in its environment
+    virtual bool PrepareControllerPipe();
+    virtual bool SetupControllerPipe(GStrv &env) = 0;
     virtual bool CheckPipe() = 0;
     virtual GStrv GetClientPath(void) = 0;
     virtual GStrv GetFallbackClientPath(void) = 0;
+    virtual bool LaunchClient();
+    // resource policy for the client about to be spawned
+    virtual void ApplyClientLimits(GStrv &argv, GSpawnChildSetupFunc *setup, gpointer *setup_data);
+    virtual bool ReadClientUsage(GPid pid, double *cpu_time, double *rss);
     static void ChildExited(GPid pid, gint status, gpointer user_data);
-    static gpointer ClientThread(gpointer data);
+    static gboolean SpawnClient(gpointer data);
+    void CaptureClientOutput(int fd);
+    GIOStatus ReadClientOutput(ClientOutput *output);
+    void AppendClientLog(const std::string &line);
+    static gboolean OnClientOutput(GIOChannel *source, GIOCondition condition, gpointer data);
+    static void ClientOutputDone(gpointer data);
+
+    volatile gint m_refcount;
 
+    GMutex m_plugin_lock;
     nsPluginInstance *m_plugin;
 
-    GMainLoop *m_child_watch_mainloop;
+    GMutex m_state_lock;
+    State m_state;
+    GSource *m_kill_source;
+    GSource *m_orphan_source;
+    std::string m_trust_store_file;
+    std::string m_tls_session_key;
+    // what the running client announced, see controller-caps.h
+    uint32_t m_client_caps;
+    bool m_client_caps_known;
+    GCond m_client_caps_cond;
+
+    // the rest of the restart state is guarded by m_state_lock
+    GMutex m_write_lock;
+    bool m_auto_restart;
+    // everything written while configuring the client, replayed as is
+    std::string m_config_batch;
+    bool m_restarting;
+    int m_restart_status;
+    GSource *m_restart_source;
+    GSource *m_replay_source;
+    guint m_replay_tries;
+    guint m_crash_count;
+    gint64 m_crash_window_start;
+
+    // guarded by m_state_lock
+    guint m_heartbeat_interval;
+    guint m_heartbeat_timeout;
+    bool m_heartbeat_restart;
+    GSource *m_heartbeat_source;
+    uint32_t m_ping_seq;
+    gint64 m_ping_sent;
+    gint64 m_heartbeat_rtt;
+    bool m_degraded;
+
+    int m_capture_fd;
+    uint32_t m_capture_session;
+
+    // ring of complete lines, guarded by m_state_lock
+    std::deque<std::string> m_client_log;
+    size_t m_client_log_size;
+    guint m_client_log_dropped;
+    // pipes being read, only touched on the reaper thread
+    std::vector<ClientOutput *> m_client_outputs;
 };
 
 #endif // SPICE_CONTROLLER_H
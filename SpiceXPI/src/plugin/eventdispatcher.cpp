@@ -0,0 +1,265 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ *   Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ *   The contents of this file are subject to the Mozilla Public License Version
+ *   1.1 (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.mozilla.org/MPL/
+ *
+ *   Software distributed under the License is distributed on an "AS IS" basis,
+ *   WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ *   for the specific language governing rights and limitations under the
+ *   License.
+ *
+ *   Copyright 2013, Red Hat Inc.
+ *
+ *   Alternatively, the contents of this file may be used under the terms of
+ *   either the GNU General Public License Version 2 or later (the "GPL"), or
+ *   the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ *   in which case the provisions of the GPL or the LGPL are applicable instead
+ *   of those above. If you wish to allow use of your version of this file only
+ *   under the terms of either the GPL or the LGPL, and not to allow others to
+ *   use your version of this file under the terms of the MPL, indicate your
+ *   decision by deleting the provisions above and replace them with the notice
+ *   and other provisions required by the GPL or the LGPL. If you do not delete
+ *   the provisions above, a recipient may use your version of this file under
+ *   the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include "config.h"
+
+#include <algorithm>
+#include <glib.h>
+
+#include "eventdispatcher.h"
+
+namespace {
+    const char *event_names[EventDispatcher::EVENT_LAST] = {
+        "connected",
+        "disconnected",
+        "status",
+        "timings",
+        "reconnecting",
+    };
+}
+
+NPIdentifier EventDispatcher::m_id_on_disconnected = NULL;
+
+EventDispatcher::EventDispatcher(NPP aInstance):
+    m_instance(aInstance),
+    m_window(NULL),
+    m_flush_pending(false),
+    m_async(aInstance)
+{
+    g_mutex_init(&m_lock);
+}
+
+EventDispatcher::~EventDispatcher()
+{
+    for (int type = 0; type < EVENT_LAST; ++type)
+    {
+        for (size_t i = 0; i < m_listeners[type].size(); ++i)
+            NPN_ReleaseObject(m_listeners[type][i]);
+    }
+
+    if (m_window)
+        NPN_ReleaseObject(m_window);
+
+    g_mutex_clear(&m_lock);
+}
+
+int EventDispatcher::TypeFromName(const char *name)
+{
+    for (int type = 0; type < EVENT_LAST; ++type)
+    {
+        if (g_ascii_strcasecmp(name, event_names[type]) == 0)
+            return type;
+    }
+
+    return -1;
+}
+
+bool EventDispatcher::AddListener(const char *aType, NPObject *aListener)
+{
+    int type = TypeFromName(aType);
+    if (type < 0 || aListener == NULL)
+        return false;
+
+    std::vector<NPObject *> &listeners = m_listeners[type];
+    if (std::find(listeners.begin(), listeners.end(), aListener) != listeners.end())
+        return true;
+
+    listeners.push_back(NPN_RetainObject(aListener));
+    return true;
+}
+
+bool EventDispatcher::RemoveListener(const char *aType, NPObject *aListener)
+{
+    int type = TypeFromName(aType);
+    if (type < 0)
+        return false;
+
+    std::vector<NPObject *> &listeners = m_listeners[type];
+    std::vector<NPObject *>::iterator it =
+        std::find(listeners.begin(), listeners.end(), aListener);
+    if (it == listeners.end())
+        return false;
+
+    listeners.erase(it);
+    NPN_ReleaseObject(aListener);
+    return true;
+}
+
+void EventDispatcher::PostConnected()
+{
+    Event event = { EVENT_CONNECTED, 0, 0.0, std::string() };
+    Post(event);
+}
+
+void EventDispatcher::PostDisconnected(int32_t code, const std::string &log)
+{
+    Event event = { EVENT_DISCONNECTED, code, 0.0, log };
+    Post(event);
+}
+
+void EventDispatcher::PostStatus(const std::string &status)
+{
+    Event event = { EVENT_STATUS, 0, 0.0, status };
+    Post(event);
+}
+
+void EventDispatcher::PostTiming(const std::string &name, double msec)
+{
+    Event event = { EVENT_TIMINGS, 0, msec, name };
+    Post(event);
+}
+
+void EventDispatcher::PostReconnecting(int32_t attempt, double delay)
+{
+    Event event = { EVENT_RECONNECTING, attempt, delay, std::string() };
+    Post(event);
+}
+
+void EventDispatcher::Post(const Event &event)
+{
+    bool schedule;
+
+    g_mutex_lock(&m_lock);
+    m_queue.push_back(event);
+    schedule = !m_flush_pending;
+    m_flush_pending = true;
+    g_mutex_unlock(&m_lock);
+
+    // one main thread pass per batch, however many events were queued
+    if (schedule)
+        m_async.Call(Flush, this);
+}
+
+void EventDispatcher::Flush(void *data)
+{
+    EventDispatcher *fake_this = static_cast<EventDispatcher *>(data);
+    std::vector<Event> queue;
+
+    g_mutex_lock(&fake_this->m_lock);
+    queue.swap(fake_this->m_queue);
+    fake_this->m_flush_pending = false;
+    g_mutex_unlock(&fake_this->m_lock);
+
+    for (size_t i = 0; i < queue.size(); ++i)
+        fake_this->Dispatch(queue[i]);
+}
+
+void EventDispatcher::Dispatch(const Event &event)
+{
+    NPVariant args[2];
+    uint32_t argc = 0;
+
+    switch (event.type)
+    {
+    case EVENT_CONNECTED:
+        break;
+    case EVENT_DISCONNECTED:
+        INT32_TO_NPVARIANT(event.code, args[0]);
+        STRINGN_TO_NPVARIANT(event.detail.c_str(), event.detail.length(), args[1]);
+        argc = 2;
+        CallLegacyOnDisconnected(event.code);
+        break;
+    case EVENT_STATUS:
+        STRINGN_TO_NPVARIANT(event.detail.c_str(), event.detail.length(), args[0]);
+        argc = 1;
+        break;
+    case EVENT_TIMINGS:
+        STRINGN_TO_NPVARIANT(event.detail.c_str(), event.detail.length(), args[0]);
+        DOUBLE_TO_NPVARIANT(event.value, args[1]);
+        argc = 2;
+        break;
+    case EVENT_RECONNECTING:
+        INT32_TO_NPVARIANT(event.code, args[0]);
+        DOUBLE_TO_NPVARIANT(event.value, args[1]);
+        argc = 2;
+        break;
+    default:
+        return;
+    }
+
+    // a listener may remove itself (or others) while being called
+    std::vector<NPObject *> listeners(m_listeners[event.type]);
+    for (size_t i = 0; i < listeners.size(); ++i)
+        NPN_RetainObject(listeners[i]);
+
+    for (size_t i = 0; i < listeners.size(); ++i)
+    {
+        NPVariant result;
+        VOID_TO_NPVARIANT(result);
+        if (NPN_InvokeDefault(m_instance, listeners[i], args, argc, &result))
+            NPN_ReleaseVariantValue(&result);
+        else
+            g_warning("could not call %s listener", event_names[event.type]);
+        NPN_ReleaseObject(listeners[i]);
+    }
+}
+
+void EventDispatcher::CallLegacyOnDisconnected(int32_t code)
+{
+    if (m_window == NULL &&
+        NPN_GetValue(m_instance, NPNVWindowNPObject, &m_window) != NPERR_NO_ERROR)
+    {
+        g_critical("could not get browser window, when trying to call OnDisconnected");
+        m_window = NULL;
+        return;
+    }
+
+    if (m_id_on_disconnected == NULL)
+        m_id_on_disconnected = NPN_GetStringIdentifier("OnDisconnected");
+
+    NPVariant var_on_disconnected;
+    if (!NPN_GetProperty(m_instance, m_window, m_id_on_disconnected, &var_on_disconnected))
+    {
+        g_critical("could not get OnDisconnected function");
+        return;
+    }
+
+    // pages using addEventListener() need not define the global callback
+    if (!NPVARIANT_IS_OBJECT(var_on_disconnected))
+    {
+        g_debug("OnDisconnected is not defined");
+        NPN_ReleaseVariantValue(&var_on_disconnected);
+        return;
+    }
+
+    NPVariant arg;
+    NPVariant void_result;
+    INT32_TO_NPVARIANT(code, arg);
+
+    if (NPN_InvokeDefault(m_instance, NPVARIANT_TO_OBJECT(var_on_disconnected),
+                          &arg, 1, &void_result))
+    {
+        g_debug("OnDisconnected successfuly called");
+        NPN_ReleaseVariantValue(&void_result);
+    }
+    else
+        g_critical("could not call OnDisconnected");
+
+    NPN_ReleaseVariantValue(&var_on_disconnected);
+}
@@ -0,0 +1,105 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ *   Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ *   The contents of this file are subject to the Mozilla Public License Version
+ *   1.1 (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.mozilla.org/MPL/
+ *
+ *   Software distributed under the License is distributed on an "AS IS" basis,
+ *   WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ *   for the specific language governing rights and limitations under the
+ *   License.
+ *
+ *   Copyright 2013, Red Hat Inc.
+ *
+ *   Alternatively, the contents of this file may be used under the terms of
+ *   either the GNU General Public License Version 2 or later (the "GPL"), or
+ *   the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ *   in which case the provisions of the GPL or the LGPL are applicable instead
+ *   of those above. If you wish to allow use of your version of this file only
+ *   under the terms of either the GPL or the LGPL, and not to allow others to
+ *   use your version of this file under the terms of the MPL, indicate your
+ *   decision by deleting the provisions above and replace them with the notice
+ *   and other provisions required by the GPL or the LGPL. If you do not delete
+ *   the provisions above, a recipient may use your version of this file under
+ *   the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef EVENT_DISPATCHER_H
+#define EVENT_DISPATCHER_H
+
+/*
+    Delivery of plugin events to JavaScript
+    ---------------------------------------
+    Scripts register listeners with addEventListener(type, fn). Events may
+    be posted from any thread; they are queued and the whole queue is
+    delivered in one pass on the browser main thread, scheduled through
+    an AsyncCaller, so a dispatcher destroyed first is never flushed. The legacy global OnDisconnected() callback
+    is still invoked for "disconnected" events; listeners get the exit
+    code and the last output of the client.
+*/
+
+#include <string>
+#include <vector>
+#include <glib.h>
+
+#include <npapi.h>
+#include <npruntime.h>
+
+#include "asynccaller.h"
+
+class EventDispatcher
+{
+public:
+    enum EventType {
+        EVENT_CONNECTED,
+        EVENT_DISCONNECTED,
+        EVENT_STATUS,
+        EVENT_TIMINGS,
+        EVENT_RECONNECTING,
+        EVENT_LAST
+    };
+
+    EventDispatcher(NPP aInstance);
+    ~EventDispatcher();
+
+    bool AddListener(const char *aType, NPObject *aListener);
+    bool RemoveListener(const char *aType, NPObject *aListener);
+
+    // may be called from any thread
+    void PostConnected();
+    // log is what the client wrote to stdout and stderr last
+    void PostDisconnected(int32_t code, const std::string &log);
+    void PostStatus(const std::string &status);
+    void PostTiming(const std::string &name, double msec);
+    void PostReconnecting(int32_t attempt, double delay);
+
+private:
+    struct Event {
+        EventType type;
+        int32_t code;
+        double value;
+        std::string detail;
+    };
+
+    void Post(const Event &event);
+    void Dispatch(const Event &event);
+    void CallLegacyOnDisconnected(int32_t code);
+    static void Flush(void *data);
+    static int TypeFromName(const char *name);
+
+    NPP m_instance;
+    NPObject *m_window;
+    std::vector<NPObject *> m_listeners[EVENT_LAST];
+
+    GMutex m_lock;
+    std::vector<Event> m_queue;
+    bool m_flush_pending;
+    AsyncCaller m_async;
+
+    static NPIdentifier m_id_on_disconnected;
+};
+
+#endif // EVENT_DISPATCHER_H
@@ -0,0 +1,131 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ *   Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ *   The contents of this file are subject to the Mozilla Public License Version
+ *   1.1 (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.mozilla.org/MPL/
+ *
+ *   Software distributed under the License is distributed on an "AS IS" basis,
+ *   WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ *   for the specific language governing rights and limitations under the
+ *   License.
+ *
+ *   Copyright 2013, Red Hat Inc.
+ *
+ *   Alternatively, the contents of this file may be used under the terms of
+ *   either the GNU General Public License Version 2 or later (the "GPL"), or
+ *   the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ *   in which case the provisions of the GPL or the LGPL are applicable instead
+ *   of those above. If you wish to allow use of your version of this file only
+ *   under the terms of either the GPL or the LGPL, and not to allow others to
+ *   use your version of this file under the terms of the MPL, indicate your
+ *   decision by deleting the provisions above and replace them with the notice
+ *   and other provisions required by the GPL or the LGPL. If you do not delete
+ *   the provisions above, a recipient may use your version of this file under
+ *   the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+#include "config.h"
+
+#include <map>
+#include <glib.h>
+
+#include "controller.h"
+#include "handoffregistry.h"
+#include "sessionregistry.h"
+
+namespace {
+    struct Handoff {
+        SpiceController *controller;
+        std::string key;
+    };
+    typedef std::map<std::string, Handoff> HandoffMap;
+
+    GMutex registry_lock;
+    // allocated on first use, the library does no static construction
+    HandoffMap *handoffs = NULL;
+
+    HandoffMap &getHandoffs()
+    {
+        if (handoffs == NULL)
+            handoffs = new HandoffMap();
+        return *handoffs;
+    }
+}
+
+std::string HandoffRegistry::Put(SpiceController *controller, const std::string &key)
+{
+    // the saved data could outlive a library reload, tokens must not repeat
+    gchar *token = g_strdup_printf("%08x%08x%08x%08x", g_random_int(), g_random_int(),
+                                   g_random_int(), g_random_int());
+    std::string result(token);
+    g_free(token);
+
+    g_mutex_lock(&registry_lock);
+    Handoff &handoff = getHandoffs()[result];
+    handoff.controller = controller;
+    handoff.key = key;
+    g_mutex_unlock(&registry_lock);
+
+    return result;
+}
+
+SpiceController *HandoffRegistry::Take(const std::string &token, std::string &key)
+{
+    SpiceController *controller = NULL;
+
+    g_mutex_lock(&registry_lock);
+    HandoffMap &map = getHandoffs();
+    HandoffMap::iterator it = map.find(token);
+    if (it != map.end()) {
+        controller = it->second.controller;
+        key = it->second.key;
+        map.erase(it);
+    }
+    g_mutex_unlock(&registry_lock);
+
+    return controller;
+}
+
+bool HandoffRegistry::Remove(SpiceController *controller)
+{
+    bool removed = false;
+    std::string key;
+
+    g_mutex_lock(&registry_lock);
+    HandoffMap &map = getHandoffs();
+    for (HandoffMap::iterator it = map.begin(); !removed && it != map.end(); ++it) {
+        if (it->second.controller == controller) {
+            key = it->second.key;
+            map.erase(it);
+            removed = true;
+        }
+    }
+    g_mutex_unlock(&registry_lock);
+
+    // embeds attached to the client lose it only now
+    if (removed)
+        SessionRegistry::RemoveOrphan(key, -1);
+
+    return removed;
+}
+
+void HandoffRegistry::Shutdown()
+{
+    HandoffMap *old_handoffs;
+
+    g_mutex_lock(&registry_lock);
+    old_handoffs = handoffs;
+    handoffs = NULL;
+    g_mutex_unlock(&registry_lock);
+
+    if (old_handoffs == NULL)
+        return;
+
+    for (HandoffMap::iterator it = old_handoffs->begin(); it != old_handoffs->end(); ++it) {
+        SessionRegistry::RemoveOrphan(it->second.key, -1);
+        it->second.controller->Shutdown();
+    }
+    delete old_handoffs;
+}
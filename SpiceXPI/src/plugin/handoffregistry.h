@@ -0,0 +1,61 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ *   Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ *   The contents of this file are subject to the Mozilla Public License Version
+ *   1.1 (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.mozilla.org/MPL/
+ *
+ *   Software distributed under the License is distributed on an "AS IS" basis,
+ *   WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ *   for the specific language governing rights and limitations under the
+ *   License.
+ *
+ *   Copyright 2013, Red Hat Inc.
+ *
+ *   Alternatively, the contents of this file may be used under the terms of
+ *   either the GNU General Public License Version 2 or later (the "GPL"), or
+ *   the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ *   in which case the provisions of the GPL or the LGPL are applicable instead
+ *   of those above. If you wish to allow use of your version of this file only
+ *   under the terms of either the GPL or the LGPL, and not to allow others to
+ *   use your version of this file under the terms of the MPL, indicate your
+ *   decision by deleting the provisions above and replace them with the notice
+ *   and other provisions required by the GPL or the LGPL. If you do not delete
+ *   the provisions above, a recipient may use your version of this file under
+ *   the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef HANDOFF_REGISTRY_H
+#define HANDOFF_REGISTRY_H
+
+/*
+    Process-wide registry of clients whose instance went away while they
+    were connected, typically because the page got reloaded. The token of
+    an entry travels in the NPSavedData of NPP_Destroy(), and the instance
+    the browser creates for the reloaded page takes the controller back
+    from NPP_New() on, with the client still connected. Entries not taken
+    within the grace period of SpiceController::Orphan() are stopped.
+*/
+
+#include <string>
+
+class SpiceController;
+
+class HandoffRegistry
+{
+public:
+    // takes over the reference of the instance, returns the token
+    static std::string Put(SpiceController *controller, const std::string &key);
+    // the controller and the session key it was put with, or NULL; the
+    // caller gets the reference
+    static SpiceController *Take(const std::string &token, std::string &key);
+    // false if the controller was taken already; ends the session of
+    // the embeds attached to the client otherwise, see SessionRegistry
+    static bool Remove(SpiceController *controller);
+    // stops the clients nobody adopted
+    static void Shutdown();
+};
+
+#endif // HANDOFF_REGISTRY_H
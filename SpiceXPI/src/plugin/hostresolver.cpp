@@ -0,0 +1,179 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ *   Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ *   The contents of this file are subject to the Mozilla Public License Version
+ *   1.1 (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.mozilla.org/MPL/
+ *
+ *   Software distributed under the License is distributed on an "AS IS" basis,
+ *   WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ *   for the specific language governing rights and limitations under the
+ *   License.
+ *
+ *   Copyright 2013, Red Hat Inc.
+ *
+ *   Alternatively, the contents of this file may be used under the terms of
+ *   either the GNU General Public License Version 2 or later (the "GPL"), or
+ *   the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ *   in which case the provisions of the GPL or the LGPL are applicable instead
+ *   of those above. If you wish to allow use of your version of this file only
+ *   under the terms of either the GPL or the LGPL, and not to allow others to
+ *   use your version of this file under the terms of the MPL, indicate your
+ *   decision by deleting the provisions above and replace them with the notice
+ *   and other provisions required by the GPL or the LGPL. If you do not delete
+ *   the provisions above, a recipient may use your version of this file under
+ *   the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+#include "config.h"
+
+#include <list>
+#include <map>
+#include <vector>
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "hostresolver.h"
+
+#define RESOLVER_THREADS      2
+
+namespace {
+    struct CacheEntry {
+        std::vector<std::string> addresses;
+        gint64 expires;
+        bool pending;
+        std::list<std::string>::iterator lru;
+    };
+
+    struct Cache {
+        std::map<std::string, CacheEntry> entries;
+        // most recently used first
+        std::list<std::string> lru;
+    };
+
+    GMutex resolver_lock;
+    // allocated on first use, the library does no static construction
+    Cache *cache = NULL;
+    GThreadPool *pool = NULL;
+
+    // resolver_lock must be held
+    void touch(CacheEntry &entry)
+    {
+        cache->lru.splice(cache->lru.begin(), cache->lru, entry.lru);
+    }
+
+    // resolver_lock must be held
+    CacheEntry &insert(const std::string &host)
+    {
+        while (cache->entries.size() >= RESOLVER_CACHE_SIZE) {
+            // a lookup still running for it finds it gone and drops the result
+            cache->entries.erase(cache->lru.back());
+            cache->lru.pop_back();
+        }
+
+        cache->lru.push_front(host);
+        CacheEntry &entry = cache->entries[host];
+        entry.expires = 0;
+        entry.pending = false;
+        entry.lru = cache->lru.begin();
+
+        return entry;
+    }
+
+    // runs on a pool thread
+    void resolve(gpointer data, gpointer user_data)
+    {
+        gchar *host = static_cast<gchar *>(data);
+        std::vector<std::string> addresses;
+        GError *error = NULL;
+        GList *list, *it;
+
+        GResolver *resolver = g_resolver_get_default();
+        list = g_resolver_lookup_by_name(resolver, host, NULL, &error);
+        for (it = list; it != NULL; it = it->next) {
+            gchar *address = g_inet_address_to_string(static_cast<GInetAddress *>(it->data));
+            addresses.push_back(address);
+            g_free(address);
+        }
+        g_resolver_free_addresses(list);
+        g_object_unref(resolver);
+
+        if (error != NULL) {
+            g_debug("failed to resolve %s: %s", host, error->message);
+            g_clear_error(&error);
+        }
+
+        g_mutex_lock(&resolver_lock);
+        std::map<std::string, CacheEntry>::iterator found = cache->entries.find(host);
+        if (found != cache->entries.end()) {
+            CacheEntry &entry = found->second;
+            entry.addresses = addresses;
+            entry.expires = g_get_monotonic_time() + G_USEC_PER_SEC *
+                (addresses.empty() ? RESOLVER_NEGATIVE_TTL : RESOLVER_TTL);
+            entry.pending = false;
+        }
+        g_mutex_unlock(&resolver_lock);
+
+        g_free(host);
+    }
+}
+
+void HostResolver::Prefetch(const std::string &host)
+{
+    if (host.empty() || g_hostname_is_ip_address(host.c_str()))
+        return;
+
+    g_mutex_lock(&resolver_lock);
+    if (cache == NULL)
+        cache = new Cache();
+    if (pool == NULL)
+        pool = g_thread_pool_new(resolve, NULL, RESOLVER_THREADS, FALSE, NULL);
+
+    std::map<std::string, CacheEntry>::iterator found = cache->entries.find(host);
+    CacheEntry &entry = found != cache->entries.end() ? found->second : insert(host);
+    touch(entry);
+    if (!entry.pending && entry.expires <= g_get_monotonic_time()) {
+        entry.pending = true;
+        g_thread_pool_push(pool, g_strdup(host.c_str()), NULL);
+    }
+    g_mutex_unlock(&resolver_lock);
+}
+
+bool HostResolver::Lookup(const std::string &host, std::vector<std::string> &addresses)
+{
+    bool found = false;
+
+    g_mutex_lock(&resolver_lock);
+    if (cache != NULL) {
+        std::map<std::string, CacheEntry>::iterator it = cache->entries.find(host);
+        if (it != cache->entries.end() && !it->second.addresses.empty() &&
+            it->second.expires > g_get_monotonic_time()) {
+            touch(it->second);
+            addresses = it->second.addresses;
+            found = true;
+        }
+    }
+    g_mutex_unlock(&resolver_lock);
+
+    return found;
+}
+void HostResolver::Shutdown()
+{
+    GThreadPool *old_pool;
+
+    g_mutex_lock(&resolver_lock);
+    old_pool = pool;
+    pool = NULL;
+    g_mutex_unlock(&resolver_lock);
+
+    // pending lookups are dropped, running ones are waited for
+    if (old_pool != NULL)
+        g_thread_pool_free(old_pool, TRUE, TRUE);
+
+    // dropped lookups would stay pending forever
+    g_mutex_lock(&resolver_lock);
+    delete cache;
+    cache = NULL;
+    g_mutex_unlock(&resolver_lock);
+}
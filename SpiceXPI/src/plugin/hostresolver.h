@@ -0,0 +1,72 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ *   Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ *   The contents of this file are subject to the Mozilla Public License Version
+ *   1.1 (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.mozilla.org/MPL/
+ *
+ *   Software distributed under the License is distributed on an "AS IS" basis,
+ *   WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ *   for the specific language governing rights and limitations under the
+ *   License.
+ *
+ *   Copyright 2013, Red Hat Inc.
+ *
+ *   Alternatively, the contents of this file may be used under the terms of
+ *   either the GNU General Public License Version 2 or later (the "GPL"), or
+ *   the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ *   in which case the provisions of the GPL or the LGPL are applicable instead
+ *   of those above. If you wish to allow use of your version of this file only
+ *   under the terms of either the GPL or the LGPL, and not to allow others to
+ *   use your version of this file under the terms of the MPL, indicate your
+ *   decision by deleting the provisions above and replace them with the notice
+ *   and other provisions required by the GPL or the LGPL. If you do not delete
+ *   the provisions above, a recipient may use your version of this file under
+ *   the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef HOST_RESOLVER_H
+#define HOST_RESOLVER_H
+
+/*
+    Process-wide DNS cache, filled in the background as soon as a page
+    sets the host, so that by the time connect() races the server the
+    addresses are usually known (see PreConnect). The lookup also warms
+    the system cache, if any, for the client, which is still given the
+    name and resolves it itself: it tries every address, and verifies
+    the certificate against the name.
+
+    Lookups never block; positive results are kept for RESOLVER_TTL
+    seconds and failures for RESOLVER_NEGATIVE_TTL. At most
+    RESOLVER_CACHE_SIZE hosts are kept, the least recently used go first.
+*/
+
+#include <string>
+#include <vector>
+
+// GResolver does not tell the record TTL, use fixed lifetimes; the tests
+// build the resolver with shorter ones
+#ifndef RESOLVER_TTL
+#define RESOLVER_TTL          60
+#endif
+#ifndef RESOLVER_NEGATIVE_TTL
+#define RESOLVER_NEGATIVE_TTL 10
+#endif
+// a portal showing a few dozen consoles fits
+#define RESOLVER_CACHE_SIZE   64
+
+class HostResolver
+{
+public:
+    // starts a background lookup unless the cache is fresh; main thread
+    static void Prefetch(const std::string &host);
+    // all cached addresses of the host in the resolver's order, if any;
+    // any thread
+    static bool Lookup(const std::string &host, std::vector<std::string> &addresses);
+    // stops the workers, the library is about to be unloaded
+    static void Shutdown();
+};
+
+#endif // HOST_RESOLVER_H
@@ -315,3 +315,15 @@ void NPN_SetException(NPObject *obj, const NPUTF8 *message)
 {
     NPNFuncs.setexception(obj, message);
 }
+
+void NPN_PluginThreadAsyncCall(NPP instance, void (*func)(void *), void *userData)
+{
+    int navMinorVers = NPNFuncs.version & 0xFF;
+
+    // minimal hosts may claim a recent version without filling the entry
+    if (navMinorVers >= NPVERS_HAS_PLUGIN_THREAD_ASYNC_CALL &&
+        NPNFuncs.pluginthreadasynccall != NULL)
+        NPNFuncs.pluginthreadasynccall(instance, func, userData);
+    else
+        func(userData);
+}
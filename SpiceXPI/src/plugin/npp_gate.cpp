@@ -67,6 +67,14 @@ NPError NPP_New(NPMIMEType pluginType, NPP instance, uint16_t mode, int16_t argc
     ds.saved    = saved;
 
     nsPluginInstanceBase *plugin = NS_NewPluginInstance(&ds);
+
+    // the saved data is ours once NPP_New() is called
+    if (saved != NULL)
+    {
+        NPN_MemFree(saved->buf);
+        NPN_MemFree(saved);
+    }
+
     if (plugin == NULL)
         return NPERR_OUT_OF_MEMORY_ERROR;
 
@@ -84,6 +92,8 @@ NPError NPP_Destroy(NPP instance, NPSavedData **save)
     nsPluginInstanceBase *plugin = static_cast<nsPluginInstanceBase *>(instance->pdata);
     if (plugin != NULL)
     {
+        if (save != NULL)
+            plugin->SaveData(save);
         plugin->shut();
         NS_DestroyPluginInstance(plugin);
     }
@@ -59,6 +59,18 @@
 #include "common.h"
 #include "nsScriptablePeer.h"
 
+namespace {
+    // negative and fractional values from scripts are clamped
+    uint32_t msecFromNumber(double number)
+    {
+        if (number <= 0)
+            return 0;
+        if (number >= G_MAXUINT32)
+            return G_MAXUINT32;
+        return static_cast<uint32_t>(number);
+    }
+}
+
 bool ScriptablePluginObject::m_id_set = false;
 NPIdentifier ScriptablePluginObject::m_id_host_ip;
 NPIdentifier ScriptablePluginObject::m_id_port;
@@ -67,6 +79,7 @@ NPIdentifier ScriptablePluginObject::m_id_password;
 NPIdentifier ScriptablePluginObject::m_id_cipher_suite;
 NPIdentifier ScriptablePluginObject::m_id_ssl_channels;
 NPIdentifier ScriptablePluginObject::m_id_trust_store;
+NPIdentifier ScriptablePluginObject::m_id_trust_store_path;
 NPIdentifier ScriptablePluginObject::m_id_host_subject;
 NPIdentifier ScriptablePluginObject::m_id_fullscreen;
 NPIdentifier ScriptablePluginObject::m_id_smartcard;
@@ -80,6 +93,16 @@ NPIdentifier ScriptablePluginObject::m_id_no_taskmgr_execution;
 NPIdentifier ScriptablePluginObject::m_id_send_ctrlaltdel;
 NPIdentifier ScriptablePluginObject::m_id_usb_listen_port;
 NPIdentifier ScriptablePluginObject::m_id_usb_auto_share;
+NPIdentifier ScriptablePluginObject::m_id_shared_session;
+NPIdentifier ScriptablePluginObject::m_id_reload_handoff;
+NPIdentifier ScriptablePluginObject::m_id_preconnect;
+NPIdentifier ScriptablePluginObject::m_id_auto_restart;
+NPIdentifier ScriptablePluginObject::m_id_heartbeat_interval;
+NPIdentifier ScriptablePluginObject::m_id_heartbeat_timeout;
+NPIdentifier ScriptablePluginObject::m_id_heartbeat_restart;
+NPIdentifier ScriptablePluginObject::m_id_heartbeat_rtt;
+NPIdentifier ScriptablePluginObject::m_id_client_cpu_time;
+NPIdentifier ScriptablePluginObject::m_id_client_rss;
 NPIdentifier ScriptablePluginObject::m_id_color_depth;
 NPIdentifier ScriptablePluginObject::m_id_disable_effects;
 NPIdentifier ScriptablePluginObject::m_id_connect;
@@ -88,8 +111,14 @@ NPIdentifier ScriptablePluginObject::m_id_disconnect;
 NPIdentifier ScriptablePluginObject::m_id_set_language_strings;
 NPIdentifier ScriptablePluginObject::m_id_set_usb_filter;
 NPIdentifier ScriptablePluginObject::m_id_connect_status;
+NPIdentifier ScriptablePluginObject::m_id_get_client_log;
 NPIdentifier ScriptablePluginObject::m_id_plugin_instance;
 NPIdentifier ScriptablePluginObject::m_id_proxy;
+NPIdentifier ScriptablePluginObject::m_id_load_config;
+NPIdentifier ScriptablePluginObject::m_id_add_event_listener;
+NPIdentifier ScriptablePluginObject::m_id_connection_state;
+NPIdentifier ScriptablePluginObject::m_id_remove_event_listener;
+NPIdentifier ScriptablePluginObject::m_id_session;
 
 NPObject *AllocateScriptablePluginObject(NPP npp, NPClass *aClass)
 {
@@ -98,7 +127,8 @@ NPObject *AllocateScriptablePluginObject(NPP npp, NPClass *aClass)
 }
 
 ScriptablePluginObject::ScriptablePluginObject(NPP npp):
-    ScriptablePluginObjectBase(npp)
+    ScriptablePluginObjectBase(npp),
+    m_session(false)
 {
     m_plugin = static_cast<nsPluginInstance *>(npp->pdata);
     Init();
@@ -106,6 +136,20 @@ ScriptablePluginObject::ScriptablePluginObject(NPP npp):
 
 ScriptablePluginObject::~ScriptablePluginObject()
 {
+    // a session lives as long as its scriptable object
+    if (m_session && m_plugin)
+        m_plugin->GetParent()->ReleaseSession(m_plugin);
+}
+
+void ScriptablePluginObject::SetSession(nsPluginInstance *aSession)
+{
+    m_plugin = aSession;
+    m_session = true;
+}
+
+void ScriptablePluginObject::Detach()
+{
+    m_plugin = NULL;
 }
 
 void ScriptablePluginObject::Init()
@@ -120,6 +164,7 @@ void ScriptablePluginObject::Init()
     m_id_cipher_suite = NPN_GetStringIdentifier("CipherSuite");
     m_id_ssl_channels = NPN_GetStringIdentifier("SSLChannels");
     m_id_trust_store = NPN_GetStringIdentifier("TrustStore");
+    m_id_trust_store_path = NPN_GetStringIdentifier("TrustStorePath");
     m_id_host_subject = NPN_GetStringIdentifier("HostSubject");
     m_id_fullscreen = NPN_GetStringIdentifier("fullScreen");
     m_id_smartcard = NPN_GetStringIdentifier("Smartcard");
@@ -133,6 +178,16 @@ void ScriptablePluginObject::Init()
     m_id_send_ctrlaltdel = NPN_GetStringIdentifier("SendCtrlAltDelete");
     m_id_usb_listen_port = NPN_GetStringIdentifier("UsbListenPort");
     m_id_usb_auto_share = NPN_GetStringIdentifier("UsbAutoShare");
+    m_id_shared_session = NPN_GetStringIdentifier("SharedSession");
+    m_id_reload_handoff = NPN_GetStringIdentifier("ReloadHandoff");
+    m_id_preconnect = NPN_GetStringIdentifier("PreConnect");
+    m_id_auto_restart = NPN_GetStringIdentifier("AutoRestart");
+    m_id_heartbeat_interval = NPN_GetStringIdentifier("HeartbeatInterval");
+    m_id_heartbeat_timeout = NPN_GetStringIdentifier("HeartbeatTimeout");
+    m_id_heartbeat_restart = NPN_GetStringIdentifier("HeartbeatRestart");
+    m_id_heartbeat_rtt = NPN_GetStringIdentifier("HeartbeatRTT");
+    m_id_client_cpu_time = NPN_GetStringIdentifier("ClientCPUTime");
+    m_id_client_rss = NPN_GetStringIdentifier("ClientRSS");
     m_id_color_depth = NPN_GetStringIdentifier("ColorDepth");
     m_id_disable_effects = NPN_GetStringIdentifier("DisableEffects");
     m_id_connect = NPN_GetStringIdentifier("connect");
@@ -141,8 +196,14 @@ void ScriptablePluginObject::Init()
     m_id_set_language_strings = NPN_GetStringIdentifier("SetLanguageStrings");
     m_id_set_usb_filter = NPN_GetStringIdentifier("SetUsbFilter");
     m_id_connect_status = NPN_GetStringIdentifier("ConnectedStatus");
+    m_id_get_client_log = NPN_GetStringIdentifier("GetClientLog");
     m_id_plugin_instance = NPN_GetStringIdentifier("PluginInstance");
     m_id_proxy = NPN_GetStringIdentifier("Proxy");
+    m_id_load_config = NPN_GetStringIdentifier("loadConfig");
+    m_id_add_event_listener = NPN_GetStringIdentifier("addEventListener");
+    m_id_connection_state = NPN_GetStringIdentifier("ConnectionState");
+    m_id_remove_event_listener = NPN_GetStringIdentifier("removeEventListener");
+    m_id_session = NPN_GetStringIdentifier("Session");
     m_id_set = true;
 }
 
@@ -153,7 +214,11 @@ bool ScriptablePluginObject::HasMethod(NPIdentifier name)
            name == m_id_disconnect ||
            name == m_id_set_language_strings ||
            name == m_id_set_usb_filter ||
-           name == m_id_connect_status);
+           name == m_id_connect_status ||
+           name == m_id_get_client_log ||
+           name == m_id_load_config ||
+           name == m_id_add_event_listener ||
+           name == m_id_remove_event_listener);
 }
 
 bool ScriptablePluginObject::HasProperty(NPIdentifier name)
@@ -165,6 +230,7 @@ bool ScriptablePluginObject::HasProperty(NPIdentifier name)
            name == m_id_cipher_suite ||
            name == m_id_ssl_channels ||
            name == m_id_trust_store ||
+           name == m_id_trust_store_path ||
            name == m_id_host_subject ||
            name == m_id_fullscreen ||
            name == m_id_smartcard ||
@@ -178,9 +244,21 @@ bool ScriptablePluginObject::HasProperty(NPIdentifier name)
            name == m_id_send_ctrlaltdel ||
            name == m_id_usb_listen_port ||
            name == m_id_usb_auto_share ||
+           name == m_id_shared_session ||
+           name == m_id_reload_handoff ||
+           name == m_id_preconnect ||
+           name == m_id_auto_restart ||
+           name == m_id_heartbeat_interval ||
+           name == m_id_heartbeat_timeout ||
+           name == m_id_heartbeat_restart ||
+           name == m_id_heartbeat_rtt ||
+           name == m_id_client_cpu_time ||
+           name == m_id_client_rss ||
            name == m_id_color_depth ||
            name == m_id_disable_effects ||
-           name == m_id_proxy);
+           name == m_id_proxy ||
+           name == m_id_connection_state ||
+           (name == m_id_session && !m_session));
 }
 
 bool ScriptablePluginObject::GetProperty(NPIdentifier name, NPVariant *result)
@@ -204,6 +282,8 @@ bool ScriptablePluginObject::GetProperty(NPIdentifier name, NPVariant *result)
         STRINGZ_TO_NPVARIANT(m_plugin->GetSSLChannels(), *result);
     else if (name == m_id_trust_store)
         STRINGZ_TO_NPVARIANT(m_plugin->GetTrustStore(), *result);
+    else if (name == m_id_trust_store_path)
+        STRINGZ_TO_NPVARIANT(m_plugin->GetTrustStorePath(), *result);
     else if (name == m_id_host_subject)
         STRINGZ_TO_NPVARIANT(m_plugin->GetHostSubject(), *result);
     else if (name == m_id_fullscreen)
@@ -230,12 +310,37 @@ bool ScriptablePluginObject::GetProperty(NPIdentifier name, NPVariant *result)
         INT32_TO_NPVARIANT(m_plugin->GetUsbListenPort(), *result);
     else if (name == m_id_usb_auto_share)
         BOOLEAN_TO_NPVARIANT(m_plugin->GetUsbAutoShare(), *result);
+    else if (name == m_id_shared_session)
+        BOOLEAN_TO_NPVARIANT(m_plugin->GetSharedSession(), *result);
+    else if (name == m_id_reload_handoff)
+        BOOLEAN_TO_NPVARIANT(m_plugin->GetReloadHandoff(), *result);
+    else if (name == m_id_preconnect)
+        BOOLEAN_TO_NPVARIANT(m_plugin->GetPreConnect(), *result);
+    else if (name == m_id_auto_restart)
+        BOOLEAN_TO_NPVARIANT(m_plugin->GetAutoRestart(), *result);
+    else if (name == m_id_heartbeat_interval)
+        INT32_TO_NPVARIANT(m_plugin->GetHeartbeatInterval(), *result);
+    else if (name == m_id_heartbeat_timeout)
+        INT32_TO_NPVARIANT(m_plugin->GetHeartbeatTimeout(), *result);
+    else if (name == m_id_heartbeat_restart)
+        BOOLEAN_TO_NPVARIANT(m_plugin->GetHeartbeatRestart(), *result);
+    else if (name == m_id_heartbeat_rtt)
+        DOUBLE_TO_NPVARIANT(m_plugin->GetHeartbeatRTT(), *result);
+    else if (name == m_id_client_cpu_time)
+        DOUBLE_TO_NPVARIANT(m_plugin->GetClientCPUTime(), *result);
+    else if (name == m_id_client_rss)
+        DOUBLE_TO_NPVARIANT(m_plugin->GetClientRSS(), *result);
     else if (name == m_id_color_depth)
         STRINGZ_TO_NPVARIANT(m_plugin->GetColorDepth(), *result);
     else if (name == m_id_disable_effects)
         STRINGZ_TO_NPVARIANT(m_plugin->GetDisableEffects(), *result);
     else if (name == m_id_proxy)
         STRINGZ_TO_NPVARIANT(m_plugin->GetProxy(), *result);
+    else if (name == m_id_session && !m_session)
+        // the embed object itself is the constructor: new embed.Session()
+        OBJECT_TO_NPVARIANT(NPN_RetainObject(this), *result);
+    else if (name == m_id_connection_state)
+        STRINGZ_TO_NPVARIANT(m_plugin->GetConnectionState(), *result);
     else
         return false;
 
@@ -251,6 +356,22 @@ bool ScriptablePluginObject::SetProperty(NPIdentifier name, const NPVariant *val
     std::stringstream ss;
     bool boolean = false;
     unsigned short val = -1;
+    // millisecond values do not fit the port sized val
+    double number = 0;
+
+    // trust store bundles can be several megabytes, copy them straight
+    // from the NPString into a shared buffer instead of a std::string
+    if (name == m_id_trust_store && NPVARIANT_IS_STRING(*value))
+    {
+        const NPString &npstr = NPVARIANT_TO_STRING(*value);
+        GBytes *trust_store = NULL;
+        if (npstr.UTF8Length > 0)
+            trust_store = g_bytes_new(npstr.UTF8Characters, npstr.UTF8Length);
+        m_plugin->SetTrustStore(trust_store);
+        if (trust_store)
+            g_bytes_unref(trust_store);
+        return true;
+    }
 
     if (NPVARIANT_IS_STRING(*value))
     {
@@ -264,12 +385,14 @@ bool ScriptablePluginObject::SetProperty(NPIdentifier name, const NPVariant *val
     else if (NPVARIANT_IS_INT32(*value))
     {
         val = NPVARIANT_TO_INT32(*value);
+        number = NPVARIANT_TO_INT32(*value);
         ss << val;
         ss >> str;
     }
     else if (NPVARIANT_IS_DOUBLE(*value))
     {
         val = NPVARIANT_TO_DOUBLE(*value);
+        number = NPVARIANT_TO_DOUBLE(*value);
         ss << val;
         ss >> str;
     }
@@ -292,6 +415,8 @@ bool ScriptablePluginObject::SetProperty(NPIdentifier name, const NPVariant *val
         m_plugin->SetSSLChannels(str.c_str());
     else if (name == m_id_trust_store)
         m_plugin->SetTrustStore(str.c_str());
+    else if (name == m_id_trust_store_path)
+        m_plugin->SetTrustStorePath(str.c_str());
     else if (name == m_id_host_subject)
         m_plugin->SetHostSubject(str.c_str());
     else if (name == m_id_fullscreen)
@@ -318,6 +443,20 @@ bool ScriptablePluginObject::SetProperty(NPIdentifier name, const NPVariant *val
         m_plugin->SetUsbListenPort(val);
     else if (name == m_id_usb_auto_share)
         m_plugin->SetUsbAutoShare(boolean);
+    else if (name == m_id_shared_session)
+        m_plugin->SetSharedSession(boolean);
+    else if (name == m_id_reload_handoff)
+        m_plugin->SetReloadHandoff(boolean);
+    else if (name == m_id_preconnect)
+        m_plugin->SetPreConnect(boolean);
+    else if (name == m_id_auto_restart)
+        m_plugin->SetAutoRestart(boolean);
+    else if (name == m_id_heartbeat_interval)
+        m_plugin->SetHeartbeatInterval(msecFromNumber(number));
+    else if (name == m_id_heartbeat_timeout)
+        m_plugin->SetHeartbeatTimeout(msecFromNumber(number));
+    else if (name == m_id_heartbeat_restart)
+        m_plugin->SetHeartbeatRestart(boolean);
     else if (name == m_id_color_depth)
         m_plugin->SetColorDepth(str.c_str());
     else if (name == m_id_disable_effects)
@@ -377,6 +516,35 @@ bool ScriptablePluginObject::Invoke(NPIdentifier name, const NPVariant *args,
         INT32_TO_NPVARIANT(ret, *result);
         return true;
     }
+    else if (name == m_id_get_client_log)
+    {
+        STRINGZ_TO_NPVARIANT(m_plugin->GetClientLog(), *result);
+        return true;
+    }
+    else if (name == m_id_load_config)
+    {
+        if (argCount < 1 || !NPVARIANT_IS_STRING(args[0]))
+            return false;
+
+        std::string url(NPVARIANT_TO_STRING(args[0]).UTF8Characters,
+                        NPVARIANT_TO_STRING(args[0]).UTF8Length);
+        BOOLEAN_TO_NPVARIANT(m_plugin->LoadConfig(url.c_str()), *result);
+        return true;
+    }
+    else if (name == m_id_add_event_listener || name == m_id_remove_event_listener)
+    {
+        if (argCount < 2 || !NPVARIANT_IS_STRING(args[0]) || !NPVARIANT_IS_OBJECT(args[1]))
+            return false;
+
+        std::string type(NPVARIANT_TO_STRING(args[0]).UTF8Characters,
+                         NPVARIANT_TO_STRING(args[0]).UTF8Length);
+        NPObject *listener = NPVARIANT_TO_OBJECT(args[1]);
+        bool ret = (name == m_id_add_event_listener) ?
+            m_plugin->AddEventListener(type.c_str(), listener) :
+            m_plugin->RemoveEventListener(type.c_str(), listener);
+        BOOLEAN_TO_NPVARIANT(ret, *result);
+        return true;
+    }
 
     return false;
 }
@@ -389,3 +557,21 @@ bool ScriptablePluginObject::InvokeDefault(const NPVariant *args, uint32_t argCo
     NS_UNUSED(result);
     return true;
 }
+
+bool ScriptablePluginObject::Construct(const NPVariant *args, uint32_t argCount,
+                                       NPVariant *result)
+{
+    NS_UNUSED(args);
+    NS_UNUSED(argCount);
+
+    // sessions do not nest
+    if (!m_plugin || m_session)
+        return false;
+
+    NPObject *session = m_plugin->CreateSession();
+    if (!session)
+        return false;
+
+    OBJECT_TO_NPVARIANT(session, *result);
+    return true;
+}
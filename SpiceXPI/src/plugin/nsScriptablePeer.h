@@ -68,12 +68,19 @@ public:
                         uint32_t argCount, NPVariant *result);
     virtual bool InvokeDefault(const NPVariant *args, uint32_t argCount,
                                NPVariant *result);
+    virtual bool Construct(const NPVariant *args, uint32_t argCount,
+                           NPVariant *result);
+
+    // binds the object to a session created by nsPluginInstance::CreateSession()
+    void SetSession(nsPluginInstance *aSession);
+    void Detach();
 
 private:
     void Init();
 
 private:
     nsPluginInstance *m_plugin;
+    bool m_session;
 
     static bool m_id_set;
     static NPIdentifier m_id_host_ip;
@@ -83,6 +90,7 @@ private:
     static NPIdentifier m_id_cipher_suite;
     static NPIdentifier m_id_ssl_channels;
     static NPIdentifier m_id_trust_store;
+    static NPIdentifier m_id_trust_store_path;
     static NPIdentifier m_id_host_subject;
     static NPIdentifier m_id_fullscreen;
     static NPIdentifier m_id_smartcard;
@@ -96,6 +104,16 @@ private:
     static NPIdentifier m_id_send_ctrlaltdel;
     static NPIdentifier m_id_usb_listen_port;
     static NPIdentifier m_id_usb_auto_share;
+    static NPIdentifier m_id_shared_session;
+    static NPIdentifier m_id_reload_handoff;
+    static NPIdentifier m_id_preconnect;
+    static NPIdentifier m_id_auto_restart;
+    static NPIdentifier m_id_heartbeat_interval;
+    static NPIdentifier m_id_heartbeat_timeout;
+    static NPIdentifier m_id_heartbeat_restart;
+    static NPIdentifier m_id_heartbeat_rtt;
+    static NPIdentifier m_id_client_cpu_time;
+    static NPIdentifier m_id_client_rss;
     static NPIdentifier m_id_color_depth;
     static NPIdentifier m_id_disable_effects;
     static NPIdentifier m_id_connect;
@@ -104,8 +122,14 @@ private:
     static NPIdentifier m_id_set_language_strings;
     static NPIdentifier m_id_set_usb_filter;
     static NPIdentifier m_id_connect_status;
+    static NPIdentifier m_id_get_client_log;
     static NPIdentifier m_id_plugin_instance;
     static NPIdentifier m_id_proxy;
+    static NPIdentifier m_id_load_config;
+    static NPIdentifier m_id_add_event_listener;
+    static NPIdentifier m_id_connection_state;
+    static NPIdentifier m_id_remove_event_listener;
+    static NPIdentifier m_id_session;
 };
 
 #define DECLARE_NPOBJECT_CLASS_WITH_BASE(_class, ctor)                        \
@@ -67,22 +67,87 @@ extern "C" {
 #include <set>
 
 #if defined(XP_UNIX)
+#include "clientprefetch.h"
 #include "controller-unix.h"
+#include "controller-daemon.h"
 #endif
 #if defined(XP_WIN)
 #include "controller-win.h"
 #endif
+#include "rederrorcodes.h"
 #include "plugin.h"
+#include "controller-caps.h"
+#include "controller-preconnect.h"
+#include "controller-tls-session.h"
+#include "handoffregistry.h"
+#include "hostresolver.h"
+#include "sessionregistry.h"
+#include "tlssessioncache.h"
+#include "vvparser.h"
 #include "nsScriptablePeer.h"
 
+// how long connect() waits for a client to announce its capabilities,
+// in ms; only when an extension is about to be used
+#define CLIENT_CAPS_WAIT 200
+
+// how long connect() waits for the pre-connect race, in ms; it runs
+// while the client starts and is usually decided by now
+#define PRECONNECT_WAIT 100
+
+// how long a client handed over on reload waits for the new page, in seconds
+#define HANDOFF_GRACE 15
+
+// what connect() keeps while the client is waited for, see WaitForClient()
+struct nsPluginInstance::PendingConnect {
+    PendingConnect(SpiceController *aController, const std::string &aHost,
+                   int aPort, int aSecurePort):
+        thread(NULL),
+        controller(aController),
+        preconnect(aHost, aPort, aSecurePort),
+        use_preconnect(false),
+        have_tls_session(false),
+        port(aPort),
+        sport(aSecurePort),
+        caps(0),
+        start_time(g_get_monotonic_time()),
+        spawn_time(0)
+    {
+    }
+
+    GThread *thread;
+    SpiceController *controller;
+    PreConnect preconnect;
+    bool use_preconnect;
+    bool have_tls_session;
+    std::string tls_session;
+    std::string tls_session_key;
+    std::string session_key;
+    int port;
+    int sport;
+    // set by AwaitClient()
+    uint32_t caps;
+    gint64 start_time;
+    gint64 spawn_time;
+};
+
 DECLARE_NPOBJECT_CLASS_WITH_BASE(ScriptablePluginObject,
                                  AllocateScriptablePluginObject);
 
 namespace {
-    const std::string ver(PACKAGE_VERSION);
-    const std::string PLUGIN_NAME = "Spice Firefox Plugin " + ver;
-    const std::string MIME_TYPES_DESCRIPTION = "application/x-spice:qsc:" + PLUGIN_NAME;
-    const std::string PLUGIN_DESCRIPTION = PLUGIN_NAME + " Spice Client wrapper for firefox";
+    // plain character arrays, so that the browser's plugin scan
+    // (NP_GetMIMEDescription, NP_GetValue) runs no static constructors
+#define SPICE_PLUGIN_NAME "Spice Firefox Plugin " PACKAGE_VERSION
+    const char PLUGIN_NAME[] = SPICE_PLUGIN_NAME;
+    const char MIME_TYPES_DESCRIPTION[] = "application/x-spice:qsc:" SPICE_PLUGIN_NAME;
+    const char PLUGIN_DESCRIPTION[] = SPICE_PLUGIN_NAME " Spice Client wrapper for firefox";
+#undef SPICE_PLUGIN_NAME
+
+    // a connection file on its way to the embed or to one of its
+    // sessions, which may be gone before the file is complete
+    struct ConfigStream {
+        unsigned int session;
+        VVFileParser *parser;
+    };
 
     // helper function for string copy
     char *stringCopy(const std::string &src)
@@ -105,11 +170,95 @@ namespace {
         return (errno || *end != '\0' || end == port.c_str() || conv < min || conv > max)
             ? -1 : static_cast<int>(conv);
     }
+
+    // helper function for boolean <embed> attribute values
+    bool attributeToBool(const char *value)
+    {
+        return (g_ascii_strcasecmp(value, "true") == 0 ||
+                g_ascii_strcasecmp(value, "yes") == 0 ||
+                g_ascii_strcasecmp(value, "on") == 0 ||
+                strcmp(value, "1") == 0);
+    }
+
+    // TrustStorePath may only name a file below the directory set by the
+    // administrator in SPICE_XPI_TRUST_STORE_DIR, a page could otherwise
+    // have any local file sent to the client; symbolic links and ".."
+    // are resolved before the check
+    bool resolveTrustStorePath(const char *path, std::string &resolved)
+    {
+#if defined(XP_UNIX)
+        const char *dir = g_getenv("SPICE_XPI_TRUST_STORE_DIR");
+        if (dir == NULL || *dir == '\0')
+            return false;
+
+        char *real_dir = realpath(dir, NULL);
+        char *real_path = realpath(path, NULL);
+        bool allowed = false;
+        if (real_dir != NULL && real_path != NULL)
+        {
+            std::string prefix(real_dir);
+            if (prefix[prefix.length() - 1] != '/')
+                prefix += '/';
+            allowed = (strncmp(real_path, prefix.c_str(), prefix.length()) == 0);
+            if (allowed)
+                resolved = real_path;
+        }
+        free(real_dir);
+        free(real_path);
+
+        return allowed;
+#else
+        return false;
+#endif
+    }
+
+    // <embed> attributes understood at instantiation time; the browser
+    // lowercases attribute names, but match case-insensitively anyway
+    const struct {
+        const char *name;
+        void (nsPluginInstance::*setter)(const char *);
+    } string_attributes[] = {
+        { "hostip",           &nsPluginInstance::SetHostIP },
+        { "port",             &nsPluginInstance::SetPort },
+        { "secureport",       &nsPluginInstance::SetSecurePort },
+        { "password",         &nsPluginInstance::SetPassword },
+        { "ciphersuite",      &nsPluginInstance::SetCipherSuite },
+        { "sslchannels",      &nsPluginInstance::SetSSLChannels },
+        { "truststore",       &nsPluginInstance::SetTrustStore },
+        { "truststorepath",   &nsPluginInstance::SetTrustStorePath },
+        { "hostsubject",      &nsPluginInstance::SetHostSubject },
+        { "title",            &nsPluginInstance::SetTitle },
+        { "dynamicmenu",      &nsPluginInstance::SetDynamicMenu },
+        { "numberofmonitors", &nsPluginInstance::SetNumberOfMonitors },
+        { "guesthostname",    &nsPluginInstance::SetGuestHostName },
+        { "hotkey",           &nsPluginInstance::SetHotKeys },
+        { "colordepth",       &nsPluginInstance::SetColorDepth },
+        { "disableeffects",   &nsPluginInstance::SetDisableEffects },
+        { "proxy",            &nsPluginInstance::SetProxy },
+        { "usbfilter",        &nsPluginInstance::SetUsbFilter },
+    };
+
+    const struct {
+        const char *name;
+        void (nsPluginInstance::*setter)(bool);
+    } bool_attributes[] = {
+        { "fullscreen",         &nsPluginInstance::SetFullScreen },
+        { "smartcard",          &nsPluginInstance::SetSmartcard },
+        { "adminconsole",       &nsPluginInstance::SetAdminConsole },
+        { "notaskmgrexecution", &nsPluginInstance::SetNoTaskMgrExecution },
+        { "sendctrlaltdelete",  &nsPluginInstance::SetSendCtrlAltDelete },
+        { "usbautoshare",       &nsPluginInstance::SetUsbAutoShare },
+        { "sharedsession",      &nsPluginInstance::SetSharedSession },
+        { "reloadhandoff",      &nsPluginInstance::SetReloadHandoff },
+        { "preconnect",         &nsPluginInstance::SetPreConnect },
+        { "autorestart",        &nsPluginInstance::SetAutoRestart },
+        { "heartbeatrestart",   &nsPluginInstance::SetHeartbeatRestart },
+    };
 }
 
 const char *NPP_GetMIMEDescription(void)
 {
-    return const_cast<char *>(MIME_TYPES_DESCRIPTION.c_str());
+    return MIME_TYPES_DESCRIPTION;
 }
 
 //////////////////////////////////////
@@ -123,6 +272,13 @@ NPError NS_PluginInitialize()
 
 void NS_PluginShutdown()
 {
+    HandoffRegistry::Shutdown();
+    HostResolver::Shutdown();
+    SpiceController::StopReaper();
+    TlsSessionCache::Shutdown();
+#if defined(XP_UNIX)
+    ClientPrefetch::Shutdown();
+#endif
 }
 
 // get values per plugin
@@ -131,11 +287,11 @@ NPError NS_PluginGetValue(NPPVariable aVariable, void *aValue)
     switch (aVariable)
     {
     case NPPVpluginNameString:
-        *(static_cast<char **>(aValue)) = const_cast<char *>(PLUGIN_NAME.c_str());
+        *(static_cast<char **>(aValue)) = const_cast<char *>(PLUGIN_NAME);
         break;
 
     case NPPVpluginDescriptionString:
-        *(static_cast<char **>(aValue)) = const_cast<char *>(PLUGIN_DESCRIPTION.c_str());
+        *(static_cast<char **>(aValue)) = const_cast<char *>(PLUGIN_DESCRIPTION);
         break;
 
     default:
@@ -156,10 +312,23 @@ nsPluginInstanceBase *NS_NewPluginInstance(nsPluginCreateData *aCreateDataStruct
         return NULL;
 
     nsPluginInstance *plugin = new nsPluginInstance(aCreateDataStruct->instance);
+    plugin->SetAttributes(aCreateDataStruct->argc,
+                          aCreateDataStruct->argn,
+                          aCreateDataStruct->argv);
+    plugin->RestoreData(aCreateDataStruct->saved);
 
     // now is the time to tell Mozilla that we are windowless
     NPN_SetValue(aCreateDataStruct->instance, NPPVpluginWindowBool, NULL);
 
+#if defined(XP_UNIX)
+    // the first instance, after glib_init_once() ran in its constructor
+    if (ClientPrefetch::Wanted()) {
+        GStrv client_argv = SpiceControllerUnix::ClientArgv();
+        ClientPrefetch::Start(client_argv);
+        g_strfreev(client_argv);
+    }
+#endif
+
     return plugin;
 }
 
@@ -219,32 +388,54 @@ static void glib_setup_logging(void)
 #endif
 }
 
+// GLib type system and logging are only needed once an instance exists,
+// a plain plugin scan never gets here
+static void glib_init_once(void)
+{
+    static volatile gsize initialized = 0;
+
+    if (g_once_init_enter(&initialized)) {
+#if !GLIB_CHECK_VERSION(2, 35, 0)
+        g_type_init();
+#endif
+        glib_setup_logging();
+        g_once_init_leave(&initialized, 1);
+    }
+}
+
 nsPluginInstance::nsPluginInstance(NPP aInstance):
     nsPluginInstanceBase(),
     m_connected_status(-2),
+    m_external_controller(NULL),
+    m_connect_after_load(false),
+    m_connect_queued(FALSE),
+    m_pending_connect(NULL),
     m_instance(aInstance),
     m_initialized(true),
+    m_events(aInstance),
+    m_async(aInstance),
     m_window(NULL),
+    m_trust_store(NULL),
     m_fullscreen(false),
     m_smartcard(false),
     m_admin_console(false),
     m_no_taskmgr_execution(false),
     m_send_ctrlaltdel(true),
     m_usb_auto_share(true),
-    m_scriptable_peer(NULL)
-{
-#if !GLIB_CHECK_VERSION(2, 35, 0)
-    g_type_init();
-#endif
-    glib_setup_logging();
-
-#if defined(XP_WIN)
-    m_external_controller = new SpiceControllerWin(this);
-#elif defined(XP_UNIX)
-    m_external_controller = new SpiceControllerUnix(this);
-#else
-#error "Unknown OS, no controller implementation"
-#endif
+    m_shared_session(false),
+    m_reload_handoff(false),
+    m_preconnect(false),
+    m_preconnect_error(0),
+    m_auto_restart(false),
+    m_heartbeat_interval(0),
+    m_heartbeat_timeout(0),
+    m_heartbeat_restart(false),
+    m_scriptable_peer(NULL),
+    m_parent(NULL),
+    m_session_id(0),
+    m_last_session_id(0)
+{
+    glib_init_once();
 }
 
 nsPluginInstance::~nsPluginInstance()
@@ -253,9 +444,27 @@ nsPluginInstance::~nsPluginInstance()
     // so releasing it here does not guarantee that it is over
     // we should take precaution in case it will be called later
     // and zero its m_plugin member
-    if (m_scriptable_peer)
+    // a session does not hold a reference to its scriptable object
+    if (m_scriptable_peer && !m_parent)
         NPN_ReleaseObject(m_scriptable_peer);
-    delete(m_external_controller);
+
+    // sessions die with the embed, their scriptable objects may live on
+    for (std::set<nsPluginInstance *>::iterator it = m_sessions.begin();
+         it != m_sessions.end(); ++it) {
+        static_cast<ScriptablePluginObject *>((*it)->m_scriptable_peer)->Detach();
+        delete *it;
+    }
+    // embeds attached to our client lose it along with us
+    SessionRegistry::Remove(this, -1);
+    // a connect() still waiting for its client, ResumeConnect() is dropped
+    if (m_pending_connect != NULL) {
+        g_thread_join(m_pending_connect->thread);
+        delete m_pending_connect;
+    }
+    // does not wait for the client, see SpiceController::Shutdown()
+    if (m_external_controller)
+        m_external_controller->Shutdown();
+    g_clear_pointer(&m_trust_store, g_bytes_unref);
 }
 
 NPBool nsPluginInstance::init(NPWindow *aWindow)
@@ -268,7 +477,8 @@ NPBool nsPluginInstance::init(NPWindow *aWindow)
     m_secure_port.clear();
     m_cipher_suite.clear();
     m_ssl_channels.clear();
-    m_trust_store.clear();
+    g_clear_pointer(&m_trust_store, g_bytes_unref);
+    m_trust_store_path.clear();
     m_host_subject.clear();
     m_title.clear();
     m_dynamic_menu.clear();
@@ -281,7 +491,8 @@ NPBool nsPluginInstance::init(NPWindow *aWindow)
     m_color_depth.clear();
     m_disable_effects.clear();
     m_proxy.clear();
-    m_external_controller->SetProxy(std::string());
+    if (m_external_controller)
+        m_external_controller->SetProxy(std::string());
 
     m_fullscreen = false;
     m_smartcard = false;
@@ -318,6 +529,8 @@ char *nsPluginInstance::GetHostIP() const
 void nsPluginInstance::SetHostIP(const char *aHostIP)
 {
     m_host_ip = aHostIP;
+    // resolve while the page sets up the rest and the client starts
+    HostResolver::Prefetch(m_host_ip);
 }
 
 /* attribute string port; */
@@ -399,12 +612,88 @@ void nsPluginInstance::SetSSLChannels(const char *aSSLChannels)
 //* attribute string TrustStore; */
 char *nsPluginInstance::GetTrustStore() const
 {
-    return stringCopy(m_trust_store);
+    gsize size = 0;
+    const char *data = NULL;
+
+    // a bundle read from TrustStorePath is a local file, the page never
+    // gets to see its contents
+    if (m_trust_store && m_trust_store_path.empty())
+        data = static_cast<const char *>(g_bytes_get_data(m_trust_store, &size));
+
+    // the browser takes ownership of the returned string, so this is the
+    // one copy we cannot avoid
+    char *dest = static_cast<char *>(NPN_MemAlloc(size + 1));
+    if (dest)
+    {
+        if (size > 0)
+            memcpy(dest, data, size);
+        dest[size] = '\0';
+    }
+
+    return dest;
 }
 
 void nsPluginInstance::SetTrustStore(const char *aTrustStore)
 {
+    GBytes *trust_store = NULL;
+
+    if (aTrustStore && *aTrustStore)
+        trust_store = g_bytes_new(aTrustStore, strlen(aTrustStore));
+
+    SetTrustStore(trust_store);
+    if (trust_store)
+        g_bytes_unref(trust_store);
+}
+
+// the bundle is shared, not copied: callers keep their own reference
+void nsPluginInstance::SetTrustStore(GBytes *aTrustStore)
+{
+    if (aTrustStore)
+        g_bytes_ref(aTrustStore);
+    g_clear_pointer(&m_trust_store, g_bytes_unref);
     m_trust_store = aTrustStore;
+    m_trust_store_path.clear();
+}
+
+/* attribute string TrustStorePath; */
+char *nsPluginInstance::GetTrustStorePath() const
+{
+    return stringCopy(m_trust_store_path);
+}
+
+void nsPluginInstance::SetTrustStorePath(const char *aTrustStorePath)
+{
+    GError *error = NULL;
+    std::string path;
+    gchar *contents;
+    gsize length;
+
+    if (aTrustStorePath == NULL || *aTrustStorePath == '\0')
+    {
+        SetTrustStore(static_cast<GBytes *>(NULL));
+        return;
+    }
+
+    if (!resolveTrustStorePath(aTrustStorePath, path))
+    {
+        g_warning("trust store %s is not below SPICE_XPI_TRUST_STORE_DIR, ignoring it",
+                  aTrustStorePath);
+        return;
+    }
+
+    // read by the plugin and passed on like an inline bundle, the client
+    // is never handed the path itself
+    if (!g_file_get_contents(path.c_str(), &contents, &length, &error))
+    {
+        g_warning("failed to read trust store %s: %s", path.c_str(), error->message);
+        g_clear_error(&error);
+        return;
+    }
+
+    GBytes *trust_store = g_bytes_new_take(contents, length);
+    SetTrustStore(trust_store);
+    g_bytes_unref(trust_store);
+    m_trust_store_path = aTrustStorePath;
 }
 
 /* attribute string HostSubject; */
@@ -586,12 +875,141 @@ char *nsPluginInstance::GetProxy() const
 void nsPluginInstance::SetProxy(const char *aProxy)
 {
     m_proxy = aProxy;
-    m_external_controller->SetProxy(m_proxy);
+    if (m_external_controller)
+        m_external_controller->SetProxy(m_proxy);
+}
+
+/* attribute boolean SharedSession; */
+bool nsPluginInstance::GetSharedSession() const
+{
+    return m_shared_session;
+}
+
+void nsPluginInstance::SetSharedSession(bool aSharedSession)
+{
+    m_shared_session = aSharedSession;
+}
+
+// Off unless the page asks for it. Without a password anybody who knows
+// host and port would be raising the console of somebody else's embed.
+bool nsPluginInstance::SharesSession() const
+{
+    return m_shared_session && !m_password.empty();
+}
+
+/* attribute boolean PreConnect; */
+bool nsPluginInstance::GetPreConnect() const
+{
+    return m_preconnect;
+}
+
+void nsPluginInstance::SetPreConnect(bool aPreConnect)
+{
+    m_preconnect = aPreConnect;
+}
+
+/* attribute boolean ReloadHandoff; */
+bool nsPluginInstance::GetReloadHandoff() const
+{
+    return m_reload_handoff;
+}
+
+void nsPluginInstance::SetReloadHandoff(bool aReloadHandoff)
+{
+    m_reload_handoff = aReloadHandoff;
+}
+
+/* attribute boolean AutoRestart; */
+bool nsPluginInstance::GetAutoRestart() const
+{
+    return m_auto_restart;
+}
+
+void nsPluginInstance::SetAutoRestart(bool aAutoRestart)
+{
+    m_auto_restart = aAutoRestart;
+    if (m_external_controller)
+        m_external_controller->SetAutoRestart(m_auto_restart);
+}
+
+/* attribute unsigned long HeartbeatInterval; */
+uint32_t nsPluginInstance::GetHeartbeatInterval() const
+{
+    return m_heartbeat_interval;
+}
+
+void nsPluginInstance::SetHeartbeatInterval(uint32_t aInterval)
+{
+    m_heartbeat_interval = aInterval;
+    if (m_external_controller)
+        m_external_controller->SetHeartbeat(m_heartbeat_interval, m_heartbeat_timeout,
+                                            m_heartbeat_restart);
+}
+
+/* attribute unsigned long HeartbeatTimeout; */
+uint32_t nsPluginInstance::GetHeartbeatTimeout() const
+{
+    return m_heartbeat_timeout;
+}
+
+void nsPluginInstance::SetHeartbeatTimeout(uint32_t aTimeout)
+{
+    m_heartbeat_timeout = aTimeout;
+    if (m_external_controller)
+        m_external_controller->SetHeartbeat(m_heartbeat_interval, m_heartbeat_timeout,
+                                            m_heartbeat_restart);
+}
+
+/* attribute boolean HeartbeatRestart; */
+bool nsPluginInstance::GetHeartbeatRestart() const
+{
+    return m_heartbeat_restart;
+}
+
+void nsPluginInstance::SetHeartbeatRestart(bool aHeartbeatRestart)
+{
+    m_heartbeat_restart = aHeartbeatRestart;
+    if (m_external_controller)
+        m_external_controller->SetHeartbeat(m_heartbeat_interval, m_heartbeat_timeout,
+                                            m_heartbeat_restart);
+}
+
+/* readonly attribute double HeartbeatRTT; */
+double nsPluginInstance::GetHeartbeatRTT() const
+{
+    if (!m_external_controller)
+        return -1.0;
+
+    return m_external_controller->GetHeartbeatRtt();
+}
+
+/* readonly attribute double ClientCPUTime; */
+double nsPluginInstance::GetClientCPUTime() const
+{
+    double cpu_time, rss;
+
+    if (!m_external_controller || !m_external_controller->GetClientUsage(&cpu_time, &rss))
+        return -1.0;
+
+    return cpu_time;
+}
+
+/* readonly attribute double ClientRSS; */
+double nsPluginInstance::GetClientRSS() const
+{
+    double cpu_time, rss;
+
+    if (!m_external_controller || !m_external_controller->GetClientUsage(&cpu_time, &rss))
+        return -1.0;
+
+    return rss;
 }
 
 void nsPluginInstance::WriteToPipe(const void *data, uint32_t size)
 {
-    m_external_controller->Write(data, size);
+    // nothing to talk to before the first connect()
+    if (m_external_controller)
+        m_external_controller->Write(data, size);
 }
 
 void nsPluginInstance::SendInit()
@@ -636,11 +1054,27 @@ void nsPluginInstance::SendStr(uint32_t id, std::string str)
     free(msg);
 }
 
-bool nsPluginInstance::CreateTrustStoreFile(const std::string &trust_store)
+void nsPluginInstance::SendData(uint32_t id, const std::string &data)
+{
+    size_t size = sizeof(ControllerData) + data.size();
+    ControllerData *msg = static_cast<ControllerData *>(malloc(size));
+    msg->base.id = id;
+    msg->base.size = size;
+    memcpy(msg->data, data.data(), data.size());
+    WriteToPipe(msg, size);
+    free(msg);
+}
+
+bool nsPluginInstance::CreateTrustStoreFile(GBytes *trust_store)
 {
     GFile *tmp_file;
     GFileIOStream *iostream;
     GOutputStream *stream;
+    gsize size = 0;
+    gconstpointer data = NULL;
+
+    if (trust_store)
+        data = g_bytes_get_data(trust_store, &size);
 
     tmp_file = g_file_new_tmp("trustore.pem-XXXXXX", &iostream, NULL);
     if (tmp_file == NULL) {
@@ -649,32 +1083,220 @@ bool nsPluginInstance::CreateTrustStoreFile(const std::string &trust_store)
     }
 
     stream = g_io_stream_get_output_stream(G_IO_STREAM(iostream));
-    if (!g_output_stream_write_all(stream,
-                                   trust_store.c_str(),
-                                   trust_store.length(),
-                                   NULL, NULL, NULL)) {
+    if (!g_output_stream_write_all(stream, data, size, NULL, NULL, NULL)) {
         g_critical("Couldn't write truststore");
         return false;
     }
-    m_trust_store_file = g_file_get_path(tmp_file);
+    char *path = g_file_get_path(tmp_file);
+    m_trust_store_file = path;
+    g_free(path);
     g_object_unref(tmp_file);
     g_object_unref(iostream);
 
+    // the controller removes the file once the client is done with it
+    GetController()->SetTrustStoreFile(m_trust_store_file);
+
     return true;
 }
 
-bool nsPluginInstance::RemoveTrustStoreFile()
+// The outcome of the pre-connect race, AwaitClient() gave it a little
+// time. A winning socket goes to the client; when the server cannot be
+// reached at all, the client is stopped right away and reports the
+// failure, see OnSpiceClientExit().
+bool nsPluginInstance::HandOffPreConnect(PreConnect &preconnect)
 {
-    if (g_unlink(m_trust_store_file.c_str()) != 0)
-        return false;;
+    ControllerValue msg = { {CONTROLLER_PRECONNECTED, sizeof(msg)}, 0 };
+    int fd;
 
-    m_trust_store_file.clear();
+    switch (preconnect.Wait(0))
+    {
+    case PreConnect::RESULT_CONNECTED:
+        fd = preconnect.TakeSocket();
+        msg.value = preconnect.IsSecure() ?
+            CONTROLLER_PRECONNECTED_TLS : CONTROLLER_PRECONNECTED_PLAIN;
+        if (!m_external_controller->WriteWithFd(&msg, sizeof(msg), fd))
+            g_debug("controller cannot take a socket, client connects itself");
+        close(fd);
+        return true;
+
+    case PreConnect::RESULT_HOST_NOT_FOUND:
+        g_warning("pre-connect: host %s not found", m_host_ip.c_str());
+        g_atomic_int_set(&m_preconnect_error, SPICEC_ERROR_CODE_GETHOSTBYNAME_FAILED);
+        break;
+
+    case PreConnect::RESULT_FAILED:
+        g_warning("pre-connect: could not connect to %s", m_host_ip.c_str());
+        g_atomic_int_set(&m_preconnect_error, SPICEC_ERROR_CODE_CONNECT_FAILED);
+        break;
+
+    case PreConnect::RESULT_PENDING:
+        // still racing, let the client do it on its own
+        return true;
+    }
+
+    m_external_controller->RequestStop();
+    return false;
+}
+
+// the controller (and its temporary directory) is only created once the
+// page actually connects, hidden or unused embeds never pay for it
+SpiceController *nsPluginInstance::GetController()
+{
+    if (m_external_controller)
+        return m_external_controller;
+
+#if defined(XP_WIN)
+    m_external_controller = new SpiceControllerWin(this);
+#elif defined(XP_UNIX)
+    if (g_getenv("SPICE_XPI_DAEMON"))
+        m_external_controller = new SpiceControllerDaemon(this);
+    else
+        m_external_controller = new SpiceControllerUnix(this);
+#else
+#error "Unknown OS, no controller implementation"
+#endif
+    ConfigureController();
+
+    return m_external_controller;
+}
+
+void nsPluginInstance::ConfigureController()
+{
+    m_external_controller->SetProxy(m_proxy);
+    m_external_controller->SetAutoRestart(m_auto_restart);
+    m_external_controller->SetHeartbeat(m_heartbeat_interval, m_heartbeat_timeout,
+                                        m_heartbeat_restart);
+}
+
+// The page is going away, most likely to be reloaded. A connected client
+// is kept for the instance of the reloaded page, which finds it through
+// the token in the saved data; see HandoffRegistry.
+NPError nsPluginInstance::SaveData(NPSavedData **save)
+{
+    if (!m_reload_handoff || !m_external_controller || m_session_key.empty() ||
+        SessionRegistry::IsAttached(this) ||
+        m_external_controller->GetState() != SpiceController::STATE_CONNECTED)
+        return NPERR_NO_ERROR;
+
+    NPSavedData *data = static_cast<NPSavedData *>(NPN_MemAlloc(sizeof(NPSavedData)));
+    if (data == NULL)
+        return NPERR_OUT_OF_MEMORY_ERROR;
+
+    const std::string token = HandoffRegistry::Put(m_external_controller, m_session_key);
+    data->len = token.length() + 1;
+    data->buf = NPN_MemAlloc(data->len);
+    if (data->buf == NULL) {
+        std::string key;
+        HandoffRegistry::Take(token, key);
+        NPN_MemFree(data);
+        return NPERR_OUT_OF_MEMORY_ERROR;
+    }
+    memcpy(data->buf, token.c_str(), data->len);
+
+    g_debug("handing over the client for %d seconds", HANDOFF_GRACE);
+    // embeds attached to the client keep it while it waits for the page
+    SessionRegistry::Orphan(this);
+    m_external_controller->Orphan(HANDOFF_GRACE * 1000);
+    // the destructor must not stop it
+    m_external_controller = NULL;
+    *save = data;
+
+    return NPERR_NO_ERROR;
+}
+
+// called from NPP_New(), takes back a client handed over by SaveData()
+void nsPluginInstance::RestoreData(const NPSavedData *saved)
+{
+    if (saved == NULL || saved->buf == NULL || saved->len <= 0 ||
+        static_cast<const char *>(saved->buf)[saved->len - 1] != '\0')
+        return;
+
+    std::string key;
+    SpiceController *controller =
+        HandoffRegistry::Take(static_cast<const char *>(saved->buf), key);
+    if (controller == NULL) {
+        g_debug("handed over client is gone");
+        return;
+    }
+    if (!controller->Adopt(this)) {
+        g_debug("handed over client is no longer connected");
+        SessionRegistry::RemoveOrphan(key, -1);
+        controller->Shutdown();
+        return;
+    }
+
+    // from now on its attached embeds are ours
+    SessionRegistry::Adopt(key, this);
+    m_external_controller = controller;
+    ConfigureController();
+    m_handoff_key = key;
+    m_session_key = key;
+}
+
+// The client of the page we replace is only kept for the same VM. It is
+// connected already, so there is no spawn, no configuration and no
+// reconnect.
+bool nsPluginInstance::TakeOverHandoff()
+{
+    const std::string key =
+        SessionRegistry::MakeKey(m_host_ip, m_port, m_secure_port, m_password);
+    const bool same = (key == m_handoff_key);
+
+    m_handoff_key.clear();
+    if (!same || m_external_controller->GetState() != SpiceController::STATE_CONNECTED) {
+        g_debug("handed over client is not for this connection, stopping it");
+        m_session_key.clear();
+        SessionRegistry::Remove(this, -1);
+        m_external_controller->Shutdown();
+        m_external_controller = NULL;
+        return false;
+    }
+
+    g_debug("adopting the client of the previous page");
+    m_connected_status = -1;
+    if (SharesSession())
+        SessionRegistry::Register(key, this);
+    Show();
+    m_events.PostTiming("connect", 0.0);
+    m_events.PostStatus("connected");
+    m_events.PostConnected();
 
     return true;
 }
 
 void nsPluginInstance::Connect()
 {
+    if (!m_handoff_key.empty() && TakeOverHandoff())
+        return;
+
+    switch (GetController()->GetState())
+    {
+    case SpiceController::STATE_IDLE:
+        // the client of the previous connect() went away while it was
+        // waited for, ResumeConnect() runs this one
+        if (m_pending_connect != NULL) {
+            g_atomic_int_set(&m_connect_queued, TRUE);
+            return;
+        }
+        break;
+
+    case SpiceController::STATE_STOPPING:
+        // the previous client is still on its way out, start the new one
+        // once it is gone so the two never overlap
+        g_debug("client is stopping, queueing connect");
+        g_atomic_int_set(&m_connect_queued, TRUE);
+        return;
+
+    case SpiceController::STATE_CONNECTED:
+        g_debug("already connected, raising the client instead");
+        Show();
+        return;
+
+    default:
+        g_debug("connect already in progress, ignoring");
+        return;
+    }
+
     const int port = portToInt(m_port);
     const int sport = portToInt(m_secure_port);
     if (port < 0)
@@ -684,32 +1306,155 @@ void nsPluginInstance::Connect()
     if (port <= 0 && sport <= 0)
     {
         m_connected_status = 1;
-        CallOnDisconnected(m_connected_status);
+        m_events.PostDisconnected(m_connected_status, std::string());
         return;
     }
 
+    // another embed already shows this VM, raise its client instead
+    const std::string session_key =
+        SessionRegistry::MakeKey(m_host_ip, m_port, m_secure_port, m_password);
+    if (SharesSession()) {
+        nsPluginInstance *owner = SessionRegistry::Attach(session_key, this);
+        if (owner != NULL && owner->SharesSession()) {
+            g_debug("attaching to the running client of another embed");
+            owner->Show();
+            m_connected_status = -1;
+            m_events.PostStatus("attached");
+            m_events.PostConnected();
+            return;
+        }
+        if (owner != NULL)
+            SessionRegistry::Remove(this, 0);
+    }
+
+    PendingConnect *pending = new PendingConnect(m_external_controller, m_host_ip, port, sport);
+    pending->session_key = session_key;
+    m_events.PostStatus("starting");
+
+    // sessions of earlier clients of the same server, see controller-tls-session.h
+    if (sport > 0)
+        pending->tls_session_key = TlsSessionCache::MakeKey(m_host_ip, sport, m_host_subject);
+    m_external_controller->SetTlsSessionKey(pending->tls_session_key);
+
+    // races the server connection, or the proxy tunnel to it, while the
+    // client starts
+    pending->use_preconnect = m_preconnect && pending->preconnect.SetProxy(m_proxy) &&
+        pending->preconnect.Start();
+
     if (!m_external_controller->StartClient()) {
         g_critical("failed to start SPICE client");
+        delete pending;
         return;
     }
 
     if (m_external_controller->Connect(10) != 0)
     {
         g_critical("could not connect to spice client controller");
+        delete pending;
+        return;
+    }
+
+    if (!m_external_controller->SetState(SpiceController::STATE_SPAWNING,
+                                         SpiceController::STATE_CONFIGURING))
+    {
+        g_debug("client went away while connecting to it");
+        delete pending;
         return;
     }
 
+    pending->spawn_time = g_get_monotonic_time();
+    m_events.PostTiming("spawn", (pending->spawn_time - pending->start_time) / 1000.0);
+    m_events.PostStatus("configuring");
+
     if (!this->CreateTrustStoreFile(m_trust_store)) {
         g_critical("failed to create trust store");
+        m_external_controller->RequestStop();
+        delete pending;
         return;
     }
 
     SendInit();
+    pending->have_tls_session = sport > 0 &&
+        TlsSessionCache::Take(pending->tls_session_key, pending->tls_session);
+
+    // extensions only go to a client which announced them, a stock
+    // client is not even waited for; see controller-caps.h. The page
+    // does not wait along, ResumeConnect() carries on.
+    if (pending->use_preconnect || pending->have_tls_session) {
+        m_pending_connect = pending;
+        pending->thread = g_thread_try_new("spice-xpi connect", WaitForClient, this, NULL);
+        if (pending->thread != NULL)
+            return;
+        m_pending_connect = NULL;
+        AwaitClient(pending);
+    }
+
+    FinishConnect(pending);
+}
+
+// Blocks for up to CLIENT_CAPS_WAIT + PRECONNECT_WAIT ms, for the client
+// to announce its capabilities and for the pre-connect race to be decided.
+void nsPluginInstance::AwaitClient(PendingConnect *pending)
+{
+    pending->caps = pending->controller->WaitForClientCaps(CLIENT_CAPS_WAIT);
+    if (pending->use_preconnect && (pending->caps & CONTROLLER_CAP_PRECONNECT))
+        pending->preconnect.Wait(PRECONNECT_WAIT * 1000);
+}
+
+// runs on its own thread, which the destructor joins
+gpointer nsPluginInstance::WaitForClient(gpointer data)
+{
+    nsPluginInstance *fake_this = static_cast<nsPluginInstance *>(data);
+
+    AwaitClient(fake_this->m_pending_connect);
+    fake_this->m_async.Call(ResumeConnect, fake_this);
+
+    return NULL;
+}
+
+void nsPluginInstance::ResumeConnect(void *aPlugin)
+{
+    nsPluginInstance *fake_this = static_cast<nsPluginInstance *>(aPlugin);
+    PendingConnect *pending = fake_this->m_pending_connect;
+
+    fake_this->m_pending_connect = NULL;
+    g_thread_join(pending->thread);
+    fake_this->FinishConnect(pending);
+
+    // connect() came in while the client was still waited for
+    if (g_atomic_int_compare_and_exchange(&fake_this->m_connect_queued, TRUE, FALSE))
+        fake_this->Connect();
+}
+
+// the rest of the configuration, once the client is known
+void nsPluginInstance::FinishConnect(PendingConnect *pending)
+{
+    const int port = pending->port;
+    const int sport = pending->sport;
+    const uint32_t caps = pending->caps;
+
+    // disconnect() came in, or the client went away, while waiting
+    if (m_external_controller->GetState() != SpiceController::STATE_CONFIGURING) {
+        g_debug("client went away while waiting for it");
+        delete pending;
+        return;
+    }
+
+    if (pending->use_preconnect && (caps & CONTROLLER_CAP_PRECONNECT) &&
+        !HandOffPreConnect(pending->preconnect)) {
+        delete pending;
+        return;
+    }
     SendStr(CONTROLLER_HOST, m_host_ip);
     if (port > 0)
         SendValue(CONTROLLER_PORT, port);
     if (sport > 0)
         SendValue(CONTROLLER_SPORT, sport);
+    if (pending->have_tls_session && (caps & CONTROLLER_CAP_TLS_SESSION))
+        SendData(CONTROLLER_TLS_SESSION, pending->tls_session);
+    else if (pending->have_tls_session)
+        TlsSessionCache::Store(pending->tls_session_key, pending->tls_session.data(),
+                               pending->tls_session.size());
     SendValue(CONTROLLER_FULL_SCREEN,
             (m_fullscreen == true ? CONTROLLER_SET_FULL_SCREEN : 0) |
             (m_admin_console == false ? CONTROLLER_AUTO_DISPLAY_RES : 0));
@@ -731,6 +1476,18 @@ void nsPluginInstance::Connect()
 
     // set connected status
     m_connected_status = -1;
+    m_external_controller->SetState(SpiceController::STATE_CONFIGURING,
+                                    SpiceController::STATE_CONNECTED);
+    m_session_key = pending->session_key;
+    if (SharesSession())
+        SessionRegistry::Register(m_session_key, this);
+
+    gint64 end_time = g_get_monotonic_time();
+    m_events.PostTiming("configure", (end_time - pending->spawn_time) / 1000.0);
+    m_events.PostTiming("connect", (end_time - pending->start_time) / 1000.0);
+    m_events.PostStatus("connected");
+    m_events.PostConnected();
+    delete pending;
 }
 
 void nsPluginInstance::Show()
@@ -741,7 +1498,16 @@ void nsPluginInstance::Show()
 
 void nsPluginInstance::Disconnect()
 {
-    m_external_controller->StopClient();
+    if (SessionRegistry::IsAttached(this)) {
+        // the client belongs to the other embed, just let go of it
+        SessionRegistry::Remove(this, 0);
+        OnSharedSessionEnd(0);
+        return;
+    }
+
+    g_atomic_int_set(&m_connect_queued, FALSE);
+    if (m_external_controller)
+        m_external_controller->RequestStop();
 }
 
 void nsPluginInstance::ConnectedStatus(int32_t *retval)
@@ -749,6 +1515,28 @@ void nsPluginInstance::ConnectedStatus(int32_t *retval)
     *retval = m_connected_status;
 }
 
+char *nsPluginInstance::GetConnectionState() const
+{
+    if (SessionRegistry::IsAttached(this))
+        return stringCopy("attached");
+    if (!m_external_controller)
+        return stringCopy(SpiceController::StateToString(SpiceController::STATE_IDLE));
+
+    SpiceController::State state = m_external_controller->GetState();
+    if (state == SpiceController::STATE_CONNECTED && m_external_controller->IsDegraded())
+        return stringCopy("degraded");
+
+    return stringCopy(SpiceController::StateToString(state));
+}
+
+char *nsPluginInstance::GetClientLog() const
+{
+    if (!m_external_controller)
+        return stringCopy(std::string());
+
+    return stringCopy(m_external_controller->GetClientLog());
+}
+
 void nsPluginInstance::SetLanguageStrings(const char *aSection, const char *aLanguage)
 {
     if (aSection != NULL && aLanguage != NULL)
@@ -765,64 +1553,225 @@ void nsPluginInstance::SetUsbFilter(const char *aUsbFilter)
         m_usb_filter = aUsbFilter;
 }
 
-void nsPluginInstance::CallOnDisconnected(int code)
+void nsPluginInstance::SetAttributes(int16_t argc, char *argn[], char *argv[])
 {
-    NPObject *window = NULL;
-    if (NPN_GetValue(m_instance, NPNVWindowNPObject, &window) != NPERR_NO_ERROR)
+    bool autoconnect = false;
+    bool has_src = false;
+
+    for (int16_t i = 0; i < argc; ++i)
     {
-        g_critical("could not get browser window, when trying to call OnDisconnected");
-        return;
+        if (argn[i] == NULL || argv[i] == NULL)
+            continue;
+
+        if (g_ascii_strcasecmp(argn[i], "autoconnect") == 0)
+        {
+            autoconnect = attributeToBool(argv[i]);
+            continue;
+        }
+
+        // the browser streams the src URL to us, see NewStream()
+        if (g_ascii_strcasecmp(argn[i], "src") == 0)
+        {
+            has_src = true;
+            continue;
+        }
+
+        for (size_t j = 0; j < G_N_ELEMENTS(string_attributes); ++j)
+        {
+            if (g_ascii_strcasecmp(argn[i], string_attributes[j].name) == 0)
+            {
+                (this->*string_attributes[j].setter)(argv[i]);
+                break;
+            }
+        }
+
+        for (size_t j = 0; j < G_N_ELEMENTS(bool_attributes); ++j)
+        {
+            if (g_ascii_strcasecmp(argn[i], bool_attributes[j].name) == 0)
+            {
+                (this->*bool_attributes[j].setter)(attributeToBool(argv[i]));
+                break;
+            }
+        }
     }
 
-    // get OnDisconnected callback
-    NPIdentifier id_on_disconnected = NPN_GetStringIdentifier("OnDisconnected");
-    if (!id_on_disconnected)
+    // a connection file given as src completes the configuration later,
+    // otherwise we are still inside NPP_New, so connect as soon as the
+    // browser gives control back to the main thread
+    if (autoconnect && has_src)
+        m_connect_after_load = true;
+    else if (autoconnect)
+        m_async.Call(AutoConnect, this);
+}
+
+bool nsPluginInstance::LoadConfig(const char *aUrl)
+{
+    // a NULL target makes the browser deliver the data to NewStream() of
+    // the embed, whose NPP sessions share; the notify data tells whose
+    // file it is
+    NPError err = NPN_GetURLNotify(m_instance, aUrl, NULL, GUINT_TO_POINTER(m_session_id));
+    if (err != NPERR_NO_ERROR)
     {
-        g_critical("could not find OnDisconnected identifier");
-        return;
+        g_warning("failed to request connection file %s: %d", aUrl, err);
+        return false;
     }
 
-    NPVariant var_on_disconnected;
-    if (!NPN_GetProperty(m_instance, window, id_on_disconnected, &var_on_disconnected))
+    return true;
+}
+
+NPError nsPluginInstance::NewStream(NPMIMEType type, NPStream *stream,
+                                    NPBool seekable, uint16_t *stype)
+{
+    NS_UNUSED(seekable);
+
+    // the src attribute is streamed without notify data, to the embed
+    const unsigned int id = GPOINTER_TO_UINT(stream->notifyData);
+    nsPluginInstance *target = FindSession(id);
+    if (target == NULL)
+        return NPERR_GENERIC_ERROR;
+
+    g_debug("loading connection file %s (%s)", stream->url, type);
+    ConfigStream *config = new ConfigStream;
+    config->session = id;
+    config->parser = new VVFileParser(target);
+    stream->pdata = config;
+    *stype = NP_NORMAL;
+
+    return NPERR_NO_ERROR;
+}
+
+int32_t nsPluginInstance::Write(NPStream *stream, int32_t offset,
+                                int32_t len, void *buffer)
+{
+    NS_UNUSED(offset);
+
+    ConfigStream *config = static_cast<ConfigStream *>(stream->pdata);
+    if (config == NULL)
+        return len;
+
+    // a negative return value makes the browser abort the stream
+    if (FindSession(config->session) == NULL ||
+        !config->parser->Feed(static_cast<const char *>(buffer), len))
+        return -1;
+
+    return len;
+}
+
+NPError nsPluginInstance::DestroyStream(NPStream *stream, NPError reason)
+{
+    ConfigStream *config = static_cast<ConfigStream *>(stream->pdata);
+    if (config == NULL)
+        return NPERR_NO_ERROR;
+
+    nsPluginInstance *target = FindSession(config->session);
+    bool loaded = (target != NULL) && (reason == NPRES_DONE) && config->parser->Finish();
+    delete config->parser;
+    delete config;
+    stream->pdata = NULL;
+
+    if (!loaded)
     {
-        g_critical("could not get OnDisconnected function");
-        return;
+        g_warning("failed to load connection file %s: %d", stream->url, reason);
+        if (target == this)
+            m_connect_after_load = false;
+        return NPERR_NO_ERROR;
     }
 
-    if (!NPVARIANT_IS_OBJECT(var_on_disconnected))
+    // only the embed has attributes, and so autoconnect
+    if (target == this && m_connect_after_load)
     {
-        g_critical("OnDisconnected is not object");
-        return;
+        m_connect_after_load = false;
+        Connect();
     }
 
-    NPObject *call_on_disconnected = NPVARIANT_TO_OBJECT(var_on_disconnected);
+    return NPERR_NO_ERROR;
+}
 
-    // call OnDisconnected
-    NPVariant arg;
-    NPVariant void_result;
-    INT32_TO_NPVARIANT(code, arg);
-    NPVariant args[] = { arg };
+void nsPluginInstance::URLNotify(const char *url, NPReason reason, void *notifyData)
+{
+    NS_UNUSED(notifyData);
 
-    if (NPN_InvokeDefault(m_instance, call_on_disconnected, args, sizeof(args) / sizeof(args[0]), &void_result))
-        g_debug("OnDisconnected successfuly called");
-    else
-        g_critical("could not call OnDisconnected");
+    if (reason != NPRES_DONE)
+        g_warning("connection file request for %s failed: %d", url, reason);
+}
 
-    // cleanup
-    NPN_ReleaseObject(window);
-    NPN_ReleaseVariantValue(&var_on_disconnected);
+void nsPluginInstance::AutoConnect(void *aPlugin)
+{
+    g_debug("connecting on behalf of the autoconnect attribute");
+    static_cast<nsPluginInstance *>(aPlugin)->Connect();
+}
+
+void nsPluginInstance::ConnectQueued(void *aPlugin)
+{
+    nsPluginInstance *fake_this = static_cast<nsPluginInstance *>(aPlugin);
+
+    if (!g_atomic_int_compare_and_exchange(&fake_this->m_connect_queued, TRUE, FALSE))
+        return;
+
+    g_debug("previous client exited, running queued connect");
+    fake_this->Connect();
+}
+
+bool nsPluginInstance::AddEventListener(const char *aType, NPObject *aListener)
+{
+    return m_events.AddListener(aType, aListener);
+}
+
+bool nsPluginInstance::RemoveEventListener(const char *aType, NPObject *aListener)
+{
+    return m_events.RemoveListener(aType, aListener);
+}
+
+// called with the registry locked, possibly from the reaper thread
+void nsPluginInstance::OnSharedSessionEnd(int exit_code)
+{
+    m_connected_status = SpiceController::TranslateRC(exit_code);
+    m_events.PostDisconnected(exit_code, std::string());
+    m_events.PostStatus("disconnected");
 }
 
 void nsPluginInstance::OnSpiceClientExit(int exit_code)
 {
-    m_connected_status = m_external_controller->TranslateRC(exit_code);
+    // the client was stopped because the server is unreachable
+    int preconnect_error = g_atomic_int_get(&m_preconnect_error);
+    if (preconnect_error != 0) {
+        g_atomic_int_set(&m_preconnect_error, 0);
+        exit_code = preconnect_error;
+    }
+
+    SessionRegistry::Remove(this, exit_code);
+
+    m_connected_status = SpiceController::TranslateRC(exit_code);
     if (!getenv("SPICE_XPI_DEBUG"))
     {
-        CallOnDisconnected(exit_code);
-        m_external_controller->Disconnect();
+        m_events.PostDisconnected(exit_code, m_external_controller->GetClientLog());
+        m_events.PostStatus("disconnected");
     }
 
-    RemoveTrustStoreFile();
+    // we are on the client thread, a connect() queued behind
+    // disconnect() must run on the main thread
+    if (g_atomic_int_get(&m_connect_queued))
+        m_async.Call(ConnectQueued, this);
+}
+
+// the client crashed, the controller starts a new one after the delay (ms)
+void nsPluginInstance::OnSpiceClientRestart(unsigned int attempt, unsigned int delay)
+{
+    m_events.PostReconnecting(attempt, delay);
+    m_events.PostStatus("reconnecting");
+}
+
+// the new client got the configuration of the crashed one
+void nsPluginInstance::OnSpiceClientRestarted()
+{
+    m_events.PostStatus("connected");
+    m_events.PostConnected();
+}
+
+// the client stopped or resumed answering the heartbeat
+void nsPluginInstance::OnSpiceClientHealth(bool degraded)
+{
+    m_events.PostStatus(degraded ? "degraded" : "connected");
 }
 
 // ==============================
@@ -861,3 +1810,48 @@ NPObject *nsPluginInstance::GetScriptablePeer()
 
     return m_scriptable_peer;
 }
+
+// Scripts create additional sessions with "new embed.Session()". A session
+// is a plugin instance without a window of its own: it has its own
+// settings, client, state and events, and shares the process-wide reaper
+// and logging and, until told otherwise, the embed's trust store. It lives
+// as long as its scriptable object, or the embed, whichever goes first;
+// its main thread calls go through AsyncCaller for that reason.
+NPObject *nsPluginInstance::CreateSession()
+{
+    NPObject *peer = NPN_CreateObject(m_instance, GET_NPOBJECT_CLASS(ScriptablePluginObject));
+    if (!peer)
+        return NULL;
+
+    nsPluginInstance *session = new nsPluginInstance(m_instance);
+    session->m_parent = this;
+    session->m_session_id = ++m_last_session_id;
+    session->m_scriptable_peer = peer;
+    session->SetTrustStore(m_trust_store);
+    session->m_trust_store_path = m_trust_store_path;
+    static_cast<ScriptablePluginObject *>(peer)->SetSession(session);
+    m_sessions.insert(session);
+
+    return peer;
+}
+
+void nsPluginInstance::ReleaseSession(nsPluginInstance *aSession)
+{
+    m_sessions.erase(aSession);
+    delete aSession;
+}
+
+// the embed for 0, or the session of that id, if it is still around
+nsPluginInstance *nsPluginInstance::FindSession(unsigned int aId)
+{
+    if (aId == m_session_id)
+        return this;
+
+    for (std::set<nsPluginInstance *>::iterator it = m_sessions.begin();
+         it != m_sessions.end(); ++it) {
+        if ((*it)->m_session_id == aId)
+            return *it;
+    }
+
+    return NULL;
+}
@@ -44,6 +44,7 @@
 #define PLUGIN_H
 
 #include <map>
+#include <set>
 #include <string>
 
 #include <npapi.h>
@@ -56,6 +57,9 @@ extern "C" {
 
 #include "pluginbase.h"
 #include "controller.h"
+#include "asynccaller.h"
+#include "eventdispatcher.h"
+#include "preconnect.h"
 #include "common.h"
 #include "glib-compat.h"
 
@@ -71,14 +75,28 @@ public:
     
     NPError	GetValue(NPPVariable variable, void *value);
     NPError SetWindow(NPWindow *aWindow);
+    NPError NewStream(NPMIMEType type, NPStream *stream,
+                      NPBool seekable, uint16_t *stype);
+    NPError DestroyStream(NPStream *stream, NPError reason);
+    NPError SaveData(NPSavedData **save);
+    int32_t Write(NPStream *stream, int32_t offset,
+                  int32_t len, void *buffer);
+    void URLNotify(const char *url, NPReason reason, void *notifyData);
     
     // locals
     void Connect();
     void Disconnect();
     void Show();
     void ConnectedStatus(int32_t *retval);
+    char *GetConnectionState() const;
+    char *GetClientLog() const;
     void SetLanguageStrings(const char *aSection, const char *aLanguage);
     void SetUsbFilter(const char *aUsbFilter);
+    void SetAttributes(int16_t argc, char *argn[], char *argv[]);
+    void RestoreData(const NPSavedData *saved);
+    bool LoadConfig(const char *aUrl);
+    bool AddEventListener(const char *aType, NPObject *aListener);
+    bool RemoveEventListener(const char *aType, NPObject *aListener);
     
     /* attribute ing Host; */
     char *GetHostIP() const;
@@ -107,6 +125,11 @@ public:
      /* attribute ing TrustStore; */
     char *GetTrustStore() const;
     void SetTrustStore(const char *aTrustStore);
+    void SetTrustStore(GBytes *aTrustStore);
+
+     /* attribute ing TrustStorePath; */
+    char *GetTrustStorePath() const;
+    void SetTrustStorePath(const char *aTrustStorePath);
     
      /* attribute ing HostSubject; */
     char *GetHostSubject() const;
@@ -172,9 +195,54 @@ public:
     char *GetProxy() const;
     void SetProxy(const char *aProxy);
 
+    /* attribute boolean SharedSession; */
+    bool GetSharedSession() const;
+    void SetSharedSession(bool aSharedSession);
+
+    /* attribute boolean ReloadHandoff; */
+    bool GetReloadHandoff() const;
+    void SetReloadHandoff(bool aReloadHandoff);
+
+    /* attribute boolean PreConnect; */
+    bool GetPreConnect() const;
+    void SetPreConnect(bool aPreConnect);
+
+    /* attribute boolean AutoRestart; */
+    bool GetAutoRestart() const;
+    void SetAutoRestart(bool aAutoRestart);
+
+    /* attribute unsigned long HeartbeatInterval; */
+    uint32_t GetHeartbeatInterval() const;
+    void SetHeartbeatInterval(uint32_t aInterval);
+
+    /* attribute unsigned long HeartbeatTimeout; */
+    uint32_t GetHeartbeatTimeout() const;
+    void SetHeartbeatTimeout(uint32_t aTimeout);
+
+    /* attribute boolean HeartbeatRestart; */
+    bool GetHeartbeatRestart() const;
+    void SetHeartbeatRestart(bool aHeartbeatRestart);
+
+    /* readonly attribute double HeartbeatRTT; */
+    double GetHeartbeatRTT() const;
+
+    /* readonly attribute double ClientCPUTime; */
+    double GetClientCPUTime() const;
+
+    /* readonly attribute double ClientRSS; */
+    double GetClientRSS() const;
+
     NPObject *GetScriptablePeer();
+
+    NPObject *CreateSession();
+    void ReleaseSession(nsPluginInstance *aSession);
+    nsPluginInstance *GetParent() const { return m_parent; }
     
     void OnSpiceClientExit(int exit_code);
+    void OnSpiceClientRestart(unsigned int attempt, unsigned int delay);
+    void OnSpiceClientRestarted();
+    void OnSpiceClientHealth(bool degraded);
+    void OnSharedSessionEnd(int exit_code);
 
 private:
     void WriteToPipe(const void *data, uint32_t size);
@@ -182,18 +250,39 @@ private:
     void SendMsg(uint32_t id);
     void SendValue(uint32_t id, uint32_t value);
     void SendStr(uint32_t id, std::string str);
+    void SendData(uint32_t id, const std::string &data);
     void SendBool(uint32_t id, bool value);
-    void CallOnDisconnected(int code);
+    static void AutoConnect(void *aPlugin);
+    static void ConnectQueued(void *aPlugin);
+    struct PendingConnect;
+    static void AwaitClient(PendingConnect *pending);
+    static gpointer WaitForClient(gpointer data);
+    static void ResumeConnect(void *aPlugin);
+    void FinishConnect(PendingConnect *pending);
   
 private:
-    bool CreateTrustStoreFile(const std::string &trust_store);
-    bool RemoveTrustStoreFile();
+    bool CreateTrustStoreFile(GBytes *trust_store);
+    SpiceController *GetController();
+    void ConfigureController();
+    bool TakeOverHandoff();
+    nsPluginInstance *FindSession(unsigned int aId);
+    bool SharesSession() const;
+    bool HandOffPreConnect(PreConnect &preconnect);
 
     int32_t m_connected_status;
     SpiceController *m_external_controller;
+    bool m_connect_after_load;
+    // read by the client thread once the client exited
+    volatile gint m_connect_queued;
+    // set while connect() waits for the client off the main thread
+    PendingConnect *m_pending_connect;
 
     NPP m_instance;
     NPBool m_initialized;
+    EventDispatcher m_events;
+    // AutoConnect(), ConnectQueued() and ResumeConnect(), which must not
+    // outlive a session
+    AsyncCaller m_async;
     
     NPWindow *m_window;
     std::string m_host_ip;
@@ -202,7 +291,8 @@ private:
     std::string m_secure_port;
     std::string m_cipher_suite;
     std::string m_ssl_channels;
-    std::string m_trust_store;
+    GBytes *m_trust_store;
+    std::string m_trust_store_path;
     std::string m_host_subject;
     bool m_fullscreen;
     bool m_smartcard;
@@ -220,9 +310,28 @@ private:
     std::string m_color_depth;
     std::string m_disable_effects;
     std::string m_proxy;
+    bool m_shared_session;
+    bool m_reload_handoff;
+    // of the running client, and of the one handed over by the page we
+    // replace until connect() tells whether it is wanted
+    std::string m_session_key;
+    std::string m_handoff_key;
+    bool m_preconnect;
+    volatile gint m_preconnect_error;
+    bool m_auto_restart;
+    uint32_t m_heartbeat_interval;
+    uint32_t m_heartbeat_timeout;
+    bool m_heartbeat_restart;
     
     NPObject *m_scriptable_peer;
     std::string m_trust_store_file;
+
+    // sessions are owned by the embed's instance, see CreateSession()
+    nsPluginInstance *m_parent;
+    std::set<nsPluginInstance *> m_sessions;
+    // 0 for the embed, names the target of a connection file
+    unsigned int m_session_id;
+    unsigned int m_last_session_id;
 };
 
 #endif // PLUGIN_H
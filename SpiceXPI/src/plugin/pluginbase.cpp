@@ -127,3 +127,9 @@ NPError nsPluginInstanceBase::SetValue(NPNVariable variable, void *value)
     NS_UNUSED(value);
     return NPERR_NO_ERROR;
 }
+
+NPError nsPluginInstanceBase::SaveData(NPSavedData **save)
+{
+    NS_UNUSED(save);
+    return NPERR_NO_ERROR;
+}
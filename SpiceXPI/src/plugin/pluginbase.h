@@ -85,6 +85,9 @@ public:
                            void *notifyData);
     virtual NPError GetValue(NPPVariable variable, void *value);
     virtual NPError SetValue(NPNVariable variable, void *value);
+    // called before shut(), *save is handed to the next instance of the
+    // page as nsPluginCreateData::saved
+    virtual NPError SaveData(NPSavedData **save);
 };
 
 // functions that should be implemented for each specific plugin
@@ -0,0 +1,573 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ *   Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ *   The contents of this file are subject to the Mozilla Public License Version
+ *   1.1 (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.mozilla.org/MPL/
+ *
+ *   Software distributed under the License is distributed on an "AS IS" basis,
+ *   WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ *   for the specific language governing rights and limitations under the
+ *   License.
+ *
+ *   Copyright 2013, Red Hat Inc.
+ *
+ *   Alternatively, the contents of this file may be used under the terms of
+ *   either the GNU General Public License Version 2 or later (the "GPL"), or
+ *   the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ *   in which case the provisions of the GPL or the LGPL are applicable instead
+ *   of those above. If you wish to allow use of your version of this file only
+ *   under the terms of either the GPL or the LGPL, and not to allow others to
+ *   use your version of this file under the terms of the MPL, indicate your
+ *   decision by deleting the provisions above and replace them with the notice
+ *   and other provisions required by the GPL or the LGPL. If you do not delete
+ *   the provisions above, a recipient may use your version of this file under
+ *   the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+#include "config.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <glib.h>
+#include <gio/gio.h>
+
+#if !defined(XP_WIN)
+extern "C" {
+#  include <unistd.h>
+#  include <fcntl.h>
+#  include <poll.h>
+#  include <sys/socket.h>
+#  include <netinet/in.h>
+}
+#endif
+
+#include "hostresolver.h"
+#include "preconnect.h"
+
+// delay between starting two connection attempts
+#define PRECONNECT_ATTEMPT_DELAY 250
+// give up on the whole race after this many ms
+#define PRECONNECT_TIMEOUT 10000
+// granularity of the cancellation checks
+#define PRECONNECT_POLL_SLICE 100
+// how long a connected plain socket waits for a TLS one still in flight
+#define PRECONNECT_SECURE_GRACE 100
+// an HTTP proxy is the default for SPICE_PROXY, spice-gtk uses this port
+#define PRECONNECT_PROXY_PORT 3128
+// longest proxy reply header accepted
+#define PRECONNECT_MAX_REPLY 8192
+
+struct PreConnect::State {
+    volatile gint refcount;
+    volatile gint cancelled;
+    std::string host;
+    int port;
+    int secure_port;
+    std::string proxy_host;
+    int proxy_port;
+    // base64 of user:password, if any
+    std::string proxy_auth;
+
+    GMutex lock;
+    GCond cond;
+    Result result;
+    int fd;
+    bool secure;
+};
+
+#if !defined(XP_WIN)
+struct PreConnect::Candidate {
+    struct sockaddr_storage addr;
+    socklen_t len;
+    bool secure;
+    int fd;
+};
+
+namespace {
+    bool fillAddress(GInetAddress *address, int port, struct sockaddr_storage *addr,
+                     socklen_t *len)
+    {
+        memset(addr, 0, sizeof(*addr));
+
+        if (g_inet_address_get_family(address) == G_SOCKET_FAMILY_IPV6) {
+            struct sockaddr_in6 *in6 = reinterpret_cast<struct sockaddr_in6 *>(addr);
+            in6->sin6_family = AF_INET6;
+            in6->sin6_port = htons(port);
+            memcpy(&in6->sin6_addr, g_inet_address_to_bytes(address), sizeof(in6->sin6_addr));
+            *len = sizeof(*in6);
+        } else if (g_inet_address_get_family(address) == G_SOCKET_FAMILY_IPV4) {
+            struct sockaddr_in *in4 = reinterpret_cast<struct sockaddr_in *>(addr);
+            in4->sin_family = AF_INET;
+            in4->sin_port = htons(port);
+            memcpy(&in4->sin_addr, g_inet_address_to_bytes(address), sizeof(in4->sin_addr));
+            *len = sizeof(*in4);
+        } else {
+            return false;
+        }
+
+        return true;
+    }
+
+    int startConnect(const struct sockaddr_storage &addr, socklen_t len)
+    {
+        int fd = socket(addr.ss_family, SOCK_STREAM, 0);
+        if (fd == -1)
+            return -1;
+
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        if (connect(fd, reinterpret_cast<const struct sockaddr *>(&addr), len) == -1 &&
+            errno != EINPROGRESS) {
+            close(fd);
+            return -1;
+        }
+
+        return fd;
+    }
+}
+#endif
+
+PreConnect::PreConnect(const std::string &host, int port, int secure_port):
+    m_state(new State)
+{
+    m_state->refcount = 1;
+    m_state->cancelled = 0;
+    m_state->host = host;
+    m_state->port = port;
+    m_state->secure_port = secure_port;
+    m_state->proxy_port = 0;
+    m_state->result = RESULT_PENDING;
+    m_state->fd = -1;
+    m_state->secure = false;
+    g_mutex_init(&m_state->lock);
+    g_cond_init(&m_state->cond);
+}
+
+// does not wait for the worker, a lookup in progress cannot be interrupted
+PreConnect::~PreConnect()
+{
+    g_atomic_int_set(&m_state->cancelled, 1);
+    Unref(m_state);
+}
+
+void PreConnect::Unref(State *state)
+{
+    if (!g_atomic_int_dec_and_test(&state->refcount))
+        return;
+
+#if !defined(XP_WIN)
+    if (state->fd != -1)
+        close(state->fd);
+#endif
+    g_cond_clear(&state->cond);
+    g_mutex_clear(&state->lock);
+    delete state;
+}
+
+// [http://][user[:password]@]host[:port], as SPICE_PROXY
+bool PreConnect::SetProxy(const std::string &proxy)
+{
+    std::string spec = proxy;
+
+    if (spec.empty())
+        return true;
+
+    if (g_ascii_strncasecmp(spec.c_str(), "http://", 7) == 0)
+        spec.erase(0, 7);
+    else if (spec.find("://") != std::string::npos)
+        return false;
+    spec = spec.substr(0, spec.find('/'));
+
+    std::string::size_type at = spec.rfind('@');
+    if (at != std::string::npos) {
+        gchar *userinfo = g_uri_unescape_string(spec.substr(0, at).c_str(), NULL);
+        if (userinfo == NULL)
+            return false;
+        gchar *auth = g_base64_encode(reinterpret_cast<const guchar *>(userinfo),
+                                      strlen(userinfo));
+        m_state->proxy_auth = auth;
+        g_free(auth);
+        g_free(userinfo);
+        spec.erase(0, at + 1);
+    }
+
+    std::string::size_type colon;
+    if (!spec.empty() && spec[0] == '[') {
+        std::string::size_type end = spec.find(']');
+        if (end == std::string::npos)
+            return false;
+        m_state->proxy_host = spec.substr(1, end - 1);
+        colon = spec.find(':', end);
+    } else {
+        colon = spec.find(':');
+        m_state->proxy_host = spec.substr(0, colon);
+    }
+    m_state->proxy_port = PRECONNECT_PROXY_PORT;
+    if (colon != std::string::npos)
+        m_state->proxy_port = atoi(spec.c_str() + colon + 1);
+
+    return !m_state->proxy_host.empty() && m_state->proxy_port > 0;
+}
+
+bool PreConnect::Start()
+{
+#if defined(XP_WIN)
+    // a socket cannot be passed over the named pipe
+    return false;
+#else
+    g_atomic_int_inc(&m_state->refcount);
+    GThread *thread = g_thread_try_new("spice-xpi preconnect", Run, m_state, NULL);
+    if (thread == NULL) {
+        Unref(m_state);
+        return false;
+    }
+    g_thread_unref(thread);
+
+    return true;
+#endif
+}
+
+PreConnect::Result PreConnect::Wait(gint64 timeout)
+{
+    Result result;
+    gint64 end_time = g_get_monotonic_time() + timeout;
+
+    g_mutex_lock(&m_state->lock);
+    while (m_state->result == RESULT_PENDING)
+        if (!g_cond_wait_until(&m_state->cond, &m_state->lock, end_time))
+            break;
+    result = m_state->result;
+    g_mutex_unlock(&m_state->lock);
+
+    return result;
+}
+
+int PreConnect::TakeSocket()
+{
+    int fd;
+
+    g_mutex_lock(&m_state->lock);
+    fd = m_state->fd;
+    m_state->fd = -1;
+    g_mutex_unlock(&m_state->lock);
+
+    return fd;
+}
+
+bool PreConnect::IsSecure()
+{
+    bool secure;
+
+    g_mutex_lock(&m_state->lock);
+    secure = m_state->secure;
+    g_mutex_unlock(&m_state->lock);
+
+    return secure;
+}
+
+void PreConnect::Finish(State *state, Result result, int fd, bool secure)
+{
+    g_mutex_lock(&state->lock);
+    state->result = result;
+    state->fd = fd;
+    state->secure = secure;
+    g_cond_broadcast(&state->cond);
+    g_mutex_unlock(&state->lock);
+}
+
+#if !defined(XP_WIN)
+gpointer PreConnect::Run(gpointer data)
+{
+    State *state = static_cast<State *>(data);
+
+    Race(state);
+    Unref(state);
+    return NULL;
+}
+
+namespace {
+    // sorted by preference by the resolver, alternate the address families
+    std::vector<GInetAddress *> interleaveFamilies(GList *addresses)
+    {
+        std::vector<GInetAddress *> first, second, ordered;
+        GSocketFamily first_family = g_inet_address_get_family(static_cast<GInetAddress *>(addresses->data));
+
+        for (GList *it = addresses; it != NULL; it = it->next) {
+            GInetAddress *address = static_cast<GInetAddress *>(it->data);
+            (g_inet_address_get_family(address) == first_family ? first : second).push_back(address);
+        }
+        for (size_t i = 0; i < first.size() || i < second.size(); ++i) {
+            if (i < first.size())
+                ordered.push_back(first[i]);
+            if (i < second.size())
+                ordered.push_back(second[i]);
+        }
+
+        return ordered;
+    }
+
+    // from the cache HostResolver filled when the page set the host, if
+    // it is done by now
+    GList *resolve(const std::string &host)
+    {
+        std::vector<std::string> cached;
+        if (HostResolver::Lookup(host, cached)) {
+            GList *addresses = NULL;
+            for (size_t i = cached.size(); i > 0; --i) {
+                GInetAddress *address = g_inet_address_new_from_string(cached[i - 1].c_str());
+                if (address != NULL)
+                    addresses = g_list_prepend(addresses, address);
+            }
+            if (addresses != NULL)
+                return addresses;
+        }
+
+        GResolver *resolver = g_resolver_get_default();
+        GList *addresses = g_resolver_lookup_by_name(resolver, host.c_str(), NULL, NULL);
+        g_object_unref(resolver);
+
+        return addresses;
+    }
+}
+
+// the secure port is preferred, like the client does
+void PreConnect::AddCandidates(std::vector<Candidate> &candidates, GList *addresses,
+                               int port, int secure_port)
+{
+    std::vector<GInetAddress *> ordered = interleaveFamilies(addresses);
+
+    for (size_t i = 0; i < ordered.size(); ++i) {
+        Candidate candidate;
+        candidate.fd = -1;
+        if (secure_port > 0 &&
+            fillAddress(ordered[i], secure_port, &candidate.addr, &candidate.len)) {
+            candidate.secure = true;
+            candidates.push_back(candidate);
+        }
+        if (port > 0 && fillAddress(ordered[i], port, &candidate.addr, &candidate.len)) {
+            candidate.secure = false;
+            candidates.push_back(candidate);
+        }
+    }
+}
+
+// returns the first connected socket, in blocking mode, or -1; a TLS one
+// connecting shortly after a plain one still wins
+int PreConnect::RaceCandidates(State *state, std::vector<Candidate> &candidates,
+                               gint64 deadline, bool *secure)
+{
+    size_t next = 0;
+    int winner = -1;
+    // a connected plain socket, held back while a TLS one may follow
+    int fallback = -1;
+    gint64 fallback_deadline = 0;
+    gint64 now = g_get_monotonic_time();
+    gint64 next_attempt = now;
+
+    while (winner == -1 && !g_atomic_int_get(&state->cancelled) && now < deadline) {
+        std::vector<struct pollfd> fds;
+        std::vector<size_t> index;
+        bool secure_pending = false;
+
+        for (size_t i = 0; i < next; ++i) {
+            if (candidates[i].fd == -1 || (int)i == fallback)
+                continue;
+            struct pollfd pfd = {candidates[i].fd, POLLOUT, 0};
+            fds.push_back(pfd);
+            index.push_back(i);
+            secure_pending = secure_pending || candidates[i].secure;
+        }
+        if (fallback != -1 && (!secure_pending || now >= fallback_deadline)) {
+            winner = fallback;
+            break;
+        }
+        // start the next attempt when it is due or when nothing is in
+        // flight; none once a plain socket is connected
+        if (fallback == -1 && next < candidates.size() &&
+            (fds.empty() || now >= next_attempt)) {
+            candidates[next].fd = startConnect(candidates[next].addr, candidates[next].len);
+            next_attempt = now + PRECONNECT_ATTEMPT_DELAY * 1000;
+            ++next;
+            continue;
+        }
+        if (fds.empty())
+            break;
+
+        int timeout = PRECONNECT_POLL_SLICE;
+        if (fallback != -1)
+            timeout = MIN(timeout, (int)((fallback_deadline - now) / 1000) + 1);
+        else if (next < candidates.size())
+            timeout = MIN(timeout, (int)((next_attempt - now) / 1000) + 1);
+        if (poll(&fds[0], fds.size(), timeout) > 0) {
+            for (size_t i = 0; i < fds.size(); ++i) {
+                if (fds[i].revents == 0)
+                    continue;
+                Candidate &candidate = candidates[index[i]];
+                int error = 0;
+                socklen_t len = sizeof(error);
+                getsockopt(candidate.fd, SOL_SOCKET, SO_ERROR, &error, &len);
+                if (error == 0 && winner == -1 && candidate.secure) {
+                    winner = index[i];
+                } else if (error == 0 && winner == -1 && fallback == -1) {
+                    fallback = index[i];
+                    fallback_deadline = g_get_monotonic_time() + PRECONNECT_SECURE_GRACE * 1000;
+                } else {
+                    close(candidate.fd);
+                    candidate.fd = -1;
+                }
+            }
+        }
+        now = g_get_monotonic_time();
+    }
+    if (winner == -1)
+        winner = fallback;
+
+    for (size_t i = 0; i < candidates.size(); ++i)
+        if (candidates[i].fd != -1 && (int)i != winner)
+            close(candidates[i].fd);
+
+    if (winner == -1)
+        return -1;
+
+    int fd = candidates[winner].fd;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    *secure = candidates[winner].secure;
+
+    return fd;
+}
+
+// Asks the proxy to open a tunnel to the server. Reads the reply one
+// byte at a time, nothing past the header may be consumed: it belongs
+// to the client. Returns the status of the reply, 0 if there was none.
+int PreConnect::Tunnel(State *state, int fd, int port, bool auth, gint64 deadline)
+{
+    std::string target = state->host;
+    if (target.find(':') != std::string::npos)
+        target = "[" + target + "]";
+    gchar *authority = g_strdup_printf("%s:%d", target.c_str(), port);
+    std::string request = std::string("CONNECT ") + authority + " HTTP/1.1\r\n"
+        "Host: " + authority + "\r\n";
+    g_free(authority);
+    if (auth)
+        request += "Proxy-Authorization: Basic " + state->proxy_auth + "\r\n";
+    request += "\r\n";
+
+    if (send(fd, request.data(), request.length(), MSG_NOSIGNAL) != (ssize_t)request.length())
+        return 0;
+
+    std::string reply;
+    while (reply.length() < PRECONNECT_MAX_REPLY &&
+           (reply.length() < 4 || reply.compare(reply.length() - 4, 4, "\r\n\r\n") != 0)) {
+        gint64 now = g_get_monotonic_time();
+        if (g_atomic_int_get(&state->cancelled) || now >= deadline)
+            return 0;
+
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, PRECONNECT_POLL_SLICE) <= 0)
+            continue;
+
+        char c;
+        if (recv(fd, &c, 1, 0) != 1)
+            return 0;
+        reply += c;
+    }
+
+    // "HTTP/1.1 200 Connection established"
+    int status = 0;
+    if (sscanf(reply.c_str(), "HTTP/%*d.%*d %d", &status) != 1)
+        return 0;
+
+    return status;
+}
+
+// runs on the worker thread
+void PreConnect::Race(State *state)
+{
+    std::vector<Candidate> candidates;
+    gint64 deadline = g_get_monotonic_time() + PRECONNECT_TIMEOUT * 1000;
+    bool secure = false;
+    int fd;
+
+    if (!state->proxy_host.empty()) {
+        RaceProxy(state, deadline);
+        return;
+    }
+
+    GList *addresses = resolve(state->host);
+    if (addresses == NULL) {
+        Finish(state, RESULT_HOST_NOT_FOUND, -1, false);
+        return;
+    }
+    AddCandidates(candidates, addresses, state->port, state->secure_port);
+    g_resolver_free_addresses(addresses);
+
+    fd = RaceCandidates(state, candidates, deadline, &secure);
+    if (fd == -1) {
+        Finish(state, RESULT_FAILED, -1, false);
+        return;
+    }
+
+    g_debug("pre-connected to %s on the %s port", state->host.c_str(),
+            secure ? "secure" : "plain");
+    Finish(state, RESULT_CONNECTED, fd, secure);
+}
+
+// The server name is resolved by the proxy, so a refused tunnel is not
+// told apart from an unknown host. Each tunnel costs a proxy connection;
+// the secure port is tried first.
+void PreConnect::RaceProxy(State *state, gint64 deadline)
+{
+    std::vector<Candidate> proxies;
+    GList *addresses = resolve(state->proxy_host);
+    if (addresses == NULL) {
+        g_warning("pre-connect: proxy %s not found", state->proxy_host.c_str());
+        Finish(state, RESULT_FAILED, -1, false);
+        return;
+    }
+    AddCandidates(proxies, addresses, state->proxy_port, 0);
+    g_resolver_free_addresses(addresses);
+
+    const int ports[] = { state->secure_port, state->port };
+    // credentials only go to a proxy which asked for them with a 407
+    bool auth = false;
+    for (size_t i = 0; i < G_N_ELEMENTS(ports); ++i) {
+        if (ports[i] <= 0)
+            continue;
+
+        std::vector<Candidate> candidates(proxies);
+        bool unused;
+        int fd = RaceCandidates(state, candidates, deadline, &unused);
+        if (fd == -1)
+            break;
+        int status = Tunnel(state, fd, ports[i], auth, deadline);
+        if (status == 407 && !auth && !state->proxy_auth.empty()) {
+            // the proxy may close the connection after the 407, ask again
+            // on a new one
+            close(fd);
+            auth = true;
+            candidates = proxies;
+            fd = RaceCandidates(state, candidates, deadline, &unused);
+            if (fd == -1)
+                break;
+            status = Tunnel(state, fd, ports[i], auth, deadline);
+        }
+        if (status / 100 == 2) {
+            g_debug("pre-connected to %s on the %s port through %s", state->host.c_str(),
+                    i == 0 ? "secure" : "plain", state->proxy_host.c_str());
+            Finish(state, RESULT_CONNECTED, fd, i == 0);
+            return;
+        }
+        if (status != 0)
+            g_warning("pre-connect: proxy %s refused a tunnel to port %d (%d)",
+                      state->proxy_host.c_str(), ports[i], status);
+        close(fd);
+    }
+
+    Finish(state, RESULT_FAILED, -1, false);
+}
+#endif
@@ -0,0 +1,89 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ *   Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ *   The contents of this file are subject to the Mozilla Public License Version
+ *   1.1 (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.mozilla.org/MPL/
+ *
+ *   Software distributed under the License is distributed on an "AS IS" basis,
+ *   WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ *   for the specific language governing rights and limitations under the
+ *   License.
+ *
+ *   Copyright 2013, Red Hat Inc.
+ *
+ *   Alternatively, the contents of this file may be used under the terms of
+ *   either the GNU General Public License Version 2 or later (the "GPL"), or
+ *   the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ *   in which case the provisions of the GPL or the LGPL are applicable instead
+ *   of those above. If you wish to allow use of your version of this file only
+ *   under the terms of either the GPL or the LGPL, and not to allow others to
+ *   use your version of this file under the terms of the MPL, indicate your
+ *   decision by deleting the provisions above and replace them with the notice
+ *   and other provisions required by the GPL or the LGPL. If you do not delete
+ *   the provisions above, a recipient may use your version of this file under
+ *   the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef PRECONNECT_H
+#define PRECONNECT_H
+
+/*
+    Races TCP connections to all addresses of the host on the secure and
+    plain port (Happy Eyeballs, RFC 8305: a new attempt every
+    PRECONNECT_ATTEMPT_DELAY ms, address families interleaved) on a
+    worker thread, while the client is being spawned. With a proxy, the
+    race is to the proxy, and an HTTP CONNECT tunnel to the server is set
+    up over the winner. The resulting socket is handed to the client, see
+    controller-preconnect.h; a failure is known in seconds instead of
+    after the client times out.
+*/
+
+#include <string>
+#include <vector>
+#include <glib.h>
+
+class PreConnect
+{
+public:
+    enum Result {
+        RESULT_PENDING,
+        RESULT_CONNECTED,
+        RESULT_HOST_NOT_FOUND,
+        RESULT_FAILED
+    };
+
+    PreConnect(const std::string &host, int port, int secure_port);
+    ~PreConnect();
+
+    // before Start(); false if the proxy cannot be handled here
+    bool SetProxy(const std::string &proxy);
+    bool Start();
+    // blocks for up to timeout microseconds
+    Result Wait(gint64 timeout);
+    // the caller owns the socket afterwards
+    int TakeSocket();
+    bool IsSecure();
+
+private:
+    struct Candidate;
+    // shared with the worker, which may outlive us while it resolves
+    struct State;
+
+    static gpointer Run(gpointer data);
+    static void Race(State *state);
+    static void RaceProxy(State *state, gint64 deadline);
+    static void AddCandidates(std::vector<Candidate> &candidates, GList *addresses,
+                              int port, int secure_port);
+    static int RaceCandidates(State *state, std::vector<Candidate> &candidates,
+                              gint64 deadline, bool *secure);
+    static int Tunnel(State *state, int fd, int port, bool auth, gint64 deadline);
+    static void Finish(State *state, Result result, int fd, bool secure);
+    static void Unref(State *state);
+
+    State *m_state;
+};
+
+#endif // PRECONNECT_H
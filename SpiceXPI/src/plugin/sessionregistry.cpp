@@ -0,0 +1,170 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ *   Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ *   The contents of this file are subject to the Mozilla Public License Version
+ *   1.1 (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.mozilla.org/MPL/
+ *
+ *   Software distributed under the License is distributed on an "AS IS" basis,
+ *   WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ *   for the specific language governing rights and limitations under the
+ *   License.
+ *
+ *   Copyright 2013, Red Hat Inc.
+ *
+ *   Alternatively, the contents of this file may be used under the terms of
+ *   either the GNU General Public License Version 2 or later (the "GPL"), or
+ *   the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ *   in which case the provisions of the GPL or the LGPL are applicable instead
+ *   of those above. If you wish to allow use of your version of this file only
+ *   under the terms of either the GPL or the LGPL, and not to allow others to
+ *   use your version of this file under the terms of the MPL, indicate your
+ *   decision by deleting the provisions above and replace them with the notice
+ *   and other provisions required by the GPL or the LGPL. If you do not delete
+ *   the provisions above, a recipient may use your version of this file under
+ *   the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+#include "config.h"
+
+#include <map>
+#include <set>
+#include <glib.h>
+
+#include "plugin.h"
+#include "sessionregistry.h"
+
+namespace {
+    struct Session {
+        nsPluginInstance *owner;
+        std::set<nsPluginInstance *> attached;
+    };
+    typedef std::map<std::string, Session> SessionMap;
+
+    GMutex registry_lock;
+    // allocated on first use, the library does no static construction
+    SessionMap *sessions = NULL;
+
+    SessionMap &getSessions()
+    {
+        if (sessions == NULL)
+            sessions = new SessionMap();
+        return *sessions;
+    }
+}
+
+std::string SessionRegistry::MakeKey(const std::string &host,
+                                     const std::string &port,
+                                     const std::string &secure_port,
+                                     const std::string &password)
+{
+    gchar *hash = g_compute_checksum_for_string(G_CHECKSUM_SHA256, password.c_str(), -1);
+    std::string key = host + ":" + port + ":" + secure_port + ":" + hash;
+    g_free(hash);
+
+    return key;
+}
+
+void SessionRegistry::Register(const std::string &key, nsPluginInstance *owner)
+{
+    g_mutex_lock(&registry_lock);
+    SessionMap &map = getSessions();
+    if (map.find(key) == map.end()) {
+        Session &session = map[key];
+        session.owner = owner;
+    }
+    g_mutex_unlock(&registry_lock);
+}
+
+nsPluginInstance *SessionRegistry::Attach(const std::string &key, nsPluginInstance *instance)
+{
+    nsPluginInstance *owner = NULL;
+
+    g_mutex_lock(&registry_lock);
+    SessionMap::iterator it = getSessions().find(key);
+    // nobody could raise the client of an orphaned session
+    if (it != getSessions().end() && it->second.owner != NULL &&
+        it->second.owner != instance) {
+        it->second.attached.insert(instance);
+        owner = it->second.owner;
+    }
+    g_mutex_unlock(&registry_lock);
+
+    return owner;
+}
+
+bool SessionRegistry::IsAttached(const nsPluginInstance *instance)
+{
+    bool attached = false;
+
+    g_mutex_lock(&registry_lock);
+    SessionMap &map = getSessions();
+    for (SessionMap::iterator it = map.begin(); !attached && it != map.end(); ++it)
+        attached = it->second.attached.count(const_cast<nsPluginInstance *>(instance)) > 0;
+    g_mutex_unlock(&registry_lock);
+
+    return attached;
+}
+
+void SessionRegistry::Remove(nsPluginInstance *instance, int exit_code)
+{
+    g_mutex_lock(&registry_lock);
+    SessionMap &map = getSessions();
+    SessionMap::iterator it = map.begin();
+    while (it != map.end()) {
+        if (it->second.owner == instance) {
+            // instances remove themselves before going away, so the
+            // attached ones are all alive while we hold the lock
+            std::set<nsPluginInstance *> &attached = it->second.attached;
+            for (std::set<nsPluginInstance *>::iterator a = attached.begin(); a != attached.end(); ++a)
+                (*a)->OnSharedSessionEnd(exit_code);
+            map.erase(it++);
+        } else {
+            it->second.attached.erase(instance);
+            ++it;
+        }
+    }
+    g_mutex_unlock(&registry_lock);
+}
+
+void SessionRegistry::Orphan(nsPluginInstance *owner)
+{
+    g_mutex_lock(&registry_lock);
+    SessionMap &map = getSessions();
+    SessionMap::iterator it = map.begin();
+    while (it != map.end()) {
+        if (it->second.owner != owner) {
+            ++it;
+        } else if (it->second.attached.empty()) {
+            map.erase(it++);
+        } else {
+            it->second.owner = NULL;
+            ++it;
+        }
+    }
+    g_mutex_unlock(&registry_lock);
+}
+
+void SessionRegistry::Adopt(const std::string &key, nsPluginInstance *owner)
+{
+    g_mutex_lock(&registry_lock);
+    SessionMap::iterator it = getSessions().find(key);
+    if (it != getSessions().end() && it->second.owner == NULL)
+        it->second.owner = owner;
+    g_mutex_unlock(&registry_lock);
+}
+
+void SessionRegistry::RemoveOrphan(const std::string &key, int exit_code)
+{
+    g_mutex_lock(&registry_lock);
+    SessionMap &map = getSessions();
+    SessionMap::iterator it = map.find(key);
+    if (it != map.end() && it->second.owner == NULL) {
+        std::set<nsPluginInstance *> &attached = it->second.attached;
+        for (std::set<nsPluginInstance *>::iterator a = attached.begin(); a != attached.end(); ++a)
+            (*a)->OnSharedSessionEnd(exit_code);
+        map.erase(it);
+    }
+    g_mutex_unlock(&registry_lock);
+}
@@ -0,0 +1,69 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ *   Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ *   The contents of this file are subject to the Mozilla Public License Version
+ *   1.1 (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.mozilla.org/MPL/
+ *
+ *   Software distributed under the License is distributed on an "AS IS" basis,
+ *   WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ *   for the specific language governing rights and limitations under the
+ *   License.
+ *
+ *   Copyright 2013, Red Hat Inc.
+ *
+ *   Alternatively, the contents of this file may be used under the terms of
+ *   either the GNU General Public License Version 2 or later (the "GPL"), or
+ *   the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ *   in which case the provisions of the GPL or the LGPL are applicable instead
+ *   of those above. If you wish to allow use of your version of this file only
+ *   under the terms of either the GPL or the LGPL, and not to allow others to
+ *   use your version of this file under the terms of the MPL, indicate your
+ *   decision by deleting the provisions above and replace them with the notice
+ *   and other provisions required by the GPL or the LGPL. If you do not delete
+ *   the provisions above, a recipient may use your version of this file under
+ *   the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef SESSION_REGISTRY_H
+#define SESSION_REGISTRY_H
+
+/*
+    Process-wide registry of running clients, so that a second embed
+    connecting to the same VM raises the existing client instead of
+    starting another one. A session is keyed by host, ports and a hash
+    of the password; the instance that started the client owns it and
+    the others are attached to it until it ends.
+*/
+
+#include <string>
+
+class nsPluginInstance;
+
+class SessionRegistry
+{
+public:
+    static std::string MakeKey(const std::string &host,
+                               const std::string &port,
+                               const std::string &secure_port,
+                               const std::string &password);
+
+    static void Register(const std::string &key, nsPluginInstance *owner);
+    // returns the owner the instance got attached to, or NULL
+    static nsPluginInstance *Attach(const std::string &key, nsPluginInstance *instance);
+    static bool IsAttached(const nsPluginInstance *instance);
+    // may be called from any thread; attached instances of a removed
+    // owner get OnSharedSessionEnd()
+    static void Remove(nsPluginInstance *instance, int exit_code);
+
+    // The client of owner was handed over, see HandoffRegistry: its
+    // session stays, without an owner, until the next instance of the
+    // page adopts it or the handoff expires.
+    static void Orphan(nsPluginInstance *owner);
+    static void Adopt(const std::string &key, nsPluginInstance *owner);
+    static void RemoveOrphan(const std::string &key, int exit_code);
+};
+
+#endif // SESSION_REGISTRY_H
@@ -0,0 +1,144 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ *   Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ *   The contents of this file are subject to the Mozilla Public License Version
+ *   1.1 (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.mozilla.org/MPL/
+ *
+ *   Software distributed under the License is distributed on an "AS IS" basis,
+ *   WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ *   for the specific language governing rights and limitations under the
+ *   License.
+ *
+ *   Copyright 2013, Red Hat Inc.
+ *
+ *   Alternatively, the contents of this file may be used under the terms of
+ *   either the GNU General Public License Version 2 or later (the "GPL"), or
+ *   the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ *   in which case the provisions of the GPL or the LGPL are applicable instead
+ *   of those above. If you wish to allow use of your version of this file only
+ *   under the terms of either the GPL or the LGPL, and not to allow others to
+ *   use your version of this file under the terms of the MPL, indicate your
+ *   decision by deleting the provisions above and replace them with the notice
+ *   and other provisions required by the GPL or the LGPL. If you do not delete
+ *   the provisions above, a recipient may use your version of this file under
+ *   the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+#include "config.h"
+
+#include <deque>
+#include <map>
+#include <sstream>
+#include <glib.h>
+
+#include "tlssessioncache.h"
+
+// servers usually accept tickets for much longer, stay on the safe side
+#define TLS_SESSION_TTL      600
+#define TLS_SESSION_PER_KEY  4
+#define TLS_SESSION_MAX_KEYS 64
+
+namespace {
+    struct Session {
+        std::string data;
+        gint64 expires;
+    };
+    typedef std::deque<Session> SessionList;
+    typedef std::map<std::string, SessionList> Cache;
+
+    GMutex cache_lock;
+    // allocated on first use, the library does no static construction
+    Cache *cache = NULL;
+
+    void expire(SessionList &sessions, gint64 now)
+    {
+        while (!sessions.empty() && sessions.front().expires <= now)
+            sessions.pop_front();
+    }
+
+    // makes room for a new server
+    void prune(gint64 now)
+    {
+        Cache::iterator it = cache->begin();
+        while (it != cache->end()) {
+            expire(it->second, now);
+            if (it->second.empty())
+                cache->erase(it++);
+            else
+                ++it;
+        }
+
+        // still full, drop the server whose sessions expire first
+        while (cache->size() >= TLS_SESSION_MAX_KEYS) {
+            Cache::iterator oldest = cache->begin();
+            for (it = cache->begin(); it != cache->end(); ++it)
+                if (it->second.back().expires < oldest->second.back().expires)
+                    oldest = it;
+            cache->erase(oldest);
+        }
+    }
+}
+
+std::string TlsSessionCache::MakeKey(const std::string &host, int port,
+                                     const std::string &subject)
+{
+    std::ostringstream key;
+
+    // the subject may contain anything but a newline
+    key << host << '\n' << port << '\n' << subject;
+    return key.str();
+}
+
+bool TlsSessionCache::Take(const std::string &key, std::string &session)
+{
+    bool found = false;
+
+    g_mutex_lock(&cache_lock);
+    if (cache != NULL) {
+        Cache::iterator it = cache->find(key);
+        if (it != cache->end()) {
+            expire(it->second, g_get_monotonic_time());
+            if (!it->second.empty()) {
+                session = it->second.back().data;
+                it->second.pop_back();
+                found = true;
+            }
+            if (it->second.empty())
+                cache->erase(it);
+        }
+    }
+    g_mutex_unlock(&cache_lock);
+
+    return found;
+}
+
+void TlsSessionCache::Store(const std::string &key, const void *data, size_t size)
+{
+    gint64 now = g_get_monotonic_time();
+    Session session;
+
+    session.data.assign(static_cast<const char *>(data), size);
+    session.expires = now + TLS_SESSION_TTL * G_USEC_PER_SEC;
+
+    g_mutex_lock(&cache_lock);
+    if (cache == NULL)
+        cache = new Cache();
+    if (cache->find(key) == cache->end() && cache->size() >= TLS_SESSION_MAX_KEYS)
+        prune(now);
+
+    SessionList &sessions = (*cache)[key];
+    sessions.push_back(session);
+    if (sessions.size() > TLS_SESSION_PER_KEY)
+        sessions.pop_front();
+    g_mutex_unlock(&cache_lock);
+}
+
+void TlsSessionCache::Shutdown()
+{
+    g_mutex_lock(&cache_lock);
+    delete cache;
+    cache = NULL;
+    g_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,54 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ *   Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ *   The contents of this file are subject to the Mozilla Public License Version
+ *   1.1 (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.mozilla.org/MPL/
+ *
+ *   Software distributed under the License is distributed on an "AS IS" basis,
+ *   WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ *   for the specific language governing rights and limitations under the
+ *   License.
+ *
+ *   Copyright 2013, Red Hat Inc.
+ *
+ *   Alternatively, the contents of this file may be used under the terms of
+ *   either the GNU General Public License Version 2 or later (the "GPL"), or
+ *   the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ *   in which case the provisions of the GPL or the LGPL are applicable instead
+ *   of those above. If you wish to allow use of your version of this file only
+ *   under the terms of either the GPL or the LGPL, and not to allow others to
+ *   use your version of this file under the terms of the MPL, indicate your
+ *   decision by deleting the provisions above and replace them with the notice
+ *   and other provisions required by the GPL or the LGPL. If you do not delete
+ *   the provisions above, a recipient may use your version of this file under
+ *   the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef TLS_SESSION_CACHE_H
+#define TLS_SESSION_CACHE_H
+
+/*
+    Process-wide cache of the TLS sessions the clients send back, see
+    controller-tls-session.h. A few sessions are kept per server for
+    TLS_SESSION_TTL seconds, so that a burst of reconnects (e.g. after the
+    portal page is reloaded) gets abbreviated handshakes.
+*/
+
+#include <string>
+
+class TlsSessionCache
+{
+public:
+    static std::string MakeKey(const std::string &host, int port, const std::string &subject);
+    // removes the newest session of the server from the cache
+    static bool Take(const std::string &key, std::string &session);
+    // may be called from any thread
+    static void Store(const std::string &key, const void *data, size_t size);
+    // the library is about to be unloaded
+    static void Shutdown();
+};
+
+#endif // TLS_SESSION_CACHE_H
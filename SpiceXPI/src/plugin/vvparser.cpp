@@ -0,0 +1,262 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ *   Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ *   The contents of this file are subject to the Mozilla Public License Version
+ *   1.1 (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.mozilla.org/MPL/
+ *
+ *   Software distributed under the License is distributed on an "AS IS" basis,
+ *   WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ *   for the specific language governing rights and limitations under the
+ *   License.
+ *
+ *   Copyright 2013, Red Hat Inc.
+ *
+ *   Alternatively, the contents of this file may be used under the terms of
+ *   either the GNU General Public License Version 2 or later (the "GPL"), or
+ *   the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ *   in which case the provisions of the GPL or the LGPL are applicable instead
+ *   of those above. If you wish to allow use of your version of this file only
+ *   under the terms of either the GPL or the LGPL, and not to allow others to
+ *   use your version of this file under the terms of the MPL, indicate your
+ *   decision by deleting the provisions above and replace them with the notice
+ *   and other provisions required by the GPL or the LGPL. If you do not delete
+ *   the provisions above, a recipient may use your version of this file under
+ *   the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#include "config.h"
+
+#include <cstring>
+#include <glib.h>
+
+#include "vvparser.h"
+#include "plugin.h"
+
+namespace {
+    // a .vv file is small; refuse to buffer runaway lines from a bogus stream
+    const size_t MAX_LINE_LENGTH = 64 * 1024;
+
+    bool valueToBool(const std::string &value)
+    {
+        return (value == "1" || g_ascii_strcasecmp(value.c_str(), "true") == 0);
+    }
+
+    std::string strip(const std::string &str)
+    {
+        const char *ws = " \t\r";
+        size_t begin = str.find_first_not_of(ws);
+        if (begin == std::string::npos)
+            return std::string();
+        size_t end = str.find_last_not_of(ws);
+        return str.substr(begin, end - begin + 1);
+    }
+}
+
+VVFileParser::VVFileParser(nsPluginInstance *aPlugin):
+    m_plugin(aPlugin),
+    m_failed(false)
+{
+}
+
+VVFileParser::~VVFileParser()
+{
+}
+
+bool VVFileParser::Feed(const char *data, size_t len)
+{
+    if (m_failed)
+        return false;
+
+    const char *end = data + len;
+    while (data < end)
+    {
+        const char *eol = static_cast<const char *>(memchr(data, '\n', end - data));
+        const char *stop = (eol != NULL) ? eol : end;
+
+        if (m_line.length() + (stop - data) > MAX_LINE_LENGTH)
+        {
+            g_warning("connection file line exceeds %u bytes, giving up",
+                      (unsigned int) MAX_LINE_LENGTH);
+            m_failed = true;
+            return false;
+        }
+
+        m_line.append(data, stop - data);
+        if (eol == NULL)
+            break;
+        data = eol + 1;
+
+        if (!ParseLine(m_line))
+            return false;
+        m_line.clear();
+    }
+
+    return true;
+}
+
+bool VVFileParser::Finish()
+{
+    if (!m_failed && !m_line.empty())
+    {
+        ParseLine(m_line);
+        m_line.clear();
+    }
+
+    if (m_failed)
+        return false;
+
+    for (size_t i = 0; i < m_values.size(); ++i)
+        ApplyKey(m_values[i].first, m_values[i].second);
+
+    if (!m_hotkeys.empty())
+        m_plugin->SetHotKeys(m_hotkeys.c_str());
+
+    return true;
+}
+
+bool VVFileParser::ParseLine(const std::string &raw_line)
+{
+    std::string line = strip(raw_line);
+
+    if (line.empty() || line[0] == '#' || line[0] == ';')
+        return true;
+
+    if (line[0] == '[')
+    {
+        size_t close = line.find(']');
+        if (close == std::string::npos)
+        {
+            g_warning("malformed group in connection file: '%s'", line.c_str());
+            m_failed = true;
+            return false;
+        }
+        m_group = line.substr(1, close - 1);
+        return true;
+    }
+
+    // only the [virt-viewer] group carries connection settings
+    if (m_group != "virt-viewer")
+        return true;
+
+    size_t eq = line.find('=');
+    if (eq == std::string::npos)
+    {
+        g_warning("ignoring malformed line in connection file");
+        return true;
+    }
+
+    SetKey(strip(line.substr(0, eq)), Unescape(strip(line.substr(eq + 1))));
+    return true;
+}
+
+// kept until Finish(), the file may still turn out broken
+void VVFileParser::SetKey(const std::string &key, const std::string &value)
+{
+    m_values.push_back(std::make_pair(key, value));
+}
+
+void VVFileParser::ApplyKey(const std::string &key, const std::string &value)
+{
+    const char *val = value.c_str();
+
+    if (key == "type")
+    {
+        if (value != "spice")
+            g_warning("unsupported connection type '%s'", val);
+    }
+    else if (key == "host")
+        m_plugin->SetHostIP(val);
+    else if (key == "port")
+        m_plugin->SetPort(val);
+    else if (key == "tls-port")
+        m_plugin->SetSecurePort(val);
+    else if (key == "password")
+        m_plugin->SetPassword(val);
+    else if (key == "tls-ciphers")
+        m_plugin->SetCipherSuite(val);
+    else if (key == "secure-channels")
+        m_plugin->SetSSLChannels(ListToCommas(value).c_str());
+    else if (key == "ca")
+        m_plugin->SetTrustStore(val);
+    else if (key == "host-subject")
+        m_plugin->SetHostSubject(val);
+    else if (key == "title")
+        m_plugin->SetTitle(val);
+    else if (key == "fullscreen")
+        m_plugin->SetFullScreen(valueToBool(value));
+    else if (key == "enable-smartcard")
+        m_plugin->SetSmartcard(valueToBool(value));
+    else if (key == "enable-usb-autoshare")
+        m_plugin->SetUsbAutoShare(valueToBool(value));
+    else if (key == "usb-filter")
+        m_plugin->SetUsbFilter(val);
+    else if (key == "color-depth")
+        m_plugin->SetColorDepth(val);
+    else if (key == "disable-effects")
+        m_plugin->SetDisableEffects(ListToCommas(value).c_str());
+    else if (key == "proxy")
+        m_plugin->SetProxy(val);
+    else if (key == "toggle-fullscreen" ||
+             key == "release-cursor" ||
+             key == "secure-attention" ||
+             key == "smartcard-insert" ||
+             key == "smartcard-remove")
+    {
+        // the controller expects all hotkeys in one comma separated string
+        if (!m_hotkeys.empty())
+            m_hotkeys += ",";
+        m_hotkeys += key + "=" + value;
+    }
+    else
+        g_debug("ignoring connection file key '%s'", key.c_str());
+}
+
+// GKeyFile style escapes: \s \n \t \r \\ and list separators kept as-is
+std::string VVFileParser::Unescape(const std::string &value)
+{
+    std::string out;
+    out.reserve(value.length());
+
+    for (size_t i = 0; i < value.length(); ++i)
+    {
+        if (value[i] != '\\' || i + 1 == value.length())
+        {
+            out += value[i];
+            continue;
+        }
+
+        switch (value[++i])
+        {
+        case 's':  out += ' ';  break;
+        case 'n':  out += '\n'; break;
+        case 't':  out += '\t'; break;
+        case 'r':  out += '\r'; break;
+        case '\\': out += '\\'; break;
+        default:
+            out += '\\';
+            out += value[i];
+            break;
+        }
+    }
+
+    return out;
+}
+
+// .vv lists are ';' separated, the controller protocol wants ','
+std::string VVFileParser::ListToCommas(const std::string &value)
+{
+    std::string out(value);
+    if (!out.empty() && out[out.length() - 1] == ';')
+        out.erase(out.length() - 1);
+
+    for (size_t i = 0; i < out.length(); ++i)
+    {
+        if (out[i] == ';')
+            out[i] = ',';
+    }
+
+    return out;
+}
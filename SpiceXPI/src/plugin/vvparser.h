@@ -0,0 +1,72 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ *   Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ *   The contents of this file are subject to the Mozilla Public License Version
+ *   1.1 (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.mozilla.org/MPL/
+ *
+ *   Software distributed under the License is distributed on an "AS IS" basis,
+ *   WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ *   for the specific language governing rights and limitations under the
+ *   License.
+ *
+ *   Copyright 2013, Red Hat Inc.
+ *
+ *   Alternatively, the contents of this file may be used under the terms of
+ *   either the GNU General Public License Version 2 or later (the "GPL"), or
+ *   the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ *   in which case the provisions of the GPL or the LGPL are applicable instead
+ *   of those above. If you wish to allow use of your version of this file only
+ *   under the terms of either the GPL or the LGPL, and not to allow others to
+ *   use your version of this file under the terms of the MPL, indicate your
+ *   decision by deleting the provisions above and replace them with the notice
+ *   and other provisions required by the GPL or the LGPL. If you do not delete
+ *   the provisions above, a recipient may use your version of this file under
+ *   the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef VV_PARSER_H
+#define VV_PARSER_H
+
+/*
+    Incremental parser for virt-viewer connection files (.vv)
+    ----------------------------------------------------------
+    The file is delivered through the NPAPI stream callbacks in chunks of
+    arbitrary size, so data is fed as it arrives. The settings of the
+    [virt-viewer] group are collected and only applied to the plugin
+    instance by Finish(), a broken or cut off file changes nothing.
+*/
+
+#include <string>
+#include <vector>
+#include <utility>
+
+class nsPluginInstance;
+
+class VVFileParser
+{
+public:
+    VVFileParser(nsPluginInstance *aPlugin);
+    ~VVFileParser();
+
+    bool Feed(const char *data, size_t len);
+    bool Finish();
+
+private:
+    bool ParseLine(const std::string &line);
+    void SetKey(const std::string &key, const std::string &value);
+    void ApplyKey(const std::string &key, const std::string &value);
+    static std::string Unescape(const std::string &value);
+    static std::string ListToCommas(const std::string &value);
+
+    nsPluginInstance *m_plugin;
+    std::string m_line;
+    std::string m_group;
+    std::vector<std::pair<std::string, std::string> > m_values;
+    std::string m_hotkeys;
+    bool m_failed;
+};
+
+#endif // VV_PARSER_H
@@ -0,0 +1,59 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ *   Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ *   The contents of this file are subject to the Mozilla Public License Version
+ *   1.1 (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.mozilla.org/MPL/
+ *
+ *   Software distributed under the License is distributed on an "AS IS" basis,
+ *   WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ *   for the specific language governing rights and limitations under the
+ *   License.
+ *
+ *   Copyright 2013, Red Hat Inc.
+ *
+ *   Alternatively, the contents of this file may be used under the terms of
+ *   either the GNU General Public License Version 2 or later (the "GPL"), or
+ *   the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ *   in which case the provisions of the GPL or the LGPL are applicable instead
+ *   of those above. If you wish to allow use of your version of this file only
+ *   under the terms of either the GPL or the LGPL, and not to allow others to
+ *   use your version of this file under the terms of the MPL, indicate your
+ *   decision by deleting the provisions above and replace them with the notice
+ *   and other provisions required by the GPL or the LGPL. If you do not delete
+ *   the provisions above, a recipient may use your version of this file under
+ *   the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+
+#ifndef CONTROLLER_CAPS_H
+#define CONTROLLER_CAPS_H
+
+/*
+    Client capabilities
+    -------------------
+    The messages of controller-*.h are not part of the SPICE controller
+    protocol, a stock client knows none of them. A client which does sends
+    CONTROLLER_CLIENT_CAPS (a ControllerValue of CONTROLLER_CAP_* flags)
+    right after it accepted the controller connection, and the plugin uses
+    an extension only once the client announced it. Without the message
+    the plugin speaks the plain protocol.
+*/
+
+#include <stdint.h>
+#include <spice/controller_prot.h>
+
+#define CONTROLLER_CLIENT_CAPS 0x10400
+
+enum {
+    // takes a CONTROLLER_PRECONNECTED socket, see controller-preconnect.h
+    CONTROLLER_CAP_PRECONNECT  = 1 << 0,
+    // takes a CONTROLLER_TLS_SESSION, see controller-tls-session.h
+    CONTROLLER_CAP_TLS_SESSION = 1 << 1,
+    // answers CONTROLLER_PING, see controller-heartbeat.h
+    CONTROLLER_CAP_HEARTBEAT   = 1 << 2
+};
+
+#endif // CONTROLLER_CAPS_H
@@ -0,0 +1,58 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ *   Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ *   The contents of this file are subject to the Mozilla Public License Version
+ *   1.1 (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.mozilla.org/MPL/
+ *
+ *   Software distributed under the License is distributed on an "AS IS" basis,
+ *   WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ *   for the specific language governing rights and limitations under the
+ *   License.
+ *
+ *   Copyright 2013, Red Hat Inc.
+ *
+ *   Alternatively, the contents of this file may be used under the terms of
+ *   either the GNU General Public License Version 2 or later (the "GPL"), or
+ *   the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ *   in which case the provisions of the GPL or the LGPL are applicable instead
+ *   of those above. If you wish to allow use of your version of this file only
+ *   under the terms of either the GPL or the LGPL, and not to allow others to
+ *   use your version of this file under the terms of the MPL, indicate your
+ *   decision by deleting the provisions above and replace them with the notice
+ *   and other provisions required by the GPL or the LGPL. If you do not delete
+ *   the provisions above, a recipient may use your version of this file under
+ *   the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef CONTROLLER_CAPTURE_H
+#define CONTROLLER_CAPTURE_H
+
+/*
+    Controller traffic capture format
+    ---------------------------------
+    When SPICE_XPI_CAPTURE names a file, the plugin appends every frame it
+    writes to the client controller to that file. Each record is a
+    CaptureFrameHeader immediately followed by 'size' bytes of payload,
+    exactly as sent on the wire. Several plugin instances (and processes)
+    may share one capture file, records are told apart by pid and session;
+    each record is appended with a single write(). The frames include the
+    password, so the file is created readable by its owner only, and an
+    existing file anyone else can access is not written to.
+*/
+
+#include <stdint.h>
+
+#define CONTROLLER_CAPTURE_MAGIC 0x46435853 /* "SXCF" */
+
+typedef struct CaptureFrameHeader {
+    uint32_t magic;
+    uint32_t pid;
+    uint32_t session;
+    uint32_t size;
+    uint64_t timestamp; /* microseconds since the epoch */
+} CaptureFrameHeader;
+
+#endif // CONTROLLER_CAPTURE_H
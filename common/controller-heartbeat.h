@@ -0,0 +1,51 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ *   Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ *   The contents of this file are subject to the Mozilla Public License Version
+ *   1.1 (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.mozilla.org/MPL/
+ *
+ *   Software distributed under the License is distributed on an "AS IS" basis,
+ *   WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ *   for the specific language governing rights and limitations under the
+ *   License.
+ *
+ *   Copyright 2013, Red Hat Inc.
+ *
+ *   Alternatively, the contents of this file may be used under the terms of
+ *   either the GNU General Public License Version 2 or later (the "GPL"), or
+ *   the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ *   in which case the provisions of the GPL or the LGPL are applicable instead
+ *   of those above. If you wish to allow use of your version of this file only
+ *   under the terms of either the GPL or the LGPL, and not to allow others to
+ *   use your version of this file under the terms of the MPL, indicate your
+ *   decision by deleting the provisions above and replace them with the notice
+ *   and other provisions required by the GPL or the LGPL. If you do not delete
+ *   the provisions above, a recipient may use your version of this file under
+ *   the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef CONTROLLER_HEARTBEAT_H
+#define CONTROLLER_HEARTBEAT_H
+
+/*
+    Controller heartbeat
+    --------------------
+    While connected to a client which announced CONTROLLER_CAP_HEARTBEAT
+    (see controller-caps.h), the plugin sends a CONTROLLER_PING (a
+    ControllerValue holding a sequence number) every heartbeat interval,
+    and the client answers from its main loop with a CONTROLLER_PONG
+    carrying the same number. Only one ping is outstanding at a time; a
+    client which leaves it unanswered for the heartbeat timeout is
+    considered hung. Other clients are never pinged.
+*/
+
+#include <stdint.h>
+#include <spice/controller_prot.h>
+
+#define CONTROLLER_PING 0x10300
+#define CONTROLLER_PONG 0x10301
+
+#endif // CONTROLLER_HEARTBEAT_H
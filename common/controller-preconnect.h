@@ -0,0 +1,62 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ *   Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ *   The contents of this file are subject to the Mozilla Public License Version
+ *   1.1 (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.mozilla.org/MPL/
+ *
+ *   Software distributed under the License is distributed on an "AS IS" basis,
+ *   WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ *   for the specific language governing rights and limitations under the
+ *   License.
+ *
+ *   Copyright 2013, Red Hat Inc.
+ *
+ *   Alternatively, the contents of this file may be used under the terms of
+ *   either the GNU General Public License Version 2 or later (the "GPL"), or
+ *   the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ *   in which case the provisions of the GPL or the LGPL are applicable instead
+ *   of those above. If you wish to allow use of your version of this file only
+ *   under the terms of either the GPL or the LGPL, and not to allow others to
+ *   use your version of this file under the terms of the MPL, indicate your
+ *   decision by deleting the provisions above and replace them with the notice
+ *   and other provisions required by the GPL or the LGPL. If you do not delete
+ *   the provisions above, a recipient may use your version of this file under
+ *   the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef CONTROLLER_PRECONNECT_H
+#define CONTROLLER_PRECONNECT_H
+
+/*
+    Pre-connected server socket handoff
+    -----------------------------------
+    With pre-connect enabled, the plugin races TCP connections to the
+    server while the client starts, and passes the winning socket over the
+    controller socket as SCM_RIGHTS ancillary data of a
+    CONTROLLER_PRECONNECTED message (a ControllerValue). The value tells
+    which port the socket is connected to. Only sent to a client which
+    announced CONTROLLER_CAP_PRECONNECT, see controller-caps.h; any other
+    client connects by itself. Only available with the Unix domain
+    controller socket.
+
+    The TLS port is preferred: when the plain one connects first, the
+    plugin waits a little longer for the TLS one before it settles.
+
+    With a proxy, the socket is an established HTTP CONNECT tunnel to the
+    server; the client must not do the proxy handshake again on it.
+*/
+
+#include <stdint.h>
+#include <spice/controller_prot.h>
+
+#define CONTROLLER_PRECONNECTED 0x10100
+
+enum {
+    CONTROLLER_PRECONNECTED_PLAIN = 0,
+    CONTROLLER_PRECONNECTED_TLS   = 1
+};
+
+#endif // CONTROLLER_PRECONNECT_H
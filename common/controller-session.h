@@ -0,0 +1,80 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ *   Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ *   The contents of this file are subject to the Mozilla Public License Version
+ *   1.1 (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.mozilla.org/MPL/
+ *
+ *   Software distributed under the License is distributed on an "AS IS" basis,
+ *   WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ *   for the specific language governing rights and limitations under the
+ *   License.
+ *
+ *   Copyright 2013, Red Hat Inc.
+ *
+ *   Alternatively, the contents of this file may be used under the terms of
+ *   either the GNU General Public License Version 2 or later (the "GPL"), or
+ *   the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ *   in which case the provisions of the GPL or the LGPL are applicable instead
+ *   of those above. If you wish to allow use of your version of this file only
+ *   under the terms of either the GPL or the LGPL, and not to allow others to
+ *   use your version of this file under the terms of the MPL, indicate your
+ *   decision by deleting the provisions above and replace them with the notice
+ *   and other provisions required by the GPL or the LGPL. If you do not delete
+ *   the provisions above, a recipient may use your version of this file under
+ *   the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef CONTROLLER_SESSION_H
+#define CONTROLLER_SESSION_H
+
+/*
+    Session multiplexing for the per-user client daemon
+    ---------------------------------------------------
+    With SPICE_XPI_DAEMON set, plugin instances no longer spawn a client
+    each. Every browser process keeps a single connection to a per-user
+    daemon, which hosts one client session per plugin instance.
+
+    The plugin starts the connection with a ControllerSessionInit. After
+    that each record, in both directions, is a ControllerSessionHeader
+    followed by 'size' bytes:
+      - plugin to daemon: the session messages below, or the ordinary
+        controller messages of spice/controller_prot.h for the session
+      - daemon to plugin: CONTROLLER_SESSION_CLOSED only
+
+    When nobody listens on the socket, the plugin starts the daemon
+    detached, with the socket path in SPICE_XPI_DAEMON_SOCKET. The daemon
+    is expected to exit by itself once it has had no session for a while.
+*/
+
+#include <stdint.h>
+#include <spice/controller_prot.h>
+
+#define CONTROLLER_SESSION_MAGIC   0x53455358 /* "XSES" */
+#define CONTROLLER_SESSION_VERSION 1
+
+typedef struct ControllerSessionInit {
+    uint32_t magic;
+    uint32_t version;
+} ControllerSessionInit;
+
+typedef struct ControllerSessionHeader {
+    uint32_t session;
+    uint32_t size;
+} ControllerSessionHeader;
+
+enum {
+    // ControllerMsg, starts a new session
+    CONTROLLER_SESSION_OPEN = 0x10000,
+    // ControllerValue, stops the client of the session,
+    // CONTROLLER_SESSION_FORCE kills it
+    CONTROLLER_SESSION_CLOSE,
+    // ControllerValue, the session is over, value is the client exit status
+    CONTROLLER_SESSION_CLOSED
+};
+
+#define CONTROLLER_SESSION_FORCE (1 << 0)
+
+#endif // CONTROLLER_SESSION_H
@@ -0,0 +1,59 @@
+/* ***** BEGIN LICENSE BLOCK *****
+ *   Version: MPL 1.1/GPL 2.0/LGPL 2.1
+ *
+ *   The contents of this file are subject to the Mozilla Public License Version
+ *   1.1 (the "License"); you may not use this file except in compliance with
+ *   the License. You may obtain a copy of the License at
+ *   http://www.mozilla.org/MPL/
+ *
+ *   Software distributed under the License is distributed on an "AS IS" basis,
+ *   WITHOUT WARRANTY OF ANY KIND, either express or implied. See the License
+ *   for the specific language governing rights and limitations under the
+ *   License.
+ *
+ *   Copyright 2013, Red Hat Inc.
+ *
+ *   Alternatively, the contents of this file may be used under the terms of
+ *   either the GNU General Public License Version 2 or later (the "GPL"), or
+ *   the GNU Lesser General Public License Version 2.1 or later (the "LGPL"),
+ *   in which case the provisions of the GPL or the LGPL are applicable instead
+ *   of those above. If you wish to allow use of your version of this file only
+ *   under the terms of either the GPL or the LGPL, and not to allow others to
+ *   use your version of this file under the terms of the MPL, indicate your
+ *   decision by deleting the provisions above and replace them with the notice
+ *   and other provisions required by the GPL or the LGPL. If you do not delete
+ *   the provisions above, a recipient may use your version of this file under
+ *   the terms of any one of the MPL, the GPL or the LGPL.
+ *
+ * ***** END LICENSE BLOCK ***** */
+
+#ifndef CONTROLLER_TLS_SESSION_H
+#define CONTROLLER_TLS_SESSION_H
+
+/*
+    TLS session resumption
+    ----------------------
+    Every connect starts a new client process, which would otherwise pay
+    a full TLS handshake each time. The plugin keeps the sessions of
+    earlier clients and offers one in a CONTROLLER_TLS_SESSION message (a
+    ControllerData holding the session as serialized by the TLS library)
+    before CONTROLLER_CONNECT, to a client which announced
+    CONTROLLER_CAP_TLS_SESSION (see controller-caps.h). Whenever the
+    client obtains a new session or ticket for the secure port, it sends
+    it back the same way in a CONTROLLER_TLS_SESSION_NEW message, on the
+    controller socket like its other messages to the plugin. The plugin
+    matches sessions on host, secure port and host subject, and offers
+    each one only once; a client which cannot take it leaves it for the
+    next one.
+*/
+
+#include <stdint.h>
+#include <spice/controller_prot.h>
+
+#define CONTROLLER_TLS_SESSION      0x10200
+#define CONTROLLER_TLS_SESSION_NEW  0x10201
+
+// larger messages from the client are a protocol error
+#define CONTROLLER_TLS_SESSION_MAX  16384
+
+#endif // CONTROLLER_TLS_SESSION_H
@@ -0,0 +1,37 @@
+/* ***** BEGIN LICENSE BLOCK *****
+*   Copyright (C) 2013, Red Hat Inc.
+*
+*   This program is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU General Public License as
+*   published by the Free Software Foundation; either version 2 of
+*   the License, or (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program. If not, see <http://www.gnu.org/licenses/>.
+* ***** END LICENSE BLOCK ***** */
+
+#include "options.h"
+#include "replayer.h"
+
+int main(int argc, char **argv)
+{
+    Options o(argc, argv);
+    if (!o.good())
+        return 1;
+
+    if (o.help()) {
+        o.printHelp();
+        return 0;
+    }
+
+    Replayer r(o);
+    if (!r.load())
+        return 1;
+
+    return r.run() ? 0 : 1;
+}
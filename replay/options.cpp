@@ -0,0 +1,94 @@
+/* ***** BEGIN LICENSE BLOCK *****
+*   Copyright (C) 2013, Red Hat Inc.
+*
+*   This program is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU General Public License as
+*   published by the Free Software Foundation; either version 2 of
+*   the License, or (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program. If not, see <http://www.gnu.org/licenses/>.
+* ***** END LICENSE BLOCK ***** */
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+extern "C" {
+#  include <getopt.h>
+}
+#include "options.h"
+
+Options::Options(int argc, char **argv):
+    m_help(false),
+    m_good(true),
+    m_dump(false),
+    m_fast(false),
+    m_input_filename(),
+    m_socket_name(getenv("SPICE_XPI_SOCKET") ? getenv("SPICE_XPI_SOCKET") : ""),
+    m_session(0),
+    m_bin_name(argv && argv[0] ? basename(argv[0]) : "spice-xpi-replay")
+{
+    static struct option longopts[] = {
+        { "input",   required_argument, NULL, 'i' },
+        { "socket",  required_argument, NULL, 's' },
+        { "session", required_argument, NULL, 'n' },
+        { "fast",    no_argument,       NULL, 'f' },
+        { "dump",    no_argument,       NULL, 'd' },
+        { "help",    no_argument,       NULL, 'h' },
+        { NULL,      0,                 NULL,  0  }
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "i:s:n:fdh", longopts, NULL)) != -1) {
+        switch (c) {
+        case 'i':
+            m_input_filename = optarg;
+            break;
+        case 's':
+            m_socket_name = optarg;
+            break;
+        case 'n':
+            m_session = strtoul(optarg, NULL, 10);
+            break;
+        case 'f':
+            m_fast = true;
+            break;
+        case 'd':
+            m_dump = true;
+            break;
+        case 'h':
+            m_help = true;
+            break;
+        default:
+            m_good = false;
+            break;
+        }
+    }
+
+    if (!m_help && m_good && m_input_filename.empty()) {
+        std::cerr << m_bin_name << ": no capture file specified\n";
+        m_good = false;
+    }
+}
+
+Options::~Options()
+{
+}
+
+void Options::printHelp() const
+{
+    std::cout << "Spice-xpi controller traffic replay\n\n"
+              << "Usage: " << m_bin_name << " [-h] [-f] [-d] [-s socket] [-n session] -i capture\n\n"
+              << "Application options:\n"
+              << "  -i, --input     capture file written by the plugin (SPICE_XPI_CAPTURE)\n"
+              << "  -s, --socket    controller socket ($SPICE_XPI_SOCKET used, if not specified)\n"
+              << "  -n, --session   replay only the given session (first session, if not specified)\n"
+              << "  -f, --fast      do not reproduce the recorded delays between frames\n"
+              << "  -d, --dump      decode the frames to stdout instead of sending them\n"
+              << "  -h, --help      prints this help\n";
+}
@@ -0,0 +1,224 @@
+/* ***** BEGIN LICENSE BLOCK *****
+*   Copyright (C) 2013, Red Hat Inc.
+*
+*   This program is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU General Public License as
+*   published by the Free Software Foundation; either version 2 of
+*   the License, or (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program. If not, see <http://www.gnu.org/licenses/>.
+* ***** END LICENSE BLOCK ***** */
+
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+extern "C" {
+#  include <unistd.h>
+#  include <time.h>
+#  include <sys/time.h>
+#  include <sys/socket.h>
+#  include <sys/un.h>
+}
+#include <spice/controller_prot.h>
+#include "options.h"
+#include "replayer.h"
+
+namespace {
+
+uint64_t now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+void sleepUntil(uint64_t deadline)
+{
+    uint64_t current = now();
+    if (current >= deadline)
+        return;
+
+    struct timespec ts;
+    ts.tv_sec = (deadline - current) / 1000000;
+    ts.tv_nsec = ((deadline - current) % 1000000) * 1000;
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+        ;
+}
+
+} // namespace
+
+Replayer::Replayer(const Options &options):
+    m_options(options),
+    m_frames(),
+    m_socket(-1)
+{
+}
+
+Replayer::~Replayer()
+{
+    if (m_socket != -1)
+        close(m_socket);
+}
+
+bool Replayer::load()
+{
+    FILE *f = fopen(m_options.inputFilename().c_str(), "rb");
+    if (!f) {
+        std::cerr << "Can't open " << m_options.inputFilename()
+                  << ": " << strerror(errno) << "\n";
+        return false;
+    }
+
+    uint32_t session = m_options.session();
+    uint32_t pid = 0;
+    Frame frame;
+    while (fread(&frame.header, sizeof(frame.header), 1, f) == 1) {
+        if (frame.header.magic != CONTROLLER_CAPTURE_MAGIC) {
+            std::cerr << "Corrupted capture file, stopping at frame "
+                      << m_frames.size() << "\n";
+            break;
+        }
+
+        frame.data.resize(frame.header.size);
+        if (frame.header.size &&
+            fread(&frame.data[0], frame.header.size, 1, f) != 1) {
+            std::cerr << "Truncated capture file\n";
+            break;
+        }
+
+        // sessions are numbered per process; the first one seen picks the pid
+        if (session == 0)
+            session = frame.header.session;
+        if (frame.header.session != session)
+            continue;
+        if (pid == 0)
+            pid = frame.header.pid;
+        if (frame.header.pid != pid)
+            continue;
+
+        m_frames.push_back(frame);
+    }
+
+    fclose(f);
+
+    if (m_frames.empty()) {
+        std::cerr << "No frames to replay\n";
+        return false;
+    }
+
+    return true;
+}
+
+bool Replayer::run()
+{
+    if (m_options.dump()) {
+        for (size_t i = 0; i < m_frames.size(); ++i)
+            dump(m_frames[i]);
+        return true;
+    }
+
+    if (!connectSocket())
+        return false;
+
+    const uint64_t first = m_frames.front().header.timestamp;
+    const uint64_t start = now();
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < m_frames.size(); ++i) {
+        if (!m_options.fast())
+            sleepUntil(start + (m_frames[i].header.timestamp - first));
+        if (!send(m_frames[i]))
+            return false;
+        bytes += m_frames[i].header.size;
+    }
+
+    const uint64_t elapsed = now() - start;
+    std::cout << "Replayed " << m_frames.size() << " frames (" << bytes
+              << " bytes) in " << elapsed / 1000 << "."
+              << (elapsed % 1000) / 100 << " ms (recorded "
+              << (m_frames.back().header.timestamp - first) / 1000 << " ms)\n";
+
+    return true;
+}
+
+bool Replayer::connectSocket()
+{
+    if (m_options.socketName().empty()) {
+        std::cerr << "No controller socket, use -s or set SPICE_XPI_SOCKET\n";
+        return false;
+    }
+
+    struct sockaddr_un remote;
+    if (m_options.socketName().size() >= sizeof(remote.sun_path)) {
+        std::cerr << "Socket name too long\n";
+        return false;
+    }
+
+    m_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (m_socket == -1) {
+        std::cerr << "Can't create socket: " << strerror(errno) << "\n";
+        return false;
+    }
+
+    memset(&remote, 0, sizeof(remote));
+    remote.sun_family = AF_UNIX;
+    strcpy(remote.sun_path, m_options.socketName().c_str());
+    if (connect(m_socket, (struct sockaddr *) &remote, sizeof(remote)) == -1) {
+        std::cerr << "Can't connect to " << m_options.socketName()
+                  << ": " << strerror(errno) << "\n";
+        return false;
+    }
+
+    return true;
+}
+
+bool Replayer::send(const Frame &frame)
+{
+    size_t sent = 0;
+    while (sent < frame.data.size()) {
+        ssize_t len = ::send(m_socket, &frame.data[sent],
+                             frame.data.size() - sent, 0);
+        if (len == -1) {
+            if (errno == EINTR)
+                continue;
+            std::cerr << "Send failed: " << strerror(errno) << "\n";
+            return false;
+        }
+        sent += len;
+    }
+
+    return true;
+}
+
+void Replayer::dump(const Frame &frame) const
+{
+    const uint64_t ts = frame.header.timestamp;
+    std::cout << "[" << ts / 1000000 << "." << (ts % 1000000) / 1000 << "] "
+              << "pid " << frame.header.pid << " session "
+              << frame.header.session << ": ";
+
+    if (frame.header.size >= sizeof(ControllerInit)) {
+        const ControllerInit *init = (const ControllerInit *) &frame.data[0];
+        if (init->base.magic == CONTROLLER_MAGIC) {
+            std::cout << "init version " << init->base.version
+                      << " flags " << init->flags << "\n";
+            return;
+        }
+    }
+
+    if (frame.header.size >= sizeof(ControllerMsg)) {
+        const ControllerMsg *msg = (const ControllerMsg *) &frame.data[0];
+        std::cout << "msg id " << msg->id << " size " << msg->size;
+        if (msg->size != frame.header.size)
+            std::cout << " (frame " << frame.header.size << ")";
+        std::cout << "\n";
+        return;
+    }
+
+    std::cout << frame.header.size << " bytes\n";
+}
@@ -0,0 +1,55 @@
+/* ***** BEGIN LICENSE BLOCK *****
+*   Copyright (C) 2013, Red Hat Inc.
+*
+*   This program is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU General Public License as
+*   published by the Free Software Foundation; either version 2 of
+*   the License, or (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program. If not, see <http://www.gnu.org/licenses/>.
+* ***** END LICENSE BLOCK ***** */
+
+#ifndef REPLAYER_H
+#define REPLAYER_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+extern "C" {
+#  include <stdint.h>
+}
+#include "controller-capture.h"
+
+class Options;
+
+class Replayer
+{
+public:
+    Replayer(const Options &options);
+    ~Replayer();
+
+    bool load();
+    bool run();
+
+private:
+    struct Frame {
+        CaptureFrameHeader header;
+        std::vector<uint8_t> data;
+    };
+
+    bool connectSocket();
+    bool send(const Frame &frame);
+    void dump(const Frame &frame) const;
+
+    const Options &m_options;
+    std::vector<Frame> m_frames;
+    int m_socket;
+};
+
+#endif // REPLAYER_H
@@ -0,0 +1,129 @@
+/* ***** BEGIN LICENSE BLOCK *****
+*   Copyright (C) 2013, Red Hat Inc.
+*
+*   This program is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU General Public License as
+*   published by the Free Software Foundation; either version 2 of
+*   the License, or (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program. If not, see <http://www.gnu.org/licenses/>.
+* ***** END LICENSE BLOCK ***** */
+
+// A portal page full of embeds that never connect: creates and destroys
+// that many instances, with their scriptable objects and a few
+// attributes, and reports what they cost. Fails if an instance holds a
+// thread, a descriptor or a controller directory before connect().
+//
+// Usage: bench-instances [instances]
+
+#include "config.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+
+#include "test-common.h"
+
+namespace {
+
+NPAPIHost &host = NPAPIHost::Get();
+
+// the host of the embeds is resolved once for all of them, see
+// HostResolver; the lookup is over within this time
+const unsigned RESOLVE_WAIT = 1000;
+
+bool never(void *data)
+{
+    return false;
+}
+
+Attributes consoleAttributes(unsigned i)
+{
+    std::ostringstream port;
+    Attributes attributes;
+
+    port << 5900 + i % 100;
+    attributes.push_back(std::make_pair("hostip", "vm.example.com"));
+    attributes.push_back(std::make_pair("port", port.str()));
+
+    return attributes;
+}
+
+void printUsage(const char *when, const ProcessUsage &usage, const ProcessUsage &base)
+{
+    printf("%-10s RSS %+ld KiB, threads %+ld, fds %+ld, controller dirs %+ld\n", when,
+           usage.rss - base.rss, usage.threads - base.threads,
+           usage.fds - base.fds, usage.controller_dirs - base.controller_dirs);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    const unsigned count = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000;
+    std::vector<NPP> instances;
+    uint64_t max = 0;
+
+    if (getenv("SPICE_XPI_PLUGIN") == NULL) {
+        std::cerr << "SPICE_XPI_PLUGIN is not set, skipping\n";
+        return TEST_SKIPPED;
+    }
+    if (count == 0 || !host.Load())
+        return 1;
+
+    // one-time setup of the first instance, and the lookup threads
+    // shared by all of them, stay out of the numbers
+    NPP warmup = host.NewInstance(consoleAttributes(0));
+    host.Release(host.Scriptable(warmup));
+    host.DestroyInstance(warmup);
+    host.PumpUntil(never, NULL, RESOLVE_WAIT);
+    host.ResetStats();
+
+    const ProcessUsage base = GetProcessUsage();
+    const uint64_t start = MonotonicTime();
+    for (unsigned i = 0; i < count; ++i) {
+        const uint64_t instance_start = MonotonicTime();
+        NPP instance = host.NewInstance(consoleAttributes(i));
+        host.Release(host.Scriptable(instance));
+        const uint64_t elapsed = MonotonicTime() - instance_start;
+        if (elapsed > max)
+            max = elapsed;
+        instances.push_back(instance);
+    }
+    const uint64_t created = MonotonicTime();
+    host.Pump();
+    const ProcessUsage usage = GetProcessUsage();
+
+    for (size_t i = 0; i < instances.size(); ++i)
+        host.DestroyInstance(instances[i]);
+    const uint64_t destroyed = MonotonicTime();
+    host.Pump();
+    const ProcessUsage after = GetProcessUsage();
+
+    printf("%u instances\n", count);
+    printf("create:  %.1f ms, %.1f us per instance, max %llu us\n",
+           (created - start) / 1000.0, (double) (created - start) / count,
+           (unsigned long long) max);
+    printf("destroy: %.1f ms, %.1f us per instance\n",
+           (destroyed - created) / 1000.0, (double) (destroyed - created) / count);
+    printUsage("created", usage, base);
+    printUsage("destroyed", after, base);
+    host.PrintStats();
+    host.Unload();
+
+    // nothing but memory until the page connects
+    if (usage.threads != base.threads || usage.fds != base.fds ||
+        usage.controller_dirs != base.controller_dirs) {
+        std::cerr << "instances hold resources before connect()\n";
+        return 1;
+    }
+
+    return 0;
+}
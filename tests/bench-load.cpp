@@ -0,0 +1,107 @@
+/* ***** BEGIN LICENSE BLOCK *****
+*   Copyright (C) 2013, Red Hat Inc.
+*
+*   This program is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU General Public License as
+*   published by the Free Software Foundation; either version 2 of
+*   the License, or (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program. If not, see <http://www.gnu.org/licenses/>.
+* ***** END LICENSE BLOCK ***** */
+
+// What the browser pays for the plugin before any page uses it: the
+// plugin scan (dlopen, NP_GetMIMEDescription, NP_GetValue, dlclose) and
+// loading it for use (the same plus NP_Initialize and NP_Shutdown).
+//
+// Usage: bench-load [cycles]
+
+#include "config.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "test-common.h"
+
+namespace {
+
+NPAPIHost &host = NPAPIHost::Get();
+
+bool queryPlugin()
+{
+    char *name = NULL;
+    char *description = NULL;
+    const char *mime = host.MIMEDescription();
+
+    return mime != NULL && strncmp(mime, "application/x-spice:", 20) == 0 &&
+           host.PluginValue(NPPVpluginNameString, &name) == NPERR_NO_ERROR &&
+           host.PluginValue(NPPVpluginDescriptionString, &description) == NPERR_NO_ERROR;
+}
+
+// mean and max microseconds per cycle, false if the plugin failed
+bool runCycles(unsigned cycles, bool initialize, uint64_t *mean, uint64_t *max)
+{
+    uint64_t total = 0;
+
+    *max = 0;
+    for (unsigned i = 0; i < cycles; ++i) {
+        const uint64_t start = MonotonicTime();
+        if (!host.Load(NULL, initialize))
+            return false;
+        const bool ok = queryPlugin();
+        host.Unload();
+        if (!ok) {
+            std::cerr << "the plugin did not answer the scan\n";
+            return false;
+        }
+
+        const uint64_t elapsed = MonotonicTime() - start;
+        total += elapsed;
+        if (elapsed > *max)
+            *max = elapsed;
+    }
+    *mean = total / cycles;
+
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    const unsigned cycles = argc > 1 ? strtoul(argv[1], NULL, 10) : 200;
+    uint64_t scan_mean, scan_max, load_mean, load_max;
+
+    if (getenv("SPICE_XPI_PLUGIN") == NULL) {
+        std::cerr << "SPICE_XPI_PLUGIN is not set, skipping\n";
+        return TEST_SKIPPED;
+    }
+    if (cycles == 0)
+        return 1;
+
+    // the first dlopen also pulls in GLib and friends, keep it out of
+    // the numbers
+    if (!runCycles(1, true, &load_mean, &load_max))
+        return 1;
+    host.ResetStats();
+
+    if (!runCycles(cycles, false, &scan_mean, &scan_max) ||
+        !runCycles(cycles, true, &load_mean, &load_max))
+        return 1;
+
+    printf("%u cycles each\n", cycles);
+    printf("scan: avg %.1f us, max %llu us\n", (double) scan_mean,
+           (unsigned long long) scan_max);
+    printf("load: avg %.1f us, max %llu us\n", (double) load_mean,
+           (unsigned long long) load_max);
+    host.PrintStats();
+
+    return 0;
+}
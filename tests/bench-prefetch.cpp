@@ -0,0 +1,142 @@
+/* ***** BEGIN LICENSE BLOCK *****
+*   Copyright (C) 2013, Red Hat Inc.
+*
+*   This program is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU General Public License as
+*   published by the Free Software Foundation; either version 2 of
+*   the License, or (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program. If not, see <http://www.gnu.org/licenses/>.
+* ***** END LICENSE BLOCK ***** */
+
+// What SPICE_XPI_PREFETCH saves the first connect after boot: drops the
+// page cache, then times connect() up to the stand-in client's SHOW,
+// with and without the prefetch. The page connects PREFETCH_LEAD ms
+// after the embed is created, as a portal page does. Only root may drop
+// the whole cache; otherwise just the client binary is evicted, with
+// POSIX_FADV_DONTNEED.
+//
+// Usage: bench-prefetch [rounds]
+
+#include "config.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+extern "C" {
+#  include <fcntl.h>
+#  include <unistd.h>
+}
+
+#include "test-common.h"
+
+namespace {
+
+NPAPIHost &host = NPAPIHost::Get();
+
+const unsigned PREFETCH_LEAD = 200;     // ms
+const unsigned CONNECT_TIMEOUT = 12000;
+
+bool never(void *data)
+{
+    return false;
+}
+
+// true if the whole page cache was dropped
+bool dropCache(const char *client)
+{
+    sync();
+    FILE *drop = fopen("/proc/sys/vm/drop_caches", "w");
+    if (drop != NULL && fputs("1\n", drop) >= 0 && fclose(drop) == 0)
+        return true;
+
+    int fd = open(client, O_RDONLY | O_CLOEXEC);
+    if (fd != -1) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+
+    return false;
+}
+
+// microseconds from connect() to SHOW, 0 if the client did not show up;
+// the plugin is loaded anew, it prefetches once per load
+uint64_t connectCold(const char *client, bool prefetch, bool *whole_cache)
+{
+    Attributes attributes;
+    uint64_t elapsed = 0;
+
+    if (prefetch)
+        setenv("SPICE_XPI_PREFETCH", "1", 1);
+    else
+        unsetenv("SPICE_XPI_PREFETCH");
+    const std::string log = UseFakeClient();
+    *whole_cache = dropCache(client);
+
+    if (!host.Load())
+        return 0;
+    attributes.push_back(std::make_pair("hostip", "127.0.0.1"));
+    attributes.push_back(std::make_pair("port", "5950"));
+    NPP instance = host.NewInstance(attributes);
+    NPObject *embed = host.Scriptable(instance);
+    NPAPIHost::Listener *disconnected = host.NewListener();
+    host.Listen(embed, "disconnected", disconnected);
+    host.PumpUntil(never, NULL, PREFETCH_LEAD);
+
+    const uint64_t start = MonotonicTime();
+    host.Call(embed, "connect");
+    if (WaitForClientMessage(log, "SHOW", CONNECT_TIMEOUT))
+        elapsed = MonotonicTime() - start;
+
+    // the client is gone before the plugin is unloaded
+    host.Call(embed, "disconnect");
+    WaitForCalls(disconnected, 1, 5000);
+    host.Release(&disconnected->object);
+    host.Release(embed);
+    host.DestroyInstance(instance);
+    host.Unload();
+
+    return elapsed;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    const unsigned rounds = argc > 1 ? strtoul(argv[1], NULL, 10) : 5;
+    const char *client = getenv("SPICE_XPI_FAKE_CLIENT");
+    uint64_t total[2] = { 0, 0 };
+    bool whole_cache = false;
+
+    if (getenv("SPICE_XPI_PLUGIN") == NULL || client == NULL) {
+        std::cerr << "SPICE_XPI_PLUGIN or SPICE_XPI_FAKE_CLIENT is not set, skipping\n";
+        return TEST_SKIPPED;
+    }
+    if (rounds == 0)
+        return 1;
+
+    // alternating, so that a drift hits both the same
+    for (unsigned i = 0; i < rounds; ++i) {
+        for (int prefetch = 0; prefetch < 2; ++prefetch) {
+            const uint64_t elapsed = connectCold(client, prefetch, &whole_cache);
+            if (elapsed == 0) {
+                std::cerr << "the client did not show up\n";
+                return 1;
+            }
+            total[prefetch] += elapsed;
+        }
+    }
+
+    printf("%u rounds, %s dropped\n", rounds,
+           whole_cache ? "page cache" : "client binary");
+    printf("cold connect: %.1f ms without prefetch, %.1f ms with\n",
+           total[0] / 1000.0 / rounds, total[1] / 1000.0 / rounds);
+
+    return 0;
+}
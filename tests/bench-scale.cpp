@@ -0,0 +1,208 @@
+/* ***** BEGIN LICENSE BLOCK *****
+*   Copyright (C) 2013, Red Hat Inc.
+*
+*   This program is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU General Public License as
+*   published by the Free Software Foundation; either version 2 of
+*   the License, or (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program. If not, see <http://www.gnu.org/licenses/>.
+* ***** END LICENSE BLOCK ***** */
+
+// An operations dashboard in one process: for every N given, connects
+// N embeds to stand-in clients and measures RSS, threads, descriptors,
+// controller directories and connect latency per instance, then tears
+// them down. Fails if a per-instance cost at the largest N is more than
+// twice the one at the smallest, i.e. grows super-linearly.
+//
+// Usage: bench-scale [N...]     (default: 25 50 100; up to 5000)
+
+#include "config.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+extern "C" {
+#  include <sys/resource.h>
+}
+
+#include "test-common.h"
+
+namespace {
+
+NPAPIHost &host = NPAPIHost::Get();
+
+// on top of twice the smallest run, allowances for measurement noise
+const double RSS_SLACK = 256;          // KiB
+const double COUNT_SLACK = 0.1;        // threads, fds, dirs
+const double LATENCY_SLACK = 50000;    // us
+
+struct Run {
+    unsigned count;
+    unsigned failures;
+    // per instance
+    double rss;
+    double threads;
+    double fds;
+    double controller_dirs;
+    double latency;
+    uint64_t max_latency;
+    double teardown;
+};
+
+struct DirsWait {
+    long dirs;
+};
+
+bool dirsGone(void *data)
+{
+    return GetProcessUsage().controller_dirs <= static_cast<DirsWait *>(data)->dirs;
+}
+
+// every client needs a few descriptors in this process
+void raiseFdLimit()
+{
+    struct rlimit limit;
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+Run runLevel(unsigned count)
+{
+    std::vector<NPP> instances;
+    Run run;
+    uint64_t total_latency = 0;
+
+    run.count = count;
+    run.failures = 0;
+    run.max_latency = 0;
+
+    UseFakeClient();
+    const ProcessUsage base = GetProcessUsage();
+
+    for (unsigned i = 0; i < count; ++i) {
+        std::ostringstream port;
+        Attributes attributes;
+
+        port << 6000 + i;
+        attributes.push_back(std::make_pair("hostip", "127.0.0.1"));
+        attributes.push_back(std::make_pair("port", port.str()));
+        NPP instance = host.NewInstance(attributes);
+        NPObject *embed = host.Scriptable(instance);
+
+        // connect() returns once the client has its configuration
+        const uint64_t start = MonotonicTime();
+        host.Call(embed, "connect");
+        const uint64_t latency = MonotonicTime() - start;
+        total_latency += latency;
+        if (latency > run.max_latency)
+            run.max_latency = latency;
+        if (host.GetString(embed, "ConnectionState") != "connected")
+            run.failures++;
+
+        host.Release(embed);
+        instances.push_back(instance);
+        host.Pump();
+    }
+
+    const ProcessUsage usage = GetProcessUsage();
+    run.rss = (double) (usage.rss - base.rss) / count;
+    run.threads = (double) (usage.threads - base.threads) / count;
+    run.fds = (double) (usage.fds - base.fds) / count;
+    run.controller_dirs = (double) (usage.controller_dirs - base.controller_dirs) / count;
+    run.latency = (double) total_latency / count;
+
+    // until the clients are reaped and their directories removed
+    const uint64_t start = MonotonicTime();
+    for (size_t i = 0; i < instances.size(); ++i)
+        host.DestroyInstance(instances[i]);
+    DirsWait wait = { base.controller_dirs };
+    if (!host.PumpUntil(dirsGone, &wait, 60000))
+        std::cerr << "clients of " << count << " instances still around after 60 s\n";
+    run.teardown = (double) (MonotonicTime() - start) / count;
+
+    return run;
+}
+
+bool checkGrowth(const char *what, double small, double large, double slack)
+{
+    if (large <= 2 * small + slack)
+        return true;
+
+    std::cerr << what << " per instance grows super-linearly: "
+              << small << " -> " << large << "\n";
+    return false;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    std::vector<unsigned> counts;
+    std::vector<Run> runs;
+
+    if (getenv("SPICE_XPI_PLUGIN") == NULL || getenv("SPICE_XPI_FAKE_CLIENT") == NULL) {
+        std::cerr << "SPICE_XPI_PLUGIN or SPICE_XPI_FAKE_CLIENT is not set, skipping\n";
+        return TEST_SKIPPED;
+    }
+
+    for (int i = 1; i < argc; ++i)
+        counts.push_back(strtoul(argv[i], NULL, 10));
+    if (counts.empty()) {
+        counts.push_back(25);
+        counts.push_back(50);
+        counts.push_back(100);
+    }
+    std::sort(counts.begin(), counts.end());
+
+    raiseFdLimit();
+    if (!host.Load())
+        return 1;
+
+    // the reaper thread and other one-time setup stay out of the numbers
+    runLevel(1);
+    host.ResetStats();
+
+    printf("%6s %8s %10s %8s %6s %6s %12s %12s %12s\n", "N", "failed", "RSS KiB",
+           "threads", "fds", "dirs", "connect ms", "max ms", "teardown ms");
+    for (size_t i = 0; i < counts.size(); ++i) {
+        if (counts[i] == 0)
+            continue;
+        const Run run = runLevel(counts[i]);
+        printf("%6u %8u %10.1f %8.2f %6.2f %6.2f %12.1f %12.1f %12.1f\n",
+               run.count, run.failures, run.rss, run.threads, run.fds,
+               run.controller_dirs, run.latency / 1000, run.max_latency / 1000.0,
+               run.teardown / 1000);
+        fflush(stdout);
+        runs.push_back(run);
+    }
+    host.PrintStats();
+    host.Unload();
+
+    bool ok = true;
+    for (size_t i = 0; i < runs.size(); ++i)
+        ok = ok && runs[i].failures == 0;
+    if (runs.size() >= 2) {
+        const Run &small = runs.front();
+        const Run &large = runs.back();
+        ok = checkGrowth("RSS", small.rss, large.rss, RSS_SLACK) && ok;
+        ok = checkGrowth("threads", small.threads, large.threads, COUNT_SLACK) && ok;
+        ok = checkGrowth("descriptors", small.fds, large.fds, COUNT_SLACK) && ok;
+        ok = checkGrowth("controller directories", small.controller_dirs,
+                         large.controller_dirs, COUNT_SLACK) && ok;
+        ok = checkGrowth("connect latency", small.latency, large.latency, LATENCY_SLACK) && ok;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,379 @@
+/* ***** BEGIN LICENSE BLOCK *****
+*   Copyright (C) 2013, Red Hat Inc.
+*
+*   This program is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU General Public License as
+*   published by the Free Software Foundation; either version 2 of
+*   the License, or (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program. If not, see <http://www.gnu.org/licenses/>.
+* ***** END LICENSE BLOCK ***** */
+
+// Stand-in for spice-xpi-client: listens on SPICE_XPI_SOCKET like the
+// real client, decodes what the plugin sends and logs every message,
+// see fake-common.h for the format. The tests point SPICE_XPI_CLIENT at
+// it and read the log.
+//
+// With --caps it announces those CONTROLLER_CAP_* flags, see
+// controller-caps.h, and logs CAPS. A socket passed along with a message
+// is logged as FD with the port it is connected to, then closed.
+//
+// With --tls it does a TLS handshake with the secure port on CONNECT,
+// through openssl s_client, offering the session of CONTROLLER_TLS_SESSION
+// if it got one. It sends the new session back and logs TLS with "new",
+// "reused" or "failed".
+//
+// A CONTROLLER_PING is answered with a CONTROLLER_PONG, unless --no-pong
+// makes it play a hung client.
+
+#include "config.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+extern "C" {
+#  include <unistd.h>
+#  include <getopt.h>
+#  include <sys/resource.h>
+#  include <sys/socket.h>
+#  include <netinet/in.h>
+}
+
+#include "controller-caps.h"
+#include "controller-heartbeat.h"
+#include "controller-tls-session.h"
+#include "fake-common.h"
+
+namespace {
+
+struct Options {
+    std::string socket_name;
+    std::string log_name;
+    unsigned startup_delay;
+    unsigned read_delay;
+    std::string crash_on;
+    bool send_caps;
+    uint32_t caps;
+    bool tls;
+    bool pong;
+    unsigned stderr_lines;
+    unsigned stderr_length;
+};
+
+// what the handshake with the secure port needs
+struct TlsState {
+    std::string host;
+    uint32_t sport;
+    std::string session;
+};
+
+bool parseOptions(int argc, char **argv, Options &options)
+{
+    static struct option longopts[] = {
+        { "socket",        required_argument, NULL, 's' },
+        { "log",           required_argument, NULL, 'l' },
+        { "startup-delay", required_argument, NULL, 'd' },
+        { "read-delay",    required_argument, NULL, 'r' },
+        { "crash-on",      required_argument, NULL, 'c' },
+        { "caps",          required_argument, NULL, 'C' },
+        { "tls",           no_argument,       NULL, 't' },
+        { "no-pong",       no_argument,       NULL, 'n' },
+        { "stderr",        required_argument, NULL, 'e' },
+        { NULL,            0,                 NULL,  0  }
+    };
+
+    const char *socket_name = getenv("SPICE_XPI_SOCKET");
+    options.socket_name = socket_name ? socket_name : "";
+    options.startup_delay = 0;
+    options.read_delay = 0;
+    options.send_caps = false;
+    options.caps = 0;
+    options.tls = false;
+    options.pong = true;
+    options.stderr_lines = 0;
+    options.stderr_length = 0;
+
+    int c;
+    char *end;
+    while ((c = getopt_long(argc, argv, "s:l:d:r:c:C:tne:", longopts, NULL)) != -1) {
+        switch (c) {
+        case 's':
+            options.socket_name = optarg;
+            break;
+        case 'l':
+            options.log_name = optarg;
+            break;
+        case 'd':
+            options.startup_delay = strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            options.read_delay = strtoul(optarg, NULL, 10);
+            break;
+        case 'c':
+            options.crash_on = optarg;
+            break;
+        case 'C':
+            options.send_caps = true;
+            options.caps = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            options.tls = true;
+            break;
+        case 'n':
+            options.pong = false;
+            break;
+        case 'e':
+            options.stderr_lines = strtoul(optarg, &end, 10);
+            if (*end == ':')
+                options.stderr_length = strtoul(end + 1, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [--socket name] [--log file] [--startup-delay ms]\n"
+                            "       [--read-delay ms] [--crash-on message] [--caps flags]\n"
+                            "       [--tls] [--no-pong] [--stderr lines[:length]]\n",
+                    argv[0]);
+            return false;
+        }
+    }
+
+    // the session files go next to the log
+    if (options.tls && options.log_name.empty()) {
+        fprintf(stderr, "%s: --tls needs --log\n", argv[0]);
+        return false;
+    }
+
+    if (options.socket_name.empty()) {
+        fprintf(stderr, "%s: SPICE_XPI_SOCKET is not set\n", argv[0]);
+        return false;
+    }
+
+    return true;
+}
+
+// "line 1", "line 2"... padded with 'x' to length
+void writeStderr(unsigned lines, unsigned length)
+{
+    for (unsigned i = 1; i <= lines; ++i) {
+        std::string line = "line " + FormatValue(i);
+        if (line.length() < length)
+            line.append(length - line.length(), 'x');
+        line += '\n';
+        fputs(line.c_str(), stderr);
+    }
+}
+
+// reads a message header and the socket that may come with it, -1 if
+// there is none
+bool readHeader(int fd, ControllerMsg *header, int *passed_fd)
+{
+    char control[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = { header, sizeof(*header) };
+    struct msghdr msg;
+    ssize_t len;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    *passed_fd = -1;
+    do {
+        len = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    } while (len == -1 && errno == EINTR);
+    if (len <= 0)
+        return false;
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            memcpy(passed_fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+
+    return ReadAll(fd, (char *)header + len, sizeof(*header) - len);
+}
+
+// the port of the server end of a passed socket
+std::string peerPort(int fd)
+{
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+
+    if (getpeername(fd, (struct sockaddr *) &addr, &len) == -1)
+        return "?";
+    if (addr.ss_family == AF_INET)
+        return FormatValue(ntohs(((struct sockaddr_in *) &addr)->sin_port));
+    if (addr.ss_family == AF_INET6)
+        return FormatValue(ntohs(((struct sockaddr_in6 *) &addr)->sin6_port));
+    return "?";
+}
+
+std::string readFile(const std::string &name)
+{
+    std::ifstream file(name.c_str(), std::ios::binary);
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+// a full or an abbreviated handshake, the new session goes back to the
+// plugin; false if the controller connection broke
+bool tlsHandshake(int fd, const Options &options, const TlsState &tls)
+{
+    const std::string session_in = options.log_name + ".session-in";
+    const std::string session_out = options.log_name + ".session-out";
+    std::string command = "openssl s_client -tls1_2 -connect " + tls.host + ":" +
+        FormatValue(tls.sport) + " -sess_out " + session_out;
+    const char *result = "failed";
+    char line[1024];
+
+    if (!tls.session.empty()) {
+        std::ofstream file(session_in.c_str(), std::ios::binary);
+        file << tls.session;
+        command += " -sess_in " + session_in;
+    }
+    command += " </dev/null 2>/dev/null";
+    unlink(session_out.c_str());
+
+    FILE *output = popen(command.c_str(), "r");
+    while (output != NULL && fgets(line, sizeof(line), output) != NULL) {
+        if (strncmp(line, "New,", 4) == 0)
+            result = "new";
+        else if (strncmp(line, "Reused,", 7) == 0)
+            result = "reused";
+    }
+    if (output != NULL)
+        pclose(output);
+
+    const std::string session = readFile(session_out);
+    if (!session.empty() && session.size() <= CONTROLLER_TLS_SESSION_MAX) {
+        std::vector<char> msg(sizeof(ControllerMsg) + session.size());
+        ControllerMsg header = { CONTROLLER_TLS_SESSION_NEW, (uint32_t) msg.size() };
+        memcpy(&msg[0], &header, sizeof(header));
+        memcpy(&msg[sizeof(header)], session.data(), session.size());
+        if (!WriteAll(fd, &msg[0], msg.size()))
+            return false;
+    }
+    LogLine("TLS", result);
+
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options options;
+    TlsState tls;
+
+    if (!parseOptions(argc, argv, options))
+        return 1;
+    tls.sport = 0;
+
+    if (!options.log_name.empty() && !OpenLog(options.log_name))
+        return 1;
+
+    LogLine("START");
+    writeStderr(options.stderr_lines, options.stderr_length);
+    usleep(options.startup_delay * 1000);
+
+    int listen_fd = ListenOn(options.socket_name);
+    if (listen_fd == -1)
+        return 1;
+    LogLine("LISTEN");
+
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd == -1) {
+        perror("accept");
+        return 1;
+    }
+    close(listen_fd);
+    LogLine("ACCEPT");
+
+    ControllerInit init;
+    if (!ReadAll(fd, &init, sizeof(init)) ||
+        init.base.magic != CONTROLLER_MAGIC ||
+        init.base.version != CONTROLLER_VERSION ||
+        init.base.size != sizeof(init)) {
+        fprintf(stderr, "bad controller init\n");
+        return 1;
+    }
+    LogLine("INIT", FormatValue(init.flags));
+
+    if (options.send_caps) {
+        ControllerValue caps = { {CONTROLLER_CLIENT_CAPS, sizeof(caps)}, options.caps };
+        if (!WriteAll(fd, &caps, sizeof(caps))) {
+            fprintf(stderr, "cannot send the capabilities\n");
+            return 1;
+        }
+        LogLine("CAPS", FormatValue(options.caps));
+    }
+
+    for (;;) {
+        usleep(options.read_delay * 1000);
+
+        ControllerMsg header;
+        int passed_fd;
+        if (!readHeader(fd, &header, &passed_fd)) {
+            LogLine("EOF");
+            break;
+        }
+        if (header.size < sizeof(header) || header.size > FAKE_MESSAGE_MAX) {
+            fprintf(stderr, "bad message size %u\n", header.size);
+            return 1;
+        }
+
+        std::vector<char> body(header.size - sizeof(header));
+        if (!body.empty() && !ReadAll(fd, &body[0], body.size())) {
+            LogLine("EOF");
+            break;
+        }
+        if (!LogMessage(header, body))
+            return 1;
+        if (passed_fd != -1) {
+            LogLine("FD", peerPort(passed_fd));
+            close(passed_fd);
+        }
+
+        // LogMessage() checked the payloads
+        if (header.id == CONTROLLER_HOST) {
+            tls.host = &body[0];
+        } else if (header.id == CONTROLLER_SPORT) {
+            memcpy(&tls.sport, &body[0], sizeof(tls.sport));
+        } else if (header.id == CONTROLLER_TLS_SESSION) {
+            tls.session.assign(body.begin(), body.end());
+        } else if (header.id == CONTROLLER_PING && options.pong) {
+            ControllerValue pong = { {CONTROLLER_PONG, sizeof(pong)}, 0 };
+            memcpy(&pong.value, &body[0], sizeof(pong.value));
+            if (!WriteAll(fd, &pong, sizeof(pong))) {
+                LogLine("EOF");
+                break;
+            }
+        } else if (header.id == CONTROLLER_CONNECT && options.tls && tls.sport != 0 &&
+                   !tlsHandshake(fd, options, tls)) {
+            LogLine("EOF");
+            break;
+        }
+
+        // a client dying in the middle of the configuration
+        if (options.crash_on == MessageName(header.id)) {
+            struct rlimit no_core = { 0, 0 };
+            setrlimit(RLIMIT_CORE, &no_core);
+            abort();
+        }
+    }
+
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,249 @@
+/* ***** BEGIN LICENSE BLOCK *****
+*   Copyright (C) 2013, Red Hat Inc.
+*
+*   This program is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU General Public License as
+*   published by the Free Software Foundation; either version 2 of
+*   the License, or (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program. If not, see <http://www.gnu.org/licenses/>.
+* ***** END LICENSE BLOCK ***** */
+
+#include "config.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+extern "C" {
+#  include <unistd.h>
+#  include <time.h>
+#  include <sys/socket.h>
+#  include <sys/un.h>
+}
+
+#include "controller-heartbeat.h"
+#include "controller-preconnect.h"
+#include "controller-tls-session.h"
+#include "fake-common.h"
+
+namespace {
+
+enum Payload {
+    PAYLOAD_NONE,
+    PAYLOAD_VALUE,
+    PAYLOAD_STRING,
+    // logged by size
+    PAYLOAD_DATA
+};
+
+struct Message {
+    uint32_t id;
+    const char *name;
+    Payload payload;
+};
+
+const Message messages[] = {
+    { CONTROLLER_HOST,                 "HOST",                 PAYLOAD_STRING },
+    { CONTROLLER_PORT,                 "PORT",                 PAYLOAD_VALUE },
+    { CONTROLLER_SPORT,                "SPORT",                PAYLOAD_VALUE },
+    { CONTROLLER_PASSWORD,             "PASSWORD",             PAYLOAD_STRING },
+    { CONTROLLER_SECURE_CHANNELS,      "SECURE_CHANNELS",      PAYLOAD_STRING },
+    { CONTROLLER_DISABLE_CHANNELS,     "DISABLE_CHANNELS",     PAYLOAD_STRING },
+    { CONTROLLER_TLS_CIPHERS,          "TLS_CIPHERS",          PAYLOAD_STRING },
+    { CONTROLLER_CA_FILE,              "CA_FILE",              PAYLOAD_STRING },
+    { CONTROLLER_HOST_SUBJECT,         "HOST_SUBJECT",         PAYLOAD_STRING },
+    { CONTROLLER_FULL_SCREEN,          "FULL_SCREEN",          PAYLOAD_VALUE },
+    { CONTROLLER_SET_TITLE,            "SET_TITLE",            PAYLOAD_STRING },
+    { CONTROLLER_CREATE_MENU,          "CREATE_MENU",          PAYLOAD_STRING },
+    { CONTROLLER_DELETE_MENU,          "DELETE_MENU",          PAYLOAD_NONE },
+    { CONTROLLER_HOTKEYS,              "HOTKEYS",              PAYLOAD_STRING },
+    { CONTROLLER_SEND_CAD,             "SEND_CAD",             PAYLOAD_VALUE },
+    { CONTROLLER_CONNECT,              "CONNECT",              PAYLOAD_NONE },
+    { CONTROLLER_SHOW,                 "SHOW",                 PAYLOAD_NONE },
+    { CONTROLLER_HIDE,                 "HIDE",                 PAYLOAD_NONE },
+    { CONTROLLER_ENABLE_SMARTCARD,     "ENABLE_SMARTCARD",     PAYLOAD_VALUE },
+    { CONTROLLER_COLOR_DEPTH,          "COLOR_DEPTH",          PAYLOAD_VALUE },
+    { CONTROLLER_DISABLE_EFFECTS,      "DISABLE_EFFECTS",      PAYLOAD_STRING },
+    { CONTROLLER_ENABLE_USB,           "ENABLE_USB",           PAYLOAD_VALUE },
+    { CONTROLLER_ENABLE_USB_AUTOSHARE, "ENABLE_USB_AUTOSHARE", PAYLOAD_VALUE },
+    { CONTROLLER_USB_FILTER,           "USB_FILTER",           PAYLOAD_STRING },
+    { CONTROLLER_PROXY,                "PROXY",                PAYLOAD_STRING },
+    { CONTROLLER_PRECONNECTED,         "PRECONNECTED",         PAYLOAD_VALUE },
+    { CONTROLLER_TLS_SESSION,          "TLS_SESSION",          PAYLOAD_DATA },
+    { CONTROLLER_PING,                 "PING",                 PAYLOAD_VALUE },
+};
+
+const size_t messages_count = sizeof(messages) / sizeof(messages[0]);
+
+FILE *log_file = stderr;
+
+uint64_t monotonicTime()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+const Message *findMessage(uint32_t id)
+{
+    for (size_t i = 0; i < messages_count; ++i) {
+        if (messages[i].id == id)
+            return &messages[i];
+    }
+
+    return NULL;
+}
+
+} // namespace
+
+bool OpenLog(const std::string &name)
+{
+    FILE *file = fopen(name.c_str(), "a");
+
+    if (file == NULL) {
+        perror(name.c_str());
+        return false;
+    }
+    log_file = file;
+
+    return true;
+}
+
+void LogLine(const std::string &message, const std::string &value)
+{
+    fprintf(log_file, "%llu %s%s%s\n", (unsigned long long)monotonicTime(),
+            message.c_str(), value.empty() ? "" : " ", value.c_str());
+    fflush(log_file);
+}
+
+std::string MessageName(uint32_t id)
+{
+    const Message *message = findMessage(id);
+    if (message != NULL)
+        return message->name;
+
+    char name[16];
+    snprintf(name, sizeof(name), "0x%x", id);
+    return name;
+}
+
+std::string FormatValue(uint32_t value)
+{
+    char str[16];
+
+    snprintf(str, sizeof(str), "%u", value);
+    return str;
+}
+
+bool LogMessage(const ControllerMsg &header, const std::vector<char> &body,
+                const std::string &prefix)
+{
+    const Message *message = findMessage(header.id);
+    const std::string name = MessageName(header.id);
+    const std::string separator = prefix.empty() ? "" : " ";
+
+    if (message == NULL) {
+        LogLine(name, prefix + separator + FormatValue(body.size()) + " bytes");
+        return true;
+    }
+
+    switch (message->payload) {
+    case PAYLOAD_NONE:
+        LogLine(name, prefix);
+        break;
+
+    case PAYLOAD_VALUE: {
+        uint32_t value;
+        if (body.size() != sizeof(value)) {
+            fprintf(stderr, "bad %s message, size %u\n", message->name, header.size);
+            return false;
+        }
+        memcpy(&value, &body[0], sizeof(value));
+        LogLine(name, prefix + separator + FormatValue(value));
+        break;
+    }
+
+    case PAYLOAD_STRING:
+        if (body.empty() || body.back() != '\0') {
+            fprintf(stderr, "unterminated %s message\n", message->name);
+            return false;
+        }
+        LogLine(name, prefix + separator + &body[0]);
+        break;
+
+    case PAYLOAD_DATA:
+        LogLine(name, prefix + separator + FormatValue(body.size()) + " bytes");
+        break;
+    }
+
+    return true;
+}
+
+bool ReadAll(int fd, void *buffer, size_t size)
+{
+    char *pos = static_cast<char *>(buffer);
+
+    while (size > 0) {
+        ssize_t len = recv(fd, pos, size, 0);
+        if (len == -1 && errno == EINTR)
+            continue;
+        if (len <= 0)
+            return false;
+        pos += len;
+        size -= len;
+    }
+
+    return true;
+}
+
+bool WriteAll(int fd, const void *buffer, size_t size)
+{
+    const char *pos = static_cast<const char *>(buffer);
+
+    while (size > 0) {
+        ssize_t len = send(fd, pos, size, MSG_NOSIGNAL);
+        if (len == -1 && errno == EINTR)
+            continue;
+        if (len <= 0)
+            return false;
+        pos += len;
+        size -= len;
+    }
+
+    return true;
+}
+
+int ListenOn(const std::string &name)
+{
+    struct sockaddr_un local;
+
+    if (name.size() >= sizeof(local.sun_path)) {
+        fprintf(stderr, "socket name too long: %s\n", name.c_str());
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        perror("socket");
+        return -1;
+    }
+
+    memset(&local, 0, sizeof(local));
+    local.sun_family = AF_UNIX;
+    strcpy(local.sun_path, name.c_str());
+    unlink(name.c_str());
+    if (bind(fd, (struct sockaddr *) &local, sizeof(local)) == -1 || listen(fd, 16) == -1) {
+        perror(name.c_str());
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
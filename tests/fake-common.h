@@ -0,0 +1,52 @@
+/* ***** BEGIN LICENSE BLOCK *****
+*   Copyright (C) 2013, Red Hat Inc.
+*
+*   This program is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU General Public License as
+*   published by the Free Software Foundation; either version 2 of
+*   the License, or (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program. If not, see <http://www.gnu.org/licenses/>.
+* ***** END LICENSE BLOCK ***** */
+
+#ifndef FAKE_COMMON_H
+#define FAKE_COMMON_H
+
+// What the stand-in client and the stand-in daemon share: decoding and
+// logging controller messages, one per line with the arrival time
+// (CLOCK_MONOTONIC, microseconds):
+//
+//   <time> <message> [<value>]
+
+#include <string>
+#include <vector>
+extern "C" {
+#  include <stdint.h>
+}
+
+#include <spice/controller_prot.h>
+
+// larger messages are taken for a broken stream
+#define FAKE_MESSAGE_MAX (1024 * 1024)
+
+// stderr until OpenLog() succeeds
+bool OpenLog(const std::string &name);
+void LogLine(const std::string &message, const std::string &value = std::string());
+
+std::string MessageName(uint32_t id);
+std::string FormatValue(uint32_t value);
+// logs message, with prefix before the value; false if it is malformed
+bool LogMessage(const ControllerMsg &header, const std::vector<char> &body,
+                const std::string &prefix = std::string());
+
+bool ReadAll(int fd, void *buffer, size_t size);
+bool WriteAll(int fd, const void *buffer, size_t size);
+int ListenOn(const std::string &name);
+
+#endif // FAKE_COMMON_H
@@ -0,0 +1,267 @@
+/* ***** BEGIN LICENSE BLOCK *****
+*   Copyright (C) 2013, Red Hat Inc.
+*
+*   This program is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU General Public License as
+*   published by the Free Software Foundation; either version 2 of
+*   the License, or (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program. If not, see <http://www.gnu.org/licenses/>.
+* ***** END LICENSE BLOCK ***** */
+
+// Stand-in for the per-user client daemon (SPICE_XPI_DAEMON): listens on
+// SPICE_XPI_DAEMON_SOCKET, takes any number of plugin connections and
+// logs what each session is sent, see fake-common.h for the format. The
+// value of every session message starts with the session id:
+//
+//   <time> OPEN <session>
+//   <time> PORT <session> 5900
+//   <time> CLOSE <session> <flags>
+//
+// It hosts no client, a closed session is reported back at once. It
+// exits once nobody has been connected for the idle time.
+
+#include "config.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <string>
+#include <vector>
+extern "C" {
+#  include <unistd.h>
+#  include <getopt.h>
+#  include <poll.h>
+#  include <sys/socket.h>
+}
+
+#include "controller-session.h"
+#include "fake-common.h"
+
+namespace {
+
+struct Options {
+    std::string socket_name;
+    std::string log_name;
+    unsigned startup_delay;
+    unsigned idle;
+    std::string end_on;
+};
+
+struct Connection {
+    int fd;
+    bool initialized;
+    std::set<uint32_t> sessions;
+};
+
+bool parseOptions(int argc, char **argv, Options &options)
+{
+    static struct option longopts[] = {
+        { "socket",        required_argument, NULL, 's' },
+        { "log",           required_argument, NULL, 'l' },
+        { "startup-delay", required_argument, NULL, 'd' },
+        { "idle",          required_argument, NULL, 'i' },
+        { "end-on",        required_argument, NULL, 'e' },
+        { NULL,            0,                 NULL,  0  }
+    };
+
+    const char *socket_name = getenv("SPICE_XPI_DAEMON_SOCKET");
+    options.socket_name = socket_name ? socket_name : "";
+    options.startup_delay = 0;
+    options.idle = 1000;
+
+    int c;
+    while ((c = getopt_long(argc, argv, "s:l:d:i:e:", longopts, NULL)) != -1) {
+        switch (c) {
+        case 's':
+            options.socket_name = optarg;
+            break;
+        case 'l':
+            options.log_name = optarg;
+            break;
+        case 'd':
+            options.startup_delay = strtoul(optarg, NULL, 10);
+            break;
+        case 'i':
+            options.idle = strtoul(optarg, NULL, 10);
+            break;
+        case 'e':
+            options.end_on = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [--socket name] [--log file] [--startup-delay ms]\n"
+                            "       [--idle ms] [--end-on message]\n",
+                    argv[0]);
+            return false;
+        }
+    }
+
+    if (options.socket_name.empty()) {
+        fprintf(stderr, "%s: SPICE_XPI_DAEMON_SOCKET is not set\n", argv[0]);
+        return false;
+    }
+
+    return true;
+}
+
+bool sendClosed(Connection &connection, uint32_t session, uint32_t status)
+{
+    ControllerSessionHeader header = { session, sizeof(ControllerValue) };
+    ControllerValue msg = { { CONTROLLER_SESSION_CLOSED, sizeof(msg) }, status };
+
+    connection.sessions.erase(session);
+    LogLine("CLOSED", FormatValue(session));
+
+    return WriteAll(connection.fd, &header, sizeof(header)) &&
+           WriteAll(connection.fd, &msg, sizeof(msg));
+}
+
+// handles one record; false if the connection is over
+bool handleRecord(Connection &connection, const Options &options)
+{
+    if (!connection.initialized) {
+        ControllerSessionInit init;
+        if (!ReadAll(connection.fd, &init, sizeof(init)) ||
+            init.magic != CONTROLLER_SESSION_MAGIC ||
+            init.version != CONTROLLER_SESSION_VERSION) {
+            fprintf(stderr, "bad session init\n");
+            return false;
+        }
+        connection.initialized = true;
+        LogLine("INIT");
+        return true;
+    }
+
+    ControllerSessionHeader record;
+    ControllerMsg header;
+    if (!ReadAll(connection.fd, &record, sizeof(record)))
+        return false;
+    if (record.size < sizeof(header) || record.size > FAKE_MESSAGE_MAX ||
+        !ReadAll(connection.fd, &header, sizeof(header))) {
+        fprintf(stderr, "bad record of session %u\n", record.session);
+        return false;
+    }
+
+    // every session starts with the ControllerInit of its client
+    if (header.id == CONTROLLER_MAGIC) {
+        ControllerInit init;
+        if (record.size != sizeof(init) || !connection.sessions.count(record.session)) {
+            fprintf(stderr, "bad init of session %u\n", record.session);
+            return false;
+        }
+        memcpy(&init, &header, sizeof(header));
+        if (!ReadAll(connection.fd, reinterpret_cast<char *>(&init) + sizeof(header),
+                     sizeof(init) - sizeof(header)))
+            return false;
+        LogLine("INIT", FormatValue(record.session) + " " + FormatValue(init.flags));
+        return true;
+    }
+
+    if (header.size != record.size) {
+        fprintf(stderr, "bad record of session %u\n", record.session);
+        return false;
+    }
+    std::vector<char> body(header.size - sizeof(header));
+    if (!body.empty() && !ReadAll(connection.fd, &body[0], body.size()))
+        return false;
+
+    const std::string session = FormatValue(record.session);
+    uint32_t value = 0;
+    if (body.size() == sizeof(value))
+        memcpy(&value, &body[0], sizeof(value));
+
+    switch (header.id) {
+    case CONTROLLER_SESSION_OPEN:
+        connection.sessions.insert(record.session);
+        LogLine("OPEN", session);
+        return true;
+
+    case CONTROLLER_SESSION_CLOSE:
+        LogLine("CLOSE", session + " " + FormatValue(value));
+        return sendClosed(connection, record.session, 0);
+    }
+
+    if (!connection.sessions.count(record.session)) {
+        fprintf(stderr, "message for session %u, which is not open\n", record.session);
+        return false;
+    }
+    if (!LogMessage(header, body, session))
+        return false;
+
+    // a client which quits by itself, e.g. the user closed its window
+    if (options.end_on == MessageName(header.id))
+        return sendClosed(connection, record.session, 0);
+
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options options;
+    std::vector<Connection> connections;
+
+    if (!parseOptions(argc, argv, options))
+        return 1;
+    if (!options.log_name.empty() && !OpenLog(options.log_name))
+        return 1;
+
+    LogLine("START");
+    usleep(options.startup_delay * 1000);
+
+    int listen_fd = ListenOn(options.socket_name);
+    if (listen_fd == -1)
+        return 1;
+    LogLine("LISTEN");
+
+    for (;;) {
+        std::vector<struct pollfd> fds(connections.size() + 1);
+
+        fds[0].fd = listen_fd;
+        fds[0].events = POLLIN;
+        for (size_t i = 0; i < connections.size(); ++i) {
+            fds[i + 1].fd = connections[i].fd;
+            fds[i + 1].events = POLLIN;
+        }
+
+        int ready = poll(&fds[0], fds.size(), connections.empty() ? options.idle : -1);
+        if (ready == 0)
+            break;
+        if (ready == -1)
+            continue;
+
+        // in reverse, closed connections are erased on the way
+        for (size_t i = connections.size(); i > 0; --i) {
+            if (fds[i].revents == 0)
+                continue;
+            if (!handleRecord(connections[i - 1], options)) {
+                LogLine("EOF");
+                close(connections[i - 1].fd);
+                connections.erase(connections.begin() + i - 1);
+            }
+        }
+
+        if (fds[0].revents & POLLIN) {
+            Connection connection;
+            connection.fd = accept(listen_fd, NULL, NULL);
+            connection.initialized = false;
+            if (connection.fd != -1) {
+                LogLine("ACCEPT");
+                connections.push_back(connection);
+            }
+        }
+    }
+
+    unlink(options.socket_name.c_str());
+    LogLine("EXIT");
+
+    return 0;
+}
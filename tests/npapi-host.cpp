@@ -0,0 +1,944 @@
+/* ***** BEGIN LICENSE BLOCK *****
+*   Copyright (C) 2013, Red Hat Inc.
+*
+*   This program is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU General Public License as
+*   published by the Free Software Foundation; either version 2 of
+*   the License, or (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program. If not, see <http://www.gnu.org/licenses/>.
+* ***** END LICENSE BLOCK ***** */
+
+#include "config.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+extern "C" {
+#  include <dlfcn.h>
+#  include <malloc.h>
+#  include <signal.h>
+#  include <time.h>
+#  include <unistd.h>
+#  include <sys/time.h>
+}
+
+#include "npapi-host.h"
+
+namespace {
+
+const char MIME_TYPE[] = "application/x-spice";
+const char USER_AGENT[] = "Mozilla/5.0 (X11; Linux x86_64) spice-xpi-test";
+
+uint64_t now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+size_t heapInUse()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    return mallinfo2().uordblks;
+#else
+    return (unsigned int) mallinfo().uordblks;
+#endif
+}
+
+std::string variantToString(const NPVariant &variant)
+{
+    std::ostringstream out;
+
+    switch (variant.type) {
+    case NPVariantType_Void:
+        return "undefined";
+    case NPVariantType_Null:
+        return "null";
+    case NPVariantType_Bool:
+        return NPVARIANT_TO_BOOLEAN(variant) ? "true" : "false";
+    case NPVariantType_Int32:
+        out << NPVARIANT_TO_INT32(variant);
+        break;
+    case NPVariantType_Double:
+        out << NPVARIANT_TO_DOUBLE(variant);
+        break;
+    case NPVariantType_String:
+        return std::string(NPVARIANT_TO_STRING(variant).UTF8Characters,
+                           NPVARIANT_TO_STRING(variant).UTF8Length);
+    case NPVariantType_Object:
+        return "[object]";
+    }
+
+    return out.str();
+}
+
+// script functions handed to the plugin as event listeners
+NPObject *listenerAllocate(NPP npp, NPClass *aClass)
+{
+    NPAPIHost::Listener *listener = new NPAPIHost::Listener;
+    return &listener->object;
+}
+
+void listenerDeallocate(NPObject *obj)
+{
+    delete reinterpret_cast<NPAPIHost::Listener *>(obj);
+}
+
+bool listenerInvokeDefault(NPObject *obj, const NPVariant *args, uint32_t argc,
+                           NPVariant *result)
+{
+    NPAPIHost::Listener *listener = reinterpret_cast<NPAPIHost::Listener *>(obj);
+    std::vector<std::string> call;
+
+    for (uint32_t i = 0; i < argc; ++i)
+        call.push_back(variantToString(args[i]));
+    listener->calls.push_back(call);
+    VOID_TO_NPVARIANT(*result);
+
+    return true;
+}
+
+NPClass listener_class = {
+    NP_CLASS_STRUCT_VERSION,
+    listenerAllocate,
+    listenerDeallocate,
+    NULL, NULL, NULL,
+    listenerInvokeDefault,
+    NULL, NULL, NULL, NULL, NULL, NULL
+};
+
+} // namespace
+
+NPAPIHost &NPAPIHost::Get()
+{
+    static NPAPIHost host;
+    return host;
+}
+
+NPAPIHost::NPAPIHost():
+    m_library(NULL),
+    m_initialized(false),
+    m_initialize(NULL),
+    m_shutdown(NULL),
+    m_get_mime_description(NULL),
+    m_get_value(NULL),
+    m_window(NULL),
+    m_on_disconnected(NULL),
+    m_chunk(512),
+    m_mem_allocs(0),
+    m_mem_frees(0),
+    m_live_objects(0)
+{
+    pthread_mutex_init(&m_lock, NULL);
+    memset(&m_plugin, 0, sizeof(m_plugin));
+    FillFuncs();
+}
+
+NPAPIHost::Timer::Timer(NPAPIHost &host, const std::string &name):
+    m_host(host),
+    m_name(name),
+    m_start(now()),
+    m_heap(heapInUse())
+{
+}
+
+NPAPIHost::Timer::~Timer()
+{
+    const uint64_t elapsed = now() - m_start;
+    CallStats &stats = m_host.m_stats[m_name];
+
+    stats.count++;
+    stats.total += elapsed;
+    stats.max = std::max(stats.max, elapsed);
+    stats.heap += (long long) heapInUse() - (long long) m_heap;
+}
+
+void NPAPIHost::FillFuncs()
+{
+    memset(&m_funcs, 0, sizeof(m_funcs));
+    m_funcs.size = sizeof(m_funcs);
+    m_funcs.version = (NP_VERSION_MAJOR << 8) | NP_VERSION_MINOR;
+    m_funcs.geturl = GetURL;
+    m_funcs.geturlnotify = GetURLNotify;
+    m_funcs.getvalue = GetValue;
+    m_funcs.setvalue = SetValue;
+    m_funcs.uagent = UserAgent;
+    m_funcs.status = Status;
+    m_funcs.memalloc = MemAlloc;
+    m_funcs.memfree = MemFree;
+    m_funcs.memflush = MemFlush;
+    m_funcs.getstringidentifier = GetStringIdentifier;
+    m_funcs.getstringidentifiers = GetStringIdentifiers;
+    m_funcs.getintidentifier = GetIntIdentifier;
+    m_funcs.identifierisstring = IdentifierIsString;
+    m_funcs.utf8fromidentifier = UTF8FromIdentifier;
+    m_funcs.intfromidentifier = IntFromIdentifier;
+    m_funcs.createobject = CreateObject;
+    m_funcs.retainobject = RetainObject;
+    m_funcs.releaseobject = ReleaseObject;
+    m_funcs.invoke = InvokeObject;
+    m_funcs.invokeDefault = InvokeDefault;
+    m_funcs.evaluate = Evaluate;
+    m_funcs.getproperty = GetObjectProperty;
+    m_funcs.setproperty = SetObjectProperty;
+    m_funcs.removeproperty = RemoveProperty;
+    m_funcs.hasproperty = HasProperty;
+    m_funcs.hasmethod = HasMethod;
+    m_funcs.releasevariantvalue = ReleaseVariantValue;
+    m_funcs.setexception = SetException;
+    m_funcs.pluginthreadasynccall = PluginThreadAsyncCall;
+    m_funcs.construct = ConstructObject;
+}
+
+bool NPAPIHost::Load(const char *path, bool initialize)
+{
+    if (path == NULL)
+        path = getenv("SPICE_XPI_PLUGIN");
+    if (path == NULL) {
+        std::cerr << "No plugin to load, set SPICE_XPI_PLUGIN\n";
+        return false;
+    }
+
+    // browsers ignore it, the plugin relies on that when a client dies
+    // with messages still to be written
+    signal(SIGPIPE, SIG_IGN);
+
+    {
+        Timer timer(*this, "dlopen");
+        m_library = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    }
+    if (m_library == NULL) {
+        std::cerr << "Can't load " << path << ": " << dlerror() << "\n";
+        return false;
+    }
+
+    m_initialize = (InitializeFunc) dlsym(m_library, "NP_Initialize");
+    m_shutdown = (ShutdownFunc) dlsym(m_library, "NP_Shutdown");
+    m_get_mime_description = (GetMIMEDescriptionFunc) dlsym(m_library, "NP_GetMIMEDescription");
+    m_get_value = (GetValueFunc) dlsym(m_library, "NP_GetValue");
+    if (!m_initialize || !m_shutdown || !m_get_mime_description || !m_get_value) {
+        std::cerr << path << " does not export the NPAPI entry points\n";
+        dlclose(m_library);
+        m_library = NULL;
+        return false;
+    }
+
+    if (!initialize)
+        return true;
+
+    NPError err;
+    memset(&m_plugin, 0, sizeof(m_plugin));
+    m_plugin.size = sizeof(m_plugin);
+    {
+        Timer timer(*this, "NP_Initialize");
+        err = m_initialize(&m_funcs, &m_plugin);
+    }
+    if (err != NPERR_NO_ERROR) {
+        std::cerr << "NP_Initialize failed: " << err << "\n";
+        dlclose(m_library);
+        m_library = NULL;
+        return false;
+    }
+    m_initialized = true;
+
+    return true;
+}
+
+void NPAPIHost::Unload()
+{
+    if (m_library == NULL)
+        return;
+
+    while (!m_instances.empty())
+        DestroyInstance(m_instances.back());
+    if (m_window != NULL) {
+        ReleaseObject(m_window);
+        m_window = NULL;
+    }
+    if (m_on_disconnected != NULL) {
+        ReleaseObject(&m_on_disconnected->object);
+        m_on_disconnected = NULL;
+    }
+
+    if (m_initialized) {
+        Timer timer(*this, "NP_Shutdown");
+        m_shutdown();
+        m_initialized = false;
+    }
+    {
+        Timer timer(*this, "dlclose");
+        dlclose(m_library);
+    }
+    m_library = NULL;
+}
+
+const char *NPAPIHost::MIMEDescription()
+{
+    Timer timer(*this, "NP_GetMIMEDescription");
+    return m_get_mime_description();
+}
+
+NPError NPAPIHost::PluginValue(NPPVariable variable, void *value)
+{
+    Timer timer(*this, "NP_GetValue");
+    return m_get_value(NULL, variable, value);
+}
+
+NPP NPAPIHost::NewInstance(const std::vector<std::pair<std::string, std::string> > &attributes,
+                           NPSavedData *saved)
+{
+    NPP instance = new NPP_t;
+    std::vector<char *> argn;
+    std::vector<char *> argv;
+    std::string src;
+    NPError err;
+
+    instance->pdata = NULL;
+    instance->ndata = this;
+    for (size_t i = 0; i < attributes.size(); ++i) {
+        argn.push_back(strdup(attributes[i].first.c_str()));
+        argv.push_back(strdup(attributes[i].second.c_str()));
+        if (attributes[i].first == "src")
+            src = attributes[i].second;
+    }
+    argn.push_back(NULL);
+    argv.push_back(NULL);
+
+    {
+        Timer timer(*this, "NPP_New");
+        err = m_plugin.newp(const_cast<char *>(MIME_TYPE), instance, NP_EMBED,
+                            attributes.size(), &argn[0], &argv[0], saved);
+    }
+    for (size_t i = 0; i < attributes.size(); ++i) {
+        free(argn[i]);
+        free(argv[i]);
+    }
+    if (err != NPERR_NO_ERROR) {
+        std::cerr << "NPP_New failed: " << err << "\n";
+        delete instance;
+        return NULL;
+    }
+    m_instances.push_back(instance);
+
+    // windowless, the browser still tells about the (lack of a) window
+    static NPWindow window;
+    m_plugin.setwindow(instance, &window);
+
+    // the browser requests the src URL by itself, once NPP_New returned
+    if (!src.empty()) {
+        Stream stream = { src, std::string(), false, NULL };
+        if (m_files.count(src))
+            stream.path = m_files[src];
+        m_pending_streams.push_back(std::make_pair(instance, stream));
+    }
+
+    return instance;
+}
+
+NPError NPAPIHost::DestroyInstance(NPP instance, NPSavedData **save)
+{
+    NPError err;
+
+    {
+        Timer timer(*this, "NPP_Destroy");
+        err = m_plugin.destroy(instance, save);
+    }
+    m_instances.erase(std::find(m_instances.begin(), m_instances.end(), instance));
+
+    // calls still queued for the instance are dropped, as Firefox does
+    pthread_mutex_lock(&m_lock);
+    for (size_t i = 0; i < m_async_calls.size(); ) {
+        if (m_async_calls[i].instance == instance)
+            m_async_calls.erase(m_async_calls.begin() + i);
+        else
+            ++i;
+    }
+    pthread_mutex_unlock(&m_lock);
+    for (size_t i = 0; i < m_pending_streams.size(); ) {
+        if (m_pending_streams[i].first == instance)
+            m_pending_streams.erase(m_pending_streams.begin() + i);
+        else
+            ++i;
+    }
+
+    delete instance;
+    return err;
+}
+
+NPObject *NPAPIHost::Scriptable(NPP instance)
+{
+    NPObject *object = NULL;
+    Timer timer(*this, "NPP_GetValue");
+
+    if (m_plugin.getvalue(instance, NPPVpluginScriptableNPObject, &object) != NPERR_NO_ERROR)
+        return NULL;
+
+    return object;
+}
+
+bool NPAPIHost::GetProperty(NPObject *object, const char *name, NPVariant *result)
+{
+    Timer timer(*this, std::string("get ") + name);
+    NPIdentifier id = GetStringIdentifier(name);
+
+    VOID_TO_NPVARIANT(*result);
+    return object->_class->hasProperty(object, id) &&
+        object->_class->getProperty(object, id, result);
+}
+
+std::string NPAPIHost::GetString(NPObject *object, const char *name)
+{
+    NPVariant result;
+    std::string value;
+
+    if (!GetProperty(object, name, &result))
+        return "<missing>";
+    if (NPVARIANT_IS_STRING(result))
+        value.assign(NPVARIANT_TO_STRING(result).UTF8Characters,
+                     NPVARIANT_TO_STRING(result).UTF8Length);
+    else
+        value = variantToString(result);
+    ReleaseVariantValue(&result);
+
+    return value;
+}
+
+bool NPAPIHost::SetString(NPObject *object, const char *name, const std::string &value)
+{
+    Timer timer(*this, std::string("set ") + name);
+    NPVariant variant;
+
+    STRINGN_TO_NPVARIANT(value.c_str(), value.length(), variant);
+    return object->_class->setProperty(object, GetStringIdentifier(name), &variant);
+}
+
+bool NPAPIHost::SetBool(NPObject *object, const char *name, bool value)
+{
+    Timer timer(*this, std::string("set ") + name);
+    NPVariant variant;
+
+    BOOLEAN_TO_NPVARIANT(value, variant);
+    return object->_class->setProperty(object, GetStringIdentifier(name), &variant);
+}
+
+bool NPAPIHost::SetNumber(NPObject *object, const char *name, double value)
+{
+    Timer timer(*this, std::string("set ") + name);
+    NPVariant variant;
+
+    DOUBLE_TO_NPVARIANT(value, variant);
+    return object->_class->setProperty(object, GetStringIdentifier(name), &variant);
+}
+
+bool NPAPIHost::Invoke(NPObject *object, const char *name, const NPVariant *args,
+                       uint32_t argc, NPVariant *result)
+{
+    Timer timer(*this, std::string(name) + "()");
+    NPIdentifier id = GetStringIdentifier(name);
+
+    VOID_TO_NPVARIANT(*result);
+    return object->_class->hasMethod(object, id) &&
+        object->_class->invoke(object, id, args, argc, result);
+}
+
+bool NPAPIHost::Call(NPObject *object, const char *name)
+{
+    NPVariant result;
+
+    if (!Invoke(object, name, NULL, 0, &result))
+        return false;
+    ReleaseVariantValue(&result);
+
+    return true;
+}
+
+NPObject *NPAPIHost::Construct(NPObject *object)
+{
+    Timer timer(*this, "new");
+    NPVariant result;
+
+    VOID_TO_NPVARIANT(result);
+    if (object->_class->construct == NULL ||
+        !object->_class->construct(object, NULL, 0, &result) ||
+        !NPVARIANT_IS_OBJECT(result))
+        return NULL;
+
+    return NPVARIANT_TO_OBJECT(result);
+}
+
+void NPAPIHost::Release(NPObject *object)
+{
+    ReleaseObject(object);
+}
+
+void NPAPIHost::ReleaseVariant(NPVariant *variant)
+{
+    ReleaseVariantValue(variant);
+}
+
+NPAPIHost::Listener *NPAPIHost::NewListener()
+{
+    return reinterpret_cast<Listener *>(CreateObject(NULL, &listener_class));
+}
+
+bool NPAPIHost::Listen(NPObject *object, const char *type, Listener *listener)
+{
+    NPVariant args[2];
+    NPVariant result;
+
+    STRINGZ_TO_NPVARIANT(type, args[0]);
+    OBJECT_TO_NPVARIANT(&listener->object, args[1]);
+    if (!Invoke(object, "addEventListener", args, 2, &result))
+        return false;
+
+    const bool added = NPVARIANT_IS_BOOLEAN(result) && NPVARIANT_TO_BOOLEAN(result);
+    ReleaseVariantValue(&result);
+
+    return added;
+}
+
+void NPAPIHost::SetOnDisconnected(Listener *listener)
+{
+    if (listener != NULL)
+        RetainObject(&listener->object);
+    if (m_on_disconnected != NULL)
+        ReleaseObject(&m_on_disconnected->object);
+    m_on_disconnected = listener;
+}
+
+void NPAPIHost::ServeFile(const std::string &url, const std::string &path, size_t chunk)
+{
+    m_files[url] = path;
+    m_chunk = chunk;
+}
+
+// the way Firefox delivers a URL: NewStream, WriteReady and Write until
+// all is written, DestroyStream, and URLNotify when asked for
+void NPAPIHost::StreamFile(NPP instance, const Stream &stream)
+{
+    NPReason reason = NPRES_DONE;
+    FILE *f = stream.path.empty() ? NULL : fopen(stream.path.c_str(), "rb");
+
+    if (f == NULL) {
+        if (stream.notify) {
+            Timer timer(*this, "NPP_URLNotify");
+            m_plugin.urlnotify(instance, stream.url.c_str(), NPRES_NETWORK_ERR,
+                               stream.notify_data);
+        }
+        return;
+    }
+
+    std::vector<char> data;
+    char buf[4096];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), f)) > 0)
+        data.insert(data.end(), buf, buf + len);
+    fclose(f);
+
+    NPStream np_stream;
+    memset(&np_stream, 0, sizeof(np_stream));
+    np_stream.url = stream.url.c_str();
+    np_stream.end = data.size();
+    np_stream.notifyData = stream.notify_data;
+
+    uint16_t stype = NP_NORMAL;
+    NPError err;
+    {
+        Timer timer(*this, "NPP_NewStream");
+        err = m_plugin.newstream(instance, const_cast<char *>("application/x-virt-viewer"),
+                                 &np_stream, false, &stype);
+    }
+    if (err != NPERR_NO_ERROR)
+        return;
+
+    size_t offset = 0;
+    while (offset < data.size()) {
+        Timer timer(*this, "NPP_Write");
+        int32_t ready = m_plugin.writeready(instance, &np_stream);
+        int32_t size = std::min<size_t>(std::min<size_t>(ready, m_chunk), data.size() - offset);
+        int32_t written = m_plugin.write(instance, &np_stream, offset, size, &data[offset]);
+        if (written < 0) {
+            reason = NPRES_USER_BREAK;
+            break;
+        }
+        offset += written;
+    }
+
+    {
+        Timer timer(*this, "NPP_DestroyStream");
+        m_plugin.destroystream(instance, &np_stream, reason);
+    }
+    if (stream.notify) {
+        Timer timer(*this, "NPP_URLNotify");
+        m_plugin.urlnotify(instance, stream.url.c_str(), reason, stream.notify_data);
+    }
+}
+
+void NPAPIHost::StreamPending()
+{
+    std::vector<std::pair<NPP, Stream> > streams;
+
+    streams.swap(m_pending_streams);
+    for (size_t i = 0; i < streams.size(); ++i)
+        StreamFile(streams[i].first, streams[i].second);
+}
+
+unsigned NPAPIHost::Pump()
+{
+    std::vector<AsyncCall> calls;
+
+    StreamPending();
+
+    pthread_mutex_lock(&m_lock);
+    calls.swap(m_async_calls);
+    pthread_mutex_unlock(&m_lock);
+
+    for (size_t i = 0; i < calls.size(); ++i) {
+        Timer timer(*this, "async call");
+        calls[i].func(calls[i].data);
+    }
+
+    return calls.size();
+}
+
+bool NPAPIHost::PumpUntil(bool (*done)(void *), void *data, unsigned timeout)
+{
+    const uint64_t deadline = now() + (uint64_t) timeout * 1000;
+
+    for (;;) {
+        Pump();
+        if (done(data))
+            return true;
+        if (now() >= deadline)
+            return false;
+        usleep(1000);
+    }
+}
+
+void NPAPIHost::ResetStats()
+{
+    m_stats.clear();
+    m_mem_allocs = 0;
+    m_mem_frees = 0;
+}
+
+void NPAPIHost::PrintStats() const
+{
+    printf("%-28s %8s %10s %10s %12s\n", "call", "count", "avg us", "max us", "avg heap B");
+    for (std::map<std::string, CallStats>::const_iterator it = m_stats.begin();
+         it != m_stats.end(); ++it) {
+        const CallStats &stats = it->second;
+        printf("%-28s %8lu %10.1f %10llu %12.1f\n", it->first.c_str(), stats.count,
+               (double) stats.total / stats.count, (unsigned long long) stats.max,
+               (double) stats.heap / stats.count);
+    }
+    printf("NPN_MemAlloc %lu, NPN_MemFree %lu, live objects %ld\n",
+           m_mem_allocs, m_mem_frees, m_live_objects);
+}
+
+// the window object only knows the global OnDisconnected()
+NPObject *NPAPIHost::Window()
+{
+    static NPClass window_class = {
+        NP_CLASS_STRUCT_VERSION,
+        NULL, NULL, NULL, NULL, NULL, NULL,
+        WindowHasProperty,
+        WindowGetProperty,
+        NULL, NULL, NULL, NULL
+    };
+
+    if (m_window == NULL)
+        m_window = CreateObject(NULL, &window_class);
+
+    return m_window;
+}
+
+bool NPAPIHost::WindowHasProperty(NPObject *obj, NPIdentifier name)
+{
+    return true;
+}
+
+bool NPAPIHost::WindowGetProperty(NPObject *obj, NPIdentifier name, NPVariant *result)
+{
+    Listener *listener = Get().m_on_disconnected;
+
+    VOID_TO_NPVARIANT(*result);
+    if (listener != NULL && static_cast<Identifier *>(name)->name == "OnDisconnected")
+        OBJECT_TO_NPVARIANT(RetainObject(&listener->object), *result);
+
+    return true;
+}
+
+NPError NPAPIHost::GetURL(NPP instance, const char *url, const char *target)
+{
+    return Get().RequestURL(instance, url, target, false, NULL);
+}
+
+NPError NPAPIHost::GetURLNotify(NPP instance, const char *url, const char *target,
+                                void *notifyData)
+{
+    return Get().RequestURL(instance, url, target, true, notifyData);
+}
+
+// only URLs for the plugin itself are served, see ServeFile(); the
+// stream starts once the plugin gave control back, from Pump()
+NPError NPAPIHost::RequestURL(NPP instance, const char *url, const char *target,
+                              bool notify, void *notify_data)
+{
+    if (target != NULL)
+        return NPERR_GENERIC_ERROR;
+
+    Stream stream = { url, std::string(), notify, notify_data };
+    if (m_files.count(url))
+        stream.path = m_files[url];
+    m_pending_streams.push_back(std::make_pair(instance, stream));
+
+    return NPERR_NO_ERROR;
+}
+
+NPError NPAPIHost::GetValue(NPP instance, NPNVariable variable, void *value)
+{
+    switch (variable) {
+    case NPNVWindowNPObject:
+        *static_cast<NPObject **>(value) = RetainObject(Get().Window());
+        return NPERR_NO_ERROR;
+    case NPNVSupportsXEmbedBool:
+        *static_cast<NPBool *>(value) = false;
+        return NPERR_NO_ERROR;
+    default:
+        return NPERR_GENERIC_ERROR;
+    }
+}
+
+NPError NPAPIHost::SetValue(NPP instance, NPPVariable variable, void *value)
+{
+    return NPERR_NO_ERROR;
+}
+
+const char *NPAPIHost::UserAgent(NPP instance)
+{
+    return USER_AGENT;
+}
+
+void NPAPIHost::Status(NPP instance, const char *message)
+{
+}
+
+void *NPAPIHost::MemAlloc(uint32_t size)
+{
+    Get().m_mem_allocs++;
+    return malloc(size);
+}
+
+void NPAPIHost::MemFree(void *ptr)
+{
+    if (ptr != NULL)
+        Get().m_mem_frees++;
+    free(ptr);
+}
+
+uint32_t NPAPIHost::MemFlush(uint32_t size)
+{
+    return 0;
+}
+
+NPIdentifier NPAPIHost::GetStringIdentifier(const NPUTF8 *name)
+{
+    std::map<std::string, Identifier *> &identifiers = Get().m_identifiers;
+    Identifier *&identifier = identifiers[name];
+
+    if (identifier == NULL) {
+        identifier = new Identifier;
+        identifier->is_string = true;
+        identifier->name = name;
+        identifier->value = 0;
+    }
+
+    return identifier;
+}
+
+void NPAPIHost::GetStringIdentifiers(const NPUTF8 **names, int32_t count,
+                                     NPIdentifier *identifiers)
+{
+    for (int32_t i = 0; i < count; ++i)
+        identifiers[i] = GetStringIdentifier(names[i]);
+}
+
+NPIdentifier NPAPIHost::GetIntIdentifier(int32_t intid)
+{
+    Identifier *&identifier = Get().m_int_identifiers[intid];
+
+    if (identifier == NULL) {
+        identifier = new Identifier;
+        identifier->is_string = false;
+        identifier->value = intid;
+    }
+
+    return identifier;
+}
+
+bool NPAPIHost::IdentifierIsString(NPIdentifier identifier)
+{
+    return static_cast<Identifier *>(identifier)->is_string;
+}
+
+NPUTF8 *NPAPIHost::UTF8FromIdentifier(NPIdentifier identifier)
+{
+    Identifier *id = static_cast<Identifier *>(identifier);
+
+    if (!id->is_string)
+        return NULL;
+
+    NPUTF8 *name = static_cast<NPUTF8 *>(MemAlloc(id->name.length() + 1));
+    strcpy(name, id->name.c_str());
+
+    return name;
+}
+
+int32_t NPAPIHost::IntFromIdentifier(NPIdentifier identifier)
+{
+    Identifier *id = static_cast<Identifier *>(identifier);
+
+    return id->is_string ? INT32_MIN : id->value;
+}
+
+NPObject *NPAPIHost::CreateObject(NPP npp, NPClass *aClass)
+{
+    NPObject *obj;
+
+    if (aClass->allocate != NULL)
+        obj = aClass->allocate(npp, aClass);
+    else
+        obj = static_cast<NPObject *>(malloc(sizeof(NPObject)));
+    if (obj == NULL)
+        return NULL;
+
+    obj->_class = aClass;
+    obj->referenceCount = 1;
+    Get().m_live_objects++;
+
+    return obj;
+}
+
+NPObject *NPAPIHost::RetainObject(NPObject *obj)
+{
+    if (obj != NULL)
+        obj->referenceCount++;
+
+    return obj;
+}
+
+void NPAPIHost::ReleaseObject(NPObject *obj)
+{
+    if (obj == NULL || --obj->referenceCount > 0)
+        return;
+
+    if (obj->_class->deallocate != NULL)
+        obj->_class->deallocate(obj);
+    else
+        free(obj);
+    Get().m_live_objects--;
+}
+
+bool NPAPIHost::InvokeObject(NPP npp, NPObject *obj, NPIdentifier name,
+                             const NPVariant *args, uint32_t argc, NPVariant *result)
+{
+    if (obj->_class->invoke == NULL)
+        return false;
+
+    return obj->_class->invoke(obj, name, args, argc, result);
+}
+
+bool NPAPIHost::InvokeDefault(NPP npp, NPObject *obj, const NPVariant *args,
+                              uint32_t argc, NPVariant *result)
+{
+    if (obj->_class->invokeDefault == NULL)
+        return false;
+
+    return obj->_class->invokeDefault(obj, args, argc, result);
+}
+
+bool NPAPIHost::Evaluate(NPP npp, NPObject *obj, NPString *script, NPVariant *result)
+{
+    return false;
+}
+
+bool NPAPIHost::GetObjectProperty(NPP npp, NPObject *obj, NPIdentifier name,
+                                  NPVariant *result)
+{
+    if (obj->_class->getProperty == NULL)
+        return false;
+
+    return obj->_class->getProperty(obj, name, result);
+}
+
+bool NPAPIHost::SetObjectProperty(NPP npp, NPObject *obj, NPIdentifier name,
+                                  const NPVariant *value)
+{
+    if (obj->_class->setProperty == NULL)
+        return false;
+
+    return obj->_class->setProperty(obj, name, value);
+}
+
+bool NPAPIHost::RemoveProperty(NPP npp, NPObject *obj, NPIdentifier name)
+{
+    if (obj->_class->removeProperty == NULL)
+        return false;
+
+    return obj->_class->removeProperty(obj, name);
+}
+
+bool NPAPIHost::HasProperty(NPP npp, NPObject *obj, NPIdentifier name)
+{
+    return obj->_class->hasProperty != NULL && obj->_class->hasProperty(obj, name);
+}
+
+bool NPAPIHost::HasMethod(NPP npp, NPObject *obj, NPIdentifier name)
+{
+    return obj->_class->hasMethod != NULL && obj->_class->hasMethod(obj, name);
+}
+
+void NPAPIHost::ReleaseVariantValue(NPVariant *variant)
+{
+    if (NPVARIANT_IS_STRING(*variant))
+        MemFree(const_cast<NPUTF8 *>(NPVARIANT_TO_STRING(*variant).UTF8Characters));
+    else if (NPVARIANT_IS_OBJECT(*variant))
+        ReleaseObject(NPVARIANT_TO_OBJECT(*variant));
+    VOID_TO_NPVARIANT(*variant);
+}
+
+void NPAPIHost::SetException(NPObject *obj, const NPUTF8 *message)
+{
+    std::cerr << "exception: " << message << "\n";
+}
+
+// may be called from any thread
+void NPAPIHost::PluginThreadAsyncCall(NPP instance, void (*func)(void *), void *data)
+{
+    NPAPIHost &host = Get();
+    AsyncCall call = { instance, func, data };
+
+    pthread_mutex_lock(&host.m_lock);
+    host.m_async_calls.push_back(call);
+    pthread_mutex_unlock(&host.m_lock);
+}
+
+bool NPAPIHost::ConstructObject(NPP npp, NPObject *obj, const NPVariant *args,
+                                uint32_t argc, NPVariant *result)
+{
+    if (obj->_class->construct == NULL)
+        return false;
+
+    return obj->_class->construct(obj, args, argc, result);
+}
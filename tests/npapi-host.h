@@ -0,0 +1,232 @@
+/* ***** BEGIN LICENSE BLOCK *****
+*   Copyright (C) 2013, Red Hat Inc.
+*
+*   This program is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU General Public License as
+*   published by the Free Software Foundation; either version 2 of
+*   the License, or (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program. If not, see <http://www.gnu.org/licenses/>.
+* ***** END LICENSE BLOCK ***** */
+
+#ifndef NPAPI_HOST_H
+#define NPAPI_HOST_H
+
+/*
+    Headless NPAPI host
+    -------------------
+    Stands in for the browser: loads npSpiceConsole.so with dlopen(),
+    hands it an in-process NPNetscapeFuncs table and drives it through
+    the NP_* and NPP_* entry points the way Firefox does. Everything runs
+    on the calling thread, which plays the browser main thread; calls the
+    plugin queues with NPN_PluginThreadAsyncCall() run from Pump().
+
+    Every call into the plugin is timed and the heap growth across it is
+    recorded, see Stats() and PrintStats().
+*/
+
+#include <map>
+#include <string>
+#include <vector>
+extern "C" {
+#  include <stdint.h>
+#  include <pthread.h>
+}
+
+#include <npapi.h>
+#include <npfunctions.h>
+#include <npruntime.h>
+
+class NPAPIHost
+{
+public:
+    struct CallStats {
+        unsigned long count;
+        // microseconds
+        uint64_t total;
+        uint64_t max;
+        // bytes in use on the heap after the call, minus before
+        long long heap;
+    };
+
+    // a script function, records the arguments of every call
+    struct Listener {
+        NPObject object;
+        std::vector<std::vector<std::string> > calls;
+    };
+
+    // the host is process-wide, like the function table it hands out
+    static NPAPIHost &Get();
+
+    // SPICE_XPI_PLUGIN, or the path given; false if the plugin cannot be
+    // loaded or initialized. Without initialize, only the entry points of
+    // the browser's plugin scan can be used.
+    bool Load(const char *path = NULL, bool initialize = true);
+    void Unload();
+
+    const char *MIMEDescription();
+    NPError PluginValue(NPPVariable variable, void *value);
+
+    NPP NewInstance(const std::vector<std::pair<std::string, std::string> > &attributes,
+                    NPSavedData *saved = NULL);
+    NPError DestroyInstance(NPP instance, NPSavedData **save = NULL);
+    // retained, release it with Release()
+    NPObject *Scriptable(NPP instance);
+
+    bool GetProperty(NPObject *object, const char *name, NPVariant *result);
+    std::string GetString(NPObject *object, const char *name);
+    bool SetString(NPObject *object, const char *name, const std::string &value);
+    bool SetBool(NPObject *object, const char *name, bool value);
+    bool SetNumber(NPObject *object, const char *name, double value);
+    bool Invoke(NPObject *object, const char *name, const NPVariant *args,
+                uint32_t argc, NPVariant *result);
+    // an object method without arguments and result
+    bool Call(NPObject *object, const char *name);
+    NPObject *Construct(NPObject *object);
+    void Release(NPObject *object);
+    void ReleaseVariant(NPVariant *variant);
+
+    Listener *NewListener();
+    // listener.addEventListener(type)
+    bool Listen(NPObject *object, const char *type, Listener *listener);
+    // global OnDisconnected() of the window object, NULL for none
+    void SetOnDisconnected(Listener *listener);
+
+    // answers NPN_GetURLNotify() for url with the file, in chunks of at
+    // most chunk bytes; "src" attributes are streamed the same way
+    void ServeFile(const std::string &url, const std::string &path, size_t chunk = 512);
+
+    // runs the async calls queued so far
+    unsigned Pump();
+    // pumps until done() is true or timeout ms passed
+    bool PumpUntil(bool (*done)(void *), void *data, unsigned timeout);
+
+    const std::map<std::string, CallStats> &Stats() const { return m_stats; }
+    void ResetStats();
+    void PrintStats() const;
+    unsigned long MemAllocs() const { return m_mem_allocs; }
+    unsigned long MemFrees() const { return m_mem_frees; }
+    long LiveObjects() const { return m_live_objects; }
+
+private:
+    struct AsyncCall {
+        NPP instance;
+        void (*func)(void *);
+        void *data;
+    };
+
+    struct Identifier {
+        bool is_string;
+        std::string name;
+        int32_t value;
+    };
+
+    struct Stream {
+        std::string url;
+        std::string path;
+        bool notify;
+        void *notify_data;
+    };
+
+    // times a call into the plugin, see Stats()
+    class Timer {
+    public:
+        Timer(NPAPIHost &host, const std::string &name);
+        ~Timer();
+    private:
+        NPAPIHost &m_host;
+        std::string m_name;
+        uint64_t m_start;
+        size_t m_heap;
+    };
+
+    NPAPIHost();
+    void FillFuncs();
+    void StreamFile(NPP instance, const Stream &stream);
+    void StreamPending();
+    NPObject *Window();
+    static bool WindowHasProperty(NPObject *obj, NPIdentifier name);
+    static bool WindowGetProperty(NPObject *obj, NPIdentifier name, NPVariant *result);
+    NPError RequestURL(NPP instance, const char *url, const char *target,
+                       bool notify, void *notify_data);
+
+    // NPN_* implementations
+    static NPError GetURL(NPP instance, const char *url, const char *target);
+    static NPError GetURLNotify(NPP instance, const char *url, const char *target,
+                                void *notifyData);
+    static NPError GetValue(NPP instance, NPNVariable variable, void *value);
+    static NPError SetValue(NPP instance, NPPVariable variable, void *value);
+    static const char *UserAgent(NPP instance);
+    static void Status(NPP instance, const char *message);
+    static void *MemAlloc(uint32_t size);
+    static void MemFree(void *ptr);
+    static uint32_t MemFlush(uint32_t size);
+    static NPIdentifier GetStringIdentifier(const NPUTF8 *name);
+    static void GetStringIdentifiers(const NPUTF8 **names, int32_t count,
+                                     NPIdentifier *identifiers);
+    static NPIdentifier GetIntIdentifier(int32_t intid);
+    static bool IdentifierIsString(NPIdentifier identifier);
+    static NPUTF8 *UTF8FromIdentifier(NPIdentifier identifier);
+    static int32_t IntFromIdentifier(NPIdentifier identifier);
+    static NPObject *CreateObject(NPP npp, NPClass *aClass);
+    static NPObject *RetainObject(NPObject *obj);
+    static void ReleaseObject(NPObject *obj);
+    static bool InvokeObject(NPP npp, NPObject *obj, NPIdentifier name,
+                             const NPVariant *args, uint32_t argc, NPVariant *result);
+    static bool InvokeDefault(NPP npp, NPObject *obj, const NPVariant *args,
+                              uint32_t argc, NPVariant *result);
+    static bool Evaluate(NPP npp, NPObject *obj, NPString *script, NPVariant *result);
+    static bool GetObjectProperty(NPP npp, NPObject *obj, NPIdentifier name,
+                                  NPVariant *result);
+    static bool SetObjectProperty(NPP npp, NPObject *obj, NPIdentifier name,
+                                  const NPVariant *value);
+    static bool RemoveProperty(NPP npp, NPObject *obj, NPIdentifier name);
+    static bool HasProperty(NPP npp, NPObject *obj, NPIdentifier name);
+    static bool HasMethod(NPP npp, NPObject *obj, NPIdentifier name);
+    static void ReleaseVariantValue(NPVariant *variant);
+    static void SetException(NPObject *obj, const NPUTF8 *message);
+    static void PluginThreadAsyncCall(NPP instance, void (*func)(void *), void *data);
+    static bool ConstructObject(NPP npp, NPObject *obj, const NPVariant *args,
+                                uint32_t argc, NPVariant *result);
+
+    typedef NPError (*InitializeFunc)(NPNetscapeFuncs *, NPPluginFuncs *);
+    typedef NPError (*ShutdownFunc)(void);
+    typedef const char *(*GetMIMEDescriptionFunc)(void);
+    typedef NPError (*GetValueFunc)(void *, NPPVariable, void *);
+
+    void *m_library;
+    bool m_initialized;
+    InitializeFunc m_initialize;
+    ShutdownFunc m_shutdown;
+    GetMIMEDescriptionFunc m_get_mime_description;
+    GetValueFunc m_get_value;
+    NPNetscapeFuncs m_funcs;
+    NPPluginFuncs m_plugin;
+    std::vector<NPP> m_instances;
+
+    // interned, never freed
+    std::map<std::string, Identifier *> m_identifiers;
+    std::map<int32_t, Identifier *> m_int_identifiers;
+
+    NPObject *m_window;
+    Listener *m_on_disconnected;
+    std::map<std::string, std::string> m_files;
+    size_t m_chunk;
+    std::vector<std::pair<NPP, Stream> > m_pending_streams;
+
+    pthread_mutex_t m_lock;
+    std::vector<AsyncCall> m_async_calls;
+
+    std::map<std::string, CallStats> m_stats;
+    unsigned long m_mem_allocs;
+    unsigned long m_mem_frees;
+    long m_live_objects;
+};
+
+#endif // NPAPI_HOST_H
@@ -0,0 +1,284 @@
+/* ***** BEGIN LICENSE BLOCK *****
+*   Copyright (C) 2013, Red Hat Inc.
+*
+*   This program is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU General Public License as
+*   published by the Free Software Foundation; either version 2 of
+*   the License, or (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program. If not, see <http://www.gnu.org/licenses/>.
+* ***** END LICENSE BLOCK ***** */
+
+#include "config.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+extern "C" {
+#  include <unistd.h>
+#  include <dirent.h>
+#  include <time.h>
+#  include <sys/stat.h>
+}
+
+#include "test-common.h"
+
+namespace {
+
+int failures = 0;
+std::string tmp_dir;
+
+// symbolic links are removed, not followed
+void removeTree(const std::string &path)
+{
+    struct stat st;
+    DIR *dir = NULL;
+
+    if (lstat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+        dir = opendir(path.c_str());
+    if (dir == NULL) {
+        unlink(path.c_str());
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, ".."))
+            removeTree(path + "/" + entry->d_name);
+    }
+    closedir(dir);
+    rmdir(path.c_str());
+}
+
+struct CallsWait {
+    NPAPIHost::Listener *listener;
+    size_t count;
+};
+
+bool called(void *data)
+{
+    CallsWait *wait = static_cast<CallsWait *>(data);
+    return wait->listener->calls.size() >= wait->count;
+}
+
+unsigned client_logs = 0;
+unsigned daemon_logs = 0;
+
+struct ClientLogWait {
+    const std::string *log;
+    const std::string *message;
+};
+
+bool logged(void *data)
+{
+    ClientLogWait *wait = static_cast<ClientLogWait *>(data);
+    return FindClientMessage(ReadClientLog(*wait->log), *wait->message) != NULL;
+}
+
+} // namespace
+
+void TestFailed(const char *file, int line, const char *what)
+{
+    std::cerr << file << ":" << line << ": check failed: " << what << "\n";
+    failures++;
+}
+
+void TestFailed(const char *file, int line, const char *what,
+                const std::string &a, const std::string &b)
+{
+    std::cerr << file << ":" << line << ": check failed: " << what
+              << " ('" << a << "' != '" << b << "')\n";
+    failures++;
+}
+
+void TestFailed(const char *file, int line, const char *what, long a, long b)
+{
+    std::cerr << file << ":" << line << ": check failed: " << what
+              << " (" << a << " != " << b << ")\n";
+    failures++;
+}
+
+int RunTests(const TestCase *tests, size_t count)
+{
+    // run by hand, outside of make check
+    if (getenv("SPICE_XPI_PLUGIN") == NULL) {
+        std::cerr << "SPICE_XPI_PLUGIN is not set, skipping\n";
+        return TEST_SKIPPED;
+    }
+
+    NPAPIHost &host = NPAPIHost::Get();
+    if (!host.Load())
+        return 1;
+
+    for (size_t i = 0; i < count; ++i) {
+        const int before = failures;
+        tests[i].run();
+        std::cout << (failures == before ? "PASS: " : "FAIL: ") << tests[i].name << "\n";
+    }
+
+    host.Unload();
+    host.PrintStats();
+    if (!tmp_dir.empty())
+        removeTree(tmp_dir);
+
+    return failures == 0 ? 0 : 1;
+}
+
+std::string TestTmpDir()
+{
+    if (tmp_dir.empty()) {
+        char dir[] = "/tmp/spice-xpi-test-XXXXXX";
+        if (mkdtemp(dir) == NULL) {
+            perror("mkdtemp");
+            exit(1);
+        }
+        tmp_dir = dir;
+    }
+
+    return tmp_dir;
+}
+
+bool WaitForCalls(NPAPIHost::Listener *listener, size_t count, unsigned timeout)
+{
+    CallsWait wait = { listener, count };
+    return NPAPIHost::Get().PumpUntil(called, &wait, timeout);
+}
+
+std::string TestDataPath(const std::string &name)
+{
+    const char *srcdir = getenv("srcdir");
+
+    return std::string(srcdir ? srcdir : ".") + "/data/" + name;
+}
+
+uint64_t MonotonicTime()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+std::string UseFakeClient(const std::string &options)
+{
+    const char *client = getenv("SPICE_XPI_FAKE_CLIENT");
+    std::ostringstream log;
+
+    if (client == NULL) {
+        std::cerr << "SPICE_XPI_FAKE_CLIENT is not set\n";
+        exit(1);
+    }
+
+    log << TestTmpDir() << "/client-" << ++client_logs << ".log";
+    std::string cmdline = std::string(client) + " --log " + log.str() + " " + options;
+    setenv("SPICE_XPI_CLIENT", cmdline.c_str(), 1);
+
+    return log.str();
+}
+
+std::string UseFakeDaemon(const std::string &options)
+{
+    const char *daemon = getenv("SPICE_XPI_FAKE_DAEMON");
+    std::ostringstream log;
+
+    if (daemon == NULL) {
+        std::cerr << "SPICE_XPI_FAKE_DAEMON is not set\n";
+        exit(1);
+    }
+
+    log << TestTmpDir() << "/daemon-" << ++daemon_logs << ".log";
+    std::string cmdline = std::string(daemon) + " --log " + log.str() + " " + options;
+    setenv("SPICE_XPI_DAEMON", cmdline.c_str(), 1);
+    // read once, by the first controller of the process
+    const std::string socket = TestTmpDir() + "/daemon";
+    setenv("SPICE_XPI_DAEMON_SOCKET", socket.c_str(), 1);
+
+    return log.str();
+}
+
+std::vector<ClientLogLine> ReadClientLog(const std::string &log)
+{
+    std::vector<ClientLogLine> lines;
+    std::ifstream file(log.c_str());
+    std::string text;
+
+    while (std::getline(file, text)) {
+        std::istringstream fields(text);
+        ClientLogLine line;
+
+        if (!(fields >> line.time >> line.message))
+            continue;
+        std::getline(fields >> std::ws, line.value);
+        lines.push_back(line);
+    }
+
+    return lines;
+}
+
+const ClientLogLine *FindClientMessage(const std::vector<ClientLogLine> &lines,
+                                       const std::string &message)
+{
+    for (size_t i = 0; i < lines.size(); ++i) {
+        if (lines[i].message == message)
+            return &lines[i];
+    }
+
+    return NULL;
+}
+
+bool WaitForClientMessage(const std::string &log, const std::string &message,
+                          unsigned timeout)
+{
+    ClientLogWait wait = { &log, &message };
+    return NPAPIHost::Get().PumpUntil(logged, &wait, timeout);
+}
+
+ProcessUsage GetProcessUsage()
+{
+    ProcessUsage usage = { -1, -1, -1, -1 };
+    std::ifstream status("/proc/self/status");
+    std::string line;
+
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmRSS:") == 0)
+            usage.rss = atol(line.c_str() + 6);
+        else if (line.compare(0, 8, "Threads:") == 0)
+            usage.threads = atol(line.c_str() + 8);
+    }
+    status.close();
+
+    DIR *dir = opendir("/proc/self/fd");
+    if (dir != NULL) {
+        struct dirent *entry;
+        usage.fds = 0;
+        while ((entry = readdir(dir)) != NULL) {
+            if (entry->d_name[0] != '.')
+                usage.fds++;
+        }
+        closedir(dir);
+        // the one opendir() just used
+        usage.fds--;
+    }
+
+    dir = opendir("/tmp");
+    if (dir != NULL) {
+        struct dirent *entry;
+        usage.controller_dirs = 0;
+        while ((entry = readdir(dir)) != NULL) {
+            if (strncmp(entry->d_name, "spicec-", 7) == 0)
+                usage.controller_dirs++;
+        }
+        closedir(dir);
+    }
+
+    return usage;
+}
@@ -0,0 +1,102 @@
+/* ***** BEGIN LICENSE BLOCK *****
+*   Copyright (C) 2013, Red Hat Inc.
+*
+*   This program is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU General Public License as
+*   published by the Free Software Foundation; either version 2 of
+*   the License, or (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program. If not, see <http://www.gnu.org/licenses/>.
+* ***** END LICENSE BLOCK ***** */
+
+#ifndef TEST_COMMON_H
+#define TEST_COMMON_H
+
+#include <string>
+#include <vector>
+#include <utility>
+extern "C" {
+#  include <stdint.h>
+}
+
+#include "npapi-host.h"
+
+// automake's exit code for a test that cannot run here
+#define TEST_SKIPPED 77
+
+#define CHECK(cond)                                                     \
+    do {                                                                \
+        if (!(cond))                                                    \
+            TestFailed(__FILE__, __LINE__, #cond);                      \
+    } while (0)
+
+#define CHECK_EQUAL(a, b)                                               \
+    do {                                                                \
+        if (!((a) == (b)))                                              \
+            TestFailed(__FILE__, __LINE__, #a " == " #b, (a), (b));     \
+    } while (0)
+
+typedef std::vector<std::pair<std::string, std::string> > Attributes;
+
+struct TestCase {
+    const char *name;
+    void (*run)();
+};
+
+void TestFailed(const char *file, int line, const char *what);
+void TestFailed(const char *file, int line, const char *what,
+                const std::string &a, const std::string &b);
+void TestFailed(const char *file, int line, const char *what, long a, long b);
+
+// loads the plugin and runs the tests; returns the exit code
+int RunTests(const TestCase *tests, size_t count);
+
+// pumps the host until listener was called count times
+bool WaitForCalls(NPAPIHost::Listener *listener, size_t count, unsigned timeout);
+
+std::string TestDataPath(const std::string &name);
+std::string TestTmpDir();
+// CLOCK_MONOTONIC in microseconds, the clock of the client logs
+uint64_t MonotonicTime();
+
+// resources of the test process, from /proc; -1 where unknown
+struct ProcessUsage {
+    long rss;        // KiB
+    long threads;
+    long fds;
+    // /tmp/spicec-* directories of the controllers, of any process
+    long controller_dirs;
+};
+
+ProcessUsage GetProcessUsage();
+
+// a line the stand-in client logged, see fake-client.cpp
+struct ClientLogLine {
+    uint64_t time;
+    std::string message;
+    std::string value;
+};
+
+// points SPICE_XPI_CLIENT at the stand-in client (SPICE_XPI_FAKE_CLIENT)
+// started with options, returns the log it will write to
+std::string UseFakeClient(const std::string &options = std::string());
+std::vector<ClientLogLine> ReadClientLog(const std::string &log);
+// the first line logged for message, NULL if there is none
+const ClientLogLine *FindClientMessage(const std::vector<ClientLogLine> &lines,
+                                       const std::string &message);
+// pumps the host until the client logged message
+bool WaitForClientMessage(const std::string &log, const std::string &message,
+                          unsigned timeout);
+
+// points SPICE_XPI_DAEMON at the stand-in daemon (SPICE_XPI_FAKE_DAEMON)
+// started with options, returns the log it will write to; the log has
+// the format of the client's, see fake-daemon.cpp
+std::string UseFakeDaemon(const std::string &options = std::string());
+
+#endif // TEST_COMMON_H
@@ -0,0 +1,569 @@
+/* ***** BEGIN LICENSE BLOCK *****
+*   Copyright (C) 2013, Red Hat Inc.
+*
+*   This program is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU General Public License as
+*   published by the Free Software Foundation; either version 2 of
+*   the License, or (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program. If not, see <http://www.gnu.org/licenses/>.
+* ***** END LICENSE BLOCK ***** */
+
+// connect() end to end against the stand-in client: what reaches the
+// client, how long it takes, and how the plugin copes with clients that
+// start late, read slowly, crash or hang, or outlive a reloaded page.
+
+#include "config.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "controller-caps.h"
+#include "controller-capture.h"
+#include "test-common.h"
+
+namespace {
+
+NPAPIHost &host = NPAPIHost::Get();
+
+// the client is spawned and configured within this time, see
+// SpiceController::Connect() for its retries
+const unsigned CONNECT_TIMEOUT = 12000;
+// crashes a client is restarted after, see controller.cpp
+const unsigned RESTART_MAX_CRASHES = 5;
+// the client log is kept within these, see controller.cpp
+const size_t CLIENT_LOG_MAX = 64 * 1024;
+const size_t CLIENT_LOG_LINE_MAX = 1024;
+
+NPP newConsole(int port)
+{
+    std::ostringstream port_str;
+    Attributes attributes;
+
+    port_str << port;
+    attributes.push_back(std::make_pair("hostip", "127.0.0.1"));
+    attributes.push_back(std::make_pair("port", port_str.str()));
+    attributes.push_back(std::make_pair("title", "fake console"));
+
+    return host.NewInstance(attributes);
+}
+
+// index of the first line logged for message, -1 if there is none
+int indexOf(const std::vector<ClientLogLine> &lines, const std::string &message)
+{
+    for (size_t i = 0; i < lines.size(); ++i) {
+        if (lines[i].message == message)
+            return i;
+    }
+
+    return -1;
+}
+
+bool never(void *data)
+{
+    return false;
+}
+
+size_t countOf(const std::vector<ClientLogLine> &lines, const std::string &message)
+{
+    size_t count = 0;
+
+    for (size_t i = 0; i < lines.size(); ++i) {
+        if (lines[i].message == message)
+            count++;
+    }
+
+    return count;
+}
+
+// how many clients two embeds of the same VM start
+size_t clientsOfTwoEmbeds(int port, bool shared, const std::string &password)
+{
+    const std::string log = UseFakeClient();
+    NPP instances[2];
+    NPObject *embeds[2];
+
+    for (int i = 0; i < 2; ++i) {
+        instances[i] = newConsole(port);
+        embeds[i] = host.Scriptable(instances[i]);
+        if (shared)
+            CHECK(host.SetBool(embeds[i], "SharedSession", true));
+        if (!password.empty())
+            CHECK(host.SetString(embeds[i], "Password", password));
+        CHECK(host.Call(embeds[i], "connect"));
+    }
+    CHECK(WaitForClientMessage(log, "SHOW", CONNECT_TIMEOUT));
+    // a second client, if any, has been started by now; an attached
+    // embed raises the shared client, so SHOW says nothing about it
+    host.PumpUntil(never, NULL, 500);
+    const size_t clients = countOf(ReadClientLog(log), "START");
+
+    for (int i = 0; i < 2; ++i) {
+        host.Call(embeds[i], "disconnect");
+        host.Release(embeds[i]);
+        host.DestroyInstance(instances[i]);
+    }
+
+    return clients;
+}
+
+void printLatency(const char *what, uint64_t start, const ClientLogLine *line)
+{
+    if (line != NULL)
+        std::cout << what << ": " << (line->time - start) / 1000.0 << " ms\n";
+}
+
+void testConnect()
+{
+    const std::string log = UseFakeClient();
+    NPP instance = newConsole(5910);
+    NPObject *embed = host.Scriptable(instance);
+    NPAPIHost::Listener *connected = host.NewListener();
+    NPAPIHost::Listener *disconnected = host.NewListener();
+
+    CHECK(host.Listen(embed, "connected", connected));
+    CHECK(host.Listen(embed, "disconnected", disconnected));
+
+    const uint64_t start = MonotonicTime();
+    CHECK(host.Call(embed, "connect"));
+    CHECK(WaitForCalls(connected, 1, CONNECT_TIMEOUT));
+    CHECK(WaitForClientMessage(log, "SHOW", CONNECT_TIMEOUT));
+    CHECK_EQUAL(host.GetString(embed, "ConnectionState"), "connected");
+
+    const std::vector<ClientLogLine> lines = ReadClientLog(log);
+    CHECK_EQUAL(indexOf(lines, "INIT"), indexOf(lines, "ACCEPT") + 1);
+    CHECK(indexOf(lines, "HOST") > indexOf(lines, "INIT"));
+    CHECK(indexOf(lines, "CONNECT") > indexOf(lines, "HOST"));
+    CHECK(indexOf(lines, "SHOW") > indexOf(lines, "CONNECT"));
+    const ClientLogLine *line = FindClientMessage(lines, "HOST");
+    CHECK(line != NULL && line->value == "127.0.0.1");
+    line = FindClientMessage(lines, "PORT");
+    CHECK(line != NULL && line->value == "5910");
+    line = FindClientMessage(lines, "SET_TITLE");
+    CHECK(line != NULL && line->value == "fake console");
+    CHECK(FindClientMessage(lines, "SPORT") == NULL);
+    printLatency("connect to SHOW", start, FindClientMessage(lines, "SHOW"));
+
+    // the client is stopped, not left behind
+    CHECK(host.Call(embed, "disconnect"));
+    CHECK(WaitForCalls(disconnected, 1, 5000));
+    CHECK_EQUAL(host.GetString(embed, "ConnectionState"), "idle");
+
+    host.Release(&connected->object);
+    host.Release(&disconnected->object);
+    host.Release(embed);
+    host.DestroyInstance(instance);
+}
+
+// a client which takes a while to listen is waited for
+void testStartupDelay()
+{
+    const std::string log = UseFakeClient("--startup-delay 2500");
+    NPP instance = newConsole(5911);
+    NPObject *embed = host.Scriptable(instance);
+    NPAPIHost::Listener *connected = host.NewListener();
+
+    CHECK(host.Listen(embed, "connected", connected));
+
+    const uint64_t start = MonotonicTime();
+    CHECK(host.Call(embed, "connect"));
+    CHECK(WaitForCalls(connected, 1, CONNECT_TIMEOUT));
+    CHECK(WaitForClientMessage(log, "SHOW", CONNECT_TIMEOUT));
+
+    const std::vector<ClientLogLine> lines = ReadClientLog(log);
+    const ClientLogLine *show = FindClientMessage(lines, "SHOW");
+    CHECK(show != NULL && show->time - start >= 2500000);
+    printLatency("connect to SHOW, 2.5 s startup", start, show);
+
+    host.Release(&connected->object);
+    host.Release(embed);
+    host.DestroyInstance(instance);
+}
+
+// nothing is lost or reordered when the client reads slowly
+void testSlowReads()
+{
+    const std::string log = UseFakeClient("--read-delay 50");
+    NPP instance = newConsole(5912);
+    NPObject *embed = host.Scriptable(instance);
+
+    CHECK(host.SetString(embed, "SecurePort", "5913"));
+    CHECK(host.SetString(embed, "Password", "secret"));
+
+    const uint64_t start = MonotonicTime();
+    CHECK(host.Call(embed, "connect"));
+    CHECK(WaitForClientMessage(log, "SHOW", CONNECT_TIMEOUT + 5000));
+
+    const std::vector<ClientLogLine> lines = ReadClientLog(log);
+    CHECK(indexOf(lines, "PORT") > indexOf(lines, "HOST"));
+    CHECK(indexOf(lines, "SPORT") > indexOf(lines, "PORT"));
+    CHECK(indexOf(lines, "PASSWORD") > indexOf(lines, "SPORT"));
+    CHECK(indexOf(lines, "CONNECT") > indexOf(lines, "PASSWORD"));
+    CHECK(indexOf(lines, "SHOW") > indexOf(lines, "CONNECT"));
+    const ClientLogLine *line = FindClientMessage(lines, "PASSWORD");
+    CHECK(line != NULL && line->value == "secret");
+    printLatency("connect to SHOW, 50 ms per read", start, FindClientMessage(lines, "SHOW"));
+
+    host.Release(embed);
+    host.DestroyInstance(instance);
+}
+
+// a client dying during the configuration ends the connection
+void testCrash()
+{
+    const std::string log = UseFakeClient("--crash-on CONNECT");
+    NPP instance = newConsole(5914);
+    NPObject *embed = host.Scriptable(instance);
+    NPAPIHost::Listener *disconnected = host.NewListener();
+
+    CHECK(host.Listen(embed, "disconnected", disconnected));
+
+    const uint64_t start = MonotonicTime();
+    CHECK(host.Call(embed, "connect"));
+    CHECK(WaitForCalls(disconnected, 1, CONNECT_TIMEOUT));
+    CHECK(!disconnected->calls.empty() && disconnected->calls[0][0] != "0");
+    CHECK_EQUAL(host.GetString(embed, "ConnectionState"), "idle");
+    std::cout << "crash to disconnected event: "
+              << (MonotonicTime() - start) / 1000.0 << " ms after connect()\n";
+
+    // and the next connect starts a new client
+    const std::string next_log = UseFakeClient();
+    CHECK(host.Call(embed, "connect"));
+    CHECK(WaitForClientMessage(next_log, "SHOW", CONNECT_TIMEOUT));
+
+    host.Release(&disconnected->object);
+    host.Release(embed);
+    host.DestroyInstance(instance);
+}
+
+// the payloads of the frames in a SPICE_XPI_CAPTURE file
+std::vector<std::string> readCapture(const std::string &path)
+{
+    std::vector<std::string> frames;
+    std::ifstream capture(path.c_str(), std::ios::binary);
+    CaptureFrameHeader header;
+
+    while (capture.read(reinterpret_cast<char *>(&header), sizeof(header))) {
+        CHECK_EQUAL(header.magic, CONTROLLER_CAPTURE_MAGIC);
+        std::string frame(header.size, '\0');
+        if (!capture.read(&frame[0], header.size))
+            break;
+        frames.push_back(frame);
+    }
+
+    return frames;
+}
+
+// a configured client crashing is restarted, with the delay doubling,
+// and gets what the first one got; a crash loop is given up on
+void testAutoRestart()
+{
+    const std::string capture = TestTmpDir() + "/autorestart.capture";
+    // the first client crashes once it is configured, and so do all the
+    // new ones on the replayed CONNECT
+    const std::string log = UseFakeClient("--crash-on CONNECT --read-delay 10");
+    Attributes attributes;
+    attributes.push_back(std::make_pair("hostip", "127.0.0.1"));
+    attributes.push_back(std::make_pair("port", "5913"));
+    attributes.push_back(std::make_pair("autorestart", "true"));
+    setenv("SPICE_XPI_CAPTURE", capture.c_str(), 1);
+    NPP instance = host.NewInstance(attributes);
+    NPObject *embed = host.Scriptable(instance);
+    NPAPIHost::Listener *reconnecting = host.NewListener();
+    NPAPIHost::Listener *disconnected = host.NewListener();
+
+    CHECK(host.Listen(embed, "reconnecting", reconnecting));
+    CHECK(host.Listen(embed, "disconnected", disconnected));
+    CHECK(host.Call(embed, "connect"));
+    unsetenv("SPICE_XPI_CAPTURE");
+
+    // 1 + 2 + 4 + 8 + 16 seconds of delays, and the clients themselves
+    CHECK(WaitForCalls(disconnected, 1, 60000));
+    CHECK_EQUAL(reconnecting->calls.size(), (size_t) RESTART_MAX_CRASHES);
+    for (size_t i = 0; i < reconnecting->calls.size(); ++i) {
+        std::ostringstream attempt, delay;
+        attempt << i + 1;
+        delay << (1000 << i);
+        CHECK(reconnecting->calls[i].size() == 2);
+        if (reconnecting->calls[i].size() == 2) {
+            CHECK_EQUAL(reconnecting->calls[i][0], attempt.str());
+            CHECK_EQUAL(reconnecting->calls[i][1], delay.str());
+        }
+    }
+    const std::vector<ClientLogLine> lines = ReadClientLog(log);
+    CHECK_EQUAL(countOf(lines, "START"), (size_t) RESTART_MAX_CRASHES + 1);
+    CHECK_EQUAL(countOf(lines, "CONNECT"), (size_t) RESTART_MAX_CRASHES + 1);
+    CHECK_EQUAL(host.GetString(embed, "ConnectionState"), "idle");
+
+    // each replay is a single frame holding the frames the first client
+    // got once configuring began
+    const std::vector<std::string> frames = readCapture(capture);
+    CHECK(frames.size() > RESTART_MAX_CRASHES);
+    if (frames.size() > RESTART_MAX_CRASHES) {
+        const size_t first_replay = frames.size() - RESTART_MAX_CRASHES;
+        const std::string &batch = frames[first_replay];
+        std::string sent;
+        for (size_t i = first_replay; i > 0 && sent.size() < batch.size(); --i)
+            sent.insert(0, frames[i - 1]);
+        CHECK(sent == batch);
+        for (size_t i = first_replay; i < frames.size(); ++i)
+            CHECK(frames[i] == batch);
+    }
+
+    host.Release(&reconnecting->object);
+    host.Release(&disconnected->object);
+    host.Release(embed);
+    host.DestroyInstance(instance);
+}
+
+// embeds of the same VM only share a client when they ask for it, and
+// never without a password
+void testSharedSession()
+{
+    CHECK_EQUAL(clientsOfTwoEmbeds(5915, false, "secret"), 2u);
+    CHECK_EQUAL(clientsOfTwoEmbeds(5916, true, ""), 2u);
+    CHECK_EQUAL(clientsOfTwoEmbeds(5917, true, "secret"), 1u);
+}
+
+struct DirsWait {
+    long dirs;
+};
+
+bool dirsGone(void *data)
+{
+    return GetProcessUsage().controller_dirs <= static_cast<DirsWait *>(data)->dirs;
+}
+
+NPP newSharedConsole(int port, NPSavedData *saved = NULL)
+{
+    std::ostringstream port_str;
+    Attributes attributes;
+
+    port_str << port;
+    attributes.push_back(std::make_pair("hostip", "127.0.0.1"));
+    attributes.push_back(std::make_pair("port", port_str.str()));
+    attributes.push_back(std::make_pair("password", "secret"));
+    attributes.push_back(std::make_pair("sharedsession", "true"));
+
+    return host.NewInstance(attributes, saved);
+}
+
+// the client outlives a closed page only when the page asked for it
+void testNoReloadHandoff()
+{
+    UseFakeClient();
+    const ProcessUsage base = GetProcessUsage();
+    NPP instance = newConsole(5919);
+    NPObject *embed = host.Scriptable(instance);
+    NPSavedData *saved = NULL;
+
+    CHECK(host.Call(embed, "connect"));
+    CHECK_EQUAL(host.GetString(embed, "ConnectionState"), "connected");
+    host.Release(embed);
+    CHECK_EQUAL(host.DestroyInstance(instance, &saved), NPERR_NO_ERROR);
+    CHECK(saved == NULL);
+
+    // stopped right away, not after the grace period of a handoff
+    DirsWait wait = { base.controller_dirs };
+    CHECK(host.PumpUntil(dirsGone, &wait, 5000));
+}
+
+// an embed attached to a handed over client keeps it until the reloaded
+// page takes it, and loses it along with that page
+void testReloadHandoff()
+{
+    const std::string log = UseFakeClient();
+    NPP owner = newSharedConsole(5919);
+    NPObject *owner_embed = host.Scriptable(owner);
+    NPP attached = newSharedConsole(5919);
+    NPObject *attached_embed = host.Scriptable(attached);
+    NPAPIHost::Listener *disconnected = host.NewListener();
+    NPSavedData *saved = NULL;
+
+    CHECK(host.Listen(attached_embed, "disconnected", disconnected));
+    CHECK(host.SetBool(owner_embed, "ReloadHandoff", true));
+    CHECK(host.Call(owner_embed, "connect"));
+    CHECK(host.Call(attached_embed, "connect"));
+    CHECK_EQUAL(host.GetString(attached_embed, "ConnectionState"), "attached");
+
+    host.Release(owner_embed);
+    CHECK_EQUAL(host.DestroyInstance(owner, &saved), NPERR_NO_ERROR);
+    CHECK(saved != NULL);
+    host.PumpUntil(never, NULL, 500);
+    CHECK(disconnected->calls.empty());
+    CHECK_EQUAL(host.GetString(attached_embed, "ConnectionState"), "attached");
+
+    // the saved data belongs to the plugin from NPP_New() on
+    NPP reloaded = newSharedConsole(5919, saved);
+    NPObject *reloaded_embed = host.Scriptable(reloaded);
+    CHECK(host.Call(reloaded_embed, "connect"));
+    CHECK_EQUAL(host.GetString(reloaded_embed, "ConnectionState"), "connected");
+    CHECK_EQUAL(countOf(ReadClientLog(log), "ACCEPT"), 1u);
+    CHECK(disconnected->calls.empty());
+
+    CHECK(host.Call(reloaded_embed, "disconnect"));
+    CHECK(WaitForCalls(disconnected, 1, 5000));
+    CHECK_EQUAL(host.GetString(attached_embed, "ConnectionState"), "idle");
+
+    host.Release(&disconnected->object);
+    host.Release(reloaded_embed);
+    host.Release(attached_embed);
+    host.DestroyInstance(reloaded);
+    host.DestroyInstance(attached);
+}
+
+std::string clientLog(NPObject *embed)
+{
+    NPVariant result;
+    std::string log;
+
+    if (!host.Invoke(embed, "GetClientLog", NULL, 0, &result))
+        return log;
+    if (NPVARIANT_IS_STRING(result))
+        log.assign(NPVARIANT_TO_STRING(result).UTF8Characters,
+                   NPVARIANT_TO_STRING(result).UTF8Length);
+    host.ReleaseVariant(&result);
+
+    return log;
+}
+
+// the log of a client which wrote lines of length to stderr, as both
+// the disconnected event and GetClientLog() report it
+std::string logOfClient(unsigned lines, unsigned length)
+{
+    std::ostringstream options;
+    options << "--stderr " << lines << ":" << length;
+    const std::string log = UseFakeClient(options.str());
+    NPP instance = newConsole(5921);
+    NPObject *embed = host.Scriptable(instance);
+    NPAPIHost::Listener *disconnected = host.NewListener();
+
+    CHECK(host.Listen(embed, "disconnected", disconnected));
+    CHECK(host.Call(embed, "connect"));
+    CHECK(WaitForClientMessage(log, "SHOW", CONNECT_TIMEOUT));
+    CHECK(host.Call(embed, "disconnect"));
+    CHECK(WaitForCalls(disconnected, 1, 5000));
+
+    std::string client_log;
+    if (!disconnected->calls.empty() && disconnected->calls[0].size() == 2)
+        client_log = disconnected->calls[0][1];
+    CHECK_EQUAL(clientLog(embed), client_log);
+
+    host.Release(&disconnected->object);
+    host.Release(embed);
+    host.DestroyInstance(instance);
+
+    return client_log;
+}
+
+// what the client writes is kept up to CLIENT_LOG_MAX bytes in lines of
+// at most CLIENT_LOG_LINE_MAX, the oldest lines are dropped first
+void testClientLog()
+{
+    CHECK_EQUAL(logOfClient(3, 0), "line 1\nline 2\nline 3\n");
+
+    const unsigned lines = 100;
+    const size_t kept = CLIENT_LOG_MAX / (CLIENT_LOG_LINE_MAX + 1);
+    const std::string log = logOfClient(lines, 2 * CLIENT_LOG_LINE_MAX);
+    std::istringstream stream(log);
+    std::string line;
+
+    std::ostringstream dropped;
+    dropped << "[" << lines - kept << " earlier lines dropped]";
+    std::getline(stream, line);
+    CHECK_EQUAL(line, dropped.str());
+    for (size_t i = lines - kept + 1; i <= lines; ++i) {
+        std::ostringstream start;
+        start << "line " << i << "x";
+        std::getline(stream, line);
+        CHECK_EQUAL(line.substr(0, start.str().length()), start.str());
+        CHECK_EQUAL((long)line.length(), (long)CLIENT_LOG_LINE_MAX);
+    }
+    CHECK(!std::getline(stream, line));
+}
+
+bool degraded(void *data)
+{
+    const NPAPIHost::Listener *status = static_cast<NPAPIHost::Listener *>(data);
+
+    for (size_t i = 0; i < status->calls.size(); ++i) {
+        if (!status->calls[i].empty() && status->calls[i][0] == "degraded")
+            return true;
+    }
+
+    return false;
+}
+
+// only a client which announced the heartbeat is pinged, and taken for
+// hung once it stops answering
+void testHeartbeat()
+{
+    std::ostringstream caps;
+    caps << "--caps " << CONTROLLER_CAP_HEARTBEAT;
+    const struct {
+        std::string options;
+        bool pinged;
+        bool hung;
+    } clients[] = {
+        { "", false, false },
+        { caps.str(), true, false },
+        { caps.str() + " --no-pong", true, true },
+    };
+
+    for (size_t i = 0; i < sizeof(clients) / sizeof(clients[0]); ++i) {
+        const std::string log = UseFakeClient(clients[i].options);
+        NPP instance = newConsole(5918);
+        NPObject *embed = host.Scriptable(instance);
+        NPAPIHost::Listener *status = host.NewListener();
+
+        CHECK(host.Listen(embed, "status", status));
+        CHECK(host.SetNumber(embed, "HeartbeatInterval", 100));
+        CHECK(host.SetNumber(embed, "HeartbeatTimeout", 300));
+        CHECK(host.Call(embed, "connect"));
+        CHECK(WaitForClientMessage(log, "SHOW", CONNECT_TIMEOUT));
+
+        CHECK_EQUAL(host.PumpUntil(degraded, status, 1000), clients[i].hung);
+        const std::vector<ClientLogLine> lines = ReadClientLog(log);
+        CHECK_EQUAL(FindClientMessage(lines, "PING") != NULL, clients[i].pinged);
+        const double rtt = atof(host.GetString(embed, "HeartbeatRTT").c_str());
+        CHECK_EQUAL(rtt >= 0, clients[i].pinged && !clients[i].hung);
+
+        CHECK(host.Call(embed, "disconnect"));
+        host.Release(&status->object);
+        host.Release(embed);
+        host.DestroyInstance(instance);
+    }
+}
+
+const TestCase tests[] = {
+    { "connect", testConnect },
+    { "slow startup", testStartupDelay },
+    { "slow reads", testSlowReads },
+    { "crash", testCrash },
+    { "autorestart", testAutoRestart },
+    { "shared session", testSharedSession },
+    { "heartbeat", testHeartbeat },
+    { "client log", testClientLog },
+    { "no reload handoff", testNoReloadHandoff },
+    { "reload handoff", testReloadHandoff },
+};
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (getenv("SPICE_XPI_FAKE_CLIENT") == NULL) {
+        std::cerr << "SPICE_XPI_FAKE_CLIENT is not set, skipping\n";
+        return TEST_SKIPPED;
+    }
+
+    return RunTests(tests, sizeof(tests) / sizeof(tests[0]));
+}
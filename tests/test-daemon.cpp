@@ -0,0 +1,224 @@
+/* ***** BEGIN LICENSE BLOCK *****
+*   Copyright (C) 2013, Red Hat Inc.
+*
+*   This program is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU General Public License as
+*   published by the Free Software Foundation; either version 2 of
+*   the License, or (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program. If not, see <http://www.gnu.org/licenses/>.
+* ***** END LICENSE BLOCK ***** */
+
+// Client sessions hosted by the per-user daemon (SPICE_XPI_DAEMON),
+// against the stand-in daemon: sessions of several embeds on one
+// connection, a daemon starting late or not at all, and sessions the
+// daemon ends.
+
+#include "config.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <set>
+#include <sstream>
+
+#include "test-common.h"
+
+namespace {
+
+NPAPIHost &host = NPAPIHost::Get();
+
+// see SpiceController::Connect() for its retries
+const unsigned CONNECT_TIMEOUT = 12000;
+// the stand-in exits this long after its last connection closed
+const char *DAEMON_IDLE = "--idle 300";
+
+NPP newConsole(int port)
+{
+    std::ostringstream port_str;
+    Attributes attributes;
+
+    port_str << port;
+    attributes.push_back(std::make_pair("hostip", "127.0.0.1"));
+    attributes.push_back(std::make_pair("port", port_str.str()));
+
+    return host.NewInstance(attributes);
+}
+
+size_t countOf(const std::vector<ClientLogLine> &lines, const std::string &message)
+{
+    size_t count = 0;
+
+    for (size_t i = 0; i < lines.size(); ++i) {
+        if (lines[i].message == message)
+            count++;
+    }
+
+    return count;
+}
+
+struct ShowWait {
+    std::string log;
+    size_t count;
+};
+
+// the daemon logs what it read, which may lag behind connect()
+bool shown(void *data)
+{
+    const ShowWait *wait = static_cast<ShowWait *>(data);
+    return countOf(ReadClientLog(wait->log), "SHOW") >= wait->count;
+}
+
+// the session id a line was logged for
+std::string sessionOf(const ClientLogLine *line)
+{
+    return line != NULL ? line->value.substr(0, line->value.find(' ')) : std::string();
+}
+
+// one daemon, one connection, a session per embed; the connection goes
+// with the last session and the daemon after it
+void testSessions()
+{
+    const std::string log = UseFakeDaemon(DAEMON_IDLE);
+    NPP first = newConsole(5930);
+    NPP second = newConsole(5931);
+    NPObject *first_embed = host.Scriptable(first);
+    NPObject *second_embed = host.Scriptable(second);
+
+    const uint64_t start = MonotonicTime();
+    CHECK(host.Call(first_embed, "connect"));
+    CHECK(host.Call(second_embed, "connect"));
+    CHECK_EQUAL(host.GetString(first_embed, "ConnectionState"), "connected");
+    CHECK_EQUAL(host.GetString(second_embed, "ConnectionState"), "connected");
+    std::cout << "two sessions connected: " << (MonotonicTime() - start) / 1000.0 << " ms\n";
+    ShowWait wait = { log, 2 };
+    CHECK(host.PumpUntil(shown, &wait, 5000));
+
+    std::vector<ClientLogLine> lines = ReadClientLog(log);
+    CHECK_EQUAL(countOf(lines, "START"), 1u);
+    CHECK_EQUAL(countOf(lines, "ACCEPT"), 1u);
+    CHECK_EQUAL(countOf(lines, "OPEN"), 2u);
+    CHECK_EQUAL(countOf(lines, "SHOW"), 2u);
+
+    std::set<std::string> ports;
+    std::set<std::string> sessions;
+    for (size_t i = 0; i < lines.size(); ++i) {
+        if (lines[i].message == "PORT") {
+            ports.insert(lines[i].value.substr(lines[i].value.find(' ') + 1));
+            sessions.insert(sessionOf(&lines[i]));
+        }
+    }
+    CHECK(ports.count("5930") && ports.count("5931"));
+    CHECK_EQUAL(sessions.size(), 2u);
+
+    CHECK(host.Call(first_embed, "disconnect"));
+    CHECK(host.Call(second_embed, "disconnect"));
+    CHECK(WaitForClientMessage(log, "EXIT", 5000));
+    lines = ReadClientLog(log);
+    CHECK_EQUAL(countOf(lines, "CLOSED"), 2u);
+    CHECK(FindClientMessage(lines, "EOF") != NULL);
+    CHECK_EQUAL(host.GetString(first_embed, "ConnectionState"), "idle");
+    CHECK_EQUAL(host.GetString(second_embed, "ConnectionState"), "idle");
+
+    host.Release(first_embed);
+    host.Release(second_embed);
+    host.DestroyInstance(first);
+    host.DestroyInstance(second);
+}
+
+// the plugin keeps trying while the daemon it started comes up
+void testStartupDelay()
+{
+    const std::string log = UseFakeDaemon(std::string(DAEMON_IDLE) + " --startup-delay 1500");
+    NPP instance = newConsole(5932);
+    NPObject *embed = host.Scriptable(instance);
+
+    const uint64_t start = MonotonicTime();
+    CHECK(host.Call(embed, "connect"));
+    CHECK(WaitForClientMessage(log, "SHOW", CONNECT_TIMEOUT));
+    const std::vector<ClientLogLine> lines = ReadClientLog(log);
+    const ClientLogLine *show = FindClientMessage(lines, "SHOW");
+    CHECK(show != NULL && show->time - start >= 1500000);
+    if (show != NULL)
+        std::cout << "connect to SHOW, 1.5 s startup: " << (show->time - start) / 1000.0 << " ms\n";
+
+    CHECK(host.Call(embed, "disconnect"));
+    CHECK(WaitForClientMessage(log, "EXIT", 5000));
+
+    host.Release(embed);
+    host.DestroyInstance(instance);
+}
+
+// a daemon which never listens fails the connect, and leaves the
+// reaper free for clients spawned the usual way
+void testNoDaemon()
+{
+    UseFakeDaemon();
+    setenv("SPICE_XPI_DAEMON", "false", 1);
+    NPP instance = newConsole(5933);
+    NPObject *embed = host.Scriptable(instance);
+    NPAPIHost::Listener *disconnected = host.NewListener();
+
+    CHECK(host.Listen(embed, "disconnected", disconnected));
+    CHECK(host.Call(embed, "connect"));
+    CHECK(WaitForCalls(disconnected, 1, CONNECT_TIMEOUT));
+    CHECK_EQUAL(host.GetString(embed, "ConnectionState"), "idle");
+
+    unsetenv("SPICE_XPI_DAEMON");
+    const std::string client_log = UseFakeClient();
+    NPP other = newConsole(5934);
+    NPObject *other_embed = host.Scriptable(other);
+    CHECK(host.Call(other_embed, "connect"));
+    CHECK(WaitForClientMessage(client_log, "SHOW", CONNECT_TIMEOUT));
+    CHECK(host.Call(other_embed, "disconnect"));
+
+    host.Release(&disconnected->object);
+    host.Release(other_embed);
+    host.Release(embed);
+    host.DestroyInstance(other);
+    host.DestroyInstance(instance);
+}
+
+// a session the daemon ends, e.g. its window was closed, ends the
+// connection of the embed
+void testSessionEnded()
+{
+    const std::string log = UseFakeDaemon(std::string(DAEMON_IDLE) + " --end-on SHOW");
+    NPP instance = newConsole(5935);
+    NPObject *embed = host.Scriptable(instance);
+    NPAPIHost::Listener *disconnected = host.NewListener();
+
+    CHECK(host.Listen(embed, "disconnected", disconnected));
+    CHECK(host.Call(embed, "connect"));
+    CHECK(WaitForCalls(disconnected, 1, CONNECT_TIMEOUT));
+    CHECK_EQUAL(host.GetString(embed, "ConnectionState"), "idle");
+    CHECK(WaitForClientMessage(log, "EXIT", 5000));
+
+    host.Release(&disconnected->object);
+    host.Release(embed);
+    host.DestroyInstance(instance);
+}
+
+const TestCase tests[] = {
+    { "sessions", testSessions },
+    { "slow daemon startup", testStartupDelay },
+    { "no daemon", testNoDaemon },
+    { "session ended by the daemon", testSessionEnded },
+};
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (getenv("SPICE_XPI_FAKE_DAEMON") == NULL || getenv("SPICE_XPI_FAKE_CLIENT") == NULL) {
+        std::cerr << "SPICE_XPI_FAKE_DAEMON or SPICE_XPI_FAKE_CLIENT is not set, skipping\n";
+        return TEST_SKIPPED;
+    }
+
+    return RunTests(tests, sizeof(tests) / sizeof(tests[0]));
+}
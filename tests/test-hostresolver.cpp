@@ -0,0 +1,178 @@
+/* ***** BEGIN LICENSE BLOCK *****
+*   Copyright (C) 2013, Red Hat Inc.
+*
+*   This program is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU General Public License as
+*   published by the Free Software Foundation; either version 2 of
+*   the License, or (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program. If not, see <http://www.gnu.org/licenses/>.
+* ***** END LICENSE BLOCK ***** */
+
+// The plugin's DNS cache, built into the test with short lifetimes (see
+// Makefile.am): localhost from /etc/hosts kept for RESOLVER_TTL, an
+// unresolvable .invalid name not looked up again for
+// RESOLVER_NEGATIVE_TTL, and the least recently used host dropped once
+// RESOLVER_CACHE_SIZE are kept. The lookups are counted by wrapping
+// g_resolver_lookup_by_name().
+
+#include "config.h"
+
+#include <algorithm>
+#include <sstream>
+#include <glib.h>
+#include <gio/gio.h>
+extern "C" {
+#  include <dlfcn.h>
+}
+
+#include "hostresolver.h"
+#include "test-common.h"
+
+namespace {
+
+volatile gint lookups = 0;
+
+const unsigned RESOLVE_TIMEOUT = 5000;
+
+unsigned lookupsDone()
+{
+    return g_atomic_int_get(&lookups);
+}
+
+bool waitForLookups(unsigned count)
+{
+    for (unsigned waited = 0; waited < RESOLVE_TIMEOUT; waited += 10) {
+        if (lookupsDone() >= count)
+            return true;
+        g_usleep(10 * 1000);
+    }
+
+    return false;
+}
+
+bool waitForCached(const std::string &host, std::vector<std::string> &addresses)
+{
+    for (unsigned waited = 0; waited < RESOLVE_TIMEOUT; waited += 10) {
+        if (HostResolver::Lookup(host, addresses))
+            return true;
+        g_usleep(10 * 1000);
+    }
+
+    return false;
+}
+
+// the result of a finished lookup is stored right after it returns
+void settle()
+{
+    g_usleep(100 * 1000);
+}
+
+std::string invalidHost(unsigned i)
+{
+    std::ostringstream host;
+    host << "host-" << i << ".invalid";
+    return host.str();
+}
+
+// resolved again only once RESOLVER_TTL passed
+void testPositive()
+{
+    std::vector<std::string> addresses;
+
+    HostResolver::Prefetch("localhost");
+    CHECK(waitForCached("localhost", addresses));
+    CHECK(std::find(addresses.begin(), addresses.end(), "127.0.0.1") != addresses.end());
+
+    const unsigned done = lookupsDone();
+    HostResolver::Prefetch("localhost");
+    settle();
+    CHECK_EQUAL(lookupsDone(), done);
+
+    g_usleep(RESOLVER_TTL * G_USEC_PER_SEC);
+    CHECK(!HostResolver::Lookup("localhost", addresses));
+    HostResolver::Prefetch("localhost");
+    CHECK(waitForCached("localhost", addresses));
+    CHECK_EQUAL(lookupsDone(), done + 1);
+
+    HostResolver::Shutdown();
+}
+
+// a failure is remembered for RESOLVER_NEGATIVE_TTL
+void testNegative()
+{
+    std::vector<std::string> addresses;
+    const unsigned done = lookupsDone();
+
+    HostResolver::Prefetch("nosuchhost.invalid");
+    CHECK(waitForLookups(done + 1));
+    settle();
+    CHECK(!HostResolver::Lookup("nosuchhost.invalid", addresses));
+
+    HostResolver::Prefetch("nosuchhost.invalid");
+    settle();
+    CHECK_EQUAL(lookupsDone(), done + 1);
+
+    g_usleep(RESOLVER_NEGATIVE_TTL * G_USEC_PER_SEC);
+    HostResolver::Prefetch("nosuchhost.invalid");
+    CHECK(waitForLookups(done + 2));
+
+    HostResolver::Shutdown();
+}
+
+// Lookup() counts as a use, Prefetch() of a new host drops the least
+// recently used one once the cache is full
+void testEviction()
+{
+    std::vector<std::string> addresses;
+    unsigned next = 0;
+
+    HostResolver::Prefetch("localhost");
+    CHECK(waitForCached("localhost", addresses));
+    while (next < RESOLVER_CACHE_SIZE - 1)
+        HostResolver::Prefetch(invalidHost(next++));
+    CHECK(HostResolver::Lookup("localhost", addresses));
+
+    // host-0 goes, it was used least recently
+    HostResolver::Prefetch(invalidHost(next++));
+    CHECK(HostResolver::Lookup("localhost", addresses));
+
+    // localhost is the oldest after as many new hosts as fit besides it
+    for (unsigned i = 0; i < RESOLVER_CACHE_SIZE - 1; ++i)
+        HostResolver::Prefetch(invalidHost(next++));
+    HostResolver::Prefetch(invalidHost(next++));
+    CHECK(!HostResolver::Lookup("localhost", addresses));
+
+    HostResolver::Shutdown();
+}
+
+const TestCase tests[] = {
+    { "positive lifetime", testPositive },
+    { "negative lifetime", testNegative },
+    { "eviction", testEviction },
+};
+
+} // namespace
+
+extern "C" GList *g_resolver_lookup_by_name(GResolver *resolver, const gchar *hostname,
+                                            GCancellable *cancellable, GError **error)
+{
+    typedef GList *(*LookupFunc)(GResolver *, const gchar *, GCancellable *, GError **);
+    LookupFunc lookup = (LookupFunc) dlsym(RTLD_NEXT, "g_resolver_lookup_by_name");
+
+    GList *addresses = lookup(resolver, hostname, cancellable, error);
+    g_atomic_int_inc(&lookups);
+
+    return addresses;
+}
+
+int main(int argc, char **argv)
+{
+    return RunTests(tests, sizeof(tests) / sizeof(tests[0]));
+}
@@ -0,0 +1,213 @@
+/* ***** BEGIN LICENSE BLOCK *****
+*   Copyright (C) 2013, Red Hat Inc.
+*
+*   This program is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU General Public License as
+*   published by the Free Software Foundation; either version 2 of
+*   the License, or (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program. If not, see <http://www.gnu.org/licenses/>.
+* ***** END LICENSE BLOCK ***** */
+
+// The plugin as the browser sees it, without a client: entry points,
+// instances, properties, sessions and listeners.
+
+#include "config.h"
+
+#include <cstring>
+
+#include "test-common.h"
+
+namespace {
+
+NPAPIHost &host = NPAPIHost::Get();
+
+void testEntryPoints()
+{
+    const char *mime = host.MIMEDescription();
+    CHECK(mime != NULL && strncmp(mime, "application/x-spice:qsc:", 24) == 0);
+
+    char *name = NULL;
+    CHECK_EQUAL(host.PluginValue(NPPVpluginNameString, &name), NPERR_NO_ERROR);
+    CHECK(name != NULL && strstr(name, "Spice") != NULL);
+
+    char *description = NULL;
+    CHECK_EQUAL(host.PluginValue(NPPVpluginDescriptionString, &description), NPERR_NO_ERROR);
+    CHECK(description != NULL);
+}
+
+void testAttributes()
+{
+    Attributes attributes;
+    attributes.push_back(std::make_pair("hostip", "vm.example.com"));
+    attributes.push_back(std::make_pair("port", "5900"));
+    attributes.push_back(std::make_pair("fullscreen", "yes"));
+    attributes.push_back(std::make_pair("title", "console"));
+
+    NPP instance = host.NewInstance(attributes);
+    CHECK(instance != NULL);
+    if (instance == NULL)
+        return;
+
+    NPObject *embed = host.Scriptable(instance);
+    CHECK(embed != NULL);
+    if (embed != NULL) {
+        CHECK_EQUAL(host.GetString(embed, "hostIP"), "vm.example.com");
+        CHECK_EQUAL(host.GetString(embed, "port"), "5900");
+        CHECK_EQUAL(host.GetString(embed, "fullScreen"), "true");
+        CHECK_EQUAL(host.GetString(embed, "Title"), "console");
+        host.Release(embed);
+    }
+
+    host.DestroyInstance(instance);
+}
+
+void testProperties()
+{
+    NPP instance = host.NewInstance(Attributes());
+    NPObject *embed = host.Scriptable(instance);
+
+    CHECK(host.SetString(embed, "hostIP", "10.0.0.1"));
+    CHECK(host.SetString(embed, "SecurePort", "5901"));
+    CHECK(host.SetString(embed, "Password", "secret"));
+    CHECK(host.SetString(embed, "SSLChannels", "smain,sinputs"));
+    CHECK(host.SetBool(embed, "Smartcard", true));
+    CHECK(host.SetNumber(embed, "HeartbeatInterval", 2500));
+    CHECK_EQUAL(host.GetString(embed, "hostIP"), "10.0.0.1");
+    CHECK_EQUAL(host.GetString(embed, "SecurePort"), "5901");
+    CHECK_EQUAL(host.GetString(embed, "Password"), "secret");
+    // the leading 's' of old channel names is dropped
+    CHECK_EQUAL(host.GetString(embed, "SSLChannels"), "main,inputs");
+    CHECK_EQUAL(host.GetString(embed, "Smartcard"), "true");
+    CHECK_EQUAL(host.GetString(embed, "HeartbeatInterval"), "2500");
+    CHECK_EQUAL(host.GetString(embed, "ConnectionState"), "idle");
+    CHECK_EQUAL(host.GetString(embed, "NoSuchProperty"), "<missing>");
+
+    host.Release(embed);
+    host.DestroyInstance(instance);
+}
+
+// nothing but the instance itself before the page connects
+void testLazyInstances()
+{
+    const long dirs = GetProcessUsage().controller_dirs;
+    std::vector<NPP> instances;
+
+    for (int i = 0; i < 50; ++i)
+        instances.push_back(host.NewInstance(Attributes()));
+    CHECK_EQUAL(GetProcessUsage().controller_dirs, dirs);
+
+    for (size_t i = 0; i < instances.size(); ++i)
+        host.DestroyInstance(instances[i]);
+}
+
+void testSession()
+{
+    NPP instance = host.NewInstance(Attributes());
+    NPObject *embed = host.Scriptable(instance);
+
+    CHECK(host.SetString(embed, "hostIP", "embed.example.com"));
+    NPObject *session = host.Construct(embed);
+    CHECK(session != NULL);
+    if (session != NULL) {
+        CHECK(session != embed);
+        CHECK(host.SetString(session, "hostIP", "session.example.com"));
+        CHECK_EQUAL(host.GetString(session, "hostIP"), "session.example.com");
+        CHECK_EQUAL(host.GetString(embed, "hostIP"), "embed.example.com");
+        // sessions do not nest
+        CHECK(host.Construct(session) == NULL);
+
+        // the file streams to the embed's instance but is for the session
+        NPVariant arg, result;
+        STRINGZ_TO_NPVARIANT("http://portal/console.vv", arg);
+        host.ServeFile("http://portal/console.vv", TestDataPath("console.vv"));
+        CHECK(host.Invoke(session, "loadConfig", &arg, 1, &result));
+        host.ReleaseVariant(&result);
+        host.Pump();
+        CHECK_EQUAL(host.GetString(session, "hostIP"), "vm.example.com");
+        CHECK_EQUAL(host.GetString(embed, "hostIP"), "embed.example.com");
+        host.Release(session);
+    }
+
+    // events still queued for a session when it goes away are dropped,
+    // the browser only drops those of destroyed embeds
+    NPAPIHost::Listener *listener = host.NewListener();
+    session = host.Construct(embed);
+    if (session != NULL) {
+        CHECK(host.Listen(session, "disconnected", listener));
+        // neither port is valid, connect() fails right away
+        CHECK(host.Call(session, "connect"));
+        host.Release(session);
+        host.Pump();
+        CHECK(listener->calls.empty());
+    }
+    host.Release(&listener->object);
+
+    // a session outliving its embed is detached, not freed under the page
+    session = host.Construct(embed);
+    host.Release(embed);
+    host.DestroyInstance(instance);
+    if (session != NULL) {
+        CHECK_EQUAL(host.GetString(session, "ConnectionState"), "<missing>");
+        host.Release(session);
+    }
+}
+
+void testListeners()
+{
+    NPP instance = host.NewInstance(Attributes());
+    NPObject *embed = host.Scriptable(instance);
+    NPAPIHost::Listener *listener = host.NewListener();
+
+    CHECK(host.Listen(embed, "status", listener));
+    CHECK(host.Listen(embed, "disconnected", listener));
+    CHECK(!host.Listen(embed, "nosuchevent", listener));
+
+    // neither port is valid, connect() fails right away
+    CHECK(host.Call(embed, "connect"));
+    CHECK(WaitForCalls(listener, 1, 1000));
+    CHECK(!listener->calls.empty() && listener->calls[0].size() == 2);
+
+    host.Release(&listener->object);
+    host.Release(embed);
+    host.DestroyInstance(instance);
+}
+
+// every object the plugin created is gone with the instances
+void testNoLeaks()
+{
+    const long objects = host.LiveObjects();
+
+    NPP instance = host.NewInstance(Attributes());
+    NPObject *embed = host.Scriptable(instance);
+    NPObject *session = host.Construct(embed);
+    if (session != NULL)
+        host.Release(session);
+    host.Release(embed);
+    host.DestroyInstance(instance);
+
+    CHECK_EQUAL(host.LiveObjects(), objects);
+}
+
+const TestCase tests[] = {
+    { "entry points", testEntryPoints },
+    { "embed attributes", testAttributes },
+    { "properties", testProperties },
+    { "lazy instances", testLazyInstances },
+    { "sessions", testSession },
+    { "event listeners", testListeners },
+    { "no leaks", testNoLeaks },
+};
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    return RunTests(tests, sizeof(tests) / sizeof(tests[0]));
+}
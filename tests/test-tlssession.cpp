@@ -0,0 +1,204 @@
+/* ***** BEGIN LICENSE BLOCK *****
+*   Copyright (C) 2013, Red Hat Inc.
+*
+*   This program is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU General Public License as
+*   published by the Free Software Foundation; either version 2 of
+*   the License, or (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program. If not, see <http://www.gnu.org/licenses/>.
+* ***** END LICENSE BLOCK ***** */
+
+// TLS session resumption against openssl s_server on the secure port:
+// the session one stand-in client sends back resumes the handshake of
+// the next, and a client which did not announce CONTROLLER_CAP_TLS_SESSION
+// gets none. Skipped without the openssl command.
+
+#include "config.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+extern "C" {
+#  include <signal.h>
+#  include <unistd.h>
+#  include <sys/socket.h>
+#  include <sys/wait.h>
+#  include <netinet/in.h>
+#  include <arpa/inet.h>
+}
+
+#include "controller-caps.h"
+#include "test-common.h"
+
+namespace {
+
+NPAPIHost &host = NPAPIHost::Get();
+
+const unsigned CONNECT_TIMEOUT = 12000;
+// the client may still be sending its session when it logs TLS
+const unsigned SESSION_NEW_DELAY = 300;
+
+struct Server {
+    pid_t pid;
+    int port;
+};
+
+std::string str(long value)
+{
+    std::ostringstream s;
+    s << value;
+    return s.str();
+}
+
+bool never(void *data)
+{
+    return false;
+}
+
+// a port nothing listens on yet
+int freePort()
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int port = -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0 &&
+        getsockname(fd, (struct sockaddr *) &addr, &len) == 0)
+        port = ntohs(addr.sin_port);
+    close(fd);
+
+    return port;
+}
+
+bool listening(int port)
+{
+    struct sockaddr_in addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    bool connected = connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0;
+    close(fd);
+
+    return connected;
+}
+
+// s_server with a throwaway self-signed certificate, false if there is
+// no openssl to run it
+bool startServer(Server *server)
+{
+    const std::string key = TestTmpDir() + "/server-key.pem";
+    const std::string cert = TestTmpDir() + "/server-cert.pem";
+    const std::string command = "openssl req -x509 -newkey rsa:2048 -nodes -days 1"
+        " -subj /CN=localhost -keyout " + key + " -out " + cert + " >/dev/null 2>&1";
+
+    if (system(command.c_str()) != 0)
+        return false;
+
+    server->port = freePort();
+    const std::string accept = str(server->port);
+    server->pid = fork();
+    if (server->pid == 0) {
+        execlp("openssl", "openssl", "s_server", "-quiet", "-accept", accept.c_str(),
+               "-cert", cert.c_str(), "-key", key.c_str(), (char *) NULL);
+        _exit(127);
+    }
+
+    for (int i = 0; i < 50 && !listening(server->port); ++i)
+        usleep(100000);
+    CHECK(listening(server->port));
+
+    return true;
+}
+
+void stopServer(Server *server)
+{
+    kill(server->pid, SIGTERM);
+    waitpid(server->pid, NULL, 0);
+}
+
+// connects an embed to the secure port through a client started with
+// client_options, returns what the client logged
+std::vector<ClientLogLine> connectOnce(const std::string &client_options, int sport)
+{
+    const std::string log = UseFakeClient(client_options);
+    Attributes attributes;
+
+    attributes.push_back(std::make_pair("hostip", "127.0.0.1"));
+    attributes.push_back(std::make_pair("secureport", str(sport)));
+    NPP instance = host.NewInstance(attributes);
+    NPObject *embed = host.Scriptable(instance);
+
+    CHECK(host.Call(embed, "connect"));
+    CHECK(WaitForClientMessage(log, "SHOW", CONNECT_TIMEOUT));
+    if (client_options.find("--tls") != std::string::npos) {
+        CHECK(WaitForClientMessage(log, "TLS", CONNECT_TIMEOUT));
+        host.PumpUntil(never, NULL, SESSION_NEW_DELAY);
+    }
+    const std::vector<ClientLogLine> lines = ReadClientLog(log);
+    CHECK(host.Call(embed, "disconnect"));
+
+    host.Release(embed);
+    host.DestroyInstance(instance);
+
+    return lines;
+}
+
+std::string tlsResult(const std::vector<ClientLogLine> &lines)
+{
+    const ClientLogLine *line = FindClientMessage(lines, "TLS");
+    return line != NULL ? line->value : "<none>";
+}
+
+void testResumption()
+{
+    Server server;
+    if (!startServer(&server)) {
+        std::cout << "no openssl to run s_server, skipped\n";
+        return;
+    }
+    const std::string client = "--tls --caps " + str(CONTROLLER_CAP_TLS_SESSION);
+
+    // a full handshake, the session goes to the plugin
+    std::vector<ClientLogLine> lines = connectOnce(client, server.port);
+    CHECK(FindClientMessage(lines, "TLS_SESSION") == NULL);
+    CHECK_EQUAL(tlsResult(lines), "new");
+
+    // a client without the capability gets nothing, the session is kept
+    // for the next one
+    lines = connectOnce("", server.port);
+    CHECK(FindClientMessage(lines, "TLS_SESSION") == NULL);
+
+    // which resumes it
+    lines = connectOnce(client, server.port);
+    CHECK(FindClientMessage(lines, "TLS_SESSION") != NULL);
+    CHECK(FindClientMessage(lines, "TLS_SESSION") < FindClientMessage(lines, "CONNECT"));
+    CHECK_EQUAL(tlsResult(lines), "reused");
+
+    stopServer(&server);
+}
+
+const TestCase tests[] = {
+    { "resumption", testResumption },
+};
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    return RunTests(tests, sizeof(tests) / sizeof(tests[0]));
+}
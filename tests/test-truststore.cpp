@@ -0,0 +1,226 @@
+/* ***** BEGIN LICENSE BLOCK *****
+*   Copyright (C) 2013, Red Hat Inc.
+*
+*   This program is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU General Public License as
+*   published by the Free Software Foundation; either version 2 of
+*   the License, or (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program. If not, see <http://www.gnu.org/licenses/>.
+* ***** END LICENSE BLOCK ***** */
+
+// TrustStore and TrustStorePath: a 5 MB bundle through the property and
+// to the client, and which local files TrustStorePath may read.
+
+#include "config.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+extern "C" {
+#  include <unistd.h>
+#  include <sys/stat.h>
+}
+
+#include "test-common.h"
+
+namespace {
+
+NPAPIHost &host = NPAPIHost::Get();
+
+const size_t BUNDLE_SIZE = 5 * 1024 * 1024;
+
+std::string makeBundle(size_t size)
+{
+    const std::string certificate =
+        "-----BEGIN CERTIFICATE-----\n"
+        "MIIBszCCAVmgAwIBAgIUQ2VydGlmaWNhdGUgZm9yIHRoZSB0ZXN0cyBvbmx5MAoG\n"
+        "-----END CERTIFICATE-----\n";
+    std::string bundle;
+
+    bundle.reserve(size);
+    while (bundle.length() + certificate.length() <= size)
+        bundle += certificate;
+    bundle.append(size - bundle.length(), '\n');
+
+    return bundle;
+}
+
+bool writeFile(const std::string &path, const std::string &contents)
+{
+    std::ofstream file(path.c_str(), std::ios::binary);
+    file << contents;
+    return file.good();
+}
+
+std::string readFile(const std::string &path)
+{
+    std::ifstream file(path.c_str(), std::ios::binary);
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+// the directory TrustStorePath is limited to
+std::string trustStoreDir()
+{
+    const std::string dir = TestTmpDir() + "/trust";
+    mkdir(dir.c_str(), 0700);
+    setenv("SPICE_XPI_TRUST_STORE_DIR", dir.c_str(), 1);
+    return dir;
+}
+
+// an embed connect() accepts
+NPP newConsole()
+{
+    Attributes attributes;
+
+    attributes.push_back(std::make_pair("hostip", "127.0.0.1"));
+    attributes.push_back(std::make_pair("port", "5925"));
+
+    return host.NewInstance(attributes);
+}
+
+// connects to the stand-in client and returns the CA file it was sent,
+// read while the client runs
+std::string connectedCAFile(NPObject *embed, std::string *path)
+{
+    const std::string log = UseFakeClient();
+    std::string contents;
+
+    CHECK(host.Call(embed, "connect"));
+    CHECK(WaitForClientMessage(log, "SHOW", 12000));
+    const std::vector<ClientLogLine> lines = ReadClientLog(log);
+    const ClientLogLine *line = FindClientMessage(lines, "CA_FILE");
+    CHECK(line != NULL);
+    if (line != NULL) {
+        contents = readFile(line->value);
+        *path = line->value;
+    }
+    CHECK(host.Call(embed, "disconnect"));
+
+    return contents;
+}
+
+void printStats(const char *name)
+{
+    std::map<std::string, NPAPIHost::CallStats>::const_iterator it = host.Stats().find(name);
+    if (it == host.Stats().end())
+        return;
+    std::cout << name << ": " << it->second.total / 1000.0 << " ms, heap "
+              << it->second.heap / 1024 << " KiB\n";
+}
+
+// the bundle is kept once, not once per copy made on the way in
+void testLargeBundle()
+{
+    const std::string bundle = makeBundle(BUNDLE_SIZE);
+    NPP instance = newConsole();
+    NPObject *embed = host.Scriptable(instance);
+
+    host.ResetStats();
+    CHECK(host.SetString(embed, "TrustStore", bundle));
+    const NPAPIHost::CallStats set = host.Stats().find("set TrustStore")->second;
+    CHECK(set.heap < (long long) (BUNDLE_SIZE + BUNDLE_SIZE / 2));
+    printStats("set TrustStore");
+
+    CHECK(host.GetString(embed, "TrustStore") == bundle);
+    printStats("get TrustStore");
+
+    std::string path;
+    const uint64_t start = MonotonicTime();
+    CHECK(connectedCAFile(embed, &path) == bundle);
+    std::cout << "connect with a 5 MB bundle: " << (MonotonicTime() - start) / 1000.0 << " ms\n";
+
+    host.Release(embed);
+    host.DestroyInstance(instance);
+}
+
+// a bundle below SPICE_XPI_TRUST_STORE_DIR goes to the client, but never
+// back to the page
+void testPath()
+{
+    const std::string bundle = makeBundle(BUNDLE_SIZE);
+    const std::string file = trustStoreDir() + "/ca.pem";
+    CHECK(writeFile(file, bundle));
+
+    NPP instance = newConsole();
+    NPObject *embed = host.Scriptable(instance);
+
+    CHECK(host.SetString(embed, "TrustStorePath", file));
+    CHECK_EQUAL(host.GetString(embed, "TrustStorePath"), file);
+    CHECK_EQUAL(host.GetString(embed, "TrustStore"), "");
+
+    // the client gets a copy, not the path of the local file
+    std::string path;
+    CHECK(connectedCAFile(embed, &path) == bundle);
+    CHECK(path != file);
+
+    // an inline bundle replaces the local one
+    CHECK(host.SetString(embed, "TrustStore", "inline"));
+    CHECK_EQUAL(host.GetString(embed, "TrustStorePath"), "");
+    CHECK_EQUAL(host.GetString(embed, "TrustStore"), "inline");
+
+    host.Release(embed);
+    host.DestroyInstance(instance);
+}
+
+void testPathOutsideDir()
+{
+    const std::string dir = trustStoreDir();
+    const std::string outside = TestTmpDir() + "/outside.pem";
+    CHECK(writeFile(outside, "secret"));
+    CHECK(symlink(outside.c_str(), (dir + "/link.pem").c_str()) == 0);
+
+    const char *paths[] = {
+        "/etc/passwd",
+        "../outside.pem",
+        NULL, // dir/../outside.pem
+        NULL, // dir/link.pem
+        NULL, // dir/missing.pem
+    };
+    const std::string escape = dir + "/../outside.pem";
+    const std::string link = dir + "/link.pem";
+    const std::string missing = dir + "/missing.pem";
+    paths[2] = escape.c_str();
+    paths[3] = link.c_str();
+    paths[4] = missing.c_str();
+
+    NPP instance = host.NewInstance(Attributes());
+    NPObject *embed = host.Scriptable(instance);
+
+    for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); ++i) {
+        host.SetString(embed, "TrustStorePath", paths[i]);
+        CHECK_EQUAL(host.GetString(embed, "TrustStorePath"), "");
+        CHECK_EQUAL(host.GetString(embed, "TrustStore"), "");
+    }
+
+    // nothing at all is read without the directory set
+    unsetenv("SPICE_XPI_TRUST_STORE_DIR");
+    CHECK(writeFile(dir + "/ca.pem", "bundle"));
+    host.SetString(embed, "TrustStorePath", dir + "/ca.pem");
+    CHECK_EQUAL(host.GetString(embed, "TrustStorePath"), "");
+
+    host.Release(embed);
+    host.DestroyInstance(instance);
+}
+
+const TestCase tests[] = {
+    { "5 MB bundle", testLargeBundle },
+    { "local bundle", testPath },
+    { "local bundle outside the directory", testPathOutsideDir },
+};
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    return RunTests(tests, sizeof(tests) / sizeof(tests[0]));
+}
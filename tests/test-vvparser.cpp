@@ -0,0 +1,216 @@
+/* ***** BEGIN LICENSE BLOCK *****
+*   Copyright (C) 2013, Red Hat Inc.
+*
+*   This program is free software; you can redistribute it and/or
+*   modify it under the terms of the GNU General Public License as
+*   published by the Free Software Foundation; either version 2 of
+*   the License, or (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program. If not, see <http://www.gnu.org/licenses/>.
+* ***** END LICENSE BLOCK ***** */
+
+// Connection files (.vv) from data/, streamed to the plugin through
+// loadConfig() and the src attribute in chunks of various sizes.
+
+#include "config.h"
+
+#include <cstring>
+#include <fstream>
+
+#include "test-common.h"
+
+namespace {
+
+NPAPIHost &host = NPAPIHost::Get();
+
+bool loadConfig(NPObject *embed, const char *url)
+{
+    NPVariant arg;
+    NPVariant result;
+
+    STRINGZ_TO_NPVARIANT(url, arg);
+    if (!host.Invoke(embed, "loadConfig", &arg, 1, &result))
+        return false;
+
+    bool requested = NPVARIANT_IS_BOOLEAN(result) && NPVARIANT_TO_BOOLEAN(result);
+    host.ReleaseVariant(&result);
+    host.Pump();
+
+    return requested;
+}
+
+void checkConsole(NPObject *embed)
+{
+    CHECK_EQUAL(host.GetString(embed, "hostIP"), "vm.example.com");
+    CHECK_EQUAL(host.GetString(embed, "port"), "5900");
+    CHECK_EQUAL(host.GetString(embed, "SecurePort"), "5901");
+    CHECK_EQUAL(host.GetString(embed, "Password"), "s3cret");
+    CHECK_EQUAL(host.GetString(embed, "CipherSuite"), "DEFAULT");
+    CHECK_EQUAL(host.GetString(embed, "SSLChannels"), "main,inputs");
+    CHECK_EQUAL(host.GetString(embed, "HostSubject"), "O=example,CN=vm.example.com");
+    CHECK_EQUAL(host.GetString(embed, "Title"), "Console of vm 1");
+    CHECK_EQUAL(host.GetString(embed, "fullScreen"), "true");
+    CHECK_EQUAL(host.GetString(embed, "Smartcard"), "false");
+    CHECK_EQUAL(host.GetString(embed, "UsbAutoShare"), "true");
+    CHECK_EQUAL(host.GetString(embed, "ColorDepth"), "16");
+    CHECK_EQUAL(host.GetString(embed, "DisableEffects"), "wallpaper,animation");
+    CHECK_EQUAL(host.GetString(embed, "HotKey"),
+                "toggle-fullscreen=shift+f11,release-cursor=shift+f12");
+}
+
+// lines split at every possible place come out the same
+void testChunks()
+{
+    const size_t chunks[] = { 1, 2, 7, 64, 4096 };
+
+    for (size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); ++i) {
+        NPP instance = host.NewInstance(Attributes());
+        NPObject *embed = host.Scriptable(instance);
+
+        host.ServeFile("http://portal/console.vv", TestDataPath("console.vv"), chunks[i]);
+        CHECK(loadConfig(embed, "http://portal/console.vv"));
+        checkConsole(embed);
+
+        host.Release(embed);
+        host.DestroyInstance(instance);
+    }
+}
+
+void testSrcAttribute()
+{
+    Attributes attributes;
+    attributes.push_back(std::make_pair("src", "http://portal/console.vv"));
+    attributes.push_back(std::make_pair("title", "overridden by the file"));
+
+    host.ServeFile("http://portal/console.vv", TestDataPath("console.vv"), 100);
+    NPP instance = host.NewInstance(attributes);
+    NPObject *embed = host.Scriptable(instance);
+    host.Pump();
+    checkConsole(embed);
+
+    host.Release(embed);
+    host.DestroyInstance(instance);
+}
+
+// comments, indentation and groups other than [virt-viewer]
+void testGroups()
+{
+    NPP instance = host.NewInstance(Attributes());
+    NPObject *embed = host.Scriptable(instance);
+
+    CHECK(host.SetString(embed, "Title", "unchanged"));
+    host.ServeFile("http://portal/groups.vv", TestDataPath("groups.vv"), 16);
+    CHECK(loadConfig(embed, "http://portal/groups.vv"));
+    CHECK_EQUAL(host.GetString(embed, "hostIP"), "vm2.example.com");
+    CHECK_EQUAL(host.GetString(embed, "port"), "5902");
+    CHECK_EQUAL(host.GetString(embed, "Title"), "unchanged");
+
+    host.Release(embed);
+    host.DestroyInstance(instance);
+}
+
+void testEscapes()
+{
+    NPP instance = host.NewInstance(Attributes());
+    NPObject *embed = host.Scriptable(instance);
+
+    host.ServeFile("http://portal/escapes.vv", TestDataPath("escapes.vv"), 5);
+    CHECK(loadConfig(embed, "http://portal/escapes.vv"));
+    CHECK_EQUAL(host.GetString(embed, "Title"), "tab\there\\backslash\\qkept");
+    CHECK_EQUAL(host.GetString(embed, "TrustStore"),
+                "-----BEGIN CERTIFICATE-----\nMIIBAA==\n-----END CERTIFICATE-----\n");
+
+    host.Release(embed);
+    host.DestroyInstance(instance);
+}
+
+// CRLF line ends and a last line without one
+void testLineEnds()
+{
+    NPP instance = host.NewInstance(Attributes());
+    NPObject *embed = host.Scriptable(instance);
+
+    host.ServeFile("http://portal/crlf.vv", TestDataPath("crlf.vv"), 3);
+    CHECK(loadConfig(embed, "http://portal/crlf.vv"));
+    CHECK_EQUAL(host.GetString(embed, "hostIP"), "crlf.example.com");
+    CHECK_EQUAL(host.GetString(embed, "port"), "5903");
+    CHECK_EQUAL(host.GetString(embed, "Title"), "no final newline");
+
+    host.Release(embed);
+    host.DestroyInstance(instance);
+}
+
+// a broken, cut off or missing file changes nothing, not even the lines
+// before the error
+void testErrors()
+{
+    NPP instance = host.NewInstance(Attributes());
+    NPObject *embed = host.Scriptable(instance);
+
+    CHECK(host.SetString(embed, "hostIP", "embed.example.com"));
+    host.ServeFile("http://portal/malformed.vv", TestDataPath("malformed.vv"), 4096);
+    CHECK(loadConfig(embed, "http://portal/malformed.vv"));
+    CHECK_EQUAL(host.GetString(embed, "hostIP"), "embed.example.com");
+    CHECK_EQUAL(host.GetString(embed, "port"), "");
+
+    CHECK(loadConfig(embed, "http://portal/missing.vv"));
+    CHECK_EQUAL(host.GetString(embed, "hostIP"), "embed.example.com");
+
+    // lines are limited to 64 KiB
+    const std::string path = TestTmpDir() + "/longline.vv";
+    std::ofstream file(path.c_str());
+    file << "[virt-viewer]\nhost=long.example.com\ntitle=" << std::string(64 * 1024, 'x') << "\n";
+    file.close();
+    host.ServeFile("http://portal/longline.vv", path, 4096);
+    CHECK(loadConfig(embed, "http://portal/longline.vv"));
+    CHECK_EQUAL(host.GetString(embed, "hostIP"), "embed.example.com");
+
+    host.Release(embed);
+    host.DestroyInstance(instance);
+}
+
+// autoconnect waits for the file, then connects with its settings
+void testAutoConnect()
+{
+    const std::string log = UseFakeClient();
+    Attributes attributes;
+    attributes.push_back(std::make_pair("src", "http://portal/autoconnect.vv"));
+    attributes.push_back(std::make_pair("autoconnect", "true"));
+
+    host.ServeFile("http://portal/autoconnect.vv", TestDataPath("autoconnect.vv"), 8);
+    NPP instance = host.NewInstance(attributes);
+    NPObject *embed = host.Scriptable(instance);
+
+    CHECK(WaitForClientMessage(log, "SHOW", 12000));
+    const std::vector<ClientLogLine> lines = ReadClientLog(log);
+    const ClientLogLine *line = FindClientMessage(lines, "PORT");
+    CHECK(line != NULL && line->value == "5920");
+    line = FindClientMessage(lines, "SET_TITLE");
+    CHECK(line != NULL && line->value == "autoconnect");
+
+    host.Release(embed);
+    host.DestroyInstance(instance);
+}
+
+const TestCase tests[] = {
+    { "chunked streams", testChunks },
+    { "src attribute", testSrcAttribute },
+    { "groups and comments", testGroups },
+    { "escapes", testEscapes },
+    { "line ends", testLineEnds },
+    { "errors", testErrors },
+    { "autoconnect", testAutoConnect },
+};
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    return RunTests(tests, sizeof(tests) / sizeof(tests[0]));
+}